@@ -0,0 +1,127 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// stand-in for ctrulib's 3ds.h, for building bits of blargSnes on a PC
+// only what the emulation core needs: files, ticks, threads, linear memory
+// and the keys. host3ds.c implements them on top of libc. the rest of the
+// code that talks to the system is under #ifdef _3DS
+
+#ifndef _HOST_3DS_H_
+#define _HOST_3DS_H_
+
+#include <3ds/types.h>
+
+// newlib's integer-only printf
+#define iprintf printf
+
+
+// FS, the current directory stands in for the SD card
+
+typedef enum
+{
+	PATH_INVALID = 0,
+	PATH_EMPTY = 1,
+	PATH_BINARY = 2,
+	PATH_CHAR = 3,
+	PATH_WCHAR = 4,
+	
+} FS_pathType;
+
+typedef struct
+{
+	FS_pathType type;
+	u32 size;
+	u8* data;
+	
+} FS_path;
+
+typedef struct
+{
+	u32 id;
+	FS_path lowPath;
+	Handle handleLow, handleHigh;
+	
+} FS_archive;
+
+#define FS_OPEN_READ	(1<<0)
+#define FS_OPEN_WRITE	(1<<1)
+#define FS_OPEN_CREATE	(1<<2)
+
+#define FS_ATTRIBUTE_NONE	(0x00000000)
+
+#define FS_WRITE_FLUSH	0x10001
+
+Result FSUSER_OpenFile(Handle* handle, Handle* out, FS_archive archive, FS_path fileLowPath, u32 openflags, u32 attributes);
+
+Result FSFILE_Close(Handle handle);
+Result FSFILE_Read(Handle handle, u32 *bytesRead, u64 offset, u32 *buffer, u32 size);
+Result FSFILE_Write(Handle handle, u32 *bytesWritten, u64 offset, u32 *buffer, u32 size, u32 flushFlags);
+Result FSFILE_GetSize(Handle handle, u64 *size);
+Result FSFILE_SetSize(Handle handle, u64 size);
+
+
+// time. the tick rate is the same as on the 3DS (268111856 Hz)
+// osGetTime() always returns the same thing, so that runs are reproducible
+
+u64 svcGetSystemTick();
+u64 osGetTime();
+
+
+// threads and events, on top of pthreads
+// svcWaitSynchronization() on a thread waits for it to end
+
+typedef void (*ThreadFunc)(u32);
+
+Result svcCreateThread(Handle* thread, ThreadFunc entrypoint, u32 arg, u32* stack_top, s32 thread_priority, s32 processor_id);
+void svcExitThread();
+Result svcCreateEvent(Handle* event, u8 reset_type);
+Result svcSignalEvent(Handle handle);
+Result svcClearEvent(Handle handle);
+Result svcWaitSynchronization(Handle handle, s64 nanoseconds);
+Result svcCloseHandle(Handle handle);
+
+
+// linear memory, kept below 4GB since the emulator stores pointers in u32s
+
+void* linearAlloc(size_t size);
+void linearFree(void* mem);
+
+// there's no difference between virtual and physical addresses here
+u32 osConvertVirtToPhys(u32 vaddr);
+
+
+// keys, whatever is in Host_Keys
+
+#define KEY_A		(1<<0)
+#define KEY_B		(1<<1)
+#define KEY_SELECT	(1<<2)
+#define KEY_START	(1<<3)
+#define KEY_RIGHT	(1<<4)
+#define KEY_LEFT	(1<<5)
+#define KEY_UP		(1<<6)
+#define KEY_DOWN	(1<<7)
+#define KEY_R		(1<<8)
+#define KEY_L		(1<<9)
+#define KEY_X		(1<<10)
+#define KEY_Y		(1<<11)
+
+extern u32 Host_Keys;
+
+u32 hidKeysHeld();
+
+#endif
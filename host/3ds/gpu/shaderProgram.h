@@ -0,0 +1,38 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// stand-in for ctrulib's gpu/shaderProgram.h. there's no shader code here,
+// a program is just something to tell apart from the others
+
+#ifndef _HOST_3DS_GPU_SHADERPROGRAM_H_
+#define _HOST_3DS_GPU_SHADERPROGRAM_H_
+
+#include <3ds/types.h>
+#include <3ds/gpu/shbin.h>
+
+typedef struct
+{
+	u32 ID;
+	u32 CodeSize;	// words sent when it's used
+	u32 GeometryStride;	// 0: no geometry shader
+	
+} shaderProgram_s;
+
+Result shaderProgramUse(shaderProgram_s* sp);
+
+#endif
@@ -0,0 +1,33 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// stand-in for ctrulib's gpu/shbin.h
+
+#ifndef _HOST_3DS_GPU_SHBIN_H_
+#define _HOST_3DS_GPU_SHBIN_H_
+
+#include <3ds/types.h>
+
+typedef struct
+{
+	u32 numDVLE;
+	u32* DVLP;
+	
+} DVLB_s;
+
+#endif
@@ -0,0 +1,1020 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// blargGL state check, runs source/blargGL.c over a stand-in GPU that reads
+// back the command lists it's given: a register file, the uniforms and the
+// shader code, looked at every time something is drawn
+//
+// every draw is done twice, once the normal way and once with
+// bglInvalidateState() right before it, which sends everything again like
+// the old code did (it sent it all whenever anything but the vertex buffers
+// had changed). the GPU has to be in the same state for both. this is done
+// for a lot of random state changes, then for something shaped like a hard
+// renderer frame, for which the command list sizes are compared
+//
+// the GPU_* functions write the same registers as ctrulib's, more or less.
+// what matters here is that each of them writes all of what it's given, and
+// that they clobber each other where ctrulib's do (GPU_SetViewport() resets
+// the scissor test, shaderProgramUse() the vertex attributes)
+//
+// build (from the repo root):
+//   gcc -O2 -no-pie -Ihost -Isource -o bglcheck host/bglcheck.c host/host3ds.c source/blargGL.c
+//
+// usage: bglcheck [random ops]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "blargGL.h"
+#include "timing.h"
+#include "hostemu.h"
+
+
+u32 Timing_Counts[COUNT_NUM];
+
+
+// the GPU
+
+typedef struct
+{
+	u32 Regs[0x400];
+	u32 Uniforms[2][96*4];
+	u32 Code[2][512];
+
+} GPUState;
+
+GPUState GPU;
+u32 UniformIdx[2], CodeIdx[2];
+
+// registers that set things off rather than hold state, and the uniform and
+// code upload ports (what went through them is in Uniforms/Code)
+static int IsKickReg(u32 reg)
+{
+	switch (reg)
+	{
+		case 0x010: case 0x063: case 0x110: case 0x111:
+		case 0x22E: case 0x22F: case 0x231: case 0x25F:
+		case 0x290: case 0x29B: case 0x2C0: case 0x2CB:
+			return 1;
+	}
+
+	if (reg >= 0x291 && reg <= 0x298) return 1;	// GS uniforms
+	if (reg >= 0x29C && reg <= 0x2A3) return 1;	// GS code
+	if (reg >= 0x2C1 && reg <= 0x2C8) return 1;	// VS uniforms
+	if (reg >= 0x2CC && reg <= 0x2D3) return 1;	// VS code
+	return 0;
+}
+
+// what the GPU looked like at each draw
+GPUState* Draws;
+u32 NumDraws, MaxDraws;
+int Recording;	// 1: keep them, 0: compare with the kept ones
+u32 Mismatches;
+
+static void Snapshot()
+{
+	static GPUState snap;
+	GPUState* cur = &snap;
+	u32 i;
+
+	memcpy(cur, &GPU, sizeof(GPUState));
+	for (i = 0; i < 0x400; i++)
+		if (IsKickReg(i)) cur->Regs[i] = 0;
+
+	if (Recording)
+	{
+		if (NumDraws >= MaxDraws)
+		{
+			MaxDraws = MaxDraws ? MaxDraws*2 : 1024;
+			Draws = (GPUState*)realloc(Draws, MaxDraws * sizeof(GPUState));
+		}
+		memcpy(&Draws[NumDraws++], cur, sizeof(GPUState));
+		return;
+	}
+
+	if (NumDraws >= MaxDraws || memcmp(&Draws[NumDraws], cur, sizeof(GPUState)))
+	{
+		if (Mismatches < 8)
+		{
+			printf("draw %u: not the same GPU state\n", NumDraws);
+			if (NumDraws < MaxDraws)
+			{
+				for (i = 0; i < 0x400; i++)
+				{
+					if (Draws[NumDraws].Regs[i] != cur->Regs[i])
+						printf("  reg %03X: %08X, should be %08X\n", i, cur->Regs[i], Draws[NumDraws].Regs[i]);
+				}
+				if (memcmp(Draws[NumDraws].Uniforms, cur->Uniforms, sizeof(cur->Uniforms)))
+					printf("  uniforms differ\n");
+				if (memcmp(Draws[NumDraws].Code, cur->Code, sizeof(cur->Code)))
+					printf("  shader code differs\n");
+			}
+		}
+		Mismatches++;
+	}
+	NumDraws++;
+}
+
+static void WriteReg(u32 reg, u32 mask, u32 val)
+{
+	u32 bits = 0;
+	if (mask & 0x1) bits |= 0x000000FF;
+	if (mask & 0x2) bits |= 0x0000FF00;
+	if (mask & 0x4) bits |= 0x00FF0000;
+	if (mask & 0x8) bits |= 0xFF000000;
+
+	GPU.Regs[reg] = (GPU.Regs[reg] & ~bits) | (val & bits);
+
+	if (reg == 0x290) UniformIdx[1] = (val & 0x7F) * 4;
+	else if (reg >= 0x291 && reg <= 0x298) GPU.Uniforms[1][UniformIdx[1]++ % (96*4)] = val;
+	else if (reg == 0x29B) CodeIdx[1] = val;
+	else if (reg >= 0x29C && reg <= 0x2A3) GPU.Code[1][CodeIdx[1]++ % 512] = val;
+	else if (reg == 0x2C0) UniformIdx[0] = (val & 0x7F) * 4;
+	else if (reg >= 0x2C1 && reg <= 0x2C8) GPU.Uniforms[0][UniformIdx[0]++ % (96*4)] = val;
+	else if (reg == 0x2CB) CodeIdx[0] = val;
+	else if (reg >= 0x2CC && reg <= 0x2D3) GPU.Code[0][CodeIdx[0]++ % 512] = val;
+	else if (reg == 0x22E) Snapshot();
+}
+
+static void ResetGPU()
+{
+	memset(&GPU, 0, sizeof(GPU));
+	memset(UniformIdx, 0, sizeof(UniformIdx));
+	memset(CodeIdx, 0, sizeof(CodeIdx));
+}
+
+
+// the command buffer, same format as the real one
+
+u32* CmdBuf;
+u32 CmdSize, CmdOffset;
+
+// words sent per kind of thing, set by the GPU_* functions
+enum
+{
+	CAT_STATE = 0,
+	CAT_SHADER,
+	CAT_VIEWPORT,
+	CAT_TEXENV,
+	CAT_TEXTURE,
+	CAT_ATTRIBS,
+	CAT_UNIFORMS,
+	CAT_DRAW,
+
+	CAT_NUM
+};
+
+char* CatNames[CAT_NUM] = {"other state", "shaders", "viewport/scissor", "texenv", "textures", "attributes", "uniforms", "draws"};
+u32 CatWords[CAT_NUM];
+u32 Cat = CAT_STATE;
+
+void GPUCMD_SetBuffer(u32* adr, u32 size, u32 offset)
+{
+	CmdBuf = adr;
+	CmdSize = size;
+	CmdOffset = offset;
+}
+
+void GPUCMD_GetBuffer(u32** adr, u32* size, u32* offset)
+{
+	if (adr) *adr = CmdBuf;
+	if (size) *size = CmdSize;
+	if (offset) *offset = CmdOffset;
+}
+
+void GPUCMD_Add(u32 header, u32* param, u32 paramlength)
+{
+	u32 start = CmdOffset;
+	u32 i;
+
+	if (!paramlength || CmdOffset + paramlength + 2 > CmdSize)
+	{
+		printf("command buffer overflow\n");
+		exit(1);
+	}
+
+	CmdBuf[CmdOffset++] = param[0];
+	CmdBuf[CmdOffset++] = header | ((paramlength-1) << 20);
+	for (i = 1; i < paramlength; i++)
+		CmdBuf[CmdOffset++] = param[i];
+	if (CmdOffset & 1) CmdBuf[CmdOffset++] = 0;
+
+	CatWords[Cat] += CmdOffset - start;
+}
+
+void GPUCMD_Finalize()
+{
+	GPUCMD_AddWrite(0x010, 0x12345678);
+	GPUCMD_AddWrite(0x010, 0x12345678);
+}
+
+// the GPU goes through the list
+void GPUCMD_Run(u32* gxbuf)
+{
+	u32 i = 0;
+
+	while (i < CmdOffset)
+	{
+		u32 param0 = CmdBuf[i++];
+		u32 header = CmdBuf[i++];
+		u32 reg = header & 0x3FF;
+		u32 mask = (header >> 16) & 0xF;
+		u32 extra = (header >> 20) & 0xFF;
+		u32 incr = header >> 31;
+		u32 j;
+
+		WriteReg(reg, mask, param0);
+		for (j = 0; j < extra; j++)
+		{
+			if (incr) reg++;
+			WriteReg(reg, mask, CmdBuf[i++]);
+		}
+		if (i & 1) i++;
+	}
+}
+
+
+// the GPU_* functions, register-wise close enough to ctrulib's
+
+static u32 F24(float f)
+{
+	u32 v;
+	memcpy(&v, &f, 4);
+	return v >> 8;
+}
+
+void GPU_Init(Handle *gsphandle)
+{
+}
+
+void GPU_Reset(u32* gxbuf, u32* gpuBuf, u32 gpuBufSize)
+{
+	GPUCMD_SetBuffer(gpuBuf, gpuBufSize, 0);
+}
+
+void GPU_SetFloatUniform(GPU_SHADER_TYPE type, u32 startreg, u32* data, u32 numreg)
+{
+	u32 base = (type == GPU_GEOMETRY_SHADER) ? 0x290 : 0x2C0;
+
+	Cat = CAT_UNIFORMS;
+	GPUCMD_AddWrite(base, 0x80000000 | startreg);
+	GPUCMD_AddWrites(base+1, data, numreg*4);
+	Cat = CAT_STATE;
+}
+
+void GPU_SetViewport(u32* depthBuffer, u32* colorBuffer, u32 x, u32 y, u32 w, u32 h)
+{
+	u32 dim = 0x01000000 | (((h-1) & 0xFFF) << 12) | (w & 0xFFF);
+
+	Cat = CAT_VIEWPORT;
+	GPUCMD_AddWrite(0x111, 1);
+	GPUCMD_AddWrite(0x110, 1);
+	GPUCMD_AddIncrementalWrites(0x11C, ((u32[]){(u32)(size_t)depthBuffer >> 3, (u32)(size_t)colorBuffer >> 3, dim}), 3);
+	GPUCMD_AddWrite(0x06E, dim);
+	GPUCMD_AddWrite(0x116, 3);
+	GPUCMD_AddWrite(0x117, 2);
+	GPUCMD_AddWrite(0x11B, 0);
+	GPUCMD_AddIncrementalWrites(0x041, ((u32[]){F24(w / 2.0f), F24(2.0f / w), F24(h / 2.0f), F24(2.0f / h)}), 4);
+	GPUCMD_AddWrite(0x068, (y << 16) | (x & 0xFFFF));
+
+	// the scissor test goes off
+	GPUCMD_AddIncrementalWrites(0x065, ((u32[]){0, 0, ((h-1) << 16) | ((w-1) & 0xFFFF)}), 3);
+
+	GPUCMD_AddIncrementalWrites(0x112, ((u32[]){0xF, 0xF, 0x2, 0x2}), 4);
+	Cat = CAT_STATE;
+}
+
+void GPU_SetScissorTest(GPU_SCISSORMODE mode, u32 x, u32 y, u32 w, u32 h)
+{
+	Cat = CAT_VIEWPORT;
+	GPUCMD_AddIncrementalWrites(0x065, ((u32[]){mode & 3, (y << 16) | (x & 0xFFFF), ((h-1) << 16) | ((w-1) & 0xFFFF)}), 3);
+	Cat = CAT_STATE;
+}
+
+void GPU_DepthMap(float zScale, float zOffset)
+{
+	GPUCMD_AddWrite(0x06D, 1);
+	GPUCMD_AddWrite(0x04D, F24(zScale));
+	GPUCMD_AddWrite(0x04E, F24(zOffset));
+}
+
+void GPU_SetAlphaTest(bool enable, GPU_TESTFUNC function, u8 ref)
+{
+	GPUCMD_AddWrite(0x104, (enable & 1) | ((function & 7) << 4) | (ref << 8));
+}
+
+void GPU_SetDepthTestAndWriteMask(bool enable, GPU_TESTFUNC function, GPU_WRITEMASK writemask)
+{
+	GPUCMD_AddWrite(0x107, (enable & 1) | ((function & 7) << 4) | (writemask << 8));
+}
+
+void GPU_SetStencilTest(bool enable, GPU_TESTFUNC function, u8 ref, u8 mask, u8 replace)
+{
+	GPUCMD_AddWrite(0x105, (enable & 1) | ((function & 7) << 4) | (replace << 8) | (ref << 16) | (mask << 24));
+}
+
+void GPU_SetStencilOp(GPU_STENCILOP sfail, GPU_STENCILOP dfail, GPU_STENCILOP pass)
+{
+	GPUCMD_AddWrite(0x106, sfail | (dfail << 4) | (pass << 8));
+}
+
+void GPU_SetFaceCulling(GPU_CULLMODE mode)
+{
+	GPUCMD_AddWrite(0x040, mode & 3);
+}
+
+void GPU_SetAlphaBlending(GPU_BLENDEQUATION colorEquation, GPU_BLENDEQUATION alphaEquation, 
+	GPU_BLENDFACTOR colorSrc, GPU_BLENDFACTOR colorDst, 
+	GPU_BLENDFACTOR alphaSrc, GPU_BLENDFACTOR alphaDst)
+{
+	GPUCMD_AddWrite(0x101, colorEquation | (alphaEquation << 8) | (colorSrc << 16) | (colorDst << 20) | (alphaSrc << 24) | (alphaDst << 28));
+	GPUCMD_AddMaskedWrite(0x100, 0x2, 0x100);
+}
+
+void GPU_SetBlendingColor(u8 r, u8 g, u8 b, u8 a)
+{
+	GPUCMD_AddWrite(0x103, r | (g << 8) | (b << 16) | (a << 24));
+}
+
+void GPU_SetAttributeBuffers(u8 totalAttributes, u32* baseAddress, u64 attributeFormats, u16 attributeMask, u64 attributePermutation, 
+	u8 numBuffers, u32 bufferOffsets[], u64 bufferPermutations[], u8 bufferNumAttributes[])
+{
+	u32 param[0x28];
+	u32 i;
+
+	Cat = CAT_ATTRIBS;
+	memset(param, 0, sizeof(param));
+	param[0] = (u32)(size_t)baseAddress >> 3;
+	param[1] = attributeFormats & 0xFFFFFFFF;
+	param[2] = ((totalAttributes-1) << 28) | ((attributeMask & 0xFFF) << 16) | ((attributeFormats >> 32) & 0xFFFF);
+	for (i = 0; i < numBuffers && i < 12; i++)
+	{
+		param[3*i+3] = bufferOffsets[i];
+		param[3*i+4] = bufferPermutations[i] & 0xFFFFFFFF;
+		param[3*i+5] = (bufferNumAttributes[i] << 28) | ((0x10 * bufferNumAttributes[i]) << 16) | ((bufferPermutations[i] >> 32) & 0xFFFF);
+	}
+	GPUCMD_AddIncrementalWrites(0x200, param, 0x27);
+
+	GPUCMD_AddMaskedWrite(0x2B9, 0xB, 0xA0000000 | (totalAttributes-1));
+	GPUCMD_AddWrite(0x242, totalAttributes-1);
+	GPUCMD_AddIncrementalWrites(0x2BB, ((u32[]){attributePermutation & 0xFFFFFFFF, (attributePermutation >> 32) & 0xFFFF}), 2);
+	Cat = CAT_STATE;
+}
+
+void GPU_SetTextureEnable(GPU_TEXUNIT units)
+{
+	GPUCMD_AddWrite(0x06F, units << 8);
+	GPUCMD_AddWrite(0x080, 0x00011000 | units);
+}
+
+void GPU_SetTexture(GPU_TEXUNIT unit, u32* data, u16 width, u16 height, u32 param, GPU_TEXCOLOR colorType)
+{
+	u32 base;
+	switch (unit)
+	{
+		case GPU_TEXUNIT0: base = 0x080; break;
+		case GPU_TEXUNIT1: base = 0x090; break;
+		case GPU_TEXUNIT2: base = 0x098; break;
+		default: return;
+	}
+
+	Cat = CAT_TEXTURE;
+	GPUCMD_AddWrite(base + 0x2, (width << 16) | height);
+	GPUCMD_AddWrite(base + 0x3, param);
+	GPUCMD_AddWrite(base + 0x5, (u32)(size_t)data >> 3);
+	GPUCMD_AddWrite(base + (unit == GPU_TEXUNIT0 ? 0xE : 0x6), colorType);
+	Cat = CAT_STATE;
+}
+
+void GPU_SetTexEnv(u8 id, u16 rgbSources, u16 alphaSources, u16 rgbOperands, u16 alphaOperands, 
+	GPU_COMBINEFUNC rgbCombine, GPU_COMBINEFUNC alphaCombine, u32 constantColor)
+{
+	static const u32 regs[6] = {0x0C0, 0x0C8, 0x0D0, 0x0D8, 0x0F0, 0x0F8};
+
+	Cat = CAT_TEXENV;
+	GPUCMD_AddIncrementalWrites(regs[id], ((u32[]){
+		(alphaSources << 16) | rgbSources,
+		(alphaOperands << 12) | rgbOperands,
+		(alphaCombine << 16) | rgbCombine,
+		constantColor,
+		0}), 5);
+	Cat = CAT_STATE;
+}
+
+void GPU_DrawArray(GPU_Primitive_t primitive, u32 n)
+{
+	Cat = CAT_DRAW;
+	GPUCMD_AddMaskedWrite(0x25E, 0x2, primitive);
+	GPUCMD_AddWrite(0x25F, 1);
+	GPUCMD_AddWrite(0x227, 0x80000000);
+	GPUCMD_AddWrite(0x228, n);
+	GPUCMD_AddWrite(0x22A, 0);
+	GPUCMD_AddMaskedWrite(0x253, 0x1, 1);
+	GPUCMD_AddMaskedWrite(0x245, 0x1, 0);
+	GPUCMD_AddWrite(0x22E, 1);
+	GPUCMD_AddMaskedWrite(0x245, 0x1, 1);
+	GPUCMD_AddMaskedWrite(0x253, 0x1, 0);
+	GPUCMD_AddWrite(0x231, 1);
+	Cat = CAT_STATE;
+}
+
+void GPU_FinishDrawing()
+{
+	Cat = CAT_DRAW;
+	GPUCMD_AddWrite(0x111, 1);
+	GPUCMD_AddWrite(0x110, 1);
+	GPUCMD_AddWrite(0x063, 1);
+	Cat = CAT_STATE;
+}
+
+// the code and the constants, with what goes along with them
+Result shaderProgramUse(shaderProgram_s* sp)
+{
+	u32 code[128];
+	u32 i, j;
+
+	if (!sp) return -1;
+
+	Cat = CAT_SHADER;
+	GPUCMD_AddMaskedWrite(0x229, 0x1, sp->GeometryStride ? 2 : 0);
+	GPUCMD_AddMaskedWrite(0x244, 0x1, sp->GeometryStride ? 1 : 0);
+	GPUCMD_AddMaskedWrite(0x2B9, 0xB, 0xA0000000);
+	GPUCMD_AddWrite(0x242, 0);
+
+	GPUCMD_AddWrite(0x2CB, 0);
+	for (i = 0; i < sp->CodeSize; i += 128)
+	{
+		u32 n = sp->CodeSize - i;
+		if (n > 128) n = 128;
+		for (j = 0; j < n; j++) code[j] = (sp->ID << 16) | (i + j);
+		GPUCMD_AddWrites(0x2CC, code, n);
+	}
+	GPUCMD_AddWrite(0x2BF, 1);
+
+	GPUCMD_AddWrite(0x2C0, 0x80000000 | 20);
+	GPUCMD_AddWrites(0x2C1, ((u32[]){sp->ID, 0, 0, 0x3F800000}), 4);
+
+	if (sp->GeometryStride)
+	{
+		GPUCMD_AddWrite(0x29B, 0);
+		for (j = 0; j < 64; j++) code[j] = 0x80000000 | (sp->ID << 16) | j;
+		GPUCMD_AddWrites(0x29C, code, 64);
+		GPUCMD_AddWrite(0x28F, 1);
+		GPUCMD_AddWrite(0x290, 0x80000000 | 9);
+		GPUCMD_AddWrites(0x291, ((u32[]){0, 0, 0x3C000000, 0x3F800000}), 4);
+	}
+
+	Cat = CAT_STATE;
+	return 0;
+}
+
+
+// things to draw with
+
+shaderProgram_s Shaders[4] = 
+{
+	{1, 40, 0},	// hardRenderShader
+	{2, 24, 0},	// plainQuadShader
+	{3, 32, 8},	// a geometry shader one, like hard7RenderShader
+	{4, 28, 0},	// finalShader
+};
+
+u32 Buffers[8][64];	// color/depth buffers and textures, by address only
+u16 Vertices[16][64];
+
+static void Uniform(GPU_SHADER_TYPE type, u32 id, float a, float b, float c, float d)
+{
+	float v[4] = {a, b, c, d};
+	bglUniform(type, id, v);
+}
+
+float ProjMatrix[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+
+
+// random state changes
+
+static u32 Rand(u32 n)
+{
+	return Host_Rand() % n;
+}
+
+static const GPU_TESTFUNC TestFuncs[] = {GPU_ALWAYS, GPU_EQUAL, GPU_GREATER};
+static const GPU_BLENDFACTOR BlendFactors[] = {GPU_ZERO, GPU_ONE, GPU_ONE_MINUS_DST_ALPHA};
+static const GPU_WRITEMASK WriteMasks[] = {GPU_WRITE_RED, GPU_WRITE_ALPHA, GPU_WRITE_COLOR, GPU_WRITE_ALL};
+static const GPU_TEXUNIT TexUnits[] = {GPU_TEXUNIT0, GPU_TEXUNIT1, GPU_TEXUNIT2};
+
+static const bglStateBlock TestBlocks[2] = 
+{
+	{
+		.ScissorMode = GPU_SCISSOR_NORMAL,
+		.DepthTest = false, .DepthFunc = GPU_GREATER, .ColorDepthMask = GPU_WRITE_COLOR,
+		.StencilTest = false,
+		.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+		.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
+		.AlphaTest = true, .AlphaFunc = GPU_GREATER, .AlphaRef = 0,
+		.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+		.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
+		.TextureEnable = GPU_TEXUNIT0,
+		.NumTexEnvs = 1,
+		.TexEnv = {{GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0), 0, 0, GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF}},
+		.NumAttribs = 2,
+		.Attrib = {{GPU_SHORT, 2}, {GPU_UNSIGNED_BYTE, 2}},
+	},
+	{
+		.ScissorMode = GPU_SCISSOR_DISABLE,
+		.DepthTest = true, .DepthFunc = GPU_EQUAL, .ColorDepthMask = GPU_WRITE_ALL,
+		.StencilTest = true,
+		.StencilFunc = GPU_EQUAL, .StencilRef = 0x20, .StencilMask = 0x20, .StencilReplace = 0xFF,
+		.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
+		.AlphaTest = false, .AlphaFunc = GPU_GREATER, .AlphaRef = 0,
+		.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_REVERSE_SUBTRACT},
+		.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE_MINUS_DST_ALPHA, GPU_ONE},
+		.TextureEnable = GPU_TEXUNIT0|GPU_TEXUNIT1,
+		.NumTexEnvs = 2,
+		.TexEnv = 
+		{
+			{GPU_TEVSOURCES(GPU_TEXTURE1, GPU_TEXTURE0, 0), GPU_TEVSOURCES(GPU_TEXTURE1, GPU_CONSTANT, 0), GPU_TEVOPERANDS(0,2,0), 0, GPU_MODULATE, GPU_ADD, 0x80FFFFFF},
+			{GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PREVIOUS, 0), GPU_TEVSOURCES(GPU_PREVIOUS, GPU_TEXTURE0, 0), 0, GPU_TEVOPERANDS(0,1,0), GPU_SUBTRACT, GPU_ADD, 0xFFFFFFFF},
+		},
+		.NumAttribs = 3,
+		.Attrib = {{GPU_SHORT, 3}, {GPU_SHORT, 2}, {GPU_UNSIGNED_BYTE, 4}},
+	},
+};
+
+static void RandomOp(int reference)
+{
+	u32 i;
+
+	switch (Rand(24))
+	{
+		case 0: bglUseShader(&Shaders[Rand(4)]); break;
+		case 1: bglOutputBuffers(Buffers[Rand(3)], Buffers[3]); break;
+		case 2: bglViewport(0, 0, Rand(2) ? 256 : 240, Rand(2) ? 256 : 400); break;
+		case 3: bglScissorMode(Rand(2) ? GPU_SCISSOR_NORMAL : GPU_SCISSOR_DISABLE); break;
+		case 4: bglScissor(0, Rand(4) * 16, 256, 16 + Rand(4) * 16); break;
+		case 5: bglDepthRange(Rand(2) ? -1.0f : 0.0f, 0.0f); break;
+		case 6: bglFaceCulling(Rand(2) ? GPU_CULL_NONE : GPU_CULL_BACK_CCW); break;
+		case 7: bglEnableStencilTest(Rand(2)); break;
+		case 8: bglStencilFunc(TestFuncs[Rand(3)], Rand(2) * 0x20, 1 << Rand(6), 0xFF); break;
+		case 9: bglStencilOp(GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, Rand(2) ? GPU_STENCIL_KEEP : GPU_STENCIL_REPLACE); break;
+		case 10: bglBlendColor(Rand(2) * 255, 0, 0, 255); break;
+		case 11: bglEnableDepthTest(Rand(2)); bglDepthFunc(TestFuncs[Rand(3)]); break;
+		case 12: bglColorDepthMask(WriteMasks[Rand(4)]); break;
+		case 13: bglEnableAlphaTest(Rand(2)); bglAlphaFunc(GPU_GREATER, Rand(2) * 0x80); break;
+		case 14: bglBlendEquation(GPU_BLEND_ADD, Rand(2) ? GPU_BLEND_ADD : GPU_BLEND_REVERSE_SUBTRACT); break;
+		case 15: bglBlendFunc(GPU_ONE, BlendFactors[Rand(3)], BlendFactors[Rand(3)], GPU_ONE); break;
+		case 16: bglEnableTextures(Rand(8)); break;
+		case 17: 
+			i = Rand(6);
+			if (Rand(2)) bglDummyTexEnv(i);
+			else bglTexEnv(i, GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0), 
+				0, 0, GPU_REPLACE, Rand(2) ? GPU_REPLACE : GPU_MODULATE, Rand(2) ? 0xFFFFFFFF : 0x80FFFFFF);
+			break;
+		case 18: bglTexImage(TexUnits[Rand(3)], Buffers[4 + Rand(4)], 256 << Rand(3), 256, Rand(2) * 6, Rand(2) ? GPU_RGBA8 : GPU_RGBA5551); break;
+		case 19: 
+			bglNumAttribs(2 + Rand(2));
+			bglAttribType(Rand(3), Rand(2) ? GPU_SHORT : GPU_UNSIGNED_BYTE, 2 + Rand(3));
+			break;
+		case 20: bglAttribBuffer(Vertices[Rand(16)]); break;
+		case 21: 
+			// keep off the shader constants (c20 and geometry c9)
+			if (Rand(2)) Uniform(GPU_VERTEX_SHADER, Rand(8), Rand(4), 1.0f, 0.0f, 1.0f);
+			else Uniform(GPU_GEOMETRY_SHADER, 10 + Rand(6), Rand(4), 0.0f, 0.0f, 0.0f);
+			break;
+		case 22: bglApplyState(&TestBlocks[Rand(2)]); break;
+		case 23: 
+			i = Rand(16);
+			if (i == 0) bglInvalidateState();
+			else if (i < 3) bglFlush();
+			break;
+	}
+
+	if (!Rand(4))
+	{
+		if (reference) bglInvalidateState();
+		bglDrawArrays(GPU_UNKPRIM, 1 + Rand(64));
+	}
+}
+
+static void RandomRun(int reference, u32 numops)
+{
+	u32 i;
+
+	Host_RandState = 0x2545F491;
+
+	bglInit();
+	bglUseShader(&Shaders[0]);
+	bglOutputBuffers(Buffers[0], Buffers[3]);
+	bglViewport(0, 0, 256, 256);
+	bglNumAttribs(2);
+	bglAttribType(0, GPU_SHORT, 2);
+	bglAttribType(1, GPU_UNSIGNED_BYTE, 2);
+	bglAttribBuffer(Vertices[0]);
+
+	for (i = 0; i < numops; i++)
+		RandomOp(reference);
+
+	bglFlush();
+	bglDeInit();
+}
+
+
+// something like a hard renderer frame: the main screen with 4 BG sections
+// with OBJ layers in between, then the sub screen with 2, blending in 3
+// sections, and the final output
+
+// the pipelines from ppu_hard.c, ppu_soft.c and main.c, keep them in sync
+
+static const bglStateBlock TileBGState = 
+{
+	.ScissorMode = GPU_SCISSOR_NORMAL,
+	.DepthTest = false, .DepthFunc = GPU_GREATER, .ColorDepthMask = GPU_WRITE_COLOR,
+	.StencilTest = false,
+	.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+	.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
+	.AlphaTest = true, .AlphaFunc = GPU_GREATER, .AlphaRef = 0,
+	.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+	.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
+	.TextureEnable = GPU_TEXUNIT0,
+	.NumTexEnvs = 1,
+	.TexEnv = {{GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0), GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF}},
+	.NumAttribs = 2,
+	.Attrib = {{GPU_SHORT, 2}, {GPU_UNSIGNED_BYTE, 2}},
+};
+
+static const bglStateBlock WindowMaskState = 
+{
+	.ScissorMode = GPU_SCISSOR_DISABLE,
+	.DepthTest = false, .DepthFunc = GPU_GREATER, .ColorDepthMask = GPU_WRITE_RED,
+	.StencilTest = false,
+	.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+	.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
+	.AlphaTest = false, .AlphaFunc = GPU_GREATER, .AlphaRef = 0,
+	.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+	.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
+	.TextureEnable = 0,
+	.NumTexEnvs = 1,
+	.TexEnv = {{GPU_TEVSOURCES(GPU_PRIMARY_COLOR, 0, 0), GPU_TEVSOURCES(GPU_PRIMARY_COLOR, 0, 0), GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF}},
+	.NumAttribs = 2,
+	.Attrib = {{GPU_SHORT, 2}, {GPU_UNSIGNED_BYTE, 2}},
+};
+
+static const bglStateBlock BlendState = 
+{
+	.ScissorMode = GPU_SCISSOR_DISABLE,
+	.DepthTest = false, .DepthFunc = GPU_GREATER, .ColorDepthMask = GPU_WRITE_COLOR,
+	.StencilTest = false,
+	.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+	.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
+	.AlphaTest = false, .AlphaFunc = GPU_GREATER, .AlphaRef = 0,
+	.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+	.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
+	.TextureEnable = GPU_TEXUNIT0|GPU_TEXUNIT1,
+	.NumTexEnvs = 0,
+	.NumAttribs = 2,
+	.Attrib = {{GPU_SHORT, 2}, {GPU_SHORT, 2}},
+};
+
+static const bglStateBlock FinalState = 
+{
+	.ScissorMode = GPU_SCISSOR_DISABLE,
+	.DepthTest = false, .DepthFunc = GPU_GREATER, .ColorDepthMask = GPU_WRITE_ALL,
+	.StencilTest = false,
+	.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+	.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
+	.AlphaTest = false, .AlphaFunc = GPU_GREATER, .AlphaRef = 0,
+	.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+	.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
+	.TextureEnable = GPU_TEXUNIT0,
+	.NumTexEnvs = 1,
+	.TexEnv = {{GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF}},
+	.NumAttribs = 2,
+	.Attrib = {{GPU_FLOAT, 3}, {GPU_FLOAT, 2}},
+};
+
+#define MainScreenTex Buffers[0]
+#define SubScreenTex Buffers[1]
+#define OBJColorBuffer Buffers[2]
+#define OBJDepthBuffer Buffers[3]
+#define TileCache Buffers[4]
+#define SNESFrame Buffers[5]
+#define BorderTex Buffers[6]
+#define FrameBuffer Buffers[7]
+
+int DoingBG;
+int Reference;
+
+static void Draw(u32 n)
+{
+	if (Reference) bglInvalidateState();
+	bglDrawArrays(GPU_UNKPRIM, n);
+}
+
+static void DummyTexEnvs(u32 first)
+{
+	u32 i;
+	for (i = first; i < 6; i++) bglDummyTexEnv(i);
+}
+
+// PPU_ClearMainScreen()/PPU_ClearSubScreen()/PPU_ClearAlpha()
+static void ClearScreen(void* buf, GPU_WRITEMASK mask)
+{
+	bglUseShader(&Shaders[1]);
+	bglOutputBuffers(buf, OBJDepthBuffer);
+	bglEnableStencilTest(false);
+	bglStencilOp(GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP);
+	bglEnableDepthTest(false);
+	bglEnableAlphaTest(false);
+	bglBlendEquation(GPU_BLEND_ADD, GPU_BLEND_ADD);
+	bglBlendFunc(GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO);
+	bglColorDepthMask(mask);
+	bglUniformMatrix(GPU_VERTEX_SHADER, 0, ProjMatrix);
+	bglEnableTextures(0);
+	bglTexEnv(0, GPU_TEVSOURCES(GPU_PRIMARY_COLOR, 0, 0), GPU_TEVSOURCES(GPU_PRIMARY_COLOR, 0, 0), 
+		GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF);
+	DummyTexEnvs(1);
+	bglNumAttribs(2);
+	bglAttribType(0, GPU_SHORT, 3);
+	bglAttribType(1, GPU_UNSIGNED_BYTE, 4);
+	bglAttribBuffer(Vertices[0]);
+	Draw(6);
+}
+
+static void WindowMask()
+{
+	bglUseShader(&Shaders[1]);
+	bglOutputBuffers(OBJDepthBuffer, OBJDepthBuffer);
+	bglApplyState(&WindowMaskState);
+	bglUniformMatrix(GPU_VERTEX_SHADER, 0, ProjMatrix);
+	bglAttribBuffer(Vertices[1]);
+	Draw(12);
+}
+
+static void OBJs()
+{
+	bglUseShader(&Shaders[0]);
+	bglOutputBuffers(OBJColorBuffer, OBJDepthBuffer);
+	bglScissorMode(GPU_SCISSOR_NORMAL);
+	bglEnableStencilTest(false);
+	bglStencilOp(GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP);
+	bglEnableDepthTest(false);
+	bglEnableAlphaTest(true);
+	bglAlphaFunc(GPU_GREATER, 0);
+	bglBlendEquation(GPU_BLEND_ADD, GPU_BLEND_ADD);
+	bglBlendFunc(GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO);
+	bglColorDepthMask(GPU_WRITE_ALL);
+	bglUniformMatrix(GPU_VERTEX_SHADER, 0, ProjMatrix);
+	Uniform(GPU_VERTEX_SHADER, 4, 1.0f/128.0f, 1.0f/128.0f, 1.0f, 1.0f);
+	bglEnableTextures(GPU_TEXUNIT0);
+	bglTexEnv(0, GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), 
+		GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF);
+	DummyTexEnvs(1);
+	bglTexImage(GPU_TEXUNIT0, TileCache, 1024, 1024, 0, GPU_RGBA5551);
+	bglScissor(0, 0, 256, 224);
+	bglNumAttribs(2);
+	bglAttribType(0, GPU_SHORT, 3);
+	bglAttribType(1, GPU_UNSIGNED_BYTE, 2);
+	bglAttribBuffer(Vertices[2]);
+	Draw(128);
+}
+
+// PPU_StartBG() and PPU_DrawBGTiles()
+static void BGTiles(u32 num, u32 setalpha, int ystart, int yend)
+{
+	if (!DoingBG)
+	{
+		DoingBG = 1;
+		bglApplyState(&TileBGState);
+		Uniform(GPU_VERTEX_SHADER, 4, 1.0f/128.0f, 1.0f/128.0f, 1.0f, 1.0f);
+		bglTexImage(GPU_TEXUNIT0, TileCache, 1024, 1024, 0, GPU_RGBA5551);
+	}
+
+	bglScissor(0, ystart, 256, yend);
+	bglEnableStencilTest(true);
+	bglStencilFunc(GPU_EQUAL, 0x00, 1<<num, 0xFF);
+	bglTexEnv(0, GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0),
+		GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), 
+		GPU_REPLACE, setalpha ? GPU_REPLACE:GPU_MODULATE, setalpha ? 0xFFFFFFFF:0x80FFFFFF);
+	bglAttribBuffer(Vertices[4 + num]);
+	Draw(200);
+}
+
+// PPU_HardRenderOBJLayer()
+static void OBJLayer(u32 setalpha)
+{
+	DoingBG = 0;
+	bglEnableStencilTest(true);
+	bglStencilFunc(GPU_EQUAL, 0x00, 0x10, 0xFF);
+	bglStencilOp(GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP);
+	bglEnableDepthTest(true);
+	bglDepthFunc(GPU_EQUAL);
+	bglEnableAlphaTest(true);
+	bglAlphaFunc(GPU_GREATER, 0);
+	bglBlendEquation(GPU_BLEND_ADD, GPU_BLEND_ADD);
+	bglBlendFunc(GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO);
+	bglScissorMode(GPU_SCISSOR_DISABLE);
+	bglColorDepthMask(GPU_WRITE_COLOR);
+	Uniform(GPU_VERTEX_SHADER, 4, 1.0f/256.0f, 1.0f/256.0f, 1.0f, 1.0f);
+	bglEnableTextures(GPU_TEXUNIT0);
+	bglTexEnv(0, GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), 
+		GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF);
+	DummyTexEnvs(1);
+	bglTexImage(GPU_TEXUNIT0, OBJColorBuffer, 256, 256, 0, GPU_RGBA8);
+	bglNumAttribs(2);
+	bglAttribType(0, GPU_SHORT, 3);
+	bglAttribType(1, GPU_SHORT, 2);
+	bglAttribBuffer(Vertices[3]);
+	Draw(2);
+
+	bglTexEnv(0, GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0), 
+		GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, setalpha ? GPU_REPLACE:GPU_MODULATE, 0x80FFFFFF);
+	bglAttribBuffer(Vertices[3] + 8);
+	Draw(2);
+}
+
+static void Screen(void* buf, u32 nsections)
+{
+	u32 s, prio, num;
+
+	ClearScreen(buf, GPU_WRITE_ALL);
+	WindowMask();
+	if (buf == MainScreenTex) OBJs();
+
+	bglUseShader(&Shaders[0]);
+	bglOutputBuffers(buf, OBJDepthBuffer);
+
+	// mode 1: BG3, BG2, BG1, and the OBJs after each priority
+	for (s = 0; s < nsections; s++)
+	{
+		int ystart = s * (224 / nsections);
+		int yend = ystart + (224 / nsections);
+
+		DoingBG = 0;
+		for (prio = 0; prio < 4; prio++)
+		{
+			for (num = 0; num < 3; num++)
+			{
+				if ((num == 2) != (prio < 2)) continue;
+				BGTiles(num, prio & 1, ystart, yend);
+			}
+			if (buf == MainScreenTex) OBJLayer(s & 1);
+		}
+	}
+
+	ClearScreen(buf, GPU_WRITE_ALPHA);
+	bglEnableStencilTest(true);
+	bglStencilFunc(GPU_EQUAL, 0x20, 0x20, 0xFF);
+	bglBlendFunc(GPU_ONE, GPU_ZERO, GPU_ZERO, GPU_ZERO);
+	Draw(2);
+}
+
+static void Blend()
+{
+	u32 s;
+
+	bglUseShader(&Shaders[0]);
+	bglOutputBuffers(SNESFrame, OBJDepthBuffer);
+	bglViewport(0, 0, 256, 256);
+	bglApplyState(&BlendState);
+	bglUniformMatrix(GPU_VERTEX_SHADER, 0, ProjMatrix);
+	bglTexImage(GPU_TEXUNIT0, MainScreenTex, 256, 256, 0, GPU_RGBA8);
+	bglTexImage(GPU_TEXUNIT1, SubScreenTex, 256, 256, 0, GPU_RGBA8);
+
+	for (s = 0; s < 3; s++)
+	{
+		bglTexEnv(0, GPU_TEVSOURCES(GPU_TEXTURE1, GPU_TEXTURE0, 0), GPU_TEVSOURCES(GPU_TEXTURE1, GPU_CONSTANT, 0),
+			GPU_TEVOPERANDS(0,2,0), GPU_TEVOPERANDS(0,0,0), GPU_MODULATE, GPU_ADD, 0x80FFFFFF);
+		bglTexEnv(1, GPU_TEVSOURCES(GPU_TEXTURE0, GPU_PREVIOUS, 0), GPU_TEVSOURCES(GPU_PREVIOUS, GPU_TEXTURE0, 0),
+			GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,1,0), (s & 1) ? GPU_SUBTRACT : GPU_ADD, GPU_ADD, 0xFFFFFFFF);
+		bglTexEnv(2, GPU_TEVSOURCES(GPU_PREVIOUS, GPU_PREVIOUS, 0), GPU_TEVSOURCES(GPU_PREVIOUS, 0, 0),
+			GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_MODULATE, GPU_REPLACE, 0xFFFFFFFF);
+		bglAttribBuffer(Vertices[8] + s*8);
+		Draw(2);
+	}
+}
+
+static void Final()
+{
+	bglUseShader(&Shaders[3]);
+	bglOutputBuffers(FrameBuffer, OBJDepthBuffer);
+	bglViewport(0, 0, 240, 400);
+	bglApplyState(&FinalState);
+	bglTexImage(GPU_TEXUNIT0, BorderTex, 512, 256, 0, GPU_RGBA8);
+	bglUniformMatrix(GPU_VERTEX_SHADER, 0, ProjMatrix);
+	bglAttribBuffer(Vertices[12]);
+	Draw(2);
+	bglTexImage(GPU_TEXUNIT0, SNESFrame, 256, 256, 0, GPU_RGBA8);
+	bglAttribBuffer(Vertices[13]);
+	Draw(2);
+}
+
+static void Frame()
+{
+	// the SNES screens are rendered with a 256x256 viewport, set in the VBlank code
+	bglUseShader(&Shaders[0]);
+	bglOutputBuffers(MainScreenTex, OBJDepthBuffer);
+	bglViewport(0, 0, 256, 256);
+
+	Screen(MainScreenTex, 4);
+	Screen(SubScreenTex, 2);
+	Blend();
+	bglFlush();
+
+	Final();
+	bglFlush();
+}
+
+static void FrameRun(int reference, u32* words, u32* catwords)
+{
+	u32 i;
+
+	Reference = reference;
+	DoingBG = 0;
+	bglInit();
+
+	for (i = 0; i < 3; i++)
+	{
+		Timing_Counts[COUNT_GPUCMD] = 0;
+		memset(CatWords, 0, sizeof(CatWords));
+		Frame();
+	}
+
+	*words = Timing_Counts[COUNT_GPUCMD];
+	memcpy(catwords, CatWords, sizeof(CatWords));
+	bglDeInit();
+}
+
+
+int main(int argc, char** argv)
+{
+	u32 numops = 8000;
+	u32 words[2], catwords[2][CAT_NUM];
+	int fail = 0;
+	u32 i;
+
+	if (argc > 1) numops = strtoul(argv[1], NULL, 0);
+
+	// random state changes, sent the old way then the new way
+	NumDraws = 0; Recording = 1; Mismatches = 0;
+	ResetGPU();
+	RandomRun(1, numops);
+	printf("random: %u ops, %u draws\n", numops, NumDraws);
+
+	u32 numdraws = NumDraws;
+	NumDraws = 0; Recording = 0;
+	ResetGPU();
+	RandomRun(0, numops);
+	if (NumDraws != numdraws || Mismatches)
+	{
+		printf("random: %u of %u draws wrong\n", Mismatches, NumDraws);
+		fail = 1;
+	}
+
+	// a frame
+	NumDraws = 0; Recording = 1; Mismatches = 0;
+	ResetGPU();
+	FrameRun(1, &words[0], catwords[0]);
+
+	numdraws = NumDraws;
+	NumDraws = 0; Recording = 0;
+	ResetGPU();
+	FrameRun(0, &words[1], catwords[1]);
+	if (NumDraws != numdraws || Mismatches)
+	{
+		printf("frame: %u of %u draws wrong\n", Mismatches, NumDraws);
+		fail = 1;
+	}
+
+	printf("frame: %u draws, command words per frame:\n", numdraws / 3);
+	printf("%-18s %9s %9s\n", "", "all", "changed");
+	for (i = 0; i < CAT_NUM; i++)
+		printf("%-18s %9u %9u\n", CatNames[i], catwords[0][i], catwords[1][i]);
+	printf("%-18s %9u %9u  (%.1f%%)\n", "total", words[0], words[1], (words[1] * 100.0) / words[0]);
+
+	if (words[1] * 2 > words[0])
+	{
+		printf("frame: not even half as many words sent\n");
+		fail = 1;
+	}
+
+	if (fail) return 1;
+	printf("check: all good\n");
+	return 0;
+}
@@ -0,0 +1,304 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// CPU throughput benchmark, runs the C CPU core (cpu_c.c) on a PC
+// the PPU, DMA, SPC and I/O are stubbed out, so this only measures the CPU
+//
+// build (from the repo root):
+//   gcc -O2 -no-pie -Ihost -Isource -o cpubench host/cpubench.c host/host3ds.c source/cpu_c.c
+//
+// -no-pie matters: the memory map stores pointers as u32, so everything
+// it points to has to live below 4GB
+//
+// with the guest profiler (writes cpubench_profile.txt):
+//   gcc -O2 -no-pie -DPROFILER -Ihost -Isource -o cpubench host/cpubench.c host/host3ds.c source/cpu_c.c source/profile.c
+//
+// usage: cpubench [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "spc700.h"
+#include "profile.h"
+#include "hostemu.h"
+
+
+u32 _Mem_PtrTable[(SNESSTATUS_SIZE >> 2) + 0x800];
+u32* Mem_PtrTable;
+SNES_StatusData* SNES_Status;
+
+u8 SNES_SysRAM[0x20000];
+u8 BenchROM[0x8000];
+
+u8* ROM_Bank0;
+u8* ROM_Bank0End;
+
+IO_Page* IO_Pages[0x100];
+IO_Page BenchIOPage, BenchGIOPage;
+
+
+// the instruction mix
+// runs in native mode with 16-bit A/X/Y, with a bit of 8-bit stuff thrown in
+// one pass through the loop is BENCH_LOOP_INSTRS instructions, and increments
+// the 32-bit counter at $00 (the high word increment is one extra instruction)
+// after BENCH_LOOP_PASSES passes it waits for the next frame by polling $4212
+// like most games do, which is what the idle loop detection is for
+
+#define BENCH_LOOP_INSTRS 83
+#define BENCH_LOOP_PASSES 64
+
+u8 BenchCode[] =
+{
+	0x18,					// 8000 CLC
+	0xFB,					// 8001 XCE
+	0xC2, 0x30,				// 8002 REP #$30
+	0xA9, 0xFF, 0x1F,		// 8004 LDA #$1FFF
+	0x1B,					// 8007 TCS
+	0xA9, 0x00, 0x00,		// 8008 LDA #$0000
+	0x5B,					// 800B TCD
+							// frame:
+	0xA9, BENCH_LOOP_PASSES, 0x00,	// 800C LDA #BENCH_LOOP_PASSES
+	0x85, 0x04,				// 800F STA $04
+							// loop:
+	0xE6, 0x00,				// 8011 INC $00
+	0xD0, 0x02,				// 8013 BNE +2
+	0xE6, 0x02,				// 8015 INC $02
+	0xA5, 0x10,				// 8017 LDA $10
+	0x18,					// 8019 CLC
+	0x69, 0x34, 0x12,		// 801A ADC #$1234
+	0x85, 0x12,				// 801D STA $12
+	0xA2, 0x10, 0x00,		// 801F LDX #$0010
+							// inner: (9 times)
+	0xBD, 0x00, 0x01,		// 8022 LDA $0100,X
+	0x45, 0x12,				// 8025 EOR $12
+	0x9D, 0x00, 0x02,		// 8027 STA $0200,X
+	0xCA,					// 802A DEX
+	0xCA,					// 802B DEX
+	0x10, 0xF4,				// 802C BPL inner
+	0x20, 0x60, 0x80,		// 802E JSR sub
+	0xE2, 0x20,				// 8031 SEP #$20
+	0xB7, 0x20,				// 8033 LDA [$20],Y
+	0x0A,					// 8035 ASL A
+	0x26, 0x30,				// 8036 ROL $30
+	0xC2, 0x20,				// 8038 REP #$20
+	0x48,					// 803A PHA
+	0x68,					// 803B PLA
+	0xAF, 0x00, 0x20, 0x7E,	// 803C LDA $7E2000
+	0x4A,					// 8040 LSR A
+	0xC6, 0x04,				// 8041 DEC $04
+	0xD0, 0xCC,				// 8043 BNE loop
+							// wait for the VBlank, then for the end of it
+	0xE2, 0x20,				// 8045 SEP #$20
+	0xAD, 0x12, 0x42,		// 8047 LDA $4212
+	0x10, 0xFB,				// 804A BPL -5
+	0xAD, 0x12, 0x42,		// 804C LDA $4212
+	0x30, 0xFB,				// 804F BMI -5
+	0xC2, 0x20,				// 8051 REP #$20
+	0x4C, 0x0C, 0x80,		// 8053 JMP frame
+	0xEA, 0xEA, 0xEA, 0xEA,	// 8056
+	0xEA, 0xEA, 0xEA, 0xEA,	// 805A
+	0xEA, 0xEA,				// 805E
+							// sub:
+	0x08,					// 8060 PHP
+	0xDA,					// 8061 PHX
+	0xA0, 0x04, 0x00,		// 8062 LDY #$0004
+	0xB1, 0x20,				// 8065 LDA ($20),Y
+	0xE5, 0x14,				// 8067 SBC $14
+	0xEB,					// 8069 XBA
+	0xAA,					// 806A TAX
+	0xFA,					// 806B PLX
+	0x28,					// 806C PLP
+	0x60,					// 806D RTS
+};
+
+
+// stubs for everything the CPU core talks to
+
+u8 PPU_Read8(u32 addr) { return 0; }
+u16 PPU_Read16(u32 addr) { return 0; }
+void PPU_Write8(u32 addr, u8 val) {}
+void PPU_Write16(u32 addr, u16 val) {}
+void PPU_RenderScanline(u32 line) {}
+void PPU_VBlank() {}
+
+// only the VBlank flag, for the frame wait
+u8 SNES_GIORead8(u32 addr) { return (addr == 0x12) ? (SNES_Status->HVBFlags & 0x80) : 0; }
+u16 SNES_GIORead16(u32 addr) { return SNES_GIORead8(addr) | (SNES_GIORead8(addr+1) << 8); }
+void SNES_GIOWrite8(u32 addr, u8 val) {}
+void SNES_GIOWrite16(u32 addr, u16 val) {}
+
+u8 SNES_JoyRead8(u32 addr) { return 0; }
+u16 SNES_JoyRead16(u32 addr) { return 0; }
+void SNES_JoyWrite8(u32 addr, u8 val) {}
+void SNES_JoyWrite16(u32 addr, u16 val) {}
+
+u8 DMA_Read8(u32 addr) { return 0; }
+u16 DMA_Read16(u32 addr) { return 0; }
+void DMA_Write8(u32 addr, u8 val) {}
+void DMA_Write16(u32 addr, u16 val) {}
+void DMA_ReloadHDMA() {}
+void DMA_DoHDMA() {}
+
+void SPC_Run(int cycles) {}
+
+void ReportCrash()
+{
+	printf("CPU crashed (STP)\n");
+	exit(1);
+}
+
+
+void SNES_Reset()
+{
+	u32 b, a;
+
+	SNES_Status = (SNES_StatusData*)&_Mem_PtrTable[0];
+	Mem_PtrTable = &_Mem_PtrTable[SNESSTATUS_SIZE >> 2];
+
+	memset(SNES_SysRAM, 0, sizeof(SNES_SysRAM));
+	memset(BenchROM, 0, sizeof(BenchROM));
+	memcpy(BenchROM, BenchCode, sizeof(BenchCode));
+	BenchROM[0x7FFC] = 0x00;
+	BenchROM[0x7FFD] = 0x80;
+
+	ROM_Bank0 = BenchROM;
+	ROM_Bank0End = BenchROM + 0x8000;
+
+	// LoROM-ish map: WRAM mirror + I/O in the low half, the ROM in the upper half
+	for (b = 0; b < 0x100; b++)
+	{
+		for (a = 0; a < 0x10000; a += 0x2000)
+		{
+			u32 ptr;
+
+			if (b == 0x7E || b == 0x7F)
+				ptr = (u32)(uintptr_t)&SNES_SysRAM[((b - 0x7E) << 16) | a];
+			else if (a >= 0x8000)
+				ptr = (u32)(uintptr_t)&BenchROM[a - 0x8000] | MPTR_SLOW | MPTR_READONLY;
+			else if (a == 0)
+				ptr = (u32)(uintptr_t)&SNES_SysRAM[0];
+			else if (a == 0x2000 || a == 0x4000)
+				ptr = MPTR_SLOW | MPTR_SPECIAL;
+			else
+				ptr = MPTR_SLOW | MPTR_READONLY;
+
+			MEM_PTR(b, a) = ptr;
+		}
+	}
+
+	SNES_Status->LastBusVal = 0;
+	SNES_Status->ScreenHeight = 224;
+	SNES_Status->TotalLines = 262 >> 1;
+	SNES_Status->IRQCond = 0;
+	SNES_Status->HVBFlags = 0;
+	SNES_Status->IRQ_CurHMatch = 0x8000;
+	SNES_Status->SPC_CycleRatio = 0;
+	SNES_Status->SPC_CyclesPerLine = 0;
+	SNES_Status->SPC_LastCycle = 0;
+
+	// every I/O page goes to the stubs
+	for (a = 0; a < 256; a++)
+	{
+		BenchIOPage.Read8[a] = PPU_Read8;
+		BenchIOPage.Read16[a] = PPU_Read16;
+		BenchIOPage.Write8[a] = PPU_Write8;
+		BenchIOPage.Write16[a] = PPU_Write16;
+	}
+	BenchIOPage.Cycles = 0;
+	for (a = 0; a < 0x100; a++)
+		IO_Pages[a] = &BenchIOPage;
+
+	// except $42xx
+	for (a = 0; a < 256; a++)
+	{
+		BenchGIOPage.Read8[a] = SNES_GIORead8;
+		BenchGIOPage.Read16[a] = SNES_GIORead16;
+		BenchGIOPage.Write8[a] = SNES_GIOWrite8;
+		BenchGIOPage.Write16[a] = SNES_GIOWrite16;
+	}
+	BenchGIOPage.Cycles = 0;
+	IO_Pages[0x42] = &BenchGIOPage;
+}
+
+
+int main(int argc, char** argv)
+{
+	int nframes = 600;
+	int i;
+	double start, elapsed;
+	u64 niter, ninstr, ncycles, nidle = 0;
+
+	if (argc > 1) nframes = atoi(argv[1]);
+	if (nframes < 1) nframes = 1;
+
+	if ((uintptr_t)SNES_SysRAM > 0xFFFFFFF0 || (uintptr_t)BenchROM > 0xFFFFFFF0)
+	{
+		printf("emulated memory isn't below 4GB, build with -no-pie\n");
+		return 1;
+	}
+
+	CPU_Reset();
+#ifdef PROFILER
+	Prof_Reset();
+#endif
+
+	start = Host_GetTime();
+	for (i = 0; i < nframes; i++)
+	{
+		CPU_MainLoop();
+		nidle += CPU_IdleCycles;
+#ifdef PROFILER
+		Prof_EndFrame();
+#endif
+	}
+	elapsed = Host_GetTime() - start;
+
+	niter = SNES_SysRAM[0] | (SNES_SysRAM[1] << 8) | (SNES_SysRAM[2] << 16) | (SNES_SysRAM[3] << 24);
+	ninstr = (niter * BENCH_LOOP_INSTRS) + (niter >> 16);
+	ncycles = (u64)nframes * (SNES_Status->TotalLines << 1) * 1364;
+
+	printf("%d frames in %.3f s (%.1f fps)\n", nframes, elapsed, nframes / elapsed);
+	printf("%llu instructions, %.2f M instructions/s\n", (unsigned long long)ninstr, ninstr / elapsed / 1000000.0);
+	printf("%llu master cycles, %.2f M cycles/s (%.1fx realtime)\n",
+		(unsigned long long)ncycles, ncycles / elapsed / 1000000.0, (ncycles / elapsed) / 21477272.0);
+	printf("%llu cycles skipped as idle (%.1f%%)\n", (unsigned long long)nidle, (nidle * 100.0) / ncycles);
+
+	// the work fits in a frame, so every frame has to have done all of it,
+	// and waited out the rest
+	if (niter != (u64)nframes * BENCH_LOOP_PASSES)
+	{
+		printf("%llu passes through the loop, should be %llu\n", (unsigned long long)niter, (unsigned long long)nframes * BENCH_LOOP_PASSES);
+		return 1;
+	}
+	if (!nidle)
+	{
+		printf("the frame wait wasn't skipped\n");
+		return 1;
+	}
+
+#ifdef PROFILER
+	if (Prof_Dump("cpubench_profile.txt"))
+		printf("profile written to cpubench_profile.txt\n");
+#endif
+
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// headless benchmark, runs a ROM on a PC with no display, sound or UI
+// it's the real emulation loop (CPU_MainLoop()) with the C CPU and SPC cores,
+// the software renderer drawing into PPU.MainBuffer/SubBuffer, and the
+// ctrulib calls replaced by host3ds.c (the rest of main.c is in hostemu.c)
+//
+// build (from the repo root):
+//   gcc -O2 -no-pie -pthread -Ihost -Isource -o headless host/headless.c host/hostemu.c host/host3ds.c source/cpu_c.c source/spc700_c.c source/spc700io.c source/snes.c source/rom.c source/dma.c source/ppu.c source/ppu_soft.c source/timing.c
+//
+// usage: headless [-n frames] [-norender] [-threads n] [-pipeline] [-keys mask] rom.smc
+//   -n         number of frames to run (default 3600)
+//   -norender  skip the rendering, like frameskip does (SkipThisFrame)
+//   -threads   render threads for the soft renderer (default 0, inline)
+//   -pipeline  let the threads finish each frame while the next one runs
+//   -keys      3DS key bits held down the whole time (see host/3ds.h)
+//
+// prints the speed, the time spent in each part (the same counters as the
+// timing HUD), and hashes of WRAM, VRAM and the screen buffers at the end
+// two runs of the same ROM give the same hashes, so a changed hash after
+// a speed tweak means it broke something
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "config.h"
+#include "snes.h"
+#include "ppu.h"
+#include "spc700.h"
+#include "timing.h"
+#include "hostemu.h"
+
+
+extern Timing_Frame Timing_Frames[TIMING_FRAMES];
+extern u32 Timing_FrameIdx;
+
+char* TimingNames[] = {"CPU", "SPC", "render", "VBlank", "HDMA"};
+
+
+int main(int argc, char** argv)
+{
+	int nframes = 3600;
+	bool render = true;
+	char* path = NULL;
+	u64 ticks[TIMING_NUM];
+	u64 idle = 0;
+	int i, j;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-n") && i+1 < argc) nframes = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-norender")) render = false;
+		else if (!strcmp(argv[i], "-threads") && i+1 < argc) Config.RenderThreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-pipeline")) Config.PipelineFrames = 1;
+		else if (!strcmp(argv[i], "-keys") && i+1 < argc) Host_Keys = strtoul(argv[++i], NULL, 0);
+		else path = argv[i];
+	}
+	if (!path || nframes < 1)
+	{
+		printf("usage: headless [-n frames] [-norender] [-threads n] [-pipeline] [-keys mask] rom.smc\n");
+		return 1;
+	}
+
+	Host_Init();
+	if (!Host_LoadROM(path, render))
+	{
+		printf("can't load %s\n", path);
+		return 1;
+	}
+
+	Timing_Enabled = true;
+	Timing_Reset();
+	memset(ticks, 0, sizeof(ticks));
+
+	double t = Host_GetTime();
+
+	for (i = 0; i < nframes && !Host_Crashed; i++)
+	{
+		Host_RunFrame();
+
+		Timing_Frame* frame = &Timing_Frames[(Timing_FrameIdx - 1) & (TIMING_FRAMES - 1)];
+		for (j = 0; j < TIMING_NUM; j++)
+			ticks[j] += frame->Ticks[j];
+		idle += frame->Counts[COUNT_IDLECYCLES];
+	}
+
+	t = Host_GetTime() - t;
+	nframes = i;
+
+	printf("%d frames in %.3f s, %.1f fps (%.2fx full speed)\n", nframes, t, nframes / t, nframes / t / 60.0);
+	for (j = 0; j <= TIMING_HDMA; j++)
+		printf("%-7s %7.3f ms/frame\n", TimingNames[j], ticks[j] / (268111.856 * nframes));
+	printf("idle   %llu cycles/frame skipped\n", (unsigned long long)(idle / nframes));
+
+	printf("WRAM   %08X\n", Host_Hash(SNES_SysRAM, 0x20000));
+	printf("VRAM   %08X\n", Host_Hash(PPU.VRAM, 0x10000));
+	printf("ARAM   %08X\n", Host_Hash(SPC_RAM, 0x10000));
+	if (render)
+		printf("screen %08X\n", Host_Hash((u8*)PPU_LastFrame_Soft(), 256*512*2));
+
+	return Host_Crashed ? 1 : 0;
+}
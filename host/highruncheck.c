@@ -0,0 +1,368 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// hard renderer high priority run check, runs the BG walks of
+// source/ppu_hard.c over a stand-in blargGL that only writes down what gets
+// drawn. built with small high priority buffers so that they fill up
+//
+// every BG setup is drawn twice, each time as a frame: the low priority pass
+// then the high priority one. the first time the high priority pass draws
+// what the low priority one kept aside, and walks the lines it couldn't keep.
+// the second time it walks the whole BG again, like before the tiles were
+// kept. both have to draw the same, in the same order. the vertices are only
+// read once both frames are done, like the GPU does, so vertices overwritten
+// after they were drawn show up too. and every byte the first frame put in
+// the vertex buffer has to be drawn, none wasted on runs that were dropped
+//
+// build (from the repo root):
+//   gcc -O2 -no-pie -Ihost -Isource -DHIGH_MAX_RUNS=12 -DHIGH_MAX_VERTICES=1536 -o highruncheck host/highruncheck.c host/host3ds.c source/ppu_hard.c source/ppu_tilecache.c
+//
+// usage: highruncheck
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "blargGL.h"
+#include "config.h"
+#include "mem.h"
+#include "snes.h"
+#include "ppu.h"
+#include "timing.h"
+#include "hostemu.h"
+
+
+// what ppu_hard.c talks to, besides host3ds.c and ppu_tilecache.c
+
+PPUState PPU;
+Config_t Config;
+SNES_StatusData* SNES_Status;
+u32 Timing_Counts[COUNT_NUM];
+
+void* vertexBuf;
+void* vertexPtr;
+
+shaderProgram_s hardRenderShaderP;
+shaderProgram_s hard7RenderShaderP;
+shaderProgram_s hard7PlaneShaderP;
+shaderProgram_s plainQuadShaderP;
+shaderProgram_s windowMaskShaderP;
+
+float snesProjMatrix[16];
+float snesM7Matrix[16];
+
+u16* MainScreenTex;
+u16* SubScreenTex;
+
+// the BG walks, and what they keep aside
+void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart, int yend, u32 opt, u32 hi);
+void PPU_HardRenderBG_16x16(u32 setalpha, u32 num, int type, u32 prio, int ystart, int yend, u32 hi);
+extern int PPU_NumHighRuns[4];
+extern int PPU_HighRunsStart[4], PPU_HighRunsUntil[4];
+
+void bprintf(char* fmt, ...) {}
+
+Result GSPGPU_FlushDataCache(Handle* handle, u8* adr, u32 size) { return 0; }
+
+void* VRAM_Alloc(u32 size) { return NULL; }
+void VRAM_Free(void* ptr) {}
+
+void PPU_ClearSectionLog() {}
+void* PPU_AddSection(u32 size) { return NULL; }
+void PPU_ComputeWindows(PPU_WindowSegment* s) {}
+void PPU_BlendScreens(u32 colorformat, PPU_ColorEffectSection* s) {}
+
+
+// the stand-in blargGL: the state the BG walks change, and the draws
+
+typedef struct
+{
+	int Pass;		// 0: low priority, 1: high priority
+	int Plane;		// drawn with the plane shader
+	void* Tex;
+	u32 YStart, YEnd;
+	u16* Vertices;
+	u32 NumVertices;
+
+} Draw;
+
+#define MAX_DRAWS 4096
+
+static Draw Draws[2][MAX_DRAWS];
+static int NumDraws[2];
+
+static int CurFrame, CurPass;
+static shaderProgram_s* CurShader;
+static void* CurTex;
+static void* CurVertices;
+static u32 CurYStart, CurYEnd;
+
+void bglApplyState(const bglStateBlock* block) {}
+void bglUseShader(shaderProgram_s* shader) { CurShader = shader; }
+void bglUniform(GPU_SHADER_TYPE type, u32 id, float* val) {}
+void bglUniformMatrix(GPU_SHADER_TYPE type, u32 id, float* val) {}
+void bglOutputBuffers(void* color, void* depth) {}
+void bglViewport(u32 x, u32 y, u32 w, u32 h) {}
+void bglScissorMode(GPU_SCISSORMODE mode) {}
+void bglScissor(u32 x, u32 y, u32 w, u32 h) { CurYStart = y; CurYEnd = h; }
+void bglEnableDepthTest(bool enable) {}
+void bglDepthFunc(GPU_TESTFUNC func) {}
+void bglFaceCulling(GPU_CULLMODE mode) {}
+void bglEnableStencilTest(bool enable) {}
+void bglStencilFunc(GPU_TESTFUNC func, u32 ref, u32 mask, u32 replace) {}
+void bglStencilOp(GPU_STENCILOP sfail, GPU_STENCILOP dfail, GPU_STENCILOP pass) {}
+void bglColorDepthMask(GPU_WRITEMASK mask) {}
+void bglEnableAlphaTest(bool enable) {}
+void bglAlphaFunc(GPU_TESTFUNC func, u32 ref) {}
+void bglBlendEquation(GPU_BLENDEQUATION coloreq, GPU_BLENDEQUATION alphaeq) {}
+void bglBlendFunc(GPU_BLENDFACTOR colorsrc, GPU_BLENDFACTOR colordst, GPU_BLENDFACTOR alphasrc, GPU_BLENDFACTOR alphadst) {}
+void bglEnableTextures(GPU_TEXUNIT units) {}
+void bglTexEnv(u32 id, u32 colorsrc, u32 alphasrc, u32 colorop, u32 alphaop, GPU_COMBINEFUNC colorcomb, GPU_COMBINEFUNC alphacomb, u32 constcol) {}
+void bglDummyTexEnv(u32 id) {}
+void bglTexImage(GPU_TEXUNIT unit, void* data, u32 width, u32 height, u32 param, GPU_TEXCOLOR colortype) { CurTex = data; }
+void bglNumAttribs(u32 num) {}
+void bglAttribBuffer(void* data) { CurVertices = data; }
+void bglAttribType(u32 id, GPU_FORMATS datatype, u32 numcomps) {}
+
+void bglDrawArrays(GPU_Primitive_t type, u32 numvertices)
+{
+	Draw* d;
+
+	if (NumDraws[CurFrame] >= MAX_DRAWS)
+	{
+		printf("more than %d draws\n", MAX_DRAWS);
+		exit(1);
+	}
+
+	d = &Draws[CurFrame][NumDraws[CurFrame]++];
+	d->Pass = CurPass;
+	d->Plane = (CurShader == &hard7PlaneShaderP);
+	d->Tex = CurTex;
+	d->YStart = CurYStart;
+	d->YEnd = CurYEnd;
+	d->Vertices = (u16*)CurVertices;
+	d->NumVertices = numvertices;
+}
+
+
+// the BG setups
+
+typedef struct
+{
+	char* Name;
+	int Type, Big, Hi, Interlace, Opt;
+	int NumSections;
+	u8 Lines[8];	// the sections' heights, if they're not all the same
+	int High;		// percent of the tiles that are high priority
+	int Planes;		// sections 2, 7, 12... have another tilemap, the others use the plane
+	int Fills;		// the high priority buffers are expected to fill up
+
+} Setup;
+
+static Setup Setups[] =
+{
+	{"8bpp, 4 sections, a quarter high", TILE_8BPP, 0, 0, 0, 0, 4, {0}, 25, 0, 0},
+	{"8bpp, all high, too many tiles in the last section", TILE_8BPP, 0, 0, 0, 0, 3, {16, 16, 192}, 100, 0, 1},
+	{"8bpp, a section every 8 lines", TILE_8BPP, 0, 0, 0, 0, 28, {0}, 50, 0, 1},
+	{"2bpp hires interlaced, too many tiles in the last section", TILE_2BPP, 0, 1, 1, 0, 4, {8, 8, 8, 200}, 30, 0, 1},
+	{"4bpp offset-per-tile, 20 sections", TILE_4BPP, 0, 0, 0, 2, 20, {0}, 50, 0, 1},
+	{"4bpp, 3 sections, planes", TILE_4BPP, 0, 0, 0, 0, 3, {0}, 50, 1, 0},
+	{"4bpp, 20 sections, planes", TILE_4BPP, 0, 0, 0, 0, 20, {0}, 50, 1, 1},
+	{"4bpp 16x16, 4 sections", TILE_4BPP, 1, 0, 0, 0, 4, {0}, 10, 0, 0},
+	{"4bpp 16x16, 20 sections", TILE_4BPP, 1, 0, 0, 0, 20, {0}, 50, 0, 1},
+	{"8bpp 16x16, all high, too many tiles in the last section", TILE_8BPP, 1, 0, 0, 0, 2, {32, 192}, 100, 0, 1},
+	{"2bpp 16x16 hires, 20 sections", TILE_2BPP, 1, 1, 0, 0, 20, {0}, 50, 0, 1},
+};
+
+#define NUM_SETUPS (sizeof(Setups) / sizeof(Setups[0]))
+
+#define YEND 225
+#define FRAME_VERTICES 0x100000
+
+static PPU_BGSection Sections[2][240];
+
+static void FillTilemap(u32 offset, int high)
+{
+	u32 i;
+
+	for (i = 0; i < 0x2000; i += 2)
+	{
+		u16 e = Host_Rand() & ~0x2000;
+		if ((int)(Host_Rand() % 100) < high) e |= 0x2000;
+		*(u16*)&PPU.VRAM[offset + i] = e;
+	}
+
+	for (i = 0; i < 0x2000; i += 16) PPU.VRAMUpdateCount[(offset + i) >> 4]++;
+	PPU.VRAMWrites++;
+}
+
+static void BuildSections(PPU_BGSection* s, int num, u8* lines, u32 tileset, u32 tilemap, int planes)
+{
+	int i, y = 1;
+
+	for (i = 0; i < num; i++)
+	{
+		y += lines[0] ? lines[i] : ((YEND - 1) / num);
+		if (i == num - 1) y = YEND;
+
+		s[i].EndOffset = y;
+		s[i].Size = 3;
+		s[i].XScroll = Host_Rand() & 0x3FF;
+		s[i].YScroll = Host_Rand() & 0x3FF;
+		s[i].TilesetOffset = tileset;
+		s[i].TilemapOffset = (planes && (i % 5) == 2) ? (tilemap + 0x2000) : tilemap;
+		s[i].Next = (i < num - 1) ? &s[i + 1] : NULL;
+	}
+}
+
+static void RenderBG(Setup* st, u32 prio)
+{
+	if (st->Big)
+		PPU_HardRenderBG_16x16(0, 0, st->Type, prio, 1, YEND, st->Hi);
+	else
+		PPU_HardRenderBG_8x8(0, 0, st->Type, prio, 1, YEND, st->Opt, st->Hi);
+}
+
+// walkall: the high priority pass walks the whole BG again
+// returns the vertex buffer bytes the frame used
+static u32 DrawFrame(Setup* st, int frame, int walkall, int* kept, int* until)
+{
+	// aligned like the real one, or the padding after each draw is off
+	u8* buf = (u8*)((((u32)vertexBuf) + frame * FRAME_VERTICES + 0x1F) & ~0x1F);
+
+	vertexPtr = buf;
+	CurFrame = frame;
+	NumDraws[frame] = 0;
+
+	CurPass = 0;
+	RenderBG(st, 0);
+	*kept = PPU_NumHighRuns[0];
+	*until = PPU_HighRunsUntil[0];
+
+	if (walkall) PPU_HighRunsStart[0] = -1;
+	CurPass = 1;
+	RenderBG(st, 0x2000);
+
+	PPU_FlushTileCache();
+	return (u8*)vertexPtr - buf;
+}
+
+static int CheckSetup(Setup* st)
+{
+	int kept, until, dummy;
+	u32 used, drawn;
+	int i, bad = 0;
+
+	PPU.Interlace = st->Interlace;
+
+	FillTilemap(0xA000, st->High);
+	FillTilemap(0xC000, st->High);
+	BuildSections(Sections[0], st->NumSections, st->Lines, (st->Type == TILE_8BPP) ? 0 : 0x4000, 0xA000, st->Planes);
+	PPU.BG[0].Sections = Sections[0];
+
+	if (st->Opt)
+	{
+		// the offsets, random: some valid for BG1, some not
+		for (i = 0; i < 0x800; i += 2) *(u16*)&PPU.VRAM[0xE000 + i] = Host_Rand();
+		for (i = 0; i < 0x800; i += 16) PPU.VRAMUpdateCount[(0xE000 + i) >> 4]++;
+		PPU.VRAMWrites++;
+		BuildSections(Sections[1], 3, (u8[]){0}, 0, 0xE000, 0);
+		for (i = 0; i < 3; i++) Sections[1][i].Size = 0;
+		PPU.BG[2].Sections = Sections[1];
+	}
+
+	used = DrawFrame(st, 0, 0, &kept, &until);
+	DrawFrame(st, 1, 1, &dummy, &dummy);
+
+	// only now, like the GPU
+	if (NumDraws[0] != NumDraws[1])
+	{
+		printf("%s: %d draws, %d walking everything\n", st->Name, NumDraws[0], NumDraws[1]);
+		bad++;
+	}
+	for (i = 0; i < NumDraws[0] && i < NumDraws[1]; i++)
+	{
+		Draw* d = &Draws[0][i];
+		Draw* r = &Draws[1][i];
+
+		if (d->Pass == r->Pass && d->Plane == r->Plane && d->Tex == r->Tex &&
+			d->YStart == r->YStart && d->YEnd == r->YEnd && d->NumVertices == r->NumVertices &&
+			!memcmp(d->Vertices, r->Vertices, d->NumVertices * 3 * sizeof(u16)))
+			continue;
+
+		if (bad++ < 10)
+			printf("%s: draw %d (%s, lines %u-%u, %u vertices%s) differs from walking everything (%s, lines %u-%u, %u vertices%s)\n",
+				st->Name, i,
+				d->Pass ? "high" : "low", d->YStart, d->YEnd, d->NumVertices, d->Plane ? ", plane" : "",
+				r->Pass ? "high" : "low", r->YStart, r->YEnd, r->NumVertices, r->Plane ? ", plane" : "");
+	}
+
+	drawn = 0;
+	for (i = 0; i < NumDraws[0]; i++)
+		drawn += (Draws[0][i].NumVertices * 3 * sizeof(u16) + 0x1F) & ~0x1F;
+	if (drawn != used)
+	{
+		printf("%s: %u vertex bytes used, %u drawn\n", st->Name, used, drawn);
+		bad++;
+	}
+
+	if ((until < YEND) != st->Fills)
+	{
+		printf("%s: the high priority buffers %s\n", st->Name, st->Fills ? "didn't fill up" : "filled up");
+		bad++;
+	}
+
+	printf("%s: %d draws, %d runs kept", st->Name, NumDraws[0], kept);
+	if (until < YEND) printf(", lines %d-%d walked again", until, YEND);
+	printf(", %u vertex bytes\n", used);
+
+	return bad;
+}
+
+int main(int argc, char** argv)
+{
+	u32 i;
+	int bad = 0;
+
+	for (i = 0; i < 0x10000; i++) PPU.VRAM[i] = Host_Rand();
+	for (i = 0; i < 0x1000; i++) PPU.VRAMUpdateCount[i]++;
+	PPU.VRAMWrites++;
+	for (i = 0; i < 256; i++) PPU.Palette[i] = Host_Rand() | 0x0001;
+	for (i = 0; i < 64; i++) PPU.PaletteUpdateCount[i]++;
+	PPU.PaletteUpdateCount128++;
+	PPU.PaletteUpdateCount256++;
+
+	PPU_InitTileCache();
+	vertexBuf = MemAlloc(2 * FRAME_VERTICES + 0x20);
+
+	for (i = 0; i < NUM_SETUPS; i++)
+		bad += CheckSetup(&Setups[i]);
+
+	PPU_DeInitTileCache();
+	MemFree(vertexBuf);
+
+	if (bad)
+	{
+		printf("%d problems\n", bad);
+		return 1;
+	}
+
+	printf("all good\n");
+	return 0;
+}
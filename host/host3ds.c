@@ -0,0 +1,403 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// the ctrulib calls from host/3ds.h, on top of libc and pthreads (Linux)
+// also has MemAlloc()/MemFree() in place of source/mem.c
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <3ds.h>
+
+#include "mem.h"
+#include "hostemu.h"
+
+
+// --- FS ----------------------------------------------------------------------
+
+#define MAX_FILES 16
+
+static FILE* Host_Files[MAX_FILES];
+
+static FILE* GetFile(Handle handle)
+{
+	if (handle < 1 || handle > MAX_FILES) return NULL;
+	return Host_Files[handle - 1];
+}
+
+static FILE* HostOpen(char* path, u32 openflags)
+{
+	FILE* f;
+
+	if (openflags & FS_OPEN_WRITE)
+	{
+		f = fopen(path, "r+b");
+		if (!f && (openflags & FS_OPEN_CREATE))
+			f = fopen(path, "w+b");
+	}
+	else
+		f = fopen(path, "rb");
+
+	return f;
+}
+
+Result FSUSER_OpenFile(Handle* handle, Handle* out, FS_archive archive, FS_path fileLowPath, u32 openflags, u32 attributes)
+{
+	char* path = (char*)fileLowPath.data;
+	FILE* f;
+	u32 i;
+
+	// paths are absolute on the SD card, the current directory stands in for it
+	// real absolute paths work too, if there's nothing in the current directory
+	f = NULL;
+	if (path[0] == '/' && path[1] != '\0')
+		f = HostOpen(path + 1, openflags);
+	if (!f)
+		f = HostOpen(path, openflags);
+
+	if (!f) return -1;
+
+	for (i = 0; i < MAX_FILES; i++)
+	{
+		if (Host_Files[i]) continue;
+
+		Host_Files[i] = f;
+		*out = i + 1;
+		return 0;
+	}
+
+	fclose(f);
+	return -1;
+}
+
+Result FSFILE_Close(Handle handle)
+{
+	FILE* f = GetFile(handle);
+	if (!f) return -1;
+
+	fclose(f);
+	Host_Files[handle - 1] = NULL;
+	return 0;
+}
+
+Result FSFILE_Read(Handle handle, u32 *bytesRead, u64 offset, u32 *buffer, u32 size)
+{
+	FILE* f = GetFile(handle);
+	if (!f) return -1;
+
+	fseek(f, offset, SEEK_SET);
+	*bytesRead = fread(buffer, 1, size, f);
+	return 0;
+}
+
+Result FSFILE_Write(Handle handle, u32 *bytesWritten, u64 offset, u32 *buffer, u32 size, u32 flushFlags)
+{
+	FILE* f = GetFile(handle);
+	if (!f) return -1;
+
+	fseek(f, offset, SEEK_SET);
+	*bytesWritten = fwrite(buffer, 1, size, f);
+	if (flushFlags) fflush(f);
+	return 0;
+}
+
+Result FSFILE_GetSize(Handle handle, u64 *size)
+{
+	FILE* f = GetFile(handle);
+	if (!f) return -1;
+
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	return 0;
+}
+
+Result FSFILE_SetSize(Handle handle, u64 size)
+{
+	FILE* f = GetFile(handle);
+	if (!f) return -1;
+
+	fflush(f);
+	return ftruncate(fileno(f), size) ? -1 : 0;
+}
+
+
+// --- Time --------------------------------------------------------------------
+
+u64 svcGetSystemTick()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	// 268111856 Hz, like the 3DS
+	return ((u64)ts.tv_sec * 268111856ULL) + (((u64)ts.tv_nsec * 268111856ULL) / 1000000000ULL);
+}
+
+u64 osGetTime()
+{
+	// SNES_Reset() seeds the WRAM garbage with this
+	return 1400000000000ULL;
+}
+
+
+// --- Threads -----------------------------------------------------------------
+
+// threads and events share one handle table, numbered after the files
+// events are a flag under a mutex, reset_type 0 clears it when a wait
+// returns (one-shot), anything else leaves it set (sticky)
+
+#define MAX_SYNC 16
+#define SYNC_BASE 0x100
+
+typedef struct
+{
+	int Type;	// 0 = free, 1 = thread, 2 = event
+
+	pthread_t Thread;
+	ThreadFunc Entry;
+	u32 Arg;
+
+	pthread_mutex_t Lock;
+	pthread_cond_t Cond;
+	u8 Signaled;
+	u8 ResetType;
+
+} HostSync;
+
+static HostSync Host_Sync[MAX_SYNC];
+
+static HostSync* GetSync(Handle handle, int type)
+{
+	if (handle < SYNC_BASE || handle >= SYNC_BASE + MAX_SYNC) return NULL;
+
+	HostSync* s = &Host_Sync[handle - SYNC_BASE];
+	if (s->Type != type) return NULL;
+	return s;
+}
+
+static HostSync* NewSync(Handle* handle, int type)
+{
+	int i;
+
+	for (i = 0; i < MAX_SYNC; i++)
+	{
+		if (Host_Sync[i].Type) continue;
+
+		memset(&Host_Sync[i], 0, sizeof(HostSync));
+		Host_Sync[i].Type = type;
+		*handle = SYNC_BASE + i;
+		return &Host_Sync[i];
+	}
+
+	return NULL;
+}
+
+static void* ThreadStart(void* arg)
+{
+	HostSync* s = (HostSync*)arg;
+	s->Entry(s->Arg);
+	return NULL;
+}
+
+// the stack, priority and core are up to the OS here
+Result svcCreateThread(Handle* thread, ThreadFunc entrypoint, u32 arg, u32* stack_top, s32 thread_priority, s32 processor_id)
+{
+	HostSync* s = NewSync(thread, 1);
+	if (!s) return -1;
+
+	s->Entry = entrypoint;
+	s->Arg = arg;
+	if (pthread_create(&s->Thread, NULL, ThreadStart, s))
+	{
+		s->Type = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void svcExitThread()
+{
+	pthread_exit(NULL);
+}
+
+Result svcCreateEvent(Handle* event, u8 reset_type)
+{
+	HostSync* s = NewSync(event, 2);
+	if (!s) return -1;
+
+	pthread_mutex_init(&s->Lock, NULL);
+	pthread_cond_init(&s->Cond, NULL);
+	s->ResetType = reset_type;
+	return 0;
+}
+
+Result svcSignalEvent(Handle handle)
+{
+	HostSync* s = GetSync(handle, 2);
+	if (!s) return -1;
+
+	pthread_mutex_lock(&s->Lock);
+	s->Signaled = 1;
+	pthread_cond_broadcast(&s->Cond);
+	pthread_mutex_unlock(&s->Lock);
+	return 0;
+}
+
+Result svcClearEvent(Handle handle)
+{
+	HostSync* s = GetSync(handle, 2);
+	if (!s) return -1;
+
+	pthread_mutex_lock(&s->Lock);
+	s->Signaled = 0;
+	pthread_mutex_unlock(&s->Lock);
+	return 0;
+}
+
+Result svcWaitSynchronization(Handle handle, s64 nanoseconds)
+{
+	HostSync* s = GetSync(handle, 1);
+	if (s)
+	{
+		// threads can only be waited on till they end
+		pthread_join(s->Thread, NULL);
+		return 0;
+	}
+
+	s = GetSync(handle, 2);
+	if (!s) return -1;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (nanoseconds >= 0 && (u64)nanoseconds != U64_MAX)
+	{
+		ts.tv_sec += nanoseconds / 1000000000LL;
+		ts.tv_nsec += nanoseconds % 1000000000LL;
+		if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+	}
+	else
+		nanoseconds = -1;
+
+	Result res = 0;
+	pthread_mutex_lock(&s->Lock);
+	while (!s->Signaled)
+	{
+		if (nanoseconds < 0)
+			pthread_cond_wait(&s->Cond, &s->Lock);
+		else if (pthread_cond_timedwait(&s->Cond, &s->Lock, &ts))
+		{
+			res = 0x09401BFE; // timeout
+			break;
+		}
+	}
+	if (!res && !s->ResetType) s->Signaled = 0;
+	pthread_mutex_unlock(&s->Lock);
+	return res;
+}
+
+Result svcCloseHandle(Handle handle)
+{
+	HostSync* s = GetSync(handle, 1);
+	if (!s) s = GetSync(handle, 2);
+	if (!s) return -1;
+
+	if (s->Type == 2)
+	{
+		pthread_mutex_destroy(&s->Lock);
+		pthread_cond_destroy(&s->Cond);
+	}
+	s->Type = 0;
+	return 0;
+}
+
+
+// --- Memory ------------------------------------------------------------------
+
+// the memory maps store pointers as u32s, so everything has to be below 4GB
+// the size goes in the first 16 bytes, which also keeps things aligned
+
+void* MemAlloc(u32 size)
+{
+	u8* mem = mmap(NULL, size + 16, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_32BIT, -1, 0);
+	if (mem == MAP_FAILED) return NULL;
+
+	*(u32*)mem = size + 16;
+	return mem + 16;
+}
+
+void MemFree(void* ptr)
+{
+	u8* mem = (u8*)ptr - 16;
+	munmap(mem, *(u32*)mem);
+}
+
+void* linearAlloc(size_t size)
+{
+	return MemAlloc(size);
+}
+
+void linearFree(void* mem)
+{
+	MemFree(mem);
+}
+
+u32 osConvertVirtToPhys(u32 vaddr)
+{
+	return vaddr;
+}
+
+
+// --- Keys --------------------------------------------------------------------
+
+u32 Host_Keys = 0;
+
+u32 hidKeysHeld()
+{
+	return Host_Keys;
+}
+
+
+// --- Tool helpers ------------------------------------------------------------
+
+u32 Host_Hash(u8* data, u32 len)
+{
+	u32 h = 2166136261u;
+	while (len--) h = (h ^ *data++) * 16777619u;
+	return h;
+}
+
+double Host_GetTime()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+u32 Host_RandState = 0x12345678;
+
+u32 Host_Rand()
+{
+	Host_RandState ^= Host_RandState << 13;
+	Host_RandState ^= Host_RandState >> 17;
+	Host_RandState ^= Host_RandState << 5;
+	return Host_RandState;
+}
@@ -0,0 +1,131 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "config.h"
+#include "main.h"
+#include "mem.h"
+#include "snes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "spc700.h"
+#include "dsp.h"
+#include "timing.h"
+#include "hostemu.h"
+
+
+// everything from main.c, ui.c and the parts we don't build
+
+Config_t Config;
+FS_archive sdmcArchive;
+
+bool SkipThisFrame = false;
+bool HideThisFrame = false;
+u8 RenderState = 0;
+u64 WaitTicks = 0;
+
+void bprintf(char* fmt, ...) {}
+void ClearConsole() {}
+void DrawRect(int x1, int x2, int y1, int y2, u32 color) {}
+void FillRect(int x1, int x2, int y1, int y2, u32 color) {}
+void DrawText(int x, int y, u32 color, char* str) {}
+
+void ApplyScaling() {}
+void ContinueRendering() {}
+void FinishRendering() {}
+void RenderTopScreen() {}
+
+void PPU_Init_Hard() {}
+void PPU_DeInit_Hard() {}
+void PPU_RenderScanline_Hard(u32 line) {}
+void PPU_VBlank_Hard() {}
+
+bool Host_Crashed = false;
+
+void ReportCrash()
+{
+	printf("CPU crashed, PC=%02X:%04X\n", CPU_Regs.PBR, CPU_Regs.PC);
+	Host_Crashed = true;
+}
+
+void SPC_ReportUnk(u8 op, u32 pc)
+{
+	printf("SPC: unknown opcode %02X at %04X\n", op, pc);
+	Host_Crashed = true;
+}
+
+
+// the DSP, just the registers
+
+u8 DSP_MEM[0x100];
+bool DSP_Muted = false;
+
+void DspReset()
+{
+	memset(DSP_MEM, 0, sizeof(DSP_MEM));
+	DSP_MEM[0x6C] = 0x60;
+}
+
+void DspWriteByte(u8 val, u8 address)
+{
+	if (address > 0x7F) return;
+	DSP_MEM[address] = (address == 0x7C) ? 0 : val;
+}
+
+void DSP_BufferSwap() {}
+
+
+void Host_Init()
+{
+	Config.HardwareRenderer = 0;
+
+	SNES_Init();
+	PPU_Init();
+}
+
+bool Host_LoadROM(char* path, bool render)
+{
+	if (ROM_Buffer) MemFree(ROM_Buffer);
+	ROM_Buffer = NULL;
+
+	if (!SNES_LoadROM(path))
+		return false;
+
+	CPU_Reset();
+	SPC_Reset();
+
+	// nothing clears these on a reset, don't let the last ROM show through
+	memset(PPU.MainBuffer, 0, 256*512*2);
+
+	Host_Crashed = false;
+	SkipThisFrame = !render;
+	return true;
+}
+
+void Host_RunFrame()
+{
+	Timing_Begin(TIMING_CPU);
+	CPU_MainLoop();
+	Timing_End(TIMING_CPU);
+	Timing_Counts[COUNT_IDLECYCLES] = CPU_IdleCycles;
+	Timing_EndFrame(SkipThisFrame);
+}
+
@@ -0,0 +1,45 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef _HOSTEMU_H_
+#define _HOSTEMU_H_
+
+// the emulator minus main.c, for the headless tools
+// stands in for main.c, ui.c, the hardware renderer and the DSP
+//
+// the DSP isn't emulated, only its registers are kept (no mixing, ENDX
+// never gets set). like on the 3DS, SRAM goes to a .srm file next to the ROM
+
+extern bool Host_Crashed;
+
+void Host_Init();
+
+// rendering off = skip every frame, like frameskip does
+bool Host_LoadROM(char* path, bool render);
+void Host_RunFrame();
+
+// these three are in host3ds.c, so the tools that don't run the whole
+// emulator can use them too
+u32 Host_Hash(u8* data, u32 len);
+double Host_GetTime();
+
+// xorshift, the same sequence every run unless Host_RandState is changed
+extern u32 Host_RandState;
+u32 Host_Rand();
+
+#endif
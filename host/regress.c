@@ -0,0 +1,354 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// golden-frame regression runner
+// replays recorded input on a set of ROMs, hashes the screen buffers
+// (PPU.MainBuffer/SubBuffer) and WRAM after every frame, and compares them
+// with the stored hashes. reports the first frame that's different, and how
+// long each ROM took so slowdowns show up too
+//
+// build (from the repo root):
+//   gcc -O2 -no-pie -pthread -Ihost -Isource -o regress host/regress.c host/hostemu.c host/host3ds.c source/cpu_c.c source/spc700_c.c source/spc700io.c source/snes.c source/rom.c source/dma.c source/ppu.c source/ppu_soft.c source/timing.c
+//
+// usage:
+//   regress suite.txt            check everything against the golden files
+//   regress -update suite.txt    (re)write the golden files
+//
+// suite file, one ROM per line, paths relative to the suite file:
+//   rom.sfc  input.txt  golden.txt
+//
+// input file, one line per stretch of frames with the same keys held:
+//   <frames> <keys...>     keys: A B X Y L R START SELECT UP DOWN LEFT RIGHT, or - for none
+// the number of frames run is the total of the input file
+//
+// golden file, one line per frame: frame number, screen hash, WRAM hash
+//
+// lines starting with # are comments. the exit code is 1 if anything failed
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "snes.h"
+#include "ppu.h"
+#include "hostemu.h"
+
+
+typedef struct
+{
+	u32 Frames;
+	u32 Keys;
+
+} InputEntry;
+
+typedef struct
+{
+	u32 Screen;
+	u32 WRAM;
+
+} FrameHash;
+
+struct
+{
+	char* Name;
+	u32 Key;
+
+} KeyNames[] =
+{
+	{"A", KEY_A}, {"B", KEY_B}, {"X", KEY_X}, {"Y", KEY_Y},
+	{"L", KEY_L}, {"R", KEY_R}, {"START", KEY_START}, {"SELECT", KEY_SELECT},
+	{"UP", KEY_UP}, {"DOWN", KEY_DOWN}, {"LEFT", KEY_LEFT}, {"RIGHT", KEY_RIGHT},
+	{"-", 0},
+};
+
+#define NUM_KEYNAMES (sizeof(KeyNames) / sizeof(KeyNames[0]))
+
+
+// relative paths in the suite are relative to the suite file
+static void MakePath(char* dst, char* dir, char* path)
+{
+	if (path[0] == '/') strcpy(dst, path);
+	else sprintf(dst, "%s%s", dir, path);
+}
+
+static bool IsComment(char* line)
+{
+	while (*line == ' ' || *line == '\t') line++;
+	return *line == '#' || *line == '\n' || *line == '\r' || *line == '\0';
+}
+
+// returns the number of entries, or -1
+static int LoadInput(char* path, InputEntry** out)
+{
+	FILE* f = fopen(path, "r");
+	char line[256];
+	int num = 0, max = 64;
+	u32 i;
+
+	if (!f) return -1;
+
+	InputEntry* entries = (InputEntry*)malloc(max * sizeof(InputEntry));
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (IsComment(line)) continue;
+
+		char* tok = strtok(line, " \t\r\n");
+		InputEntry* e = &entries[num];
+		e->Frames = strtoul(tok, NULL, 0);
+		e->Keys = 0;
+
+		while ((tok = strtok(NULL, " \t\r\n")))
+		{
+			for (i = 0; i < NUM_KEYNAMES; i++)
+			{
+				if (!strcmp(tok, KeyNames[i].Name)) break;
+			}
+			if (i == NUM_KEYNAMES)
+			{
+				printf("%s: unknown key %s\n", path, tok);
+				fclose(f);
+				free(entries);
+				return -1;
+			}
+
+			e->Keys |= KeyNames[i].Key;
+		}
+
+		if (++num == max)
+		{
+			max <<= 1;
+			entries = (InputEntry*)realloc(entries, max * sizeof(InputEntry));
+		}
+	}
+
+	fclose(f);
+	*out = entries;
+	return num;
+}
+
+// returns the number of frames, or -1
+static int LoadGolden(char* path, FrameHash* hashes, u32 maxframes)
+{
+	FILE* f = fopen(path, "r");
+	char line[256];
+	u32 frame, screen, wram;
+	int num = 0;
+
+	if (!f) return -1;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (IsComment(line)) continue;
+		if (sscanf(line, "%u %x %x", &frame, &screen, &wram) != 3) continue;
+		if (frame >= maxframes) continue;
+
+		hashes[frame].Screen = screen;
+		hashes[frame].WRAM = wram;
+		if (frame >= num) num = frame + 1;
+	}
+
+	fclose(f);
+	return num;
+}
+
+static bool SaveGolden(char* path, char* rom, FrameHash* hashes, u32 nframes)
+{
+	FILE* f = fopen(path, "w");
+	u32 i;
+
+	if (!f) return false;
+
+	fprintf(f, "# %s\n# frame screen wram\n", rom);
+	for (i = 0; i < nframes; i++)
+		fprintf(f, "%u %08X %08X\n", i, hashes[i].Screen, hashes[i].WRAM);
+
+	fclose(f);
+	return true;
+}
+
+
+// runs one ROM, returns true if it passed
+static bool RunTest(char* dir, char* rompath, char* inputpath, char* goldenpath, bool update)
+{
+	char path[1024];
+	InputEntry* input;
+	FrameHash* hashes;
+	FrameHash* golden = NULL;
+	u32 nframes = 0, ngolden = 0;
+	u32 i, e, left;
+	int firstbad = -1;
+	bool ok = true;
+
+	MakePath(path, dir, inputpath);
+	int ninput = LoadInput(path, &input);
+	if (ninput < 0)
+	{
+		printf("%s: can't load input %s\n", rompath, path);
+		return false;
+	}
+
+	for (e = 0; e < ninput; e++)
+		nframes += input[e].Frames;
+
+	hashes = (FrameHash*)calloc(nframes + 1, sizeof(FrameHash));
+
+	if (!update)
+	{
+		golden = (FrameHash*)calloc(nframes + 1, sizeof(FrameHash));
+		MakePath(path, dir, goldenpath);
+		int n = LoadGolden(path, golden, nframes);
+		if (n < 0)
+		{
+			printf("%s: can't load golden hashes %s\n", rompath, path);
+			free(input); free(hashes); free(golden);
+			return false;
+		}
+		ngolden = n;
+	}
+
+	MakePath(path, dir, rompath);
+	if (!Host_LoadROM(path, true))
+	{
+		printf("%s: can't load the ROM\n", rompath);
+		free(input); free(hashes); free(golden);
+		return false;
+	}
+
+	double t = Host_GetTime();
+
+	e = 0;
+	left = ninput ? input[0].Frames : 0;
+	for (i = 0; i < nframes && !Host_Crashed; i++)
+	{
+		while (!left) left = input[++e].Frames;
+		Host_Keys = input[e].Keys;
+		left--;
+
+		Host_RunFrame();
+
+		hashes[i].Screen = Host_Hash((u8*)PPU.MainBuffer, 256*512*2);
+		hashes[i].WRAM = Host_Hash(SNES_SysRAM, 0x20000);
+
+		if (golden && firstbad < 0 && i < ngolden &&
+			(hashes[i].Screen != golden[i].Screen || hashes[i].WRAM != golden[i].WRAM))
+			firstbad = i;
+	}
+
+	t = Host_GetTime() - t;
+	Host_Keys = 0;
+
+	if (Host_Crashed)
+	{
+		printf("%s: FAIL, crashed at frame %u", rompath, i - 1);
+		ok = false;
+	}
+	else if (update)
+	{
+		MakePath(path, dir, goldenpath);
+		if (!SaveGolden(path, rompath, hashes, nframes))
+		{
+			printf("%s: can't write %s\n", rompath, path);
+			ok = false;
+		}
+		else
+			printf("%s: wrote %u frames", rompath, nframes);
+	}
+	else if (firstbad >= 0)
+	{
+		bool screen = hashes[firstbad].Screen != golden[firstbad].Screen;
+		bool wram = hashes[firstbad].WRAM != golden[firstbad].WRAM;
+		printf("%s: FAIL, frame %d differs (%s)", rompath, firstbad,
+			(screen && wram) ? "screen and WRAM" : (screen ? "screen" : "WRAM"));
+		ok = false;
+	}
+	else if (ngolden < nframes)
+	{
+		printf("%s: FAIL, only %u of %u frames in the golden file", rompath, ngolden, nframes);
+		ok = false;
+	}
+	else
+		printf("%s: ok, %u frames", rompath, nframes);
+
+	printf(", %.3f s (%.1f fps)\n", t, i / t);
+
+	free(input);
+	free(hashes);
+	free(golden);
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	bool update = false;
+	char* suitepath = NULL;
+	char dir[1024];
+	char line[1024];
+	char rom[256], input[256], golden[256];
+	int i, ntests = 0, nfailed = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-update")) update = true;
+		else suitepath = argv[i];
+	}
+	if (!suitepath)
+	{
+		printf("usage: regress [-update] suite.txt\n");
+		return 1;
+	}
+
+	FILE* f = fopen(suitepath, "r");
+	if (!f)
+	{
+		printf("can't open %s\n", suitepath);
+		return 1;
+	}
+
+	strncpy(dir, suitepath, sizeof(dir) - 1);
+	dir[sizeof(dir) - 1] = '\0';
+	char* slash = strrchr(dir, '/');
+	if (slash) slash[1] = '\0';
+	else dir[0] = '\0';
+
+	Host_Init();
+
+	double t = Host_GetTime();
+
+	while (fgets(line, sizeof(line), f))
+	{
+		if (IsComment(line)) continue;
+		if (sscanf(line, "%255s %255s %255s", rom, input, golden) != 3)
+		{
+			printf("bad line in suite: %s", line);
+			nfailed++;
+			continue;
+		}
+
+		ntests++;
+		if (!RunTest(dir, rom, input, golden, update))
+			nfailed++;
+	}
+
+	fclose(f);
+	t = Host_GetTime() - t;
+
+	printf("%d ROMs, %d failed, %.3f s total\n", ntests, nfailed, t);
+	return nfailed ? 1 : 0;
+}
@@ -0,0 +1,207 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// rewind benchmark, runs the savestate + rewind code (savestate.c, rewind.c) on a PC
+// plays a ROM through the headless emulator (hostemu.c), measures how big and
+// how slow the snapshots are, then rewinds as far back as the ring goes and
+// checks every snapshot comes back right
+//
+// build (from the repo root):
+//   gcc -O2 -no-pie -pthread -Ihost -Isource -o rewindbench host/rewindbench.c host/hostemu.c host/host3ds.c source/cpu_c.c source/spc700_c.c source/spc700io.c source/snes.c source/rom.c source/dma.c source/ppu.c source/ppu_soft.c source/timing.c source/savestate.c source/rewind.c
+//
+// usage:
+//   rewindbench [-n frames] rom.sfc              replays the built-in input recording
+//   rewindbench rom.sfc state1.sst ...           uses savestates as the frames instead
+//
+// the built-in recording is a side scroller's worth of pad input (walking,
+// running, jumping), fed to the game through Host_Keys. with the default
+// 3600 frames most games fill the ring, the history figure is only an
+// estimate when they don't
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "snes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "spc700.h"
+#include "dsp.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "hostemu.h"
+
+
+// the DSP state savestate.c syncs, hostemu.c only keeps the registers
+
+u16 DSP_WriteBuffer[2][32*128];
+s16 DSP_NoiseSample;
+s16 DSP_NoiseSamples[17];
+u16 DSP_NoiseStep;
+DspChannel channels[8];
+s8 firFilter[16];
+u32 echoBase, echoDelay;
+u16 dspPreamp = 0x100, echoRemain, firOffset;
+
+
+// the recording: (keys, frames held)
+u32 Recording[][2] =
+{
+	{0, 60}, {KEY_RIGHT, 90}, {KEY_RIGHT|KEY_B, 20}, {KEY_RIGHT, 40}, {KEY_RIGHT|KEY_Y, 120},
+	{KEY_RIGHT|KEY_Y|KEY_B, 24}, {KEY_RIGHT|KEY_Y, 60}, {0, 30}, {KEY_LEFT, 45}, {KEY_LEFT|KEY_B, 20},
+	{0, 15}, {KEY_START, 2}, {0, 30}, {KEY_START, 2}, {KEY_RIGHT|KEY_Y, 200}, {KEY_RIGHT|KEY_Y|KEY_B, 30},
+	{KEY_RIGHT, 80}, {0, 40}, {KEY_A, 10}, {0, 20}, {KEY_RIGHT|KEY_Y, 150},
+};
+
+// the DSP isn't in the snapshots
+u32 HashMachine()
+{
+	return Host_Hash(SNES_SysRAM, 0x20000) ^ Host_Hash(PPU.VRAM, 0x10000) ^ Host_Hash(SPC_RAM, 0x10000)
+		^ Host_Hash(PPU.OAM, 0x220) ^ CPU_Regs.PC ^ (SPC_Regs.PC << 16);
+}
+
+int main(int argc, char** argv)
+{
+	int nframes = 3600;
+	int nfiles = 0;
+	char* rompath = NULL;
+	char** files = NULL;
+	int i;
+	u32* hashes;
+	double t, tsnap = 0, tstep = 0;
+	u64 totalbytes = 0;
+	u32 nsnaps = 0, maxbytes = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-n") && i+1 < argc) nframes = atoi(argv[++i]);
+		else if (!rompath) rompath = argv[i];
+		else
+		{
+			files = &argv[i];
+			nfiles = argc - i;
+			break;
+		}
+	}
+
+	if (!rompath)
+	{
+		printf("usage: rewindbench [-n frames] rom.sfc [state1.sst ...]\n");
+		return 1;
+	}
+	if (nfiles) nframes = nfiles;
+	if (nframes < 2) nframes = 2;
+
+	Host_Init();
+	if (!Host_LoadROM(rompath, false))
+	{
+		printf("can't load %s\n", rompath);
+		return 1;
+	}
+
+	Rewind_Interval = 1;
+	Rewind_Enabled = true;
+	if (!Rewind_Init())
+	{
+		printf("out of memory\n");
+		return 1;
+	}
+
+	hashes = (u32*)malloc(nframes * sizeof(u32));
+
+	for (i = 0; i < nframes; i++)
+	{
+		if (nfiles)
+		{
+			if (!State_Load(files[i]))
+			{
+				printf("can't load %s\n", files[i]);
+				return 1;
+			}
+		}
+		else
+		{
+			u32 n = sizeof(Recording) / sizeof(Recording[0]);
+			u32 pos = i, r = 0;
+			while (pos >= Recording[r][1]) { pos -= Recording[r][1]; r = (r + 1) % n; }
+			Host_Keys = Recording[r][0];
+			Host_RunFrame();
+			if (Host_Crashed)
+			{
+				printf("crashed at frame %d\n", i);
+				return 1;
+			}
+		}
+
+		hashes[i] = HashMachine();
+
+		t = Host_GetTime();
+		Rewind_Frame();
+		t = Host_GetTime() - t;
+
+		// the first one is the full snapshot
+		if (i == 0) continue;
+		tsnap += t;
+		totalbytes += Rewind_LastSize;
+		if (Rewind_LastSize > maxbytes) maxbytes = Rewind_LastSize;
+		nsnaps++;
+	}
+	Host_Keys = 0;
+
+	u32 kept = Rewind_NumSnapshots;
+	u32 statesize = State_MaxSize();
+	double avg = (double)totalbytes / nsnaps;
+
+	printf("%u snapshots, full state is %u bytes\n", nsnaps, statesize);
+	printf("delta: %.0f bytes/snapshot avg, %u max (%.2f%% of a full state)\n",
+		avg, maxbytes, 100.0 * avg / statesize);
+	printf("capture: %.1f us/snapshot\n", tsnap * 1000000.0 / nsnaps);
+
+	// only a ring that had to drop snapshots tells how many it really holds
+	if (kept < nsnaps)
+		printf("%u snapshots fit in %u KB (%.1f s of history at one snapshot per frame)\n",
+			kept, REWIND_BUFFER_SIZE >> 10, kept / 60.0);
+	else
+		printf("the ring never filled, estimate: %.0f snapshots fit in %u KB (%.1f s of history at one snapshot per frame)\n",
+			REWIND_BUFFER_SIZE / avg, REWIND_BUFFER_SIZE >> 10, REWIND_BUFFER_SIZE / avg / 60.0);
+
+	// go back as far as the ring goes, checking every step
+	int bad = 0;
+	for (i = nframes - 1; i >= 0; i--)
+	{
+		t = Host_GetTime();
+		bool ok = Rewind_Step();
+		tstep += Host_GetTime() - t;
+
+		if (!ok) break;
+		if (HashMachine() != hashes[i])
+		{
+			printf("snapshot for frame %d came back wrong\n", i);
+			bad++;
+		}
+	}
+	u32 nsteps = nframes - 1 - i;
+
+	printf("rewind: %u steps, %.1f us/step, %s\n", nsteps, tstep * 1000000.0 / nsteps,
+		bad ? "MISMATCH" : "all good");
+
+	free(hashes);
+	Rewind_DeInit();
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,340 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// tile decoder benchmark, the soft renderer's row decoders and PPU_RenderRow_*
+// against the old bit-by-bit versions (kept here as the reference)
+// checks that both give the same pixels for every flip/start/end, then
+// measures pixels/second on random tiles (about a quarter of the pixels transparent)
+// "new" decodes every time, "cached" only draws rows that were decoded already
+// (what the tile cache gives when VRAM doesn't change)
+//
+// build (from the repo root):
+//   gcc -O2 -no-pie -pthread -Ihost -Isource -o tilebench host/tilebench.c host/host3ds.c source/ppu_soft.c
+//
+// usage: tilebench [millions of tiles]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "snes.h"
+#include "ppu.h"
+#include "hostemu.h"
+
+
+// what ppu_soft.c talks to, besides host3ds.c
+
+PPUState PPU;
+
+void bprintf(char* fmt, ...) {}
+
+void PPU_ComputeWindows(PPU_WindowSegment* s) {}
+void PPU_ClearSectionLog() {}
+void* PPU_AddSection(u32 size) { return NULL; }
+
+
+// the old decoders
+
+void Old_RenderTile_2bpp(u16 curtile, u16 tilepixels, u16* buffer, u16* pal, u32 alpha, int start, int end)
+{
+	u32 idx, colorval;
+
+	if (curtile & 0x4000)
+	{
+		tilepixels >>= start;
+
+		for (idx = 0; idx < end; idx++)
+		{
+			colorval = 0;
+			if (tilepixels & 0x0001) colorval |= 0x01;
+			if (tilepixels & 0x0100) colorval |= 0x02;
+			tilepixels >>= 1;
+
+			if (colorval)
+				buffer[idx] = pal[colorval] | alpha;
+		}
+	}
+	else
+	{
+		tilepixels <<= start;
+
+		for (idx = 0; idx < end; idx++)
+		{
+			colorval = 0;
+			if (tilepixels & 0x0080) colorval |= 0x01;
+			if (tilepixels & 0x8000) colorval |= 0x02;
+			tilepixels <<= 1;
+
+			if (colorval)
+				buffer[idx] = pal[colorval] | alpha;
+		}
+	}
+}
+
+void Old_RenderTile_4bpp(u16 curtile, u32 tilepixels, u16* buffer, u16* pal, u32 alpha, int start, int end)
+{
+	u32 idx, colorval;
+
+	if (curtile & 0x4000)
+	{
+		tilepixels >>= start;
+
+		for (idx = 0; idx < end; idx++)
+		{
+			colorval = 0;
+			if (tilepixels & 0x00000001) colorval |= 0x01;
+			if (tilepixels & 0x00000100) colorval |= 0x02;
+			if (tilepixels & 0x00010000) colorval |= 0x04;
+			if (tilepixels & 0x01000000) colorval |= 0x08;
+			tilepixels >>= 1;
+
+			if (colorval)
+				buffer[idx] = pal[colorval] | alpha;
+		}
+	}
+	else
+	{
+		tilepixels <<= start;
+
+		for (idx = 0; idx < end; idx++)
+		{
+			colorval = 0;
+			if (tilepixels & 0x00000080) colorval |= 0x01;
+			if (tilepixels & 0x00008000) colorval |= 0x02;
+			if (tilepixels & 0x00800000) colorval |= 0x04;
+			if (tilepixels & 0x80000000) colorval |= 0x08;
+			tilepixels <<= 1;
+
+			if (colorval)
+				buffer[idx] = pal[colorval] | alpha;
+		}
+	}
+}
+
+void Old_RenderTile_8bpp(u16 curtile, u32 tilepixels1, u32 tilepixels2, u16* buffer, u16* pal, u32 alpha, int start, int end)
+{
+	u32 idx, colorval;
+
+	if (curtile & 0x4000)
+	{
+		tilepixels1 >>= start;
+		tilepixels2 >>= start;
+
+		for (idx = 0; idx < end; idx++)
+		{
+			colorval = 0;
+			if (tilepixels1 & 0x00000001) colorval |= 0x01;
+			if (tilepixels1 & 0x00000100) colorval |= 0x02;
+			if (tilepixels1 & 0x00010000) colorval |= 0x04;
+			if (tilepixels1 & 0x01000000) colorval |= 0x08;
+			if (tilepixels2 & 0x00000001) colorval |= 0x10;
+			if (tilepixels2 & 0x00000100) colorval |= 0x20;
+			if (tilepixels2 & 0x00010000) colorval |= 0x40;
+			if (tilepixels2 & 0x01000000) colorval |= 0x80;
+			tilepixels1 >>= 1;
+			tilepixels2 >>= 1;
+
+			if (colorval)
+				buffer[idx] = pal[colorval] | alpha;
+		}
+	}
+	else
+	{
+		tilepixels1 <<= start;
+		tilepixels2 <<= start;
+
+		for (idx = 0; idx < end; idx++)
+		{
+			colorval = 0;
+			if (tilepixels1 & 0x00000080) colorval |= 0x01;
+			if (tilepixels1 & 0x00008000) colorval |= 0x02;
+			if (tilepixels1 & 0x00800000) colorval |= 0x04;
+			if (tilepixels1 & 0x80000000) colorval |= 0x08;
+			if (tilepixels2 & 0x00000080) colorval |= 0x10;
+			if (tilepixels2 & 0x00008000) colorval |= 0x20;
+			if (tilepixels2 & 0x00800000) colorval |= 0x40;
+			if (tilepixels2 & 0x80000000) colorval |= 0x80;
+			tilepixels1 <<= 1;
+			tilepixels2 <<= 1;
+
+			if (colorval)
+				buffer[idx] = pal[colorval] | alpha;
+		}
+	}
+}
+
+void Old_RenderTile_OBJ(u16 attrib, u32 tilepixels, u16* buffer, u16 paloffset_prio)
+{
+	if (!tilepixels) return;
+	u32 idx, colorval;
+
+	if (attrib & 0x4000)
+	{
+		for (idx = 0; idx < 8; idx++)
+		{
+			colorval = 0;
+			if (tilepixels & 0x00000001) colorval |= 0x01;
+			if (tilepixels & 0x00000100) colorval |= 0x02;
+			if (tilepixels & 0x00010000) colorval |= 0x04;
+			if (tilepixels & 0x01000000) colorval |= 0x08;
+			tilepixels >>= 1;
+
+			if (colorval)
+				buffer[idx] = colorval | paloffset_prio;
+		}
+	}
+	else
+	{
+		for (idx = 0; idx < 8; idx++)
+		{
+			colorval = 0;
+			if (tilepixels & 0x00000080) colorval |= 0x01;
+			if (tilepixels & 0x00008000) colorval |= 0x02;
+			if (tilepixels & 0x00800000) colorval |= 0x04;
+			if (tilepixels & 0x80000000) colorval |= 0x08;
+			tilepixels <<= 1;
+
+			if (colorval)
+				buffer[idx] = colorval | paloffset_prio;
+		}
+	}
+}
+
+
+// a tile row where about a quarter of the pixels are transparent
+u32 RandTileRow()
+{
+	u32 val = Host_Rand();
+	u32 holes = Host_Rand() & Host_Rand() & 0xFF;
+	return val & ~(holes * 0x01010101);
+}
+
+
+#define NUM_TILES 4096
+
+u32 Tiles1[NUM_TILES], Tiles2[NUM_TILES];
+u32 Rows2[NUM_TILES], Rows4[NUM_TILES], Rows8[NUM_TILES][2];
+u16 Attribs[NUM_TILES];
+u16 Pal[256];
+u16 Buffer[NUM_TILES * 8 + 8];
+u32 LineBuffer[NUM_TILES * 8 + 8];	// color and depth, what PPU_RenderRow_16/256 draw to
+
+static int CompareLine(u16* buf, u32* linebuf)
+{
+	int i;
+	for (i = 0; i < 8; i++)
+		if (buf[i] != (u16)linebuf[i]) return 1;
+	return 0;
+}
+
+// returns 0 if everything matches
+int Check()
+{
+	u16 bufold[8], bufnew[8];
+	u32 linebuf[8];
+	u32 rows[2];
+	int i, start, end, bad = 0;
+
+	for (i = 0; i < 2000; i++)
+	{
+		u32 t1 = RandTileRow(), t2 = RandTileRow();
+		u16 attrib = Host_Rand() & 0xFFFF;
+
+		for (start = 0; start < 8; start++)
+		{
+			for (end = 1; end <= 8 - start; end++)
+			{
+				memset(bufold, 0, 16); memset(linebuf, 0, 32);
+				Old_RenderTile_2bpp(attrib, t1, bufold, Pal, 0x8000, start, end);
+				PPU_RenderRow_16(attrib, PPU_DecodeRow_2bpp(t1 & 0xFFFF), linebuf, Pal, 0x8000, start, end);
+				if (CompareLine(bufold, linebuf)) bad++;
+
+				memset(bufold, 0, 16); memset(linebuf, 0, 32);
+				Old_RenderTile_4bpp(attrib, t1, bufold, Pal, 0x8000, start, end);
+				PPU_RenderRow_16(attrib, PPU_DecodeRow_4bpp(t1), linebuf, Pal, 0x8000, start, end);
+				if (CompareLine(bufold, linebuf)) bad++;
+
+				memset(bufold, 0, 16); memset(linebuf, 0, 32);
+				Old_RenderTile_8bpp(attrib, t1, t2, bufold, Pal, 0x8000, start, end);
+				rows[0] = PPU_DecodeRow_4bpp(t1); rows[1] = PPU_DecodeRow_4bpp(t2);
+				PPU_RenderRow_256(attrib, rows, linebuf, Pal, 0x8000, start, end);
+				if (CompareLine(bufold, linebuf)) bad++;
+			}
+		}
+
+		memset(bufold, 0, 16); memset(bufnew, 0, 16);
+		Old_RenderTile_OBJ(attrib, t1, bufold, 0x3070);
+		PPU_RenderRow_OBJ(attrib, PPU_DecodeRow_4bpp(t1), bufnew, 0x3070);
+		if (memcmp(bufold, bufnew, 16)) bad++;
+	}
+
+	return bad;
+}
+
+#define BENCH(name, call) \
+	{ \
+		double t = Host_GetTime(); \
+		for (n = 0; n < passes; n++) \
+			for (i = 0; i < NUM_TILES; i++) \
+				call; \
+		t = Host_GetTime() - t; \
+		printf("%-12s %8.1f Mpixels/s\n", name, (double)passes * NUM_TILES * 8 / t / 1000000.0); \
+	}
+
+int main(int argc, char** argv)
+{
+	int passes = 4000000 / NUM_TILES;
+	int i, n;
+
+	if (argc > 1) passes = (int)(atof(argv[1]) * 1000000 / NUM_TILES);
+	if (passes < 1) passes = 1;
+
+	PPU_Init_Soft();
+
+	for (i = 0; i < 256; i++) Pal[i] = Host_Rand() & 0x7FFF;
+	for (i = 0; i < NUM_TILES; i++)
+	{
+		Tiles1[i] = RandTileRow();
+		Tiles2[i] = RandTileRow();
+		Attribs[i] = Host_Rand() & 0xFFFF;
+
+		Rows2[i] = PPU_DecodeRow_2bpp(Tiles1[i] & 0xFFFF);
+		Rows4[i] = PPU_DecodeRow_4bpp(Tiles1[i]);
+		Rows8[i][0] = Rows4[i];
+		Rows8[i][1] = PPU_DecodeRow_4bpp(Tiles2[i]);
+	}
+
+	int bad = Check();
+	printf("check: %s\n", bad ? "MISMATCH" : "all good");
+
+	printf("%d tiles, full rows\n", passes * NUM_TILES);
+	BENCH("2bpp old", Old_RenderTile_2bpp(Attribs[i], Tiles1[i], &Buffer[i << 3], Pal, 0, 0, 8))
+	BENCH("2bpp new", PPU_RenderRow_16(Attribs[i], PPU_DecodeRow_2bpp(Tiles1[i] & 0xFFFF), &LineBuffer[i << 3], Pal, (n+1) << 16, 0, 8))
+	BENCH("2bpp cached", PPU_RenderRow_16(Attribs[i], Rows2[i], &LineBuffer[i << 3], Pal, (n+1) << 16, 0, 8))
+	BENCH("4bpp old", Old_RenderTile_4bpp(Attribs[i], Tiles1[i], &Buffer[i << 3], Pal, 0, 0, 8))
+	BENCH("4bpp new", PPU_RenderRow_16(Attribs[i], PPU_DecodeRow_4bpp(Tiles1[i]), &LineBuffer[i << 3], Pal, (n+1) << 16, 0, 8))
+	BENCH("4bpp cached", PPU_RenderRow_16(Attribs[i], Rows4[i], &LineBuffer[i << 3], Pal, (n+1) << 16, 0, 8))
+	BENCH("8bpp old", Old_RenderTile_8bpp(Attribs[i], Tiles1[i], Tiles2[i], &Buffer[i << 3], Pal, 0, 0, 8))
+	BENCH("8bpp cached", PPU_RenderRow_256(Attribs[i], Rows8[i], &LineBuffer[i << 3], Pal, (n+1) << 16, 0, 8))
+	BENCH("OBJ old", Old_RenderTile_OBJ(Attribs[i], Tiles1[i], &Buffer[i << 3], 0x3070))
+	BENCH("OBJ new", PPU_RenderRow_OBJ(Attribs[i], PPU_DecodeRow_4bpp(Tiles1[i]), &Buffer[i << 3], 0x3070))
+	BENCH("OBJ cached", PPU_RenderRow_OBJ(Attribs[i], Rows4[i], &Buffer[i << 3], 0x3070))
+
+	return bad ? 1 : 0;
+}
@@ -0,0 +1,341 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// tile cache benchmark, replays the hard renderer's tile lookups through
+// the real cache (PPU_StoreTileInCache() in ppu_tilecache.c, CLOCK
+// replacement) and through a model of the old one (FIFO replacement, which
+// isn't in the tree anymore), and compares the miss rates
+//
+// the trace doesn't say what type each tile was, so they're all replayed as
+// 2bpp tiles with the same key. the type doesn't matter to the bookkeeping:
+// the VRAM and palette stamps the cache reads get bumped whenever the ones
+// in the trace change, and the tile's VRAM is made empty or not to match
+//
+// the trace comes from a build with TILECACHE_TRACE (see the Makefile), which
+// writes /blargSnesTiles.bin to the SD. without one, a made-up trace is used:
+// a status bar that's always there over two layers scrolling back and forth
+// across a wide level, with some animated tiles and some empty ones, and more
+// tiles overall than the cache can hold
+//
+// build (from the repo root):
+//   gcc -O2 -Ihost -Isource -o tilecachebench host/tilecachebench.c host/host3ds.c source/ppu_tilecache.c
+//
+// usage: tilecachebench [trace.bin]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "snes.h"
+#include "ppu.h"
+#include "timing.h"
+
+
+// what ppu_tilecache.c talks to, besides host3ds.c
+
+PPUState PPU;
+u32 Timing_Counts[COUNT_NUM];
+
+void bprintf(char* fmt, ...) {}
+
+
+// the old cache: same as PPU_StoreTileInCache(), minus the decoding, with the
+// FIFO replacement it had before
+
+#define SLOTS 16384
+
+typedef struct
+{
+	u32 Index;
+
+	u16 List[0x20000];	// key -> slot, 0x8000 = not there, 0xC000 = empty
+	u32 Reverse[SLOTS];	// slot -> key
+	u32 VRAMUpdate[0x20000];
+	u32 PalUpdate[0x20000];
+
+	u32 Hits, Empty, Recolors, Misses, Decodes, Evictions;
+
+} Cache;
+
+static void Cache_Init(Cache* c)
+{
+	int i;
+
+	memset(c, 0, sizeof(Cache));
+	for (i = 0; i < 0x20000; i++) c->List[i] = 0x8000;
+	for (i = 0; i < SLOTS; i++) c->Reverse[i] = 0x80000000;
+}
+
+static void Cache_Lookup(Cache* c, u32 key, u32 vramdirty, u32 paldirty, int empty)
+{
+	u32 coord = c->List[key];
+	u32 tileidx = 0;
+	int isnew = 0;
+
+	if (coord != 0x8000)
+	{
+		// a palette change alone only means recoloring the tile
+		if (vramdirty == c->VRAMUpdate[key])
+		{
+			if (coord == 0xC000)
+				c->Empty++;
+			else
+			{
+				if (paldirty == c->PalUpdate[key]) c->Hits++;
+				else c->Recolors++;
+			}
+			c->PalUpdate[key] = paldirty;
+			return;
+		}
+
+		if (coord == 0xC000)
+			isnew = 1;
+		else
+			tileidx = coord;
+	}
+	else
+		isnew = 1;
+
+	c->Misses++;
+	c->VRAMUpdate[key] = vramdirty;
+	c->PalUpdate[key] = paldirty;
+
+	if (empty)
+	{
+		c->List[key] = 0xC000;
+		if (!isnew)
+		{
+			u32 oldkey = c->Reverse[tileidx];
+			c->Reverse[tileidx] = 0x80000000;
+
+			// it forgot that the tile is empty here
+			if (oldkey != 0x80000000)
+				c->List[oldkey] = 0x8000;
+		}
+		return;
+	}
+
+	if (isnew)
+	{
+		tileidx = c->Index;
+		c->Index = (c->Index + 1) & (SLOTS-1);
+		c->List[key] = tileidx;
+	}
+
+	c->Decodes++;
+
+	u32 oldkey = c->Reverse[tileidx];
+	c->Reverse[tileidx] = key;
+	if (oldkey != key && oldkey != 0x80000000)
+	{
+		c->List[oldkey] = 0x8000;
+		c->Evictions++;
+	}
+}
+
+
+// the real one
+
+u32 LastVRAMStamp[0x1000];
+u32 LastPalStamp[32];
+
+static void Real_Init()
+{
+	memset(&PPU, 0, sizeof(PPU));
+	memset(LastVRAMStamp, 0, sizeof(LastVRAMStamp));
+	memset(LastPalStamp, 0, sizeof(LastPalStamp));
+	memset(Timing_Counts, 0, sizeof(Timing_Counts));
+	PPU_InitTileCache();
+}
+
+static void Real_Lookup(u32 key, u32 vramdirty, u32 paldirty, int empty)
+{
+	u32 tile = key & 0xFFF;
+	u32 palid = key >> 12;
+
+	if (vramdirty != LastVRAMStamp[tile])
+	{
+		LastVRAMStamp[tile] = vramdirty;
+		PPU.VRAMUpdateCount[tile]++;
+	}
+	if (paldirty != LastPalStamp[palid])
+	{
+		LastPalStamp[palid] = paldirty;
+		PPU.PaletteUpdateCount[palid]++;
+	}
+
+	memset(&PPU.VRAM[tile << 4], empty ? 0 : 0x5A, 16);
+	PPU_StoreTileInCache(TILE_2BPP, palid, tile << 4);
+}
+
+
+// the made-up trace
+
+u32* Trace;
+u32 TraceLen, TraceSize;
+
+static void Trace_Add(u32 key, u32 vramdirty, u32 paldirty)
+{
+	if (TraceLen + 3 > TraceSize)
+	{
+		TraceSize = TraceSize ? TraceSize*2 : 0x100000;
+		Trace = (u32*)realloc(Trace, TraceSize * 4);
+	}
+
+	Trace[TraceLen++] = key;
+	Trace[TraceLen++] = vramdirty;
+	Trace[TraceLen++] = paldirty;
+}
+
+static u32 Hash(u32 x)
+{
+	x ^= x >> 16; x *= 0x7FEB352D;
+	x ^= x >> 15; x *= 0x846CA68B;
+	x ^= x >> 16;
+	return x;
+}
+
+#define LEVEL_WIDTH 1536
+#define FRAMES 3600
+
+static void Trace_Make()
+{
+	u32 frame, x, y, layer;
+
+	for (frame = 0; frame < FRAMES; frame++)
+	{
+		// status bar: 2bpp font at 0xC000, 32x4 tiles
+		for (y = 0; y < 4; y++)
+		{
+			for (x = 0; x < 32; x++)
+			{
+				u32 tile = Hash(y*32 + x) % 96;
+				Trace_Add((0xC000 >> 4) + tile, 0, 0);
+			}
+		}
+
+		// two 4bpp layers going back and forth (8 pixels a frame, the back one
+		// at half that). the back one stands for the sprites too (palettes 8-15),
+		// so that there are more tiles than the cache can hold
+		u32 pos = frame * 8;
+		pos %= (LEVEL_WIDTH - 34) * 8 * 2;
+		if (pos >= (LEVEL_WIDTH - 34) * 8) pos = (LEVEL_WIDTH - 34) * 8 * 2 - pos;
+
+		for (layer = 0; layer < 2; layer++)
+		{
+			u32 xstart = (layer ? (pos / 2) : pos) >> 3;
+
+			for (y = 4; y < 28; y++)
+			{
+				for (x = xstart; x < xstart + 33; x++)
+				{
+					u32 h = Hash((layer << 24) | (y << 16) | x);
+					u32 tile = (h & 0x7FF) ^ (layer ? 0x400 : 0);
+					u32 pal = ((h >> 11) & 0x7) | (layer << 3);
+					u32 empty = ((h >> 14) & 0x7) == 0;
+
+					// 32 animated tiles, changing every 8 frames
+					u32 vramdirty = (tile < 32) ? (frame >> 3) : 0;
+
+					Trace_Add(((tile << 5) >> 4) | (pal << 12) | (empty ? 0x80000000 : 0), vramdirty, 0);
+				}
+			}
+		}
+
+		Trace_Add(0xFFFFFFFF, 0, 0);
+	}
+}
+
+static int Trace_Load(char* path)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) return 0;
+
+	fseek(f, 0, SEEK_END);
+	TraceSize = ftell(f) / 4;
+	fseek(f, 0, SEEK_SET);
+
+	Trace = (u32*)malloc(TraceSize * 4);
+	TraceLen = fread(Trace, 4, TraceSize, f);
+	TraceLen -= TraceLen % 3;
+	fclose(f);
+	return 1;
+}
+
+
+int main(int argc, char** argv)
+{
+	Cache* c = (Cache*)malloc(sizeof(Cache));
+	u32 frames = 0, lookups = 0;
+	u32 i;
+
+	if (argc > 1)
+	{
+		if (!Trace_Load(argv[1]))
+		{
+			printf("can't load %s\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+		Trace_Make();
+
+	for (i = 0; i < TraceLen; i += 3)
+	{
+		if (Trace[i] == 0xFFFFFFFF) frames++;
+		else lookups++;
+	}
+	printf("%u frames, %u lookups (%.1f per frame)\n", frames, lookups, frames ? (double)lookups / frames : 0.0);
+	printf("cache    hit%%    misses  decodes    empty  recolors  evictions  (per frame)\n");
+
+	double n = frames ? frames : 1;
+
+	Cache_Init(c);
+	for (i = 0; i < TraceLen; i += 3)
+	{
+		u32 key = Trace[i];
+		if (key == 0xFFFFFFFF) continue;
+
+		Cache_Lookup(c, key & 0x1FFFF, Trace[i+1], Trace[i+2], (key & 0x80000000) != 0);
+	}
+
+	printf("%-7s %5.2f  %8.1f %8.1f %8.1f %9.1f %10.1f\n", "FIFO",
+		lookups ? ((lookups - c->Misses) * 100.0) / lookups : 0.0,
+		c->Misses / n, c->Decodes / n, c->Empty / n, c->Recolors / n, c->Evictions / n);
+
+	Real_Init();
+	for (i = 0; i < TraceLen; i += 3)
+	{
+		u32 key = Trace[i];
+		if (key == 0xFFFFFFFF) continue;
+
+		Real_Lookup(key & 0x1FFFF, Trace[i+1], Trace[i+2], (key & 0x80000000) != 0);
+	}
+
+	u32 misses = Timing_Counts[COUNT_TILEMISS];
+	printf("%-7s %5.2f  %8.1f %8.1f %8.1f %9.1f %10.1f\n", "CLOCK",
+		lookups ? ((lookups - misses) * 100.0) / lookups : 0.0,
+		misses / n, Timing_Counts[COUNT_TILEDECODE] / n, Timing_Counts[COUNT_TILEEMPTY] / n,
+		Timing_Counts[COUNT_TILERECOLOR] / n, Timing_Counts[COUNT_TILEEVICT] / n);
+
+	PPU_DeInitTileCache();
+	free(c);
+	free(Trace);
+	return 0;
+}
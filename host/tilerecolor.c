@@ -0,0 +1,871 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// hard renderer tile cache check, runs source/ppu_tilecache.c against the old
+// decoders that went straight to colors (kept here as the reference)
+// checks that new tiles, recolored tiles (only the palette changed) and
+// redecoded ones (VRAM changed) all come out the same as the reference, for
+// every tile type, and that every texture row that changed gets flushed.
+// also checks that the mode 7 planes stay the same as the tilemap when
+// entries, tiles and the palette change, and that a palette change that
+// doesn't change any of the map's tiles doesn't redraw anything. same for
+// the BG planes, flips and priorities included. then measures what a
+// palette change costs: recoloring the cached tiles vs decoding them again
+// the old way, and what keeping the planes up to date costs
+//
+// build (from the repo root):
+//   gcc -O2 -Ihost -Isource -o tilerecolor host/tilerecolor.c host/host3ds.c source/ppu_tilecache.c
+//
+// usage: tilerecolor [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "snes.h"
+#include "ppu.h"
+#include "timing.h"
+#include "hostemu.h"
+
+
+// what ppu_tilecache.c talks to, besides host3ds.c
+
+PPUState PPU;
+u32 Timing_Counts[COUNT_NUM];
+
+extern u32 PPU_TileCacheDirty[4];
+extern PPU_Mode7Plane PPU_Mode7Planes[2];
+
+void bprintf(char* fmt, ...) {}
+
+
+// the old decoders
+
+static u32 Old_DecodeTile_2bpp(u16* vram, u16* pal, u32* dst)
+{
+	int i;
+	u8 p1, p2, p3, p4;
+	u32 col1, col2;
+	u32 nonzero = 0;
+
+	u16 oldcolor0 = pal[0];
+	pal[0] = 0;
+
+#define DO_MINIBLOCK(l1, l2) \
+	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
+	if (l2 & 0x0080) p1 |= 0x01; \
+	if (l2 & 0x8000) p1 |= 0x02; \
+	if (l2 & 0x0040) p2 |= 0x01; \
+	if (l2 & 0x4000) p2 |= 0x02; \
+	l2 <<= 2; \
+	col1 = pal[p1] | (pal[p2] << 16); \
+	if (l1 & 0x0080) p3 |= 0x01; \
+	if (l1 & 0x8000) p3 |= 0x02; \
+	if (l1 & 0x0040) p4 |= 0x01; \
+	if (l1 & 0x4000) p4 |= 0x02; \
+	l1 <<= 2; \
+	col2 = pal[p3] | (pal[p4] << 16); \
+	*dst++ = col1; \
+	*dst++ = col2; 
+
+	for (i = 4; i >= 0; i -= 4)
+	{
+		u16 line1 = vram[i+0];
+		u16 line2 = vram[i+1];
+		u16 line3 = vram[i+2];
+		u16 line4 = vram[i+3];
+
+		nonzero |= line1 | line2 | line3 | line4;
+
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line1, line2);
+	}
+
+	pal[0] = oldcolor0;
+
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+static u32 Old_DecodeTile_4bpp(u16* vram, u16* pal, u32* dst)
+{
+	int i;
+	u8 p1, p2, p3, p4;
+	u32 col1, col2;
+	u32 nonzero = 0;
+
+	u16 oldcolor0 = pal[0];
+	pal[0] = 0;
+
+#define DO_MINIBLOCK(l1, l2) \
+	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
+	if (l2 & 0x00000080) p1 |= 0x01; \
+	if (l2 & 0x00008000) p1 |= 0x02; \
+	if (l2 & 0x00800000) p1 |= 0x04; \
+	if (l2 & 0x80000000) p1 |= 0x08; \
+	if (l2 & 0x00000040) p2 |= 0x01; \
+	if (l2 & 0x00004000) p2 |= 0x02; \
+	if (l2 & 0x00400000) p2 |= 0x04; \
+	if (l2 & 0x40000000) p2 |= 0x08; \
+	l2 <<= 2; \
+	col1 = pal[p1] | (pal[p2] << 16); \
+	if (l1 & 0x00000080) p3 |= 0x01; \
+	if (l1 & 0x00008000) p3 |= 0x02; \
+	if (l1 & 0x00800000) p3 |= 0x04; \
+	if (l1 & 0x80000000) p3 |= 0x08; \
+	if (l1 & 0x00000040) p4 |= 0x01; \
+	if (l1 & 0x00004000) p4 |= 0x02; \
+	if (l1 & 0x00400000) p4 |= 0x04; \
+	if (l1 & 0x40000000) p4 |= 0x08; \
+	l1 <<= 2; \
+	col2 = pal[p3] | (pal[p4] << 16); \
+	*dst++ = col1; \
+	*dst++ = col2; 
+
+	for (i = 4; i >= 0; i -= 4)
+	{
+		u32 line1 = vram[i+0] | (vram[i+8 ] << 16);
+		u32 line2 = vram[i+1] | (vram[i+9 ] << 16);
+		u32 line3 = vram[i+2] | (vram[i+10] << 16);
+		u32 line4 = vram[i+3] | (vram[i+11] << 16);
+
+		nonzero |= line1 | line2 | line3 | line4;
+
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line1, line2);
+	}
+
+	pal[0] = oldcolor0;
+
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+static u32 Old_DecodeTile_8bpp(u16* vram, u16* pal, u32* dst)
+{
+	int i;
+	u8 p1, p2, p3, p4;
+	u32 col1, col2;
+	u32 nonzero = 0;
+
+	u16 oldcolor0 = pal[0];
+	pal[0] = 0;
+
+#define DO_MINIBLOCK(l11, l12, l21, l22) \
+	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
+	if (l21 & 0x00000080) p1 |= 0x01; \
+	if (l21 & 0x00008000) p1 |= 0x02; \
+	if (l21 & 0x00800000) p1 |= 0x04; \
+	if (l21 & 0x80000000) p1 |= 0x08; \
+	if (l22 & 0x00000080) p1 |= 0x10; \
+	if (l22 & 0x00008000) p1 |= 0x20; \
+	if (l22 & 0x00800000) p1 |= 0x40; \
+	if (l22 & 0x80000000) p1 |= 0x80; \
+	if (l21 & 0x00000040) p2 |= 0x01; \
+	if (l21 & 0x00004000) p2 |= 0x02; \
+	if (l21 & 0x00400000) p2 |= 0x04; \
+	if (l21 & 0x40000000) p2 |= 0x08; \
+	if (l22 & 0x00000040) p2 |= 0x10; \
+	if (l22 & 0x00004000) p2 |= 0x20; \
+	if (l22 & 0x00400000) p2 |= 0x40; \
+	if (l22 & 0x40000000) p2 |= 0x80; \
+	l21 <<= 2; l22 <<= 2; \
+	col1 = pal[p1] | (pal[p2] << 16); \
+	if (l11 & 0x00000080) p3 |= 0x01; \
+	if (l11 & 0x00008000) p3 |= 0x02; \
+	if (l11 & 0x00800000) p3 |= 0x04; \
+	if (l11 & 0x80000000) p3 |= 0x08; \
+	if (l12 & 0x00000080) p3 |= 0x10; \
+	if (l12 & 0x00008000) p3 |= 0x20; \
+	if (l12 & 0x00800000) p3 |= 0x40; \
+	if (l12 & 0x80000000) p3 |= 0x80; \
+	if (l11 & 0x00000040) p4 |= 0x01; \
+	if (l11 & 0x00004000) p4 |= 0x02; \
+	if (l11 & 0x00400000) p4 |= 0x04; \
+	if (l11 & 0x40000000) p4 |= 0x08; \
+	if (l12 & 0x00000040) p4 |= 0x10; \
+	if (l12 & 0x00004000) p4 |= 0x20; \
+	if (l12 & 0x00400000) p4 |= 0x40; \
+	if (l12 & 0x40000000) p4 |= 0x80; \
+	l11 <<= 2; l12 <<= 2; \
+	col2 = pal[p3] | (pal[p4] << 16); \
+	*dst++ = col1; \
+	*dst++ = col2; 
+
+	for (i = 4; i >= 0; i -= 4)
+	{
+		u32 line11 = vram[i+0 ] | (vram[i+8 ] << 16);
+		u32 line12 = vram[i+16] | (vram[i+24] << 16);
+		u32 line21 = vram[i+1 ] | (vram[i+9 ] << 16);
+		u32 line22 = vram[i+17] | (vram[i+25] << 16);
+		u32 line31 = vram[i+2 ] | (vram[i+10] << 16);
+		u32 line32 = vram[i+18] | (vram[i+26] << 16);
+		u32 line41 = vram[i+3 ] | (vram[i+11] << 16);
+		u32 line42 = vram[i+19] | (vram[i+27] << 16);
+
+		nonzero |= line11 | line21 | line31 | line41;
+		nonzero |= line12 | line22 | line32 | line42;
+
+		DO_MINIBLOCK(line31, line32, line41, line42);
+		DO_MINIBLOCK(line31, line32, line41, line42);
+		DO_MINIBLOCK(line11, line12, line21, line22);
+		DO_MINIBLOCK(line11, line12, line21, line22);
+		DO_MINIBLOCK(line31, line32, line41, line42);
+		DO_MINIBLOCK(line31, line32, line41, line42);
+		DO_MINIBLOCK(line11, line12, line21, line22);
+		DO_MINIBLOCK(line11, line12, line21, line22);
+	}
+
+	pal[0] = oldcolor0;
+
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+static u32 Old_DecodeTile_8bpp_m7(u16* vram, u16* pal, u32* dst)
+{
+	int i;
+	u8 p1, p2, p3, p4;
+	u32 col1, col2;
+	u32 nonzero = 0;
+
+	u16 oldcolor0 = pal[0];
+	pal[0] = 0;
+
+#define DO_MINIBLOCK(block) \
+	p1 = block & 0xFF; p2 = (block >> 8) & 0xFF; \
+	p3 = (block >> 16) & 0xFF; p4 = (block >> 24) & 0xFF; \
+	col1 = pal[p1] | (pal[p2] << 16); \
+	col2 = pal[p3] | (pal[p4] << 16); \
+	*dst++ = col1; \
+	*dst++ = col2; 
+
+	for (i = 16; i >= 0; i -= 16)
+	{
+		u32 b1 = vram[i+12] | (vram[i+8 ] << 16);
+		u32 b2 = vram[i+13] | (vram[i+9 ] << 16);
+		u32 b3 = vram[i+4 ] | (vram[i+0 ] << 16);
+		u32 b4 = vram[i+5 ] | (vram[i+1 ] << 16);
+		u32 b5 = vram[i+14] | (vram[i+10] << 16);
+		u32 b6 = vram[i+15] | (vram[i+11] << 16);
+		u32 b7 = vram[i+6 ] | (vram[i+2 ] << 16);
+		u32 b8 = vram[i+7 ] | (vram[i+3 ] << 16);
+
+		nonzero |= b1 | b2 | b3 | b4;
+		nonzero |= b5 | b6 | b7 | b8;
+
+		DO_MINIBLOCK(b1);
+		DO_MINIBLOCK(b2);
+		DO_MINIBLOCK(b3);
+		DO_MINIBLOCK(b4);
+		DO_MINIBLOCK(b5);
+		DO_MINIBLOCK(b6);
+		DO_MINIBLOCK(b7);
+		DO_MINIBLOCK(b8);
+	}
+
+	pal[0] = oldcolor0;
+
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+static u32 Old_DecodeTile_8bpp_m7e(u16* vram, u16* pal, u32* dst, u32 prio)
+{
+	int i, j;
+	u8 p1, p2, p3, p4;
+	u32 col1, col2;
+	u32 nonzero = 0;
+	u32 block[8], tmp, tmp1;
+	u16 oldcolor0 = pal[0];
+	pal[0] = 0;
+
+	if(!prio)
+		prio = 0x80808080;
+	else
+		prio = 0x00000000;
+
+#define DO_MINIBLOCK(block) \
+	p1 = block & 0xFF; p2 = (block >> 8) & 0xFF; \
+	p3 = (block >> 16) & 0xFF; p4 = (block >> 24) & 0xFF; \
+	col1 = pal[p1] | (pal[p2] << 16); \
+	col2 = pal[p3] | (pal[p4] << 16); \
+	*dst++ = col1; \
+	*dst++ = col2; 
+
+	for (i = 16; i >= 0; i -= 16)
+	{
+		block[0] = vram[i+12] | (vram[i+8 ] << 16);
+		block[1] = vram[i+13] | (vram[i+9 ] << 16);
+		block[2] = vram[i+4 ] | (vram[i+0 ] << 16);
+		block[3] = vram[i+5 ] | (vram[i+1 ] << 16);
+		block[4] = vram[i+14] | (vram[i+10] << 16);
+		block[5] = vram[i+15] | (vram[i+11] << 16);
+		block[6] = vram[i+6 ] | (vram[i+2 ] << 16);
+		block[7] = vram[i+7 ] | (vram[i+3 ] << 16);
+
+		for(j = 0; j < 8; j++)
+		{
+			tmp = 0;
+			tmp1 = block[j] ^ prio;
+			if(tmp1 & 0x80000000)
+				tmp |= 0xFF000000;
+			if(tmp1 & 0x00800000)
+				tmp |= 0x00FF0000;
+			if(tmp1 & 0x00008000)
+				tmp |= 0x0000FF00;
+			if(tmp1 & 0x00000080)
+				tmp |= 0x000000FF;
+			tmp = block[j] & tmp;
+
+			nonzero |= tmp;
+			DO_MINIBLOCK(tmp);
+		}
+	}
+
+	pal[0] = oldcolor0;
+
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+
+
+#define PPU_COORD2IDX(coord) (((coord) & 0x7F) | ((0x7F00 - ((coord) & 0x7F00)) >> 1))
+
+// what the tile should look like, the old way
+static u32 Reference(u32 type, u32 palid, u32 addr, u32* dst)
+{
+	switch (type)
+	{
+		case TILE_2BPP: return Old_DecodeTile_2bpp((u16*)&PPU.VRAM[addr], &PPU.Palette[palid << 2], dst);
+		case TILE_4BPP: return Old_DecodeTile_4bpp((u16*)&PPU.VRAM[addr], &PPU.Palette[palid << 4], dst);
+		case TILE_8BPP: return Old_DecodeTile_8bpp((u16*)&PPU.VRAM[addr], &PPU.Palette[0], dst);
+		case TILE_Mode7: return Old_DecodeTile_8bpp_m7((u16*)&PPU.VRAM7[addr << 2], &PPU.Palette[0], dst);
+		case TILE_Mode7_1: return Old_DecodeTile_8bpp_m7e((u16*)&PPU.VRAM7[addr << 2], &PPU.PaletteEx1[0], dst, 0);
+		case TILE_Mode7_2: return Old_DecodeTile_8bpp_m7e((u16*)&PPU.VRAM7[addr << 2], &PPU.PaletteEx2[0], dst, 1);
+	}
+	return 0;
+}
+
+char* TypeNames[] = {"2bpp", "4bpp", "8bpp", "mode7", "mode7 ext bg1", "mode7 ext bg2"};
+
+// a tile of each type, each type in its own part of VRAM so that the keys
+// don't run into each other (the key doesn't say which type the tile is)
+static void PickTile(u32 type, u32* palid, u32* addr)
+{
+	*palid = 0;
+	switch (type)
+	{
+		case TILE_2BPP: *palid = 1 + (Host_Rand() % 15); *addr = (Host_Rand() & 0x3FF) << 4; break;
+		case TILE_4BPP: *palid = Host_Rand() & 0x7; *addr = 0x4000 + ((Host_Rand() % 0x300) << 5); break;
+		case TILE_8BPP: *addr = 0xA000 + ((Host_Rand() % 0x180) << 6); break;
+		case TILE_Mode7: *addr = (Host_Rand() & 0x7F) << 4; break;
+		case TILE_Mode7_1: *addr = (0x80 + (Host_Rand() & 0x7F)) << 4; break;
+		case TILE_Mode7_2: *addr = (0x100 + (Host_Rand() & 0xFF)) << 4; break;
+	}
+}
+
+static void RandomVRAM()
+{
+	u32 i;
+
+	for (i = 0; i < 0x10000; i++) PPU.VRAM[i] = Host_Rand();
+	for (i = 0; i < 0x8000; i++) PPU.VRAM7[i] = Host_Rand();
+
+	// some empty tiles
+	for (i = 0; i < 0x10000; i += 0x200) memset(&PPU.VRAM[i], 0, 0x40);
+	for (i = 0; i < 0x8000; i += 0x800) memset(&PPU.VRAM7[i], 0, 0x40);
+}
+
+// what ppu.c does when the game writes CGRAM
+static void RandomPalette()
+{
+	u32 i;
+
+	for (i = 0; i < 256; i++)
+	{
+		PPU.Palette[i] = Host_Rand() | 0x0001;
+		if (i < 128)
+		{
+			PPU.PaletteEx1[i] = PPU.Palette[i];
+			PPU.PaletteEx2[i + 128] = PPU.Palette[i];
+		}
+		PPU.PaletteUpdateCount[i >> 2]++;
+	}
+	PPU.PaletteUpdateCount128++;
+	PPU.PaletteUpdateCount256++;
+}
+
+// one CGRAM write, like ppu.c does it
+static void SetColor(u32 num, u16 color)
+{
+	PPU.Palette[num] = color | 0x0001;
+	if (num < 128)
+	{
+		PPU.PaletteEx1[num] = PPU.Palette[num];
+		PPU.PaletteEx2[num + 128] = PPU.Palette[num];
+		PPU.PaletteUpdateCount128++;
+	}
+	PPU.PaletteUpdateCount[num >> 2]++;
+	PPU.PaletteUpdateCount256++;
+}
+
+static void TouchVRAM()
+{
+	u32 i;
+
+	for (i = 0; i < 0x1000; i++) PPU.VRAMUpdateCount[i]++;
+	for (i = 0; i < 0x800; i++) PPU.VRAM7UpdateCount[i]++;
+}
+
+static int Check()
+{
+	u32 tiles[2000][3];
+	u32 ref[32];
+	int round, i, bad = 0;
+	u16* before = (u16*)malloc(1024*1024*2);
+
+	for (i = 0; i < 2000; i++)
+	{
+		tiles[i][0] = i % 6;
+		PickTile(tiles[i][0], &tiles[i][1], &tiles[i][2]);
+	}
+
+	// new tiles, then the same ones after a palette change, after a VRAM change
+	// and with nothing changed
+	for (round = 0; round < 4; round++)
+	{
+		if (round == 1) RandomPalette();
+		if (round == 2) { RandomVRAM(); TouchVRAM(); }
+
+		memset(Timing_Counts, 0, sizeof(Timing_Counts));
+		PPU_FlushTileCache();
+		memcpy(before, PPU_TileCache, 1024*1024*2);
+
+		for (i = 0; i < 2000; i++)
+		{
+			u32 type = tiles[i][0], palid = tiles[i][1], addr = tiles[i][2];
+			u32 coord = PPU_StoreTileInCache(type, palid, addr);
+			u32 nonzero = Reference(type, palid, addr, ref);
+
+			if ((coord == 0xC000) != !nonzero)
+			{
+				if (bad++ < 10) printf("round %d, %s tile %05X pal %u: empty mismatch\n", round, TypeNames[type], addr, palid);
+				continue;
+			}
+			if (coord == 0xC000) continue;
+
+			if (memcmp(&PPU_TileCache[PPU_COORD2IDX(coord) * 64], ref, 64*2))
+			{
+				if (bad++ < 10) printf("round %d, %s tile %05X pal %u: pixel mismatch\n", round, TypeNames[type], addr, palid);
+			}
+		}
+
+		// each texture row is 128 tiles
+		for (i = 0; i < 128; i++)
+		{
+			if (!memcmp(&before[i * 128*64], &PPU_TileCache[i * 128*64], 128*64*2)) continue;
+			if (PPU_TileCacheDirty[i >> 5] & (1 << (i & 0x1F))) continue;
+			if (bad++ < 10) printf("round %d, texture row %d changed but isn't dirty\n", round, i);
+		}
+
+		printf("round %d: %u hits, %u empty, %u recolored, %u misses, %uK flushed\n", round,
+			Timing_Counts[COUNT_TILEHIT], Timing_Counts[COUNT_TILEEMPTY],
+			Timing_Counts[COUNT_TILERECOLOR], Timing_Counts[COUNT_TILEMISS],
+			PPU_FlushTileCache() >> 10);
+	}
+
+	free(before);
+	return bad;
+}
+
+// the whole map, as the plane should have it
+static int CheckPlaneCells(u16* plane, u32 style, char* what)
+{
+	u32 ref[32];
+	u32 j;
+	int bad = 0;
+
+	for (j = 0; j < 128*128; j++)
+	{
+		u32 tile = PPU.VRAM[j << 1];
+		u16* cell = &plane[((j & 0x7F) | ((127 - (j >> 7)) << 7)) * 64];
+
+		if (!Reference(style, 0, tile << 4, ref)) memset(ref, 0, 64*2);
+		if (memcmp(cell, ref, 64*2))
+		{
+			if (bad++ < 5) printf("%s, %s plane: cell %u,%u (tile %02X) is wrong\n", TypeNames[style], what, j & 0x7F, j >> 7, tile);
+		}
+	}
+
+	return bad;
+}
+
+static int CheckPlanes()
+{
+	u32 style, i;
+	int bad = 0;
+
+	for (style = TILE_Mode7; style <= TILE_Mode7_2; style++)
+	{
+		// the cache doesn't tell mode 7 from EXTBG BG1 tiles apart, start over
+		RandomVRAM();
+		TouchVRAM();
+
+		u16* plane = PPU_UpdateMode7Plane(style);
+		bad += CheckPlaneCells(plane, style, "new");
+		PPU_FlushTileCache();
+
+		PPU_UpdateMode7Plane(style);
+		u32 idle = PPU_FlushTileCache();
+
+		// a few tilemap entries and one tile
+		for (i = 0; i < 16; i++)
+		{
+			u32 j = Host_Rand() & 0x3FFF;
+			PPU.VRAM[j << 1] = Host_Rand();
+			PPU.VRAMUpdateCount[j >> 3]++;
+		}
+		u32 tile = PPU.VRAM[(Host_Rand() & 0x3FFF) << 1];
+		for (i = 0; i < 64; i++) PPU.VRAM7[(tile << 6) + i] = Host_Rand();
+		PPU.VRAM7UpdateCount[tile]++;
+
+		PPU_UpdateMode7Plane(style);
+		bad += CheckPlaneCells(plane, style, "changed");
+		u32 changed = PPU_FlushTileCache();
+
+		RandomPalette();
+		PPU_UpdateMode7Plane(style);
+		bad += CheckPlaneCells(plane, style, "recolored");
+		u32 recolored = PPU_FlushTileCache();
+
+		// a color no tile uses: the plane shouldn't be touched
+		for (i = 0; i < 0x8000; i++)
+		{
+			if ((PPU.VRAM7[i] & 0x7F) == 0x7F) PPU.VRAM7[i] ^= 0x01;
+		}
+		for (i = 0; i < 0x800; i++) PPU.VRAM7UpdateCount[i]++;
+		PPU_UpdateMode7Plane(style);
+		PPU_FlushTileCache();
+
+		SetColor(0x7F, Host_Rand());
+		PPU_UpdateMode7Plane(style);
+		bad += CheckPlaneCells(plane, style, "unused color");
+		u32* dirty = PPU_Mode7Planes[(style == TILE_Mode7_2) ? 1:0].Dirty;
+		if (dirty[0] | dirty[1] | dirty[2] | dirty[3])
+		{
+			if (bad++ < 10) printf("%s plane: redrawn for a color no tile uses\n", TypeNames[style]);
+		}
+		PPU_FlushTileCache();
+
+		printf("%s plane: %uK flushed with nothing changed, %uK with 16 entries and a tile, %uK after a palette change\n",
+			TypeNames[style], idle >> 10, changed >> 10, recolored >> 10);
+	}
+
+	return bad;
+}
+
+// the whole BG map, as the planes should have it. the flips are worked out
+// from pixel coordinates here, not from the zcurve bits
+static int CheckBGPlaneCells(PPU_HardBGPlane* plane, PPU_BGSection* bg, u32 type, char* what)
+{
+	u16 ref[64];
+	u32 w = plane->Width, h = plane->Height;
+	u32 tx, ty, i;
+	int bad = 0;
+
+	for (ty = 0; ty < h; ty++)
+	{
+		for (tx = 0; tx < w; tx++)
+		{
+			u32 entry = (tx & 0x1F) | ((ty & 0x1F) << 5);
+			if (tx & 0x20) entry += 1024;
+			if (ty & 0x20) entry += (bg->Size & 0x1) ? 2048 : 1024;
+
+			u16 curtile = *(u16*)&PPU.VRAM[bg->TilemapOffset + (entry << 1)];
+			u32 addr = bg->TilesetOffset + ((curtile & 0x3FF) << ((type == TILE_4BPP) ? 5 : 4));
+			if (!Reference(type, (curtile & 0x1C00) >> 10, addr, (u32*)ref)) memset(ref, 0, 64*2);
+
+			u32 cell = (tx + (h - 1 - ty) * w) * 64;
+			u16* planes[2] = {&plane->Pixels[cell], &plane->Pixels[cell + w*h*64]};
+			u32 p = (curtile & 0x2000) ? 1:0;
+
+			for (i = 0; i < 64; i++)
+			{
+				u32 x = (i & 0x1) | ((i & 0x4) >> 1) | ((i & 0x10) >> 2);
+				u32 y = 7 - (((i & 0x2) >> 1) | ((i & 0x8) >> 2) | ((i & 0x20) >> 3));
+				if (curtile & 0x4000) x = 7 - x;
+				if (curtile & 0x8000) y = 7 - y;
+
+				u32 fy = 7 - y;
+				u32 src = (x & 0x1) | ((x & 0x2) << 1) | ((x & 0x4) << 2) | ((fy & 0x1) << 1) | ((fy & 0x2) << 2) | ((fy & 0x4) << 3);
+				if (planes[p][i] != ref[src] || planes[p ^ 1][i]) break;
+			}
+			if (i < 64)
+			{
+				if (bad++ < 5) printf("%s BG plane, %s: cell %u,%u (entry %04X) is wrong\n", TypeNames[type], what, tx, ty, curtile);
+			}
+		}
+	}
+
+	return bad;
+}
+
+static int PlaneDirty(PPU_HardBGPlane* plane)
+{
+	return (plane->Dirty[0] | plane->Dirty[1] | plane->Dirty[2] | plane->Dirty[3]) != 0;
+}
+
+static int CheckBGPlanes()
+{
+	PPU_BGSection bg;
+	PPU_HardBGPlane* plane;
+	u32 type, i;
+	int bad = 0;
+
+	for (type = TILE_2BPP; type <= TILE_4BPP; type++)
+	{
+		// the mode 7 tiles from before have the same keys as some 2bpp ones
+		PPU_DeInitTileCache();
+		PPU_InitTileCache();
+		RandomVRAM();
+		TouchVRAM();
+		PPU.VRAMWrites++;
+		PPU_FlushTileCache();
+
+		memset(&bg, 0, sizeof(bg));
+		bg.Size = (type == TILE_4BPP) ? 3 : 1;
+		bg.TilemapOffset = 0xA000;
+		bg.TilesetOffset = (type == TILE_4BPP) ? 0x4000 : 0;
+
+		plane = PPU_UpdateBGPlane(type, type, &bg);
+		bad += CheckBGPlaneCells(plane, &bg, type, "new");
+		PPU_FlushTileCache();
+
+		// the next frame, with nothing changed
+		PPU_UpdateBGPlane(type, type, &bg);
+		if (PlaneDirty(plane))
+		{
+			if (bad++ < 10) printf("%s BG plane: redrawn with nothing changed\n", TypeNames[type]);
+		}
+		PPU_FlushTileCache();
+
+		// a few tilemap entries and one tile
+		for (i = 0; i < 16; i++)
+		{
+			u32 j = Host_Rand() & 0x7FF;
+			*(u16*)&PPU.VRAM[bg.TilemapOffset + (j << 1)] = Host_Rand();
+			PPU.VRAMUpdateCount[(bg.TilemapOffset + (j << 1)) >> 4]++;
+		}
+		u16 curtile = *(u16*)&PPU.VRAM[bg.TilemapOffset];
+		u32 addr = bg.TilesetOffset + ((curtile & 0x3FF) << ((type == TILE_4BPP) ? 5 : 4));
+		for (i = 0; i < 16; i++) PPU.VRAM[addr + i] = Host_Rand();
+		PPU.VRAMUpdateCount[addr >> 4]++;
+		PPU.VRAMWrites++;
+
+		PPU_UpdateBGPlane(type, type, &bg);
+		bad += CheckBGPlaneCells(plane, &bg, type, "changed");
+		PPU_FlushTileCache();
+
+		// a fade: tile by tile while it goes on, then the plane catches up
+		RandomPalette();
+		if (PPU_UpdateBGPlane(type, type, &bg))
+		{
+			if (bad++ < 10) printf("%s BG plane: used while the palette changes\n", TypeNames[type]);
+		}
+		PPU_FlushTileCache();
+
+		plane = PPU_UpdateBGPlane(type, type, &bg);
+		if (!plane)
+		{
+			printf("%s BG plane: not used after the palette settled\n", TypeNames[type]);
+			return bad + 1;
+		}
+		bad += CheckBGPlaneCells(plane, &bg, type, "recolored");
+		PPU_FlushTileCache();
+
+		// a section further down with a different tilemap: not this frame
+		PPU_UpdateBGPlane(type, type, &bg);
+		bg.TilemapOffset = 0x8000;
+		if (PPU_UpdateBGPlane(type, type, &bg) == plane && plane->GraphicsParams != bg.GraphicsParams)
+		{
+			PPU_FlushTileCache();
+			plane = PPU_UpdateBGPlane(type, type, &bg);
+			bad += CheckBGPlaneCells(plane, &bg, type, "moved");
+		}
+		else
+		{
+			if (bad++ < 10) printf("%s BG plane: switched to another tilemap mid-frame\n", TypeNames[type]);
+		}
+		PPU_FlushTileCache();
+
+		printf("%s BG plane: %ux%u tiles\n", TypeNames[type], plane->Width, plane->Height);
+	}
+
+	PPU_DeInitTileCache();
+	PPU_InitTileCache();
+	return bad;
+}
+
+// a palette fade over a screen's worth of 4bpp tiles (two layers + sprites)
+#define BENCH_TILES 2048
+
+static void Bench(int frames)
+{
+	u32 ref[32];
+	int f, i;
+	double t;
+
+	for (i = 0; i < BENCH_TILES; i++)
+		PPU_StoreTileInCache(TILE_4BPP, i & 0x7, (i >> 3) << 5);
+
+	memset(Timing_Counts, 0, sizeof(Timing_Counts));
+	t = Host_GetTime();
+	for (f = 0; f < frames; f++)
+	{
+		RandomPalette();
+		for (i = 0; i < BENCH_TILES; i++)
+			PPU_StoreTileInCache(TILE_4BPP, i & 0x7, (i >> 3) << 5);
+	}
+	t = Host_GetTime() - t;
+	printf("recolor:      %.3f ms/frame (%u recolored, %u decoded per frame)\n", t * 1000.0 / frames,
+		Timing_Counts[COUNT_TILERECOLOR] / frames, Timing_Counts[COUNT_TILEDECODE] / frames);
+
+	memset(Timing_Counts, 0, sizeof(Timing_Counts));
+	t = Host_GetTime();
+	for (f = 0; f < frames; f++)
+	{
+		RandomPalette();
+		TouchVRAM();
+		for (i = 0; i < BENCH_TILES; i++)
+			PPU_StoreTileInCache(TILE_4BPP, i & 0x7, (i >> 3) << 5);
+	}
+	t = Host_GetTime() - t;
+	printf("full decode:  %.3f ms/frame (%u recolored, %u decoded per frame)\n", t * 1000.0 / frames,
+		Timing_Counts[COUNT_TILERECOLOR] / frames, Timing_Counts[COUNT_TILEDECODE] / frames);
+
+	// what a palette change used to cost, without the cache bookkeeping
+	t = Host_GetTime();
+	for (f = 0; f < frames; f++)
+	{
+		RandomPalette();
+		for (i = 0; i < BENCH_TILES; i++)
+			Old_DecodeTile_4bpp((u16*)&PPU.VRAM[(i >> 3) << 5], &PPU.Palette[(i & 0x7) << 4], ref);
+	}
+	t = Host_GetTime() - t;
+	printf("old decoder:  %.3f ms/frame\n", t * 1000.0 / frames);
+
+	// mode 7 plane upkeep, with nothing changed and with one tile animating
+	PPU_UpdateMode7Plane(TILE_Mode7);
+	t = Host_GetTime();
+	for (f = 0; f < frames; f++)
+		PPU_UpdateMode7Plane(TILE_Mode7);
+	t = Host_GetTime() - t;
+	printf("mode 7 plane: %.3f ms/frame idle", t * 1000.0 / frames);
+
+	t = Host_GetTime();
+	for (f = 0; f < frames; f++)
+	{
+		PPU.VRAM7UpdateCount[PPU.VRAM[0]]++;
+		PPU_UpdateMode7Plane(TILE_Mode7);
+	}
+	t = Host_GetTime() - t;
+	printf(", %.3f ms/frame with a tile changing", t * 1000.0 / frames);
+
+	// CheckPlanes() left color 7F unused, like a sprite color would be
+	t = Host_GetTime();
+	for (f = 0; f < frames; f++)
+	{
+		SetColor(0x7F, Host_Rand());
+		PPU_UpdateMode7Plane(TILE_Mode7);
+	}
+	t = Host_GetTime() - t;
+	printf(", %.3f ms/frame with an unused color changing\n", t * 1000.0 / frames);
+
+	// BG plane upkeep, for a 64x64 4bpp BG, with nothing changed and with the
+	// tile in the top left corner animating
+	PPU_BGSection bg;
+	memset(&bg, 0, sizeof(bg));
+	bg.Size = 3;
+	bg.TilemapOffset = 0xA000;
+	bg.TilesetOffset = 0x4000;
+	u32 addr = bg.TilesetOffset + ((*(u16*)&PPU.VRAM[bg.TilemapOffset] & 0x3FF) << 5);
+
+	PPU_UpdateBGPlane(0, TILE_4BPP, &bg);
+	PPU_FlushTileCache();
+	t = Host_GetTime();
+	for (f = 0; f < frames; f++)
+	{
+		PPU_UpdateBGPlane(0, TILE_4BPP, &bg);
+		PPU_FlushTileCache();
+	}
+	t = Host_GetTime() - t;
+	printf("BG plane:     %.3f ms/frame idle", t * 1000.0 / frames);
+
+	t = Host_GetTime();
+	for (f = 0; f < frames; f++)
+	{
+		PPU.VRAMUpdateCount[addr >> 4]++;
+		PPU.VRAMWrites++;
+		PPU_UpdateBGPlane(0, TILE_4BPP, &bg);
+		PPU_FlushTileCache();
+	}
+	t = Host_GetTime() - t;
+	printf(", %.3f ms/frame with a tile changing\n", t * 1000.0 / frames);
+}
+
+
+int main(int argc, char** argv)
+{
+	int frames = (argc > 1) ? atoi(argv[1]) : 500;
+	if (frames < 1) frames = 1;
+
+	memset(&PPU, 0, sizeof(PPU));
+	PPU_InitTileCache();
+	RandomVRAM();
+	RandomPalette();
+
+	int bad = Check();
+	bad += CheckBGPlanes();
+	bad += CheckPlanes();
+	if (bad)
+	{
+		printf("check: %d bad tiles\n", bad);
+		return 1;
+	}
+	printf("check: all good\n");
+
+	Bench(frames);
+
+	PPU_DeInitTileCache();
+	return 0;
+}
@@ -16,9 +16,11 @@
     with blargSnes. If not, see http://www.gnu.org/licenses/.
 */
 
+#include <stdint.h>
 #include <3ds.h>
 
 #include "blargGL.h"
+#include "timing.h"
 
 
 typedef union
@@ -34,66 +36,88 @@ typedef union
 	
 } bglColor;
 
-struct
+// the state that goes to the GPU. it's kept twice: what was asked for, and
+// what was last sent, so that what didn't change isn't sent again
+typedef struct
 {
-	u32 GeometryStride;
-	u32 ShaderAttrMask; // for vertex->geometry shaders
-
 	shaderProgram_s* Shader;
 	
-	void* ColorBuffer;
-	void* DepthBuffer;
-	
-	u32 ViewportX, ViewportY;
-	u32 ViewportW, ViewportH;
+	struct
+	{
+		void* ColorBuffer;
+		void* DepthBuffer;
+		u32 X, Y;
+		u32 W, H;
+		
+	} Viewport;
 	
-	GPU_SCISSORMODE ScissorMode;
-	u32 ScissorX, ScissorY;
-	u32 ScissorW, ScissorH;
+	struct
+	{
+		GPU_SCISSORMODE Mode;
+		u32 X, Y;
+		u32 W, H;
+		
+	} Scissor;
 	
 	
-	float DepthMin, DepthMax;
+	struct
+	{
+		float Min, Max;
+		
+	} DepthRange;
 	
 	
 	GPU_CULLMODE CullMode;
 	
 	
-	bool StencilTest;
-	GPU_TESTFUNC StencilFunc;
-	u8 StencilRef, StencilMask, StencilReplace;
+	struct
+	{
+		bool Enable;
+		GPU_TESTFUNC Func;
+		u8 Ref, Mask, Replace;
+		
+	} Stencil;
 	
-	GPU_STENCILOP StencilOpSFail, StencilOpDFail, StencilOpPass;
+	struct
+	{
+		GPU_STENCILOP SFail, DFail, Pass;
+		
+	} StencilOp;
 	
 	
 	bglColor BlendingColor;
 	
 	
-	bool DepthTest;
-	GPU_TESTFUNC DepthFunc;
-	
-	GPU_WRITEMASK ColorDepthMask;
+	struct
+	{
+		bool Enable;
+		GPU_TESTFUNC Func;
+		GPU_WRITEMASK ColorDepthMask;
+		
+	} DepthTest;
 	
 	
-	GPU_BLENDEQUATION ColorBlendEquation, AlphaBlendEquation;
-	GPU_BLENDFACTOR ColorSrcFactor, ColorDstFactor, AlphaSrcFactor, AlphaDstFactor;
+	struct
+	{
+		GPU_BLENDEQUATION ColorEquation, AlphaEquation;
+		GPU_BLENDFACTOR ColorSrc, ColorDst, AlphaSrc, AlphaDst;
+		
+	} Blending;
 	
 	
-	bool AlphaTest;
-	GPU_TESTFUNC AlphaFunc;
-	u8 AlphaRef;
+	struct
+	{
+		bool Enable;
+		GPU_TESTFUNC Func;
+		u8 Ref;
+		
+	} AlphaTest;
 	
 	
 	GPU_TEXUNIT TextureEnable;
 	
 	
-	struct
-	{
-		u16 RGBSources, AlphaSources;
-		u16 RGBOperands, AlphaOperands;
-		GPU_COMBINEFUNC RGBCombine, AlphaCombine;
-		bglColor ConstantColor;
-		
-	} TextureEnv[6];
+	bglTexEnvState TextureEnv[6];
 	
 	
 	struct
@@ -105,6 +129,34 @@ struct
 		
 	} Texture[3];
 	
+} bglGPUState;
+
+// one bit per part of the state above, for DirtyFlags and SentValid
+#define BGL_SHADER		(1<<0)
+#define BGL_ATTRIBS		(1<<1)
+#define BGL_VIEWPORT	(1<<2)
+#define BGL_SCISSOR		(1<<3)
+#define BGL_DEPTHRANGE	(1<<4)
+#define BGL_CULLMODE	(1<<5)
+#define BGL_STENCIL		(1<<6)
+#define BGL_STENCILOP	(1<<7)
+#define BGL_BLENDCOLOR	(1<<8)
+#define BGL_DEPTHTEST	(1<<9)
+#define BGL_BLENDING	(1<<10)
+#define BGL_ALPHATEST	(1<<11)
+#define BGL_TEXENABLE	(1<<12)
+#define BGL_TEXENV(n)	(1<<(13+(n)))
+#define BGL_TEXTURE(n)	(1<<(19+(n)))
+
+struct
+{
+	u32 GeometryStride;
+	u32 ShaderAttrMask; // for vertex->geometry shaders
+	
+	bglGPUState Cur;
+	bglGPUState Sent;
+	u32 SentValid;	// which parts of Sent are known to be what the GPU has
+	
 	
 	u8 NumAttribBuffers;
 	void* AttribBufferPtr;
@@ -116,10 +168,7 @@ struct
 	} AttribBuffer[16];
 	
 	
-	// bit0: shader changed
-	// bit1: buffer attributes changed
-	// bit2: viewport/scissor changed
-	// the rest: anything else changed
+	// what changed since the last draw (bits above)
 	u32 DirtyFlags;
 	
 	bool DrawnSomething;
@@ -160,6 +209,26 @@ void bglDeInit()
 }
 
 
+// forget what was sent, so that everything is sent again at the next draw
+// (for when something else may have messed with the GPU, like the home menu)
+void bglInvalidateState()
+{
+	bglState.SentValid = 0;
+	bglState.DirtyFlags = 0xFFFFFFFF;
+}
+
+
+
+// whether a part of the state has to be sent: it changed, and isn't what was
+// last sent (or what was last sent isn't known)
+#define STALE(bit, x) ((dirty & (bit)) && \
+	(!(bglState.SentValid & (bit)) || memcmp(&bglState.Cur.x, &bglState.Sent.x, sizeof(bglState.Cur.x))))
+
+#define SENT(bit, x) \
+	{ \
+		bglState.Sent.x = bglState.Cur.x; \
+		bglState.SentValid |= (bit); \
+	}
 
 // update PICA200 state as needed before drawing shit
 void _bglUpdateState()
@@ -178,69 +247,137 @@ void _bglUpdateState()
 		bglState.DrawnSomething = false;
 	}
 	
-	if (dirty & ~0x2)
+	if (STALE(BGL_SHADER, Shader))
 	{
-		dirty |= 0x2;
-			
-		if (dirty & 0x1)
-			shaderProgramUse(bglState.Shader);
+		shaderProgramUse(bglState.Cur.Shader);
+		SENT(BGL_SHADER, Shader);
 		
-		if (dirty & 0x4)
-		{
-			GPU_SetViewport(bglState.DepthBuffer, bglState.ColorBuffer, bglState.ViewportX, bglState.ViewportY, bglState.ViewportW, bglState.ViewportH);
-			GPU_SetScissorTest(bglState.ScissorMode, bglState.ScissorX, bglState.ScissorY, bglState.ScissorW, bglState.ScissorH);
-		}
-
-		GPU_DepthMap(bglState.DepthMin, bglState.DepthMax);
-		GPU_SetFaceCulling(bglState.CullMode);
-		GPU_SetStencilTest(bglState.StencilTest, bglState.StencilFunc, bglState.StencilRef, bglState.StencilMask, bglState.StencilReplace);
-		GPU_SetStencilOp(bglState.StencilOpSFail, bglState.StencilOpDFail, bglState.StencilOpPass);
-		GPU_SetBlendingColor(bglState.BlendingColor.R, bglState.BlendingColor.G, bglState.BlendingColor.B, bglState.BlendingColor.A);
-		GPU_SetDepthTestAndWriteMask(bglState.DepthTest, bglState.DepthFunc, bglState.ColorDepthMask);
+		// it also sets up the vertex attributes its own way
+		dirty |= BGL_ATTRIBS;
+	}
+	
+	if (STALE(BGL_VIEWPORT, Viewport))
+	{
+		GPU_SetViewport(bglState.Cur.Viewport.DepthBuffer, bglState.Cur.Viewport.ColorBuffer, 
+			bglState.Cur.Viewport.X, bglState.Cur.Viewport.Y, bglState.Cur.Viewport.W, bglState.Cur.Viewport.H);
+		SENT(BGL_VIEWPORT, Viewport);
+		
+		// that one resets the scissor test
+		bglState.SentValid &= ~BGL_SCISSOR;
+		dirty |= BGL_SCISSOR;
+	}
+	
+	if (STALE(BGL_SCISSOR, Scissor))
+	{
+		GPU_SetScissorTest(bglState.Cur.Scissor.Mode, bglState.Cur.Scissor.X, bglState.Cur.Scissor.Y, bglState.Cur.Scissor.W, bglState.Cur.Scissor.H);
+		SENT(BGL_SCISSOR, Scissor);
+	}
+	
+	if (STALE(BGL_DEPTHRANGE, DepthRange))
+	{
+		GPU_DepthMap(bglState.Cur.DepthRange.Min, bglState.Cur.DepthRange.Max);
+		SENT(BGL_DEPTHRANGE, DepthRange);
+	}
+	
+	if (STALE(BGL_CULLMODE, CullMode))
+	{
+		GPU_SetFaceCulling(bglState.Cur.CullMode);
+		SENT(BGL_CULLMODE, CullMode);
+	}
+	
+	if (STALE(BGL_STENCIL, Stencil))
+	{
+		GPU_SetStencilTest(bglState.Cur.Stencil.Enable, bglState.Cur.Stencil.Func, 
+			bglState.Cur.Stencil.Ref, bglState.Cur.Stencil.Mask, bglState.Cur.Stencil.Replace);
+		SENT(BGL_STENCIL, Stencil);
+	}
+	
+	if (STALE(BGL_STENCILOP, StencilOp))
+	{
+		GPU_SetStencilOp(bglState.Cur.StencilOp.SFail, bglState.Cur.StencilOp.DFail, bglState.Cur.StencilOp.Pass);
+		SENT(BGL_STENCILOP, StencilOp);
+	}
+	
+	if (STALE(BGL_BLENDCOLOR, BlendingColor))
+	{
+		GPU_SetBlendingColor(bglState.Cur.BlendingColor.R, bglState.Cur.BlendingColor.G, bglState.Cur.BlendingColor.B, bglState.Cur.BlendingColor.A);
+		SENT(BGL_BLENDCOLOR, BlendingColor);
+	}
+	
+	if (STALE(BGL_DEPTHTEST, DepthTest))
+	{
+		GPU_SetDepthTestAndWriteMask(bglState.Cur.DepthTest.Enable, bglState.Cur.DepthTest.Func, bglState.Cur.DepthTest.ColorDepthMask);
 		
 		// start drawing? whatever that junk is
 		GPUCMD_AddMaskedWrite(GPUREG_0062, 0x1, 0);
 		GPUCMD_AddWrite(GPUREG_0118, 0);
 		
+		SENT(BGL_DEPTHTEST, DepthTest);
+	}
+	
+	if (STALE(BGL_BLENDING, Blending))
+	{
 		GPU_SetAlphaBlending(
-			bglState.ColorBlendEquation, bglState.AlphaBlendEquation,
-			bglState.ColorSrcFactor, bglState.ColorDstFactor,
-			bglState.AlphaSrcFactor, bglState.AlphaDstFactor);
-		GPU_SetAlphaTest(bglState.AlphaTest, bglState.AlphaFunc, bglState.AlphaRef);
+			bglState.Cur.Blending.ColorEquation, bglState.Cur.Blending.AlphaEquation,
+			bglState.Cur.Blending.ColorSrc, bglState.Cur.Blending.ColorDst,
+			bglState.Cur.Blending.AlphaSrc, bglState.Cur.Blending.AlphaDst);
+		SENT(BGL_BLENDING, Blending);
+	}
+	
+	if (STALE(BGL_ALPHATEST, AlphaTest))
+	{
+		GPU_SetAlphaTest(bglState.Cur.AlphaTest.Enable, bglState.Cur.AlphaTest.Func, bglState.Cur.AlphaTest.Ref);
+		SENT(BGL_ALPHATEST, AlphaTest);
+	}
+	
+	if (STALE(BGL_TEXENABLE, TextureEnable))
+	{
+		GPU_SetTextureEnable(bglState.Cur.TextureEnable);
+		SENT(BGL_TEXENABLE, TextureEnable);
+	}
+	
+	for (i = 0; i < 6; i++)
+	{
+		if (!STALE(BGL_TEXENV(i), TextureEnv[i]))
+			continue;
+		
+		GPU_SetTexEnv(i,
+			bglState.Cur.TextureEnv[i].RGBSources,
+			bglState.Cur.TextureEnv[i].AlphaSources,
+			bglState.Cur.TextureEnv[i].RGBOperands,
+			bglState.Cur.TextureEnv[i].AlphaOperands,
+			bglState.Cur.TextureEnv[i].RGBCombine,
+			bglState.Cur.TextureEnv[i].AlphaCombine,
+			bglState.Cur.TextureEnv[i].ConstantColor);
+		SENT(BGL_TEXENV(i), TextureEnv[i]);
+	}
+	
+	for (i = 0; i < 3; i++)
+	{
+		u32 texunit = 1<<i;
 		
-		GPU_SetTextureEnable(bglState.TextureEnable);
+		if (!STALE(BGL_TEXTURE(i), Texture[i]))
+			continue;
 		
-		for (i = 0; i < 6; i++)
+		// disabled units are sent once they're enabled
+		if (!(bglState.Cur.TextureEnable & texunit))
 		{
-			GPU_SetTexEnv(i,
-				bglState.TextureEnv[i].RGBSources,
-				bglState.TextureEnv[i].AlphaSources,
-				bglState.TextureEnv[i].RGBOperands,
-				bglState.TextureEnv[i].AlphaOperands,
-				bglState.TextureEnv[i].RGBCombine,
-				bglState.TextureEnv[i].AlphaCombine,
-				bglState.TextureEnv[i].ConstantColor.Val);
+			bglState.DirtyFlags |= BGL_TEXTURE(i);
+			continue;
 		}
 		
-		for (i = 0; i < 3; i++)
-		{
-			u32 texunit = 1<<i;
-			
-			if (!(bglState.TextureEnable & texunit))
-				continue;
-			
-			GPU_SetTexture(texunit,
-				bglState.Texture[i].Data,
-				bglState.Texture[i].Height,
-				bglState.Texture[i].Width,
-				bglState.Texture[i].Parameters,
-				bglState.Texture[i].ColorType);
-		}
+		GPU_SetTexture(texunit,
+			bglState.Cur.Texture[i].Data,
+			bglState.Cur.Texture[i].Height,
+			bglState.Cur.Texture[i].Width,
+			bglState.Cur.Texture[i].Parameters,
+			bglState.Cur.Texture[i].ColorType);
+		SENT(BGL_TEXTURE(i), Texture[i]);
 	}
 	
 	// attribute buffers
 	// this lacks flexiblity
-	if (dirty & 0x2)
+	if (dirty & BGL_ATTRIBS)
 	{
 		u64 attrib = 0;
 		u64 permut = 0;
@@ -263,11 +400,52 @@ void _bglUpdateState()
 	}
 }
 
+#undef STALE
+#undef SENT
+
+
+void bglApplyState(const bglStateBlock* block)
+{
+	u32 i;
+	
+	bglScissorMode(block->ScissorMode);
+	
+	bglEnableDepthTest(block->DepthTest);
+	bglDepthFunc(block->DepthFunc);
+	bglColorDepthMask(block->ColorDepthMask);
+	
+	bglEnableStencilTest(block->StencilTest);
+	bglStencilFunc(block->StencilFunc, block->StencilRef, block->StencilMask, block->StencilReplace);
+	bglStencilOp(block->StencilOp[0], block->StencilOp[1], block->StencilOp[2]);
+	
+	bglEnableAlphaTest(block->AlphaTest);
+	bglAlphaFunc(block->AlphaFunc, block->AlphaRef);
+	
+	bglBlendEquation(block->BlendEquation[0], block->BlendEquation[1]);
+	bglBlendFunc(block->BlendFunc[0], block->BlendFunc[1], block->BlendFunc[2], block->BlendFunc[3]);
+	
+	bglEnableTextures(block->TextureEnable);
+	for (i = 0; i < 6; i++)
+	{
+		const bglTexEnvState* env = &block->TexEnv[i];
+		
+		if (i < block->NumTexEnvs)
+			bglTexEnv(i, env->RGBSources, env->AlphaSources, env->RGBOperands, env->AlphaOperands, 
+				env->RGBCombine, env->AlphaCombine, env->ConstantColor);
+		else
+			bglDummyTexEnv(i);
+	}
+	
+	bglNumAttribs(block->NumAttribs);
+	for (i = 0; i < block->NumAttribs; i++)
+		bglAttribType(i, block->Attrib[i].DataType, block->Attrib[i].NumComponents);
+}
+
 
 void bglUseShader(shaderProgram_s* shader)
 {
-	bglState.Shader = shader;
-	bglState.DirtyFlags |= 0x5;
+	bglState.Cur.Shader = shader;
+	bglState.DirtyFlags |= BGL_SHADER;
 }
 
 
@@ -291,150 +469,150 @@ void bglUniformMatrix(GPU_SHADER_TYPE type, u32 id, float* val)
 
 void bglOutputBuffers(void* color, void* depth)
 {
-	bglState.ColorBuffer = (void*)osConvertVirtToPhys((u32)color);
-	bglState.DepthBuffer = (void*)osConvertVirtToPhys((u32)depth);
-	bglState.DirtyFlags |= 0x4;
+	bglState.Cur.Viewport.ColorBuffer = (void*)(uintptr_t)osConvertVirtToPhys((u32)(uintptr_t)color);
+	bglState.Cur.Viewport.DepthBuffer = (void*)(uintptr_t)osConvertVirtToPhys((u32)(uintptr_t)depth);
+	bglState.DirtyFlags |= BGL_VIEWPORT;
 }
 
 void bglViewport(u32 x, u32 y, u32 w, u32 h)
 {
-	bglState.ViewportX = x;
-	bglState.ViewportY = y;
-	bglState.ViewportW = w;
-	bglState.ViewportH = h;
-	bglState.DirtyFlags |= 0x4;
+	bglState.Cur.Viewport.X = x;
+	bglState.Cur.Viewport.Y = y;
+	bglState.Cur.Viewport.W = w;
+	bglState.Cur.Viewport.H = h;
+	bglState.DirtyFlags |= BGL_VIEWPORT;
 }
 
 void bglScissorMode(GPU_SCISSORMODE mode)
 {
-	bglState.ScissorMode = mode;
-	bglState.DirtyFlags |= 0x4;
+	bglState.Cur.Scissor.Mode = mode;
+	bglState.DirtyFlags |= BGL_SCISSOR;
 }
 
 void bglScissor(u32 x, u32 y, u32 w, u32 h)
 {
-	bglState.ScissorX = x;
-	bglState.ScissorY = y;
-	bglState.ScissorW = w;
-	bglState.ScissorH = h;
-	bglState.DirtyFlags |= 0x4;
+	bglState.Cur.Scissor.X = x;
+	bglState.Cur.Scissor.Y = y;
+	bglState.Cur.Scissor.W = w;
+	bglState.Cur.Scissor.H = h;
+	bglState.DirtyFlags |= BGL_SCISSOR;
 }
 
 
 void bglDepthRange(float min, float max)
 {
-	bglState.DepthMin = min;
-	bglState.DepthMax = max;
-	bglState.DirtyFlags |= 0x8;
+	bglState.Cur.DepthRange.Min = min;
+	bglState.Cur.DepthRange.Max = max;
+	bglState.DirtyFlags |= BGL_DEPTHRANGE;
 }
 
 void bglEnableDepthTest(bool enable)
 {
-	bglState.DepthTest = enable;
-	bglState.DirtyFlags |= 0x40;
+	bglState.Cur.DepthTest.Enable = enable;
+	bglState.DirtyFlags |= BGL_DEPTHTEST;
 }
 
 void bglDepthFunc(GPU_TESTFUNC func)
 {
-	bglState.DepthFunc = func;
-	bglState.DirtyFlags |= 0x40;
+	bglState.Cur.DepthTest.Func = func;
+	bglState.DirtyFlags |= BGL_DEPTHTEST;
 }
 
 
 void bglFaceCulling(GPU_CULLMODE mode)
 {
-	bglState.CullMode = mode;
-	bglState.DirtyFlags |= 0x10;
+	bglState.Cur.CullMode = mode;
+	bglState.DirtyFlags |= BGL_CULLMODE;
 }
 
 
 void bglEnableStencilTest(bool enable)
 {
-	bglState.StencilTest = enable;
-	bglState.DirtyFlags |= 0x20;
+	bglState.Cur.Stencil.Enable = enable;
+	bglState.DirtyFlags |= BGL_STENCIL;
 }
 
 void bglStencilFunc(GPU_TESTFUNC func, u32 ref, u32 mask, u32 replace)
 {
-	bglState.StencilFunc = func;
-	bglState.StencilRef = ref;
-	bglState.StencilMask = mask;
-	bglState.StencilReplace = replace;
-	bglState.DirtyFlags |= 0x20;
+	bglState.Cur.Stencil.Func = func;
+	bglState.Cur.Stencil.Ref = ref;
+	bglState.Cur.Stencil.Mask = mask;
+	bglState.Cur.Stencil.Replace = replace;
+	bglState.DirtyFlags |= BGL_STENCIL;
 }
 
 void bglStencilOp(GPU_STENCILOP sfail, GPU_STENCILOP dfail, GPU_STENCILOP pass)
 {
-	bglState.StencilOpSFail = sfail;
-	bglState.StencilOpDFail = dfail;
-	bglState.StencilOpPass = pass;
-	bglState.DirtyFlags |= 0x20;
+	bglState.Cur.StencilOp.SFail = sfail;
+	bglState.Cur.StencilOp.DFail = dfail;
+	bglState.Cur.StencilOp.Pass = pass;
+	bglState.DirtyFlags |= BGL_STENCILOP;
 }
 
 
 void bglColorDepthMask(GPU_WRITEMASK mask)
 {
-	bglState.ColorDepthMask = mask;
-	bglState.DirtyFlags |= 0x40;
+	bglState.Cur.DepthTest.ColorDepthMask = mask;
+	bglState.DirtyFlags |= BGL_DEPTHTEST;
 }
 
 
 void bglEnableAlphaTest(bool enable)
 {
-	bglState.AlphaTest = enable;
-	bglState.DirtyFlags |= 0x80;
+	bglState.Cur.AlphaTest.Enable = enable;
+	bglState.DirtyFlags |= BGL_ALPHATEST;
 }
 
 void bglAlphaFunc(GPU_TESTFUNC func, u32 ref)
 {
-	bglState.AlphaFunc = func;
-	bglState.AlphaRef = ref;
-	bglState.DirtyFlags |= 0x80;
+	bglState.Cur.AlphaTest.Func = func;
+	bglState.Cur.AlphaTest.Ref = ref;
+	bglState.DirtyFlags |= BGL_ALPHATEST;
 }
 
 
 void bglBlendColor(u32 r, u32 g, u32 b, u32 a)
 {
-	bglState.BlendingColor.R = r;
-	bglState.BlendingColor.G = g;
-	bglState.BlendingColor.B = b;
-	bglState.BlendingColor.A = a;
-	bglState.DirtyFlags |= 0x20;
+	bglState.Cur.BlendingColor.R = r;
+	bglState.Cur.BlendingColor.G = g;
+	bglState.Cur.BlendingColor.B = b;
+	bglState.Cur.BlendingColor.A = a;
+	bglState.DirtyFlags |= BGL_BLENDCOLOR;
 }
 
 void bglBlendEquation(GPU_BLENDEQUATION coloreq, GPU_BLENDEQUATION alphaeq)
 {
-	bglState.ColorBlendEquation = coloreq;
-	bglState.AlphaBlendEquation = alphaeq;
-	bglState.DirtyFlags |= 0x100;
+	bglState.Cur.Blending.ColorEquation = coloreq;
+	bglState.Cur.Blending.AlphaEquation = alphaeq;
+	bglState.DirtyFlags |= BGL_BLENDING;
 }
 
 void bglBlendFunc(GPU_BLENDFACTOR colorsrc, GPU_BLENDFACTOR colordst, GPU_BLENDFACTOR alphasrc, GPU_BLENDFACTOR alphadst)
 {
-	bglState.ColorSrcFactor = colorsrc;
-	bglState.ColorDstFactor = colordst;
-	bglState.AlphaSrcFactor = alphasrc;
-	bglState.AlphaDstFactor = alphadst;
-	bglState.DirtyFlags |= 0x100;
+	bglState.Cur.Blending.ColorSrc = colorsrc;
+	bglState.Cur.Blending.ColorDst = colordst;
+	bglState.Cur.Blending.AlphaSrc = alphasrc;
+	bglState.Cur.Blending.AlphaDst = alphadst;
+	bglState.DirtyFlags |= BGL_BLENDING;
 }
 
 
 void bglEnableTextures(GPU_TEXUNIT units)
 {
-	bglState.TextureEnable = units;
-	bglState.DirtyFlags |= 0x200;
+	bglState.Cur.TextureEnable = units;
+	bglState.DirtyFlags |= BGL_TEXENABLE;
 }
 
 void bglTexEnv(u32 id, u32 colorsrc, u32 alphasrc, u32 colorop, u32 alphaop, GPU_COMBINEFUNC colorcomb, GPU_COMBINEFUNC alphacomb, u32 constcol)
 {
-	bglState.TextureEnv[id].RGBSources = colorsrc;
-	bglState.TextureEnv[id].AlphaSources = alphasrc;
-	bglState.TextureEnv[id].RGBOperands = colorop;
-	bglState.TextureEnv[id].AlphaOperands = alphaop;
-	bglState.TextureEnv[id].RGBCombine = colorcomb;
-	bglState.TextureEnv[id].AlphaCombine = alphacomb;
-	bglState.TextureEnv[id].ConstantColor.Val = constcol;
-	bglState.DirtyFlags |= 0x200;
+	bglState.Cur.TextureEnv[id].RGBSources = colorsrc;
+	bglState.Cur.TextureEnv[id].AlphaSources = alphasrc;
+	bglState.Cur.TextureEnv[id].RGBOperands = colorop;
+	bglState.Cur.TextureEnv[id].AlphaOperands = alphaop;
+	bglState.Cur.TextureEnv[id].RGBCombine = colorcomb;
+	bglState.Cur.TextureEnv[id].AlphaCombine = alphacomb;
+	bglState.Cur.TextureEnv[id].ConstantColor = constcol;
+	bglState.DirtyFlags |= BGL_TEXENV(id);
 }
 
 void bglDummyTexEnv(u32 id)
@@ -452,32 +630,32 @@ void bglTexImage(GPU_TEXUNIT unit, void* data, u32 width, u32 height, u32 param,
 {
 	u32 id = (unit==4) ? 2:(unit-1);
 	
-	bglState.Texture[id].Data = (void*)osConvertVirtToPhys((u32)data);
-	bglState.Texture[id].Width = width;
-	bglState.Texture[id].Height = height;
-	bglState.Texture[id].Parameters = param;
-	bglState.Texture[id].ColorType = colortype;
-	bglState.DirtyFlags |= 0x200;
+	bglState.Cur.Texture[id].Data = (void*)(uintptr_t)osConvertVirtToPhys((u32)(uintptr_t)data);
+	bglState.Cur.Texture[id].Width = width;
+	bglState.Cur.Texture[id].Height = height;
+	bglState.Cur.Texture[id].Parameters = param;
+	bglState.Cur.Texture[id].ColorType = colortype;
+	bglState.DirtyFlags |= BGL_TEXTURE(id);
 }
 
 
 void bglNumAttribs(u32 num)
 {
 	bglState.NumAttribBuffers = num;
-	bglState.DirtyFlags |= 0x2;
+	bglState.DirtyFlags |= BGL_ATTRIBS;
 }
 
 void bglAttribBuffer(void* data)
 {
-	bglState.AttribBufferPtr = (void*)osConvertVirtToPhys((u32)data);
-	bglState.DirtyFlags |= 0x2;
+	bglState.AttribBufferPtr = (void*)(uintptr_t)osConvertVirtToPhys((u32)(uintptr_t)data);
+	bglState.DirtyFlags |= BGL_ATTRIBS;
 }
 
 void bglAttribType(u32 id, GPU_FORMATS datatype, u32 numcomps)
 {
 	bglState.AttribBuffer[id].NumComponents = numcomps;
 	bglState.AttribBuffer[id].DataType = datatype;
-	bglState.DirtyFlags |= 0x2;
+	bglState.DirtyFlags |= BGL_ATTRIBS;
 }
 
 
@@ -491,12 +669,18 @@ void bglDrawArrays(GPU_Primitive_t type, u32 numvertices)
 
 void bglFlush()
 {
+	u32* cmdbuf;
+	u32 cmdsize, cmdwords;
+	
 	if (bglState.DrawnSomething)
 	{
 		GPU_FinishDrawing();
 		bglState.DrawnSomething = false;
 	}
 	
+	GPUCMD_GetBuffer(&cmdbuf, &cmdsize, &cmdwords);
+	Timing_Counts[COUNT_GPUCMD] += cmdwords;
+	
 	GPUCMD_Finalize();
 	GPUCMD_Run(NULL);
 	GPUCMD_SetBuffer(bglCommandBuffer, bglCommandBufferSize, 0);
@@ -29,10 +29,65 @@
 
 // blargGL -- thin wrapper around the ctrulib GPU API
 // Not meant to be on par with OpenGL, just meant to be somewhat sane~
+//
+// state is only sent to the GPU when drawing, and only what actually changed
+// since it was last sent
+
+
+typedef struct
+{
+	u16 RGBSources, AlphaSources;
+	u16 RGBOperands, AlphaOperands;
+	GPU_COMBINEFUNC RGBCombine, AlphaCombine;
+	u32 ConstantColor;
+	
+} bglTexEnvState;
+
+// the fixed state of a pipeline, meant to be built once (static const) and set
+// all at once with bglApplyState(). what changes from a draw to another (the
+// shader, buffers, scissor rect, stencil func, textures, uniforms...) is set
+// apart as usual, after it
+typedef struct
+{
+	GPU_SCISSORMODE ScissorMode;
+	
+	bool DepthTest;
+	GPU_TESTFUNC DepthFunc;
+	GPU_WRITEMASK ColorDepthMask;
+	
+	bool StencilTest;
+	GPU_TESTFUNC StencilFunc;
+	u8 StencilRef, StencilMask, StencilReplace;
+	GPU_STENCILOP StencilOp[3];	// sfail, dfail, pass
+	
+	bool AlphaTest;
+	GPU_TESTFUNC AlphaFunc;
+	u8 AlphaRef;
+	
+	GPU_BLENDEQUATION BlendEquation[2];	// color, alpha
+	GPU_BLENDFACTOR BlendFunc[4];	// color src/dst, alpha src/dst
+	
+	GPU_TEXUNIT TextureEnable;
+	u32 NumTexEnvs;	// the stages after these are dummies
+	bglTexEnvState TexEnv[6];
+	
+	u32 NumAttribs;
+	struct
+	{
+		GPU_FORMATS DataType;
+		u32 NumComponents;
+		
+	} Attrib[4];
+	
+} bglStateBlock;
+
 
 void bglInit();
 void bglDeInit();
 
+void bglInvalidateState();
+void bglApplyState(const bglStateBlock* block);
+
 void bglUseShader(shaderProgram_s* shader);
 
 void bglUniform(GPU_SHADER_TYPE type, u32 id, float* val);
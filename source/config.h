@@ -25,6 +25,11 @@ typedef struct
 	int ScaleMode;
 	char DirPath[0x106];
 	int HardwareMode7;
+	int TimingHUD;
+	int Rewind;
+	int RunAhead;
+	int RenderThreads;
+	int PipelineFrames;
 } Config_t;
 
 extern Config_t Config;
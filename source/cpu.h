@@ -58,8 +58,14 @@ typedef struct
 
 extern CPU_Regs_t CPU_Regs;
 
+// master cycles skipped by the idle loop detection during the last frame
+extern u32 CPU_IdleCycles;
+
 	
 void CPU_Reset();
+// recomputes the internal bits of CPU_Regs after the registers were changed
+// from outside (savestates)
+void CPU_FixupRegs();
 void CPU_Run();
 
 void CPU_TriggerIRQ();
@@ -487,6 +487,7 @@ OpTableStart:
 @ --- Misc. functions ---------------------------------------------------------
 	
 .global CPU_Reset
+.global CPU_FixupRegs
 .global CPU_Run
 .global CPU_TriggerIRQ
 .global CPU_TriggerNMI
@@ -542,6 +543,27 @@ CPU_Reset:
 	ldmia sp!, {r3-r12, lr}
 	bx lr
 	
+CPU_FixupRegs:
+	stmdb sp!, {r3-r12, lr}
+	
+	LoadRegs
+	ldr memoryMap, =Mem_PtrTable
+	ldr memoryMap, [memoryMap]
+	SetOpcodeTable
+	StoreRegs
+	
+	ldmia sp!, {r3-r12, lr}
+	bx lr
+	
+@ lets the profiler know the next opcode is the start of an interrupt handler
+.macro ProfInterrupt
+#ifdef PROFILER
+	ldr r0, =Prof_CPUIntPending
+	mov r1, #1
+	strb r1, [r0]
+#endif
+.endm
+
 CPU_TriggerIRQ:
 	tst snesP, #flagI
 	bic snesP, #flagW
@@ -574,6 +596,7 @@ irq_nostack:
 	subne r0, r0, #vec_e1_IRQ
 	ldrh r0, [r0]
 	SetPC
+	ProfInterrupt
 	bx lr
 	
 CPU_TriggerNMI:
@@ -606,7 +629,8 @@ nmi_nostack:
 	subne r0, r0, #vec_e1_NMI
 	ldrh r0, [r0]
 	SetPC
-	b cpuloop
+	ProfInterrupt
+	bx lr
 	
 @ --- Main loop ---------------------------------------------------------------
 
@@ -616,6 +640,11 @@ nmi_nostack:
 debugpc:
 	.long 0
 
+@ master cycles skipped by the idle loop detection during the current frame
+.global CPU_IdleCycles
+CPU_IdleCycles:
+	.long 0
+
 	
 .text
 
@@ -623,6 +652,13 @@ debugpc:
 CPU_Run:
 	stmdb sp!, {r3, lr}
 	
+	@ the low hword of snesCycles is the end of the slice we have to run
+	@ within it, the CPU runs straight up to the next event (IRQ or end of slice)
+	@ so there's no need to check for IRQs after every instruction
+	mov r0, snesCycles, lsl #16
+	mov r0, r0, lsr #16
+	strh r0, [snesStatus, #SliceEnd]
+	
 	@ TODO finish this
 	@tst snesP, #flagDMA
 	@addne r0, snesCycles, #7
@@ -632,39 +668,65 @@ CPU_Run:
 	@sub r2, r2, r0
 	
 	tst snesP, #flagNMI
-	bne CPU_TriggerNMI
+	blne CPU_TriggerNMI
+	
+run_events:
+	@ H/V IRQ
+	ldrb r3, [snesStatus, #HVBFlags]
+	ldrh r0, [snesStatus, #IRQ_CurHMatch]
+	cmp r0, snesCycles, asr #16
+	movle r0, #0x8000
+	strleh r0, [snesStatus, #IRQ_CurHMatch]
+	orrle r3, r3, #0x10
+	strleb r3, [snesStatus, #HVBFlags]
+	
+	tst r3, #0x10
+	blne CPU_TriggerIRQ
+	
+	@ run until the next event
+	ldrh r0, [snesStatus, #IRQ_CurHMatch]
+	ldrh r1, [snesStatus, #SliceEnd]
+	cmp r0, r1
+	movgt r0, r1
+	mov snesCycles, snesCycles, lsr #16
+	orr snesCycles, r0, snesCycles, lsl #16
 	
 	@ do not execute if we're waiting for an IRQ
 	tst snesP, #flagW
 	beq cpuloop
 	mov snesCycles, snesCycles, lsl #16
 	orr snesCycles, snesCycles, lsr #16
-	ldmia sp!, {r3, pc}
+	b run_next
 	
 cpuloop:
-		ldrb r3, [snesStatus, #HVBFlags]
-		
-		@ check for IRQ
-		ldrh r0, [snesStatus, #IRQ_CurHMatch]
-		cmp r0, snesCycles, asr #16
-		bgt _noirq
-		mov r0, #0x8000
-		strh r0, [snesStatus, #IRQ_CurHMatch]
-		orr r3, r3, #0x10
-		strb r3, [snesStatus, #HVBFlags]
-	_noirq:
-	
-		tst r3, #0x10
-		blne CPU_TriggerIRQ
-		
 		OpcodePrefetch8
 		str snesCycles, [snesStatus, #HCountFull]
+#ifdef PROFILER
+		@ Prof_CPUOp(opcode, PBR:PC of the opcode, current cycle)
+		@ r2/r3 hold the fetch pointer and map flags for the operand prefetches
+		stmdb sp!, {r0, r2, r3, r12}
+		sub r1, snesPC, #0x10000
+		mov r1, r1, lsr #0x10
+		and r2, snesPBR, #0xFF
+		orr r1, r1, r2, lsl #0x10
+		mov r2, snesCycles, asr #0x10
+		bl Prof_CPUOp
+		ldmia sp!, {r0, r2, r3, r12}
+#endif
 		ldr pc, [opTable, r0, lsl #0x2]
 		
 	op_return:
 		cmp snesCycles, snesCycles, lsl #16
 		blt cpuloop
+		
+run_next:
+	@ keep going if that wasn't the end of the slice
+	ldrh r0, [snesStatus, #SliceEnd]
+	cmp r0, snesCycles, asr #16
+	bgt run_events
 	
+	mov snesCycles, snesCycles, lsr #16
+	orr snesCycles, r0, snesCycles, lsl #16
 	ldmia sp!, {r3, pc}
 	
 	
@@ -676,6 +738,10 @@ CPU_MainLoop:
 	
 	SafeCall DMA_ReloadHDMA
 	
+	ldr r0, =CPU_IdleCycles
+	mov r1, #0
+	str r1, [r0]
+	
 	mov r3, #0
 	mov snesCycles, snesCycles, lsr #16
 	mov snesCycles, snesCycles, lsl #16
@@ -735,17 +801,19 @@ lineloop1:
 		bl CPU_Run
 		
 		@ run the SPC700
+		@ only whole cycles are run, the fractional part carries over to the next line
 		mov r0, snesCycles, asr #16
 		ldr r1, [snesStatus, #SPC_CycleRatio]
 		mul r2, r1, r0
 		ldr r1, [snesStatus, #SPC_LastCycle]
 		sub r0, r2, r1
-		ldr r1, [snesStatus, #SPC_CyclesPerLine]
-		sub r2, r2, r1
-		str r2, [snesStatus, #SPC_LastCycle]
-		movs r0, r0, asr #24
-		movmis r0, #0
-		blne SPC_Run
+		mov r0, r0, asr #24
+		cmp r0, #0
+		addgt r1, r1, r0, lsl #24
+		ldr r2, [snesStatus, #SPC_CyclesPerLine]
+		sub r1, r1, r2
+		str r1, [snesStatus, #SPC_LastCycle]
+		blgt SPC_Run
 		
 		ldr r0, =((1364<<16) + 340)
 		sub snesCycles, snesCycles, r0
@@ -810,17 +878,19 @@ lineloop2:
 		bl CPU_Run
 		
 		@ run the SPC700
+		@ only whole cycles are run, the fractional part carries over to the next line
 		mov r0, snesCycles, asr #16
 		ldr r1, [snesStatus, #SPC_CycleRatio]
 		mul r2, r1, r0
 		ldr r1, [snesStatus, #SPC_LastCycle]
 		sub r0, r2, r1
-		ldr r1, [snesStatus, #SPC_CyclesPerLine]
-		sub r2, r2, r1
-		str r2, [snesStatus, #SPC_LastCycle]
-		movs r0, r0, asr #24
-		movmis r0, #0
-		blne SPC_Run
+		mov r0, r0, asr #24
+		cmp r0, #0
+		addgt r1, r1, r0, lsl #24
+		ldr r2, [snesStatus, #SPC_CyclesPerLine]
+		sub r1, r1, r2
+		str r1, [snesStatus, #SPC_LastCycle]
+		blgt SPC_Run
 		
 		ldr r0, =(1364<<16)
 		sub snesCycles, snesCycles, r0
@@ -846,6 +916,18 @@ frame_end:
 	mov snesCycles, snesCycles, lsl #16
 	orr snesCycles, snesCycles, lsr #16
 .endm
+
+@ if the I flag got cleared while the IRQ line is still asserted, end the run
+@ right now so CPU_Run() takes the IRQ
+.macro CheckPendingIRQ
+	tst snesP, #flagI
+	bne 1f
+	ldrb r0, [snesStatus, #HVBFlags]
+	tst r0, #0x10
+	movne snesCycles, snesCycles, lsr #16
+	orrne snesCycles, snesCycles, snesCycles, lsl #16
+1:
+.endm
 	
 @ --- Addressing modes --------------------------------------------------------
 @ TODO: indexed addressing modes must add one cycle if adding index crosses a
@@ -1538,12 +1620,136 @@ OP_m1_ASL_DPIndX:
 1:
 	.endif
 	Prefetch8
+	cmp r0, #0xF8
+	bhs branch_idlecheck
 	mov r0, r0, lsl #0x18
 	add snesPC, snesPC, r0, asr #0x8
 	AddCycles 1
 	b op_return
 .endm
 
+@ short backward branch (-8 to -2): take it, then check whether it's an idle loop
+@ idle loops are loops that just poll something that can't change before the next
+@ IRQ, the HBlank or the end of the scanline, like:
+@   LDA $4212 / BPL -
+@   LDA $10 / AND #$80 / BEQ -
+@   BRA *
+@ these are skipped straight to that point instead of being run for real
+@ r0 = branch offset, r2 = pointer to it
+
+branch_idlecheck:
+	mov r0, r0, lsl #0x18
+	add snesPC, snesPC, r0, asr #0x8
+	AddCycles 1
+	
+	sub lr, r2, #1			@ lr = pointer to the branch opcode
+	add r2, r2, #1
+	add r2, r2, r0, asr #0x18	@ r2 = pointer to the start of the loop
+	sub r1, lr, r2			@ r1 = size of the loop body
+	cmp r1, #0
+	beq idle_skip			@ branch to itself
+	
+	@ first instruction should be a load/compare (LDA/LDX/LDY/BIT/CMP)
+	ldrb r3, [r2]
+	cmp r3, #0xA5
+	cmpne r3, #0x24
+	cmpne r3, #0xC5
+	cmpne r3, #0xA6
+	cmpne r3, #0xA4
+	beq idle_dp
+	cmp r3, #0xAD
+	cmpne r3, #0x2C
+	cmpne r3, #0xCD
+	cmpne r3, #0xAE
+	cmpne r3, #0xAC
+	beq idle_abs
+	cmp r3, #0xAF
+	bne op_return
+	
+	ldrb r0, [r2, #1]
+	ldrb r3, [r2, #2]
+	orr r0, r0, r3, lsl #8
+	ldrb r3, [r2, #3]
+	orr r0, r0, r3, lsl #16
+	subs r1, r1, #4
+	b idle_checkimm
+	
+idle_abs:
+	ldrb r0, [r2, #1]
+	ldrb r3, [r2, #2]
+	orr r0, r0, r3, lsl #8
+	and r3, snesDBR, #0xFF
+	orr r0, r0, r3, lsl #16
+	subs r1, r1, #3
+	b idle_checkimm
+	
+idle_dp:
+	ldrb r0, [r2, #1]
+	add r0, r0, snesD, lsr #0x10
+	subs r1, r1, #2
+	
+idle_checkimm:
+	@ then there can be an AND/CMP/BIT #imm
+	beq idle_checkaddr
+	sub r3, lr, r1
+	ldrb r3, [r3]
+	cmp r3, #0x29
+	cmpne r3, #0xC9
+	cmpne r3, #0x89
+	bne op_return
+	tst snesP, #flagM
+	subeq r1, r1, #1
+	cmp r1, #2
+	bne op_return
+	
+idle_checkaddr:
+	@ r0 = polled address
+	@ plain memory can only be changed by an IRQ/NMI handler
+	bic r3, r0, #0x1800
+	ldr r3, [memoryMap, r3, lsr #0xB]
+	tst r3, #0x2
+	beq idle_skip
+	
+	@ I/O: only a few registers are safe to skip on
+	@ (not $2140-$2143, reading those catches up the SPC700)
+	mov r0, r0, lsl #0x10
+	mov r0, r0, lsr #0x10
+	mov r3, #0x4200
+	orr r3, r3, #0x10
+	cmp r0, r3				@ RDNMI, set at the start of VBlank
+	addne r3, r3, #1
+	cmpne r0, r3			@ TIMEUP, set when the IRQ fires
+	beq idle_skip
+	mov r3, #0x2100
+	orr r3, r3, #0x37
+	cmp r0, r3				@ SLHV
+	beq idle_skip
+	mov r3, #0x4200
+	orr r3, r3, #0x12
+	cmp r0, r3				@ HVBJOY, the HBlank flag changes at 1024
+	bne op_return
+	mov r1, #1024
+	cmp r1, snesCycles, asr #0x10
+	bgt idle_skip_cap
+	
+idle_skip:
+	mov r1, #0x8000
+idle_skip_cap:
+	ldrh r0, [snesStatus, #IRQ_CurHMatch]
+	cmp r0, r1
+	movgt r0, r1
+	mov r3, snesCycles, lsl #0x10
+	cmp r0, r3, lsr #0x10
+	movgt r0, r3, lsr #0x10
+	subs r1, r0, snesCycles, asr #0x10
+	ble op_return
+	add snesCycles, snesCycles, r1, lsl #0x10
+	ldr r3, =CPU_IdleCycles
+	ldr r0, [r3]
+	add r0, r0, r1
+	str r0, [r3]
+	b op_return
+
 OP_BCC:
 	BRANCH flagC, 0
 
@@ -1711,6 +1917,7 @@ OP_CLD:
 OP_CLI:
 	bic snesP, snesP, #flagI
 	AddCycles 1
+	CheckPendingIRQ
 	b op_return
 	
 @ --- CLV ---------------------------------------------------------------------
@@ -3288,6 +3495,7 @@ OP_PLP:
 	orr snesP, snesP, r0
 	UpdateCPUMode
 	AddCycles 2
+	CheckPendingIRQ
 	b op_return
 	
 @ --- PLX ---------------------------------------------------------------------
@@ -3340,6 +3548,7 @@ OP_e0_REP:
 	GetOp_Imm 8
 	bic snesP, snesP, r0
 	UpdateCPUMode
+	CheckPendingIRQ
 	b op_return
 	
 OP_e1_REP:
@@ -3347,6 +3556,7 @@ OP_e1_REP:
 	bic r0, r0, #(flagM|flagX)
 	bic snesP, snesP, r0
 	UpdateCPUMode
+	CheckPendingIRQ
 	b op_return
 	
 .ltorg
@@ -3591,6 +3801,7 @@ OP_e0_RTI:
 	bic snesPBR, snesPBR, #0xFF
 	orr snesPBR, snesPBR, r0
 	AddCycles 2
+	CheckPendingIRQ
 	b op_return
 	
 OP_e1_RTI:
@@ -3602,6 +3813,7 @@ OP_e1_RTI:
 	StackRead16
 	SetPC
 	AddCycles 2
+	CheckPendingIRQ
 	b op_return
 	
 .ltorg
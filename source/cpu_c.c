@@ -0,0 +1,1635 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// portable C version of the 65C816 core (cpu.s + mem_io.s)
+// meant for running the CPU on something that isn't an ARM11 (profiling, testing, etc)
+// it is meant to behave exactly like the asm core, quirks included, so don't fix
+// anything here without fixing it in cpu.s too
+//
+// the 3DS build still uses cpu.s
+
+#ifndef ARM11
+
+#include <stdint.h>
+
+#include "snes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "spc700.h"
+#include "profile.h"
+
+
+#define flagC	0x01
+#define flagZ	0x02
+#define flagI	0x04
+#define flagD	0x08
+#define flagX	0x10
+#define flagB	0x10
+#define flagM	0x20
+#define flagV	0x40
+#define flagN	0x80
+#define flagE	0x100
+#define flagW	0x200
+#define flagNMI	0x400
+
+#define vec_e0_IRQ	0x12
+#define vec_e0_NMI	0x16
+#define vec_e1_IRQ	0x2
+#define vec_e1_NMI	0x6
+#define vec_Reset	0x4
+
+
+CPU_Regs_t CPU_Regs;
+u32 debugpc = 0;
+u32 CPU_IdleCycles = 0;
+
+void DMA_ReloadHDMA();
+void DMA_DoHDMA();
+void ReportCrash();
+
+// live registers, same as r6-r12 in cpu.s
+// they live in CPU_Regs between frames
+static u32 snesA, snesX, snesY;
+static u32 snesP;
+static u32 snesPC, snesPBR;
+static u32 snesD, snesDBR;
+static u32 snesS;
+static s32 snesCycles;		// current master cycle within the scanline
+static s32 snesTarget;		// CPU_Run() runs until snesCycles reaches this
+
+// opcode fetch state
+static u8* opPtr;
+static u32 opCost;
+static u8 openBusOp[4];
+
+static bool stopped;
+
+
+#define AddCycles(n) snesCycles += (n) * 6
+#define EatCycles() snesCycles = snesTarget
+
+#define MPTR(ptr) ((u8*)(uintptr_t)((ptr) & ~0xF))
+#define MPTR_ENTRY(addr) Mem_PtrTable[((addr) >> 13) & 0x7FF]
+
+
+static void LoadRegs()
+{
+	snesA = CPU_Regs.A;
+	snesX = CPU_Regs.X;
+	snesY = CPU_Regs.Y;
+	snesP = CPU_Regs.P.val;
+	snesPC = CPU_Regs.PC;
+	snesPBR = CPU_Regs.PBR;
+	snesD = CPU_Regs.D;
+	snesDBR = CPU_Regs.DBR;
+	snesS = CPU_Regs.S;
+	snesCycles = CPU_Regs.nCycles;
+	snesTarget = CPU_Regs.nLines;
+}
+
+static void StoreRegs()
+{
+	CPU_Regs._memoryMap = (u32)(uintptr_t)Mem_PtrTable;
+	CPU_Regs.A = snesA;
+	CPU_Regs.X = snesX;
+	CPU_Regs.Y = snesY;
+	CPU_Regs.P.val = snesP;
+	CPU_Regs.PC = snesPC;
+	CPU_Regs.PBR = snesPBR;
+	CPU_Regs.D = snesD;
+	CPU_Regs.DBR = snesDBR;
+	CPU_Regs.S = snesS;
+	CPU_Regs.nCycles = snesCycles;
+	CPU_Regs.nLines = snesTarget;
+}
+
+static void UpdateCPUMode()
+{
+	if (snesP & flagE)
+		snesS = 0x100 | (snesS & 0xFF);
+
+	if (snesP & (flagE|flagX))
+	{
+		snesX &= 0xFF;
+		snesY &= 0xFF;
+	}
+}
+
+
+// run until the next event: the IRQ or the end of the slice
+static void NextEvent()
+{
+	snesTarget = SNES_Status->IRQ_CurHMatch;
+	if (snesTarget > SNES_Status->SliceEnd)
+		snesTarget = SNES_Status->SliceEnd;
+}
+
+// if the I flag got cleared while the IRQ line is still asserted, end the run
+// right now so CPU_Run() takes the IRQ
+static void CheckPendingIRQ()
+{
+	if (!(snesP & flagI) && (SNES_Status->HVBFlags & 0x10))
+		snesTarget = snesCycles;
+}
+
+
+// --- I/O (mem_io.s) ----------------------------------------------------------
+
+#define IO_PAGE(addr) IO_Pages[((addr) >> 8) & 0xFF]
+
+u8 SNES_IORead8(u32 addr)
+{
+	IO_Page* page = IO_PAGE(addr);
+	snesCycles += page->Cycles;
+	return page->Read8[addr & 0xFF](addr & 0xFF);
+}
+
+u16 SNES_IORead16(u32 addr)
+{
+	IO_Page* page = IO_PAGE(addr);
+	snesCycles += page->Cycles << 1;
+	return page->Read16[addr & 0xFF](addr & 0xFF);
+}
+
+void SNES_IOWrite8(u32 addr, u32 val)
+{
+	IO_Page* page = IO_PAGE(addr);
+	snesCycles += page->Cycles;
+	page->Write8[addr & 0xFF](addr & 0xFF, val);
+}
+
+void SNES_IOWrite16(u32 addr, u32 val)
+{
+	IO_Page* page = IO_PAGE(addr);
+	snesCycles += page->Cycles << 1;
+	page->Write16[addr & 0xFF](addr & 0xFF, val);
+}
+
+// $42xx writes may reschedule the IRQ
+
+void IO_GIOWrite8(u32 addr, u8 val)
+{
+	SNES_GIOWrite8(addr, val);
+	NextEvent();
+}
+
+void IO_GIOWrite16(u32 addr, u16 val)
+{
+	SNES_GIOWrite16(addr, val);
+	NextEvent();
+}
+
+
+// --- Memory access -----------------------------------------------------------
+
+static u32 MemRead8(u32 addr)
+{
+	u32 ptr = MPTR_ENTRY(addr);
+	u32 val;
+
+	snesCycles += (ptr & MPTR_SLOW) ? 8 : 6;
+
+	if (ptr & MPTR_SPECIAL)
+		val = SNES_IORead8(addr);
+	else
+	{
+		if (ptr & MPTR_SRAM) addr &= SNES_Status->SRAMMask;
+		val = MPTR(ptr)[addr & 0x1FFF];
+	}
+
+	SNES_Status->LastBusVal = val;
+	return val;
+}
+
+static u32 MemRead16(u32 addr)
+{
+	u32 ptr = MPTR_ENTRY(addr);
+	u32 val;
+
+	snesCycles += (ptr & MPTR_SLOW) ? 16 : 12;
+
+	if (ptr & MPTR_SPECIAL)
+		val = SNES_IORead16(addr);
+	else
+	{
+		u8* mem;
+		if (ptr & MPTR_SRAM) addr &= SNES_Status->SRAMMask;
+		mem = &MPTR(ptr)[addr & 0x1FFF];
+		val = mem[0] | (mem[1] << 8);
+	}
+
+	SNES_Status->LastBusVal = val >> 8;
+	return val;
+}
+
+static u32 MemRead24(u32 addr)
+{
+	u32 ptr = MPTR_ENTRY(addr);
+	u32 val;
+
+	snesCycles += (ptr & MPTR_SLOW) ? 24 : 18;
+
+	// cpu.s doesn't check for I/O here, but it would just crash
+	if (ptr & MPTR_SPECIAL)
+		val = SNES_IORead16(addr) | (SNES_IORead8(addr+2) << 16);
+	else
+	{
+		u8* mem;
+		if (ptr & MPTR_SRAM) addr &= SNES_Status->SRAMMask;
+		mem = &MPTR(ptr)[addr & 0x1FFF];
+		val = mem[0] | (mem[1] << 8) | (mem[2] << 16);
+	}
+
+	SNES_Status->LastBusVal = val >> 16;
+	return val;
+}
+
+static void MemWrite8(u32 addr, u32 val)
+{
+	u32 ptr = MPTR_ENTRY(addr);
+
+	snesCycles += (ptr & MPTR_SLOW) ? 8 : 6;
+
+	if (ptr & MPTR_READONLY) return;
+	if (ptr & MPTR_SPECIAL)
+	{
+		SNES_IOWrite8(addr, val & 0xFF);
+		return;
+	}
+
+	if (ptr & MPTR_SRAM)
+	{
+		addr &= SNES_Status->SRAMMask;
+		SNES_Status->SRAMDirty = ptr;
+	}
+	MPTR(ptr)[addr & 0x1FFF] = val;
+}
+
+static void MemWrite16(u32 addr, u32 val)
+{
+	u32 ptr = MPTR_ENTRY(addr);
+	u8* mem;
+
+	snesCycles += (ptr & MPTR_SLOW) ? 16 : 12;
+
+	if (ptr & MPTR_READONLY) return;
+	if (ptr & MPTR_SPECIAL)
+	{
+		SNES_IOWrite16(addr, val & 0xFFFF);
+		return;
+	}
+
+	if (ptr & MPTR_SRAM)
+	{
+		addr &= SNES_Status->SRAMMask;
+		SNES_Status->SRAMDirty = ptr;
+	}
+	mem = &MPTR(ptr)[addr & 0x1FFF];
+	mem[0] = val;
+	mem[1] = val >> 8;
+}
+
+
+// stack accesses always take 8 cycles per byte
+
+static u32 StackRead8()
+{
+	u32 ptr, val;
+
+	snesS = (snesS + 1) & 0xFFFF;
+	ptr = MPTR_ENTRY(snesS);
+	snesCycles += 8;
+
+	val = MPTR(ptr)[snesS & 0x1FFF];
+	SNES_Status->LastBusVal = val;
+	return val;
+}
+
+static u32 StackRead16()
+{
+	u32 ptr, val;
+	u8* mem;
+
+	snesS = (snesS + 2) & 0xFFFF;
+	ptr = MPTR_ENTRY(snesS);
+	snesCycles += 16;
+
+	mem = &MPTR(ptr)[snesS & 0x1FFF];
+	val = mem[-1] | (mem[0] << 8);
+	SNES_Status->LastBusVal = val >> 8;
+	return val;
+}
+
+static void StackWrite8(u32 val)
+{
+	u32 ptr = MPTR_ENTRY(snesS);
+
+	snesCycles += 8;
+	if (!(ptr & MPTR_READONLY))
+		MPTR(ptr)[snesS & 0x1FFF] = val;
+
+	snesS = (snesS - 1) & 0xFFFF;
+}
+
+static void StackWrite16(u32 val)
+{
+	u32 ptr = MPTR_ENTRY(snesS);
+
+	snesCycles += 16;
+	if (!(ptr & MPTR_READONLY))
+	{
+		u8* mem = &MPTR(ptr)[snesS & 0x1FFF];
+		mem[-1] = val;
+		mem[0] = val >> 8;
+	}
+
+	snesS = (snesS - 2) & 0xFFFF;
+}
+
+
+// operand fetches read straight from the opcode pointer, like in cpu.s
+
+static u32 OpcodePrefetch8()
+{
+	u32 ptr = MPTR_ENTRY((snesPBR << 16) | snesPC);
+
+	opCost = (ptr & MPTR_SLOW) ? 8 : 6;
+	snesCycles += opCost;
+
+	if (!(ptr & ~0xF))
+	{
+		// executing open bus
+		u8 val = SNES_Status->LastBusVal;
+		openBusOp[0] = val; openBusOp[1] = val;
+		openBusOp[2] = val; openBusOp[3] = val;
+		opPtr = &openBusOp[0];
+		return val;
+	}
+
+	opPtr = &MPTR(ptr)[snesPC & 0x1FFF];
+	snesPC = (snesPC + 1) & 0xFFFF;
+	SNES_Status->LastBusVal = opPtr[0];
+	return opPtr[0];
+}
+
+static u32 Prefetch8()
+{
+	snesCycles += opCost;
+	snesPC = (snesPC + 1) & 0xFFFF;
+	opPtr++;
+	return opPtr[0];
+}
+
+static u32 Prefetch16()
+{
+	u32 val;
+
+	snesCycles += opCost << 1;
+	snesPC = (snesPC + 2) & 0xFFFF;
+	val = opPtr[1] | (opPtr[2] << 8);
+	opPtr += 2;
+	return val;
+}
+
+static u32 Prefetch24()
+{
+	u32 val;
+
+	snesCycles += opCost * 3;
+	snesPC = (snesPC + 3) & 0xFFFF;
+	val = opPtr[1] | (opPtr[2] << 8) | (opPtr[3] << 16);
+	opPtr += 3;
+	return val;
+}
+
+
+// --- Addressing modes --------------------------------------------------------
+
+// like in cpu.s, addresses aren't wrapped within banks
+
+static u32 Addr_DP()
+{
+	if (snesD & 0xFF) AddCycles(1);
+	return Prefetch8() + snesD;
+}
+
+static u32 Addr_DPIndX()
+{
+	AddCycles((snesD & 0xFF) ? 2 : 1);
+	return Prefetch8() + snesD + snesX;
+}
+
+static u32 Addr_DPIndY()
+{
+	AddCycles((snesD & 0xFF) ? 2 : 1);
+	return Prefetch8() + snesD + snesY;
+}
+
+static u32 Addr_DPIndirect()
+{
+	return MemRead16(Addr_DP()) | (snesDBR << 16);
+}
+
+static u32 Addr_DPIndirectLong()
+{
+	return MemRead24(Addr_DP());
+}
+
+static u32 Addr_DPIndIndirectX()
+{
+	return MemRead16(Addr_DPIndX()) | (snesDBR << 16);
+}
+
+static u32 Addr_DPIndirectIndY()
+{
+	return (MemRead16(Addr_DP()) + snesY) | (snesDBR << 16);
+}
+
+static u32 Addr_DPIndirectLongIndY()
+{
+	return MemRead24(Addr_DP()) + snesY;
+}
+
+static u32 Addr_Abs()
+{
+	return Prefetch16() | (snesDBR << 16);
+}
+
+static u32 Addr_AbsIndX()
+{
+	return (Prefetch16() + snesX) | (snesDBR << 16);
+}
+
+static u32 Addr_AbsIndY()
+{
+	return (Prefetch16() + snesY) | (snesDBR << 16);
+}
+
+static u32 Addr_AbsLong()
+{
+	return Prefetch24();
+}
+
+static u32 Addr_AbsLongIndX()
+{
+	return Prefetch24() + snesX;
+}
+
+static u32 Addr_SR()
+{
+	AddCycles(1);
+	return Prefetch8() + snesS;
+}
+
+static u32 Addr_SRIndirectIndY()
+{
+	AddCycles(2);
+	return (MemRead16(Prefetch8() + snesS) + snesY) | (snesDBR << 16);
+}
+
+
+// --- Operations --------------------------------------------------------------
+
+#define MEM8 (snesP & (flagE|flagM))
+#define IDX8 (snesP & (flagE|flagX))
+
+#define SetNZ8(v) \
+	snesP &= ~(flagN|flagZ); \
+	if ((v) & 0x80) snesP |= flagN; \
+	if (!((v) & 0xFF)) snesP |= flagZ;
+
+#define SetNZ16(v) \
+	snesP &= ~(flagN|flagZ); \
+	if ((v) & 0x8000) snesP |= flagN; \
+	if (!((v) & 0xFFFF)) snesP |= flagZ;
+
+static u32 ReadM(u32 addr) { return MEM8 ? MemRead8(addr) : MemRead16(addr); }
+static u32 ReadX(u32 addr) { return IDX8 ? MemRead8(addr) : MemRead16(addr); }
+static u32 ImmM() { return MEM8 ? Prefetch8() : Prefetch16(); }
+static u32 ImmX() { return IDX8 ? Prefetch8() : Prefetch16(); }
+
+static void WriteM(u32 addr, u32 val)
+{
+	if (MEM8) MemWrite8(addr, val);
+	else      MemWrite16(addr, val);
+}
+
+static void WriteX(u32 addr, u32 val)
+{
+	if (IDX8) MemWrite8(addr, val);
+	else      MemWrite16(addr, val);
+}
+
+static void PushM(u32 val)
+{
+	if (MEM8) StackWrite8(val & 0xFF);
+	else      StackWrite16(val);
+}
+
+static void PushX(u32 val)
+{
+	if (IDX8) StackWrite8(val);
+	else      StackWrite16(val);
+}
+
+
+static void Op_ORA(u32 val)
+{
+	snesA |= val;
+	if (MEM8) { SetNZ8(snesA); }
+	else      { SetNZ16(snesA); }
+}
+
+static void Op_AND(u32 val)
+{
+	if (MEM8)
+	{
+		snesA &= (val | 0xFF00);
+		SetNZ8(snesA);
+	}
+	else
+	{
+		snesA &= val;
+		SetNZ16(snesA);
+	}
+}
+
+static void Op_EOR(u32 val)
+{
+	snesA ^= val;
+	if (MEM8) { SetNZ8(snesA); }
+	else      { SetNZ16(snesA); }
+}
+
+static void Op_ADC(u32 val)
+{
+	u32 res;
+
+	if (MEM8)
+	{
+		res = (snesA & 0xFF) + val + (snesP & flagC);
+		if (snesP & flagD)
+		{
+			if ((res & 0x0F) >= 0x0A) res += 0x06;
+			if ((res & 0xF0) >= 0xA0) res += 0x60;
+		}
+
+		snesP &= ~(flagN|flagV|flagZ|flagC);
+		if (res & 0x80) snesP |= flagN;
+		if (res & 0x100) snesP |= flagC;
+		if (!((snesA ^ val) & 0x80) && ((snesA ^ res) & 0x80)) snesP |= flagV;
+
+		snesA = (snesA & 0xFF00) | (res & 0xFF);
+		if (!(res & 0xFF)) snesP |= flagZ;
+	}
+	else
+	{
+		res = snesA + val + (snesP & flagC);
+		if (snesP & flagD)
+		{
+			if ((res & 0x000F) >= 0x000A) res += 0x0006;
+			if ((res & 0x00F0) >= 0x00A0) res += 0x0060;
+			if ((res & 0x0F00) >= 0x0A00) res += 0x0600;
+			if ((res & 0xF000) >= 0xA000) res += 0x6000;
+		}
+
+		snesP &= ~(flagN|flagV|flagZ|flagC);
+		if (res & 0x8000) snesP |= flagN;
+		if (res & 0x10000) snesP |= flagC;
+		if (!((snesA ^ val) & 0x8000) && ((snesA ^ res) & 0x8000)) snesP |= flagV;
+
+		snesA = res & 0xFFFF;
+		if (!snesA) snesP |= flagZ;
+	}
+}
+
+static void Op_SBC(u32 val)
+{
+	u32 res;
+
+	if (MEM8)
+	{
+		res = (snesA & 0xFF) - val - (~snesP & flagC);
+		if (snesP & flagD)
+		{
+			if ((res & 0x0F) >= 0x0A) res -= 0x06;
+			if ((res & 0xF0) >= 0xA0) res -= 0x60;
+		}
+
+		snesP &= ~(flagN|flagV|flagZ|flagC);
+		if (res & 0x80) snesP |= flagN;
+		if (!(res & 0x100)) snesP |= flagC;
+		if (((snesA ^ val) & 0x80) && ((snesA ^ res) & 0x80)) snesP |= flagV;
+
+		snesA = (snesA & 0xFF00) | (res & 0xFF);
+		if (!(res & 0xFF)) snesP |= flagZ;
+	}
+	else
+	{
+		res = snesA - val - (~snesP & flagC);
+		if (snesP & flagD)
+		{
+			if ((res & 0x000F) >= 0x000A) res -= 0x0006;
+			if ((res & 0x00F0) >= 0x00A0) res -= 0x0060;
+			if ((res & 0x0F00) >= 0x0A00) res -= 0x0600;
+			if ((res & 0xF000) >= 0xA000) res -= 0x6000;
+		}
+
+		snesP &= ~(flagN|flagV|flagZ|flagC);
+		if (res & 0x8000) snesP |= flagN;
+		if (!(res & 0x10000)) snesP |= flagC;
+		if (((snesA ^ val) & 0x8000) && ((snesA ^ res) & 0x8000)) snesP |= flagV;
+
+		snesA = res & 0xFFFF;
+		if (!snesA) snesP |= flagZ;
+	}
+}
+
+static void Op_Compare(u32 reg, u32 val, bool is8)
+{
+	s32 res = (s32)reg - (s32)val;
+
+	snesP &= ~flagC;
+	if (res >= 0) snesP |= flagC;
+	if (is8) { SetNZ8(res); }
+	else     { SetNZ16(res); }
+}
+
+static void Op_CMP(u32 val) { Op_Compare(MEM8 ? (snesA & 0xFF) : snesA, val, MEM8); }
+static void Op_CPX(u32 val) { Op_Compare(snesX, val, IDX8); }
+static void Op_CPY(u32 val) { Op_Compare(snesY, val, IDX8); }
+
+static void Op_LDA(u32 val)
+{
+	if (MEM8)
+	{
+		snesA = (snesA & 0xFF00) | val;
+		SetNZ8(val);
+	}
+	else
+	{
+		snesA = val;
+		SetNZ16(val);
+	}
+}
+
+static void Op_LDX(u32 val)
+{
+	snesX = val;
+	if (IDX8) { SetNZ8(val); }
+	else      { SetNZ16(val); }
+}
+
+static void Op_LDY(u32 val)
+{
+	snesY = val;
+	if (IDX8) { SetNZ8(val); }
+	else      { SetNZ16(val); }
+}
+
+static void Op_BIT(u32 val)
+{
+	snesP &= ~(flagN|flagV|flagZ);
+	if (MEM8)
+	{
+		if (val & 0x80) snesP |= flagN;
+		if (val & 0x40) snesP |= flagV;
+	}
+	else
+	{
+		if (val & 0x8000) snesP |= flagN;
+		if (val & 0x4000) snesP |= flagV;
+	}
+	if (!(val & snesA)) snesP |= flagZ;
+}
+
+
+// read-modify-write ops, all of them take one extra cycle
+
+static u32 Op_ASL(u32 val)
+{
+	AddCycles(1);
+	snesP &= ~flagC;
+	if (MEM8)
+	{
+		if (val & 0x80) snesP |= flagC;
+		val = (val << 1) & 0xFF;
+		SetNZ8(val);
+	}
+	else
+	{
+		if (val & 0x8000) snesP |= flagC;
+		val = (val << 1) & 0xFFFF;
+		SetNZ16(val);
+	}
+	return val;
+}
+
+static u32 Op_LSR(u32 val)
+{
+	AddCycles(1);
+	snesP &= ~flagC;
+	if (val & 0x1) snesP |= flagC;
+	val >>= 1;
+	if (MEM8) { SetNZ8(val); }
+	else      { SetNZ16(val); }
+	return val;
+}
+
+static u32 Op_ROL(u32 val)
+{
+	u32 c = snesP & flagC;
+
+	AddCycles(1);
+	snesP &= ~flagC;
+	if (MEM8)
+	{
+		if (val & 0x80) snesP |= flagC;
+		val = ((val << 1) | c) & 0xFF;
+		SetNZ8(val);
+	}
+	else
+	{
+		if (val & 0x8000) snesP |= flagC;
+		val = ((val << 1) | c) & 0xFFFF;
+		SetNZ16(val);
+	}
+	return val;
+}
+
+static u32 Op_ROR(u32 val)
+{
+	u32 c = snesP & flagC;
+
+	AddCycles(1);
+	snesP &= ~flagC;
+	if (val & 0x1) snesP |= flagC;
+	if (MEM8)
+	{
+		val = (val >> 1) | (c << 7);
+		SetNZ8(val);
+	}
+	else
+	{
+		val = (val >> 1) | (c << 15);
+		SetNZ16(val);
+	}
+	return val;
+}
+
+static u32 Op_INC(u32 val)
+{
+	AddCycles(1);
+	if (MEM8) { val = (val + 1) & 0xFF; SetNZ8(val); }
+	else      { val = (val + 1) & 0xFFFF; SetNZ16(val); }
+	return val;
+}
+
+static u32 Op_DEC(u32 val)
+{
+	AddCycles(1);
+	if (MEM8) { val = (val - 1) & 0xFF; SetNZ8(val); }
+	else      { val = (val - 1) & 0xFFFF; SetNZ16(val); }
+	return val;
+}
+
+static u32 Op_TSB(u32 val)
+{
+	snesP &= ~flagZ;
+	if (!(val & snesA)) snesP |= flagZ;
+	return val | snesA;
+}
+
+static u32 Op_TRB(u32 val)
+{
+	snesP &= ~flagZ;
+	if (!(val & snesA)) snesP |= flagZ;
+	return val & ~snesA;
+}
+
+#define RMW(func, addrmode) \
+	{ \
+		u32 addr = addrmode(); \
+		WriteM(addr, func(ReadM(addr))); \
+	}
+
+#define RMW_A(func) \
+	if (MEM8) snesA = (snesA & 0xFF00) | func(snesA & 0xFF); \
+	else      snesA = func(snesA);
+
+#define TESTBIT(func, addrmode) \
+	{ \
+		u32 addr = addrmode(); \
+		WriteM(addr, func(ReadM(addr))); \
+		AddCycles(1); \
+	}
+
+
+// idle loop detection, see branch_idlecheck in cpu.s
+static void CheckIdleLoop(s32 offset)
+{
+	u8* loop = opPtr + 1 + offset;
+	u8* branch = opPtr - 1;
+	s32 size = branch - loop;
+	u32 addr, limit = 0x8000;
+	s32 skipto;
+
+	if (size > 0)
+	{
+		switch (loop[0])
+		{
+			case 0xA5: case 0x24: case 0xC5: case 0xA6: case 0xA4:
+				addr = loop[1] + snesD;
+				size -= 2;
+				break;
+
+			case 0xAD: case 0x2C: case 0xCD: case 0xAE: case 0xAC:
+				addr = loop[1] | (loop[2] << 8) | (snesDBR << 16);
+				size -= 3;
+				break;
+
+			case 0xAF:
+				addr = loop[1] | (loop[2] << 8) | (loop[3] << 16);
+				size -= 4;
+				break;
+
+			default:
+				return;
+		}
+
+		if (size)
+		{
+			u8 op = branch[-size];
+			if (op != 0x29 && op != 0xC9 && op != 0x89) return;
+			if (size != ((snesP & flagM) ? 2 : 3)) return;
+		}
+
+		if (MPTR_ENTRY(addr) & MPTR_SPECIAL)
+		{
+			switch (addr & 0xFFFF)
+			{
+				case 0x4210:
+				case 0x4211:
+				case 0x2137:
+					break;
+
+				case 0x4212:
+					if (snesCycles < 1024) limit = 1024;
+					break;
+
+				default:
+					return;
+			}
+		}
+	}
+
+	skipto = SNES_Status->IRQ_CurHMatch;
+	if (skipto > limit) skipto = limit;
+	if (skipto > snesTarget) skipto = snesTarget;
+
+	if (skipto > snesCycles)
+	{
+		CPU_IdleCycles += skipto - snesCycles;
+		snesCycles = skipto;
+	}
+}
+
+static void Branch(bool cond)
+{
+	if (cond)
+	{
+		s8 offset = (s8)Prefetch8();
+		snesPC = (snesPC + offset) & 0xFFFF;
+		AddCycles(1);
+
+		if (offset >= -8 && offset <= -2)
+			CheckIdleLoop(offset);
+	}
+	else
+		snesPC = (snesPC + 1) & 0xFFFF;
+}
+
+static void Interrupt(u32 vec_e0, u32 vec_e1)
+{
+	// skip the signature byte
+	snesPC = (snesPC + 1) & 0xFFFF;
+
+	if (snesP & flagE)
+	{
+		StackWrite16(snesPC);
+		snesP |= flagB;
+		StackWrite8(snesP & 0xFF);
+		snesP &= ~flagD;
+		snesP |= flagI;
+		snesPBR = 0;
+		snesPC = MemRead16(vec_e1);
+	}
+	else
+	{
+		StackWrite8(snesPBR);
+		StackWrite16(snesPC);
+		StackWrite8(snesP & 0xFF);
+		snesP &= ~flagD;
+		snesP |= flagI;
+		snesPBR = 0;
+		snesPC = MemRead16(vec_e0);
+	}
+}
+
+static void BlockMove(int dir)
+{
+	u32 dstbank = Prefetch8();
+	u32 srcbank = Prefetch8();
+	u32 val;
+
+	snesDBR = dstbank;
+	val = MemRead8(snesX | (srcbank << 16));
+	MemWrite8(snesY | (dstbank << 16), val);
+
+	snesX = (snesX + dir) & (IDX8 ? 0xFF : 0xFFFF);
+	snesY = (snesY + dir) & (IDX8 ? 0xFF : 0xFFFF);
+
+	if (snesA--)
+		snesPC = (snesPC - 3) & 0xFFFF;
+	snesA &= 0xFFFF;
+
+	AddCycles(2);
+}
+
+
+// ALU ops with all their addressing modes
+// (ORA 00, AND 20, EOR 40, ADC 60, LDA A0, CMP C0, SBC E0)
+#define ALU_OPS(base, func) \
+	case base+0x01: func(ReadM(Addr_DPIndIndirectX())); break; \
+	case base+0x03: func(ReadM(Addr_SR())); break; \
+	case base+0x05: func(ReadM(Addr_DP())); break; \
+	case base+0x07: func(ReadM(Addr_DPIndirectLong())); break; \
+	case base+0x09: func(ImmM()); break; \
+	case base+0x0D: func(ReadM(Addr_Abs())); break; \
+	case base+0x0F: func(ReadM(Addr_AbsLong())); break; \
+	case base+0x11: func(ReadM(Addr_DPIndirectIndY())); break; \
+	case base+0x12: func(ReadM(Addr_DPIndirect())); break; \
+	case base+0x13: func(ReadM(Addr_SRIndirectIndY())); break; \
+	case base+0x15: func(ReadM(Addr_DPIndX())); break; \
+	case base+0x17: func(ReadM(Addr_DPIndirectLongIndY())); break; \
+	case base+0x19: func(ReadM(Addr_AbsIndY())); break; \
+	case base+0x1D: func(ReadM(Addr_AbsIndX())); break; \
+	case base+0x1F: func(ReadM(Addr_AbsLongIndX())); break;
+
+#define RMW_OPS(base, func) \
+	case base+0x06: RMW(func, Addr_DP); break; \
+	case base+0x0E: RMW(func, Addr_Abs); break; \
+	case base+0x16: RMW(func, Addr_DPIndX); break; \
+	case base+0x1E: RMW(func, Addr_AbsIndX); break;
+
+
+static void CPU_Execute(u32 op)
+{
+	u32 val;
+
+	switch (op)
+	{
+		ALU_OPS(0x00, Op_ORA)
+		ALU_OPS(0x20, Op_AND)
+		ALU_OPS(0x40, Op_EOR)
+		ALU_OPS(0x60, Op_ADC)
+		ALU_OPS(0xA0, Op_LDA)
+		ALU_OPS(0xC0, Op_CMP)
+		ALU_OPS(0xE0, Op_SBC)
+
+		// STA
+		case 0x81: WriteM(Addr_DPIndIndirectX(), snesA); break;
+		case 0x83: WriteM(Addr_SR(), snesA); break;
+		case 0x85: WriteM(Addr_DP(), snesA); break;
+		case 0x87: WriteM(Addr_DPIndirectLong(), snesA); break;
+		case 0x8D: WriteM(Addr_Abs(), snesA); break;
+		case 0x8F: WriteM(Addr_AbsLong(), snesA); break;
+		case 0x91: WriteM(Addr_DPIndirectIndY(), snesA); break;
+		case 0x92: WriteM(Addr_DPIndirect(), snesA); break;
+		case 0x93: WriteM(Addr_SRIndirectIndY(), snesA); break;
+		case 0x95: WriteM(Addr_DPIndX(), snesA); break;
+		case 0x97: WriteM(Addr_DPIndirectLongIndY(), snesA); break;
+		case 0x99: WriteM(Addr_AbsIndY(), snesA); break;
+		case 0x9D: WriteM(Addr_AbsIndX(), snesA); break;
+		case 0x9F: WriteM(Addr_AbsLongIndX(), snesA); break;
+
+		// STX/STY/STZ
+		case 0x86: WriteX(Addr_DP(), snesX); break;
+		case 0x8E: WriteX(Addr_Abs(), snesX); break;
+		case 0x96: WriteX(Addr_DPIndY(), snesX); break;
+		case 0x84: WriteX(Addr_DP(), snesY); break;
+		case 0x8C: WriteX(Addr_Abs(), snesY); break;
+		case 0x94: WriteX(Addr_DPIndX(), snesY); break;
+		case 0x64: WriteM(Addr_DP(), 0); break;
+		case 0x74: WriteM(Addr_DPIndX(), 0); break;
+		case 0x9C: WriteM(Addr_Abs(), 0); break;
+		case 0x9E: WriteM(Addr_AbsIndX(), 0); break;
+
+		// LDX/LDY
+		case 0xA2: Op_LDX(ImmX()); break;
+		case 0xA6: Op_LDX(ReadX(Addr_DP())); break;
+		case 0xAE: Op_LDX(ReadX(Addr_Abs())); break;
+		case 0xB6: Op_LDX(ReadX(Addr_DPIndY())); break;
+		case 0xBE: Op_LDX(ReadX(Addr_AbsIndY())); break;
+		case 0xA0: Op_LDY(ImmX()); break;
+		case 0xA4: Op_LDY(ReadX(Addr_DP())); break;
+		case 0xAC: Op_LDY(ReadX(Addr_Abs())); break;
+		case 0xB4: Op_LDY(ReadX(Addr_DPIndX())); break;
+		case 0xBC: Op_LDY(ReadX(Addr_AbsIndX())); break;
+
+		// CPX/CPY
+		case 0xE0: Op_CPX(ImmX()); break;
+		case 0xE4: Op_CPX(ReadX(Addr_DP())); break;
+		case 0xEC: Op_CPX(ReadX(Addr_Abs())); break;
+		case 0xC0: Op_CPY(ImmX()); break;
+		case 0xC4: Op_CPY(ReadX(Addr_DP())); break;
+		case 0xCC: Op_CPY(ReadX(Addr_Abs())); break;
+
+		// BIT
+		case 0x89:
+			val = ImmM();
+			snesP &= ~flagZ;
+			if (!(val & snesA)) snesP |= flagZ;
+			break;
+		case 0x24: Op_BIT(ReadM(Addr_DP())); break;
+		case 0x2C: Op_BIT(ReadM(Addr_Abs())); break;
+		case 0x34: Op_BIT(ReadM(Addr_DPIndX())); break;
+		case 0x3C: Op_BIT(ReadM(Addr_AbsIndX())); break;
+
+		// shifts, INC/DEC
+		RMW_OPS(0x00, Op_ASL)
+		RMW_OPS(0x20, Op_ROL)
+		RMW_OPS(0x40, Op_LSR)
+		RMW_OPS(0x60, Op_ROR)
+		RMW_OPS(0xC0, Op_DEC)
+		RMW_OPS(0xE0, Op_INC)
+		case 0x0A: RMW_A(Op_ASL); break;
+		case 0x2A: RMW_A(Op_ROL); break;
+		case 0x4A: RMW_A(Op_LSR); break;
+		case 0x6A: RMW_A(Op_ROR); break;
+		case 0x1A: RMW_A(Op_INC); break;
+		case 0x3A: RMW_A(Op_DEC); break;
+
+		case 0x04: TESTBIT(Op_TSB, Addr_DP); break;
+		case 0x0C: TESTBIT(Op_TSB, Addr_Abs); break;
+		case 0x14: TESTBIT(Op_TRB, Addr_DP); break;
+		case 0x1C: TESTBIT(Op_TRB, Addr_Abs); break;
+
+		case 0xE8:
+			AddCycles(1);
+			if (IDX8) { snesX = (snesX + 1) & 0xFF; SetNZ8(snesX); }
+			else      { snesX = (snesX + 1) & 0xFFFF; SetNZ16(snesX); }
+			break;
+		case 0xC8:
+			AddCycles(1);
+			if (IDX8) { snesY = (snesY + 1) & 0xFF; SetNZ8(snesY); }
+			else      { snesY = (snesY + 1) & 0xFFFF; SetNZ16(snesY); }
+			break;
+		case 0xCA:
+			AddCycles(1);
+			if (IDX8) { snesX = (snesX - 1) & 0xFF; SetNZ8(snesX); }
+			else      { snesX = (snesX - 1) & 0xFFFF; SetNZ16(snesX); }
+			break;
+		case 0x88:
+			AddCycles(1);
+			if (IDX8) { snesY = (snesY - 1) & 0xFF; SetNZ8(snesY); }
+			else      { snesY = (snesY - 1) & 0xFFFF; SetNZ16(snesY); }
+			break;
+
+		// branches
+		case 0x10: Branch(!(snesP & flagN)); break;
+		case 0x30: Branch(snesP & flagN); break;
+		case 0x50: Branch(!(snesP & flagV)); break;
+		case 0x70: Branch(snesP & flagV); break;
+		case 0x80: Branch(true); break;
+		case 0x90: Branch(!(snesP & flagC)); break;
+		case 0xB0: Branch(snesP & flagC); break;
+		case 0xD0: Branch(!(snesP & flagZ)); break;
+		case 0xF0: Branch(snesP & flagZ); break;
+		case 0x82:
+			val = Prefetch16();
+			snesPC = (snesPC + val) & 0xFFFF;
+			AddCycles(1);
+			break;
+
+		// jumps
+		case 0x4C: snesPC = Prefetch16(); break;
+		case 0x5C:
+			val = Prefetch24();
+			snesPBR = val >> 16;
+			snesPC = val & 0xFFFF;
+			break;
+		case 0x6C: snesPC = MemRead16(Prefetch16()); break;
+		case 0x7C:
+			AddCycles(1);
+			val = Prefetch16() + (snesPBR << 16) + snesX;
+			snesPC = MemRead16(val);
+			break;
+		case 0xDC:
+			val = MemRead24(Prefetch16());
+			snesPBR = val >> 16;
+			snesPC = val & 0xFFFF;
+			break;
+		case 0x20:
+			val = Prefetch16();
+			StackWrite16((snesPC - 1) & 0xFFFF);
+			snesPC = val;
+			break;
+		case 0x22:
+			val = Prefetch24();
+			StackWrite8(snesPBR);
+			StackWrite16((snesPC - 1) & 0xFFFF);
+			snesPBR = val >> 16;
+			snesPC = val & 0xFFFF;
+			break;
+		case 0xFC:
+			val = MemRead16(Prefetch16() + (snesPBR << 16) + snesX);
+			StackWrite16((snesPC - 1) & 0xFFFF);
+			snesPC = val;
+			AddCycles(1);
+			break;
+		case 0x60:
+			snesPC = (StackRead16() + 1) & 0xFFFF;
+			AddCycles(3);
+			break;
+		case 0x6B:
+			snesPC = (StackRead16() + 1) & 0xFFFF;
+			snesPBR = StackRead8();
+			AddCycles(2);
+			break;
+		case 0x40:
+			if (snesP & flagE)
+			{
+				val = StackRead8() & ~(flagM|flagX);
+				snesP = (snesP & ~0xCF) | val;
+				UpdateCPUMode();
+				snesPC = StackRead16();
+			}
+			else
+			{
+				snesP = (snesP & ~0xFF) | StackRead8();
+				UpdateCPUMode();
+				snesPC = StackRead16();
+				snesPBR = StackRead8();
+			}
+			AddCycles(2);
+			CheckPendingIRQ();
+			break;
+
+		case 0x00: Interrupt(0xFFE6, 0xFFFE); break;
+		case 0x02: Interrupt(0xFFE4, 0xFFF4); break;
+
+		// stack
+		case 0x48: PushM(snesA); AddCycles(1); break;
+		case 0xDA: PushX(snesX); AddCycles(1); break;
+		case 0x5A: PushX(snesY); AddCycles(1); break;
+		case 0x8B: StackWrite8(snesDBR); AddCycles(1); break;
+		case 0x0B: StackWrite16(snesD); AddCycles(1); break;
+		case 0x4B: StackWrite8(snesPBR); AddCycles(1); break;
+		case 0x08: StackWrite8(snesP & 0xFF); AddCycles(1); break;
+		case 0xF4: StackWrite16(Prefetch16()); break;
+		case 0xD4: StackWrite16(MemRead16(Addr_DP())); break;
+		case 0x62:
+			val = Prefetch16();
+			StackWrite16((val + snesPC) & 0xFFFF);
+			break;
+		case 0x68:
+			if (MEM8) { val = StackRead8(); snesA = (snesA & 0xFF00) | val; SetNZ8(val); }
+			else      { snesA = StackRead16(); SetNZ16(snesA); }
+			AddCycles(2);
+			break;
+		case 0xFA:
+			if (IDX8) { snesX = StackRead8(); SetNZ8(snesX); }
+			else      { snesX = StackRead16(); SetNZ16(snesX); }
+			AddCycles(2);
+			break;
+		case 0x7A:
+			if (IDX8) { snesY = StackRead8(); SetNZ8(snesY); }
+			else      { snesY = StackRead16(); SetNZ16(snesY); }
+			AddCycles(2);
+			break;
+		case 0xAB:
+			snesDBR = StackRead8();
+			SetNZ8(snesDBR);
+			AddCycles(2);
+			break;
+		case 0x2B:
+			snesD = StackRead16();
+			SetNZ16(snesD);
+			AddCycles(2);
+			break;
+		case 0x28:
+			snesP = (snesP & ~0xFF) | StackRead8();
+			UpdateCPUMode();
+			AddCycles(2);
+			CheckPendingIRQ();
+			break;
+
+		// transfers
+		case 0xAA:
+			AddCycles(1);
+			if (IDX8) { snesX = snesA & 0xFF; SetNZ8(snesX); }
+			else      { snesX = snesA; SetNZ16(snesX); }
+			break;
+		case 0xA8:
+			AddCycles(1);
+			if (IDX8) { snesY = snesA & 0xFF; SetNZ8(snesY); }
+			else      { snesY = snesA; SetNZ16(snesY); }
+			break;
+		case 0x8A:
+			AddCycles(1);
+			if (MEM8) { snesA = (snesA & 0xFF00) | (snesX & 0xFF); SetNZ8(snesA); }
+			else      { snesA = snesX; SetNZ16(snesA); }
+			break;
+		case 0x98:
+			AddCycles(1);
+			if (MEM8) { snesA = (snesA & 0xFF00) | (snesY & 0xFF); SetNZ8(snesA); }
+			else      { snesA = snesY; SetNZ16(snesA); }
+			break;
+		case 0x9B:
+			// cpu.s tests bit 15 even in 8-bit mode
+			AddCycles(1);
+			snesY = snesX;
+			SetNZ16(snesY);
+			break;
+		case 0xBB:
+			AddCycles(1);
+			snesX = snesY;
+			SetNZ16(snesX);
+			break;
+		case 0x5B:
+			AddCycles(1);
+			snesD = snesA;
+			SetNZ16(snesD);
+			break;
+		case 0x7B:
+			AddCycles(1);
+			snesA = snesD;
+			SetNZ16(snesA);
+			break;
+		case 0x1B:
+			AddCycles(1);
+			if (snesP & flagE) snesS = 0x100 | (snesA & 0xFF);
+			else               snesS = snesA;
+			break;
+		case 0x3B:
+			AddCycles(1);
+			snesA = snesS;
+			SetNZ16(snesA);
+			break;
+		case 0xBA:
+			AddCycles(1);
+			if (IDX8) { snesX = snesS & 0xFF; SetNZ8(snesX); }
+			else      { snesX = snesS; SetNZ16(snesX); }
+			break;
+		case 0x9A:
+			AddCycles(1);
+			if (snesP & flagE) snesS = 0x100 | (snesX & 0xFF);
+			else               snesS = snesX;
+			break;
+		case 0xEB:
+			snesA = ((snesA >> 8) | (snesA << 8)) & 0xFFFF;
+			SetNZ8(snesA);
+			AddCycles(2);
+			break;
+
+		// flags
+		case 0x18: snesP &= ~flagC; AddCycles(1); break;
+		case 0x38: snesP |= flagC; AddCycles(1); break;
+		case 0x58: snesP &= ~flagI; AddCycles(1); CheckPendingIRQ(); break;
+		case 0x78: snesP |= flagI; AddCycles(1); break;
+		case 0xB8: snesP &= ~flagV; AddCycles(1); break;
+		case 0xD8: snesP &= ~flagD; AddCycles(1); break;
+		case 0xF8: snesP |= flagD; AddCycles(1); break;
+		case 0xC2:
+			val = Prefetch8();
+			if (snesP & flagE) val &= ~(flagM|flagX);
+			snesP &= ~val;
+			UpdateCPUMode();
+			CheckPendingIRQ();
+			break;
+		case 0xE2:
+			val = Prefetch8();
+			if (snesP & flagE) val &= ~(flagM|flagX);
+			snesP |= val;
+			UpdateCPUMode();
+			break;
+		case 0xFB:
+			if (!(snesP & flagE))
+			{
+				if (snesP & flagC)
+				{
+					snesP &= ~flagC;
+					snesP |= (flagE|flagM);
+					UpdateCPUMode();
+				}
+			}
+			else
+			{
+				if (!(snesP & flagC))
+				{
+					snesP &= ~flagE;
+					snesP |= (flagC|flagM|flagX);
+					UpdateCPUMode();
+				}
+			}
+			AddCycles(1);
+			break;
+
+		// misc
+		case 0x44: BlockMove(-1); break;
+		case 0x54: BlockMove(1); break;
+		case 0xEA: AddCycles(1); break;
+		case 0xCB:
+			snesP |= flagW;
+			EatCycles();
+			break;
+		case 0xDB:
+			StoreRegs();
+			ReportCrash();
+			stopped = true;
+			EatCycles();
+			break;
+
+		case 0x42:
+			{
+				// speed hack: idle loop branch (see the patcher)
+				u32 b;
+				bool cond;
+
+				EatCycles();
+				b = opPtr[1];
+				snesPC = (snesPC + 1) & 0xFFFF;
+
+				switch (b >> 5)
+				{
+					case 0: cond = !(snesP & flagN); break;
+					case 1: cond = (snesP & flagN); break;
+					case 2: cond = !(snesP & flagV); break;
+					case 3: cond = (snesP & flagV); break;
+					case 4: cond = !(snesP & flagC); break;
+					case 5: cond = (snesP & flagC); break;
+					case 6: cond = !(snesP & flagZ); break;
+					default: cond = (snesP & flagZ); break;
+				}
+
+				if (cond)
+					snesPC = (snesPC + (b & 0xF) - 0x10) & 0xFFFF;
+			}
+			break;
+	}
+}
+
+
+// --- Interrupts --------------------------------------------------------------
+
+static void PushInterrupt()
+{
+	u32 ptr = MPTR_ENTRY(snesS);
+
+	if (snesP & flagE)
+	{
+		snesS = (snesS - 3) & 0xFFFF;
+		snesCycles += 24;
+	}
+	else
+	{
+		snesS = (snesS - 4) & 0xFFFF;
+		snesCycles += 32;
+	}
+
+	if (!(ptr & MPTR_READONLY))
+	{
+		u8* mem = &MPTR(ptr)[snesS & 0x1FFF];
+		if (!(snesP & flagE)) mem[4] = snesPBR;
+		mem[2] = snesPC;
+		mem[3] = snesPC >> 8;
+		mem[1] = snesP;
+	}
+}
+
+static u32 ReadVector(u32 vec)
+{
+	u8* ptr = ROM_Bank0End - vec;
+	return ptr[0] | (ptr[1] << 8);
+}
+
+void CPU_TriggerIRQ()
+{
+	snesP &= ~flagW;
+	if (snesP & flagI) return;
+
+	PushInterrupt();
+
+	snesP &= ~flagD;
+	snesP |= flagI;
+	snesPBR = 0;
+	snesPC = ReadVector((snesP & flagE) ? vec_e1_IRQ : vec_e0_IRQ);
+#ifdef PROFILER
+	Prof_CPUIntPending = 1;
+#endif
+}
+
+void CPU_TriggerNMI()
+{
+	PushInterrupt();
+
+	snesP &= ~(flagD|flagW|flagNMI);
+	snesP |= flagI;
+	snesPBR = 0;
+	snesPC = ReadVector((snesP & flagE) ? vec_e1_NMI : vec_e0_NMI);
+#ifdef PROFILER
+	Prof_CPUIntPending = 1;
+#endif
+}
+
+
+// --- Main loop ---------------------------------------------------------------
+
+void CPU_Reset()
+{
+	SNES_Reset();
+
+	snesA = 0;
+	snesX = 0;
+	snesY = 0;
+	snesS = 0x01FF;
+	snesPBR = 0;
+	snesD = 0;
+	snesDBR = 0;
+	snesP = 0x134;
+	snesPC = ReadVector(vec_Reset);
+	snesCycles = 0;
+	snesTarget = 0;
+	stopped = false;
+
+	StoreRegs();
+}
+
+void CPU_FixupRegs()
+{
+	// there's no opcode table here, the rest is picked up by LoadRegs()
+	CPU_Regs._memoryMap = (u32)(uintptr_t)Mem_PtrTable;
+	CPU_Regs._opTable = 0;
+	stopped = false;
+}
+
+void CPU_Run()
+{
+	// snesTarget is the end of the slice we have to run
+	// within it, the CPU runs straight up to the next event (IRQ or end of slice)
+	SNES_Status->SliceEnd = snesTarget;
+
+	if (snesP & flagNMI)
+		CPU_TriggerNMI();
+
+	for (;;)
+	{
+		// H/V IRQ
+		if ((s32)SNES_Status->IRQ_CurHMatch <= snesCycles)
+		{
+			SNES_Status->IRQ_CurHMatch = 0x8000;
+			SNES_Status->HVBFlags |= 0x10;
+		}
+
+		if (SNES_Status->HVBFlags & 0x10)
+			CPU_TriggerIRQ();
+
+		NextEvent();
+
+		// do not execute if we're waiting for an IRQ
+		if (snesP & flagW)
+			EatCycles();
+		else
+		{
+			do
+			{
+				u32 op = OpcodePrefetch8();
+				SNES_Status->HCount = snesCycles;
+#ifdef PROFILER
+				Prof_CPUOp(op, (snesPBR << 16) | ((snesPC - 1) & 0xFFFF), snesCycles);
+#endif
+				CPU_Execute(op);
+			}
+			while (snesCycles < snesTarget);
+		}
+
+		// keep going if that wasn't the end of the slice
+		if (stopped || snesCycles >= SNES_Status->SliceEnd)
+			break;
+	}
+
+	snesTarget = SNES_Status->SliceEnd;
+}
+
+static void SetIRQMatch(u32 line)
+{
+	u16 match;
+
+	switch (SNES_Status->IRQCond & 0x30)
+	{
+		case 0x10: match = SNES_Status->IRQ_HMatch; break;
+		case 0x20: match = (SNES_Status->IRQ_VMatch == line) ? 0 : 0x8000; break;
+		case 0x30: match = (SNES_Status->IRQ_VMatch == line) ? SNES_Status->IRQ_HMatch : 0x8000; break;
+		default: match = 0x8000; break;
+	}
+
+	SNES_Status->IRQ_CurHMatch = match;
+}
+
+static void RunSPC()
+{
+	// only whole cycles are run, the fractional part carries over to the next line
+	s32 cyc = snesCycles * SNES_Status->SPC_CycleRatio;
+	s32 torun = (cyc - SNES_Status->SPC_LastCycle) >> 24;
+
+	if (torun > 0)
+		SNES_Status->SPC_LastCycle += torun << 24;
+	SNES_Status->SPC_LastCycle -= SNES_Status->SPC_CyclesPerLine;
+
+	if (torun > 0)
+		SPC_Run(torun);
+}
+
+void CPU_MainLoop()
+{
+	u32 line;
+
+	LoadRegs();
+	stopped = false;
+
+	DMA_ReloadHDMA();
+
+	CPU_IdleCycles = 0;
+
+	snesTarget = 1024;
+
+	for (line = 0; line <= SNES_Status->ScreenHeight; line++)
+	{
+		SNES_Status->VCount = line;
+		SetIRQMatch(line);
+
+		PPU_RenderScanline(SNES_Status->VCount);
+
+		// run until the HBlank
+		CPU_Run();
+		if (stopped) goto frame_end;
+
+		DMA_DoHDMA();
+
+		// run until the end of the scanline
+		snesTarget += 340;
+		CPU_Run();
+		if (stopped) goto frame_end;
+
+		RunSPC();
+
+		snesCycles -= 1364;
+		snesTarget -= 340;
+	}
+
+	snesTarget = 1024 + 340;
+
+	// VBlank
+	SNES_Status->HVBFlags |= 0xA0;
+	if (SNES_Status->IRQCond & 0x80)
+		snesP |= flagNMI;
+
+	PPU_VBlank();
+
+	for (; line < (SNES_Status->TotalLines << 1); line++)
+	{
+		SNES_Status->VCount = line;
+		SetIRQMatch(line);
+
+		CPU_Run();
+		if (stopped) goto frame_end;
+
+		RunSPC();
+
+		snesCycles -= 1364;
+	}
+
+	SNES_Status->HVBFlags &= ~0xA0;
+
+frame_end:
+	StoreRegs();
+}
+
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "snes.h"
 #include "ppu.h"
+#include "timing.h"
 
 
 u8 DMA_Chans[8*16];
@@ -90,14 +91,18 @@ void DMA_Enable(u8 flag)
 			{
 				while (bytecount > 1)
 				{
-					if (PPU.OAMAddr >= 0x200)
-					{
-						*(u16*)&PPU.OAM[PPU.OAMAddr & 0x21F] = SNES_Read16(membank|memaddr);
-					}
-					else
+					u16 val = SNES_Read16(membank|memaddr);
+					u16* oam = (u16*)&PPU.OAM[(PPU.OAMAddr >= 0x200) ? (PPU.OAMAddr & 0x21F) : PPU.OAMAddr];
+					
+					// the soft renderer's sprite lists only care about Y positions and the high table
+					u16 mask = (PPU.OAMAddr >= 0x200) ? 0xFFFF : ((PPU.OAMAddr & 0x2) ? 0 : 0xFF00);
+					if (*oam != val)
 					{
-						*(u16*)&PPU.OAM[PPU.OAMAddr] = SNES_Read16(membank|memaddr);
+						PPU_SYNC_SOFT();
+						if ((*oam ^ val) & mask)
+							PPU.OBJListDirty = 1;
 					}
+					*oam = val;
 					memaddr += maddrinc<<1;
 					bytecount -= 2;
 					PPU.OAMAddr += 2;
@@ -126,8 +131,10 @@ void DMA_Enable(u8 flag)
 					u32 newaddr = PPU_TranslateVRAMAddress(PPU.VRAMAddr);
 					if (newval != *(u16*)&PPU.VRAM[newaddr])
 					{
+						PPU_SYNC_SOFT();
 						*(u16*)&PPU.VRAM[newaddr] = newval;
 						PPU.VRAMUpdateCount[newaddr >> 4]++;
+						PPU.VRAMWrites++;
 						PPU.VRAM7[newaddr >> 1] = newval >> 8;
 						PPU.VRAM7UpdateCount[newaddr >> 7]++;
 					}
@@ -328,6 +335,7 @@ void DMA_DoHDMA()
 	if (flag)
 	{
 		int c;
+		Timing_Begin(TIMING_HDMA);
 		for (c = 0; c < 8; c++)
 		{
 			if (!(flag & (1 << c)))
@@ -546,5 +554,6 @@ void DMA_DoHDMA()
 			
 			*(u16*)&chan[8] = tableaddr;
 		}
+		Timing_End(TIMING_HDMA);
 	}
 }
@@ -400,10 +400,20 @@ void DspPrepareStateAfterReload() {
 extern Handle SPCSync;
 void DspReplayWriteByte(u8 val, u8 address);
 
+bool DSP_Muted = false;
+
 void DSP_BufferSwap()
 {
 	int i;
 	
+	if (DSP_Muted)
+	{
+		// nobody's going to hear this, drop the writes
+		for (i = 0; i < 32; i++)
+			DSP_WritingWriteBuffer[(i << 7) + 127] = 0;
+		return;
+	}
+	
 	u16* tmp = DSP_WritingWriteBuffer;
 	DSP_WritingWriteBuffer = DSP_PlayingWriteBuffer;
 	DSP_PlayingWriteBuffer = tmp;
@@ -25,6 +25,10 @@ extern s8 firFilter[16];
 void DspMixSamplesStereo(u32 samples, s16 *mixBuf);
 void DspWriteByte(u8 val, u8 address);
 
+// set for frames whose sound isn't played (run-ahead)
+extern bool DSP_Muted;
+extern u16* DSP_WritingWriteBuffer;
+
 void DSP_BufferSwap();
 void DSP_ReplayWrites(u32 idx);
 
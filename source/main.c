@@ -34,6 +34,11 @@
 #include "ppu.h"
 #include "snes.h"
 #include "dsp.h"
+#include "profile.h"
+#include "timing.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "runahead.h"
 
 #include "defaultborder.h"
 #include "screenfill.h"
@@ -49,6 +54,7 @@
 #include "grender_soft_vsh_shbin.h"
 #include "grender_hard_vsh_shbin.h"
 #include "grender_hard7_vsh_shbin.h"
+#include "grender_hard7plane_vsh_shbin.h"
 #include "gplain_quad_vsh_shbin.h"
 #include "gwindow_mask_vsh_shbin.h"
 
@@ -69,6 +75,7 @@ DVLB_s* gfinalShader;
 DVLB_s* gsoftRenderShader;
 DVLB_s* ghardRenderShader;
 DVLB_s* ghard7RenderShader;
+DVLB_s* ghard7PlaneShader;
 DVLB_s* gplainQuadShader;
 DVLB_s* gwindowMaskShader;
 
@@ -76,6 +83,7 @@ shaderProgram_s finalShaderP;
 shaderProgram_s softRenderShaderP;
 shaderProgram_s hardRenderShaderP;
 shaderProgram_s hard7RenderShaderP;
+shaderProgram_s hard7PlaneShaderP;
 shaderProgram_s plainQuadShaderP;
 shaderProgram_s windowMaskShaderP;
 
@@ -101,6 +109,10 @@ u32 framecount = 0;
 u8 RenderState = 0;
 int FramesSkipped = 0;
 bool SkipThisFrame = false;
+bool HideThisFrame = false;
+
+// time spent waiting for the GPU and the VBlank
+u64 WaitTicks = 0;
 u64 LastVBlank = 0;
 
 // debug
@@ -138,6 +150,7 @@ void SPCThread()
 		
 		if (!pause)
 		{
+			Timing_Begin(TIMING_DSP);
 			bool started = Audio_Begin();
 			if(started)
 			{
@@ -155,6 +168,7 @@ void SPCThread()
 			audCnt = 32;
 			for(i = 0; i < audExt; i++)
 				Audio_Mix();
+			Timing_End(TIMING_DSP);
 			audExt = 0;
  
 			u64 curmixtime = svcGetSystemTick();
@@ -406,11 +420,44 @@ void SafeWait(Handle evt)
 	// this method of waiting avoids that
 	// it's dirty and doesn't solve the actual issue but atleast it avoids a freeze
 	
+	u64 t = svcGetSystemTick();
+	Timing_Begin(TIMING_GPUWAIT);
 	Result res = svcWaitSynchronization(evt, 40*1000*1000);
 	if (!res)
 		svcClearEvent(evt);
+	Timing_End(TIMING_GPUWAIT);
+	WaitTicks += svcGetSystemTick() - t;
 }
 
+static const bglStateBlock FinalState = 
+{
+	.ScissorMode = GPU_SCISSOR_DISABLE,
+	
+	.DepthTest = false,
+	.DepthFunc = GPU_GREATER,
+	.ColorDepthMask = GPU_WRITE_ALL,
+	
+	.StencilTest = false,
+	.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+	.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
+	
+	.AlphaTest = false,
+	.AlphaFunc = GPU_GREATER, .AlphaRef = 0,
+	
+	.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+	.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
+	
+	.TextureEnable = GPU_TEXUNIT0,
+	.NumTexEnvs = 1,
+	.TexEnv = 
+	{
+		{GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF},
+	},
+	
+	.NumAttribs = 2,
+	.Attrib = {{GPU_FLOAT, 3}, {GPU_FLOAT, 2}},	// vertex, texcoord
+};
+
 void RenderTopScreen()
 {
 	bglUseShader(&finalShaderP);
@@ -418,31 +465,12 @@ void RenderTopScreen()
 	bglOutputBuffers(gpuOut, gpuDOut);
 	bglViewport(0, 0, 240, 400);
 	
-	bglEnableDepthTest(false);
-	bglColorDepthMask(GPU_WRITE_ALL);
-	
-	bglEnableTextures(GPU_TEXUNIT0);
-	
-	bglTexEnv(0, 
-		GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), 
-		GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0),
-		GPU_TEVOPERANDS(0,0,0), 
-		GPU_TEVOPERANDS(0,0,0), 
-		GPU_REPLACE, GPU_REPLACE, 
-		0xFFFFFFFF);
-	bglDummyTexEnv(1);
-	bglDummyTexEnv(2);
-	bglDummyTexEnv(3);
-	bglDummyTexEnv(4);
-	bglDummyTexEnv(5);
+	bglApplyState(&FinalState);
 	
 	bglTexImage(GPU_TEXUNIT0, BorderTex,512,256,0,GPU_RGBA8);
 	
 	bglUniformMatrix(GPU_VERTEX_SHADER, 0, screenProjMatrix);
 	
-	bglNumAttribs(2);
-	bglAttribType(0, GPU_FLOAT, 3);	// vertex
-	bglAttribType(1, GPU_FLOAT, 2);	// texcoord
 	bglAttribBuffer(borderVertices);
 	
 	bglDrawArrays(GPU_UNKPRIM, 2); // border
@@ -554,11 +582,16 @@ void VSyncAndFrameskip()
 			
 			UI_SetFramebuffer(bottomfb);
 			UI_Render();
+			if (running && Timing_Enabled) Timing_DrawHUD();
 			GSPGPU_FlushDataCache(NULL, bottomfb, 0x38400);
 		}
 		
 		gfxSwapBuffersGpu();
+		u64 t = svcGetSystemTick();
+		Timing_Begin(TIMING_VSYNC);
 		gspWaitForEvent(GSPEVENT_VBlank0, false);
+		Timing_End(TIMING_VSYNC);
+		WaitTicks += svcGetSystemTick() - t;
 		//LastVBlank = svcGetSystemTick();
 	}
 	
@@ -569,7 +602,11 @@ void VSyncAndFrameskip()
 		if (PALCount >= 5)
 		{
 			PALCount = 0;
+			u64 t = svcGetSystemTick();
+			Timing_Begin(TIMING_VSYNC);
 			gspWaitForVBlank();
+			Timing_End(TIMING_VSYNC);
+			WaitTicks += svcGetSystemTick() - t;
 		}
 	}
 }
@@ -786,6 +823,11 @@ bool StartROM(char* path, char* dir)
 	
 	CPU_Reset();
 	SPC_Reset();
+	
+	if (Rewind_Enabled && !Rewind_Init())
+		Rewind_Enabled = false;
+	if (RunAhead_Frames && !RunAhead_Init())
+		RunAhead_Frames = 0;
 
 	RenderState = 0;
 	FramesSkipped = 0;
@@ -885,6 +927,7 @@ int main()
 	vsoftRenderShader = DVLB_ParseFile((u32*)vrender_soft_vsh_shbin, vrender_soft_vsh_shbin_size);	gsoftRenderShader = DVLB_ParseFile((u32*)grender_soft_vsh_shbin, grender_soft_vsh_shbin_size);
 	vhardRenderShader = DVLB_ParseFile((u32*)vrender_hard_vsh_shbin, vrender_hard_vsh_shbin_size);	ghardRenderShader = DVLB_ParseFile((u32*)grender_hard_vsh_shbin, grender_hard_vsh_shbin_size);
 	vhard7RenderShader = DVLB_ParseFile((u32*)vrender_hard7_vsh_shbin, vrender_hard7_vsh_shbin_size);	ghard7RenderShader = DVLB_ParseFile((u32*)grender_hard7_vsh_shbin, grender_hard7_vsh_shbin_size);
+	ghard7PlaneShader = DVLB_ParseFile((u32*)grender_hard7plane_vsh_shbin, grender_hard7plane_vsh_shbin_size);
 	vplainQuadShader = DVLB_ParseFile((u32*)vplain_quad_vsh_shbin, vplain_quad_vsh_shbin_size);		gplainQuadShader = DVLB_ParseFile((u32*)gplain_quad_vsh_shbin, gplain_quad_vsh_shbin_size);
 	vwindowMaskShader = DVLB_ParseFile((u32*)vwindow_mask_vsh_shbin, vwindow_mask_vsh_shbin_size);	gwindowMaskShader = DVLB_ParseFile((u32*)gwindow_mask_vsh_shbin, gwindow_mask_vsh_shbin_size);
 
@@ -892,6 +935,7 @@ int main()
 	shaderProgramInit(&softRenderShaderP);	shaderProgramSetVsh(&softRenderShaderP, &vsoftRenderShader->DVLE[0]);	shaderProgramSetGsh(&softRenderShaderP, &gsoftRenderShader->DVLE[0], 4);
 	shaderProgramInit(&hardRenderShaderP);	shaderProgramSetVsh(&hardRenderShaderP, &vhardRenderShader->DVLE[0]);	shaderProgramSetGsh(&hardRenderShaderP, &ghardRenderShader->DVLE[0], 4);
 	shaderProgramInit(&hard7RenderShaderP);	shaderProgramSetVsh(&hard7RenderShaderP, &vhard7RenderShader->DVLE[0]);	shaderProgramSetGsh(&hard7RenderShaderP, &ghard7RenderShader->DVLE[0], 2);
+	shaderProgramInit(&hard7PlaneShaderP);	shaderProgramSetVsh(&hard7PlaneShaderP, &vhard7RenderShader->DVLE[0]);	shaderProgramSetGsh(&hard7PlaneShaderP, &ghard7PlaneShader->DVLE[0], 2);
 	shaderProgramInit(&plainQuadShaderP);	shaderProgramSetVsh(&plainQuadShaderP, &vplainQuadShader->DVLE[0]);		shaderProgramSetGsh(&plainQuadShaderP, &gplainQuadShader->DVLE[0], 4);
 	shaderProgramInit(&windowMaskShaderP);	shaderProgramSetVsh(&windowMaskShaderP, &vwindowMaskShader->DVLE[0]);	shaderProgramSetGsh(&windowMaskShaderP, &gwindowMaskShader->DVLE[0], 4);
 
@@ -949,8 +993,16 @@ int main()
 			if (running && !pause)
 			{
 				// emulate
-				CPU_MainLoop(); // runs the SNES for one frame. Handles PPU rendering.
+				Timing_Begin(TIMING_CPU);
+				RunAhead_Frame(); // runs the SNES for one frame. Handles PPU rendering.
+				Timing_End(TIMING_CPU);
+				Timing_Counts[COUNT_IDLECYCLES] = CPU_IdleCycles;
 				ContinueRendering();
+				Timing_EndFrame(SkipThisFrame);
+				Rewind_Frame();
+#ifdef PROFILER
+				Prof_EndFrame();
+#endif
 				
 				/*{
 					extern u32 dbgcycles, nruns;
@@ -974,6 +1026,20 @@ int main()
 					bprintf("Tap screen or press A to resume.\n");
 					bprintf("Press Select to load another game.\n");
 					bprintf("Press Start to enter the config.\n");
+					bprintf("Press Y to save state, B to load state.\n");
+					if (Rewind_Enabled)
+						bprintf("Press Left to rewind.\n");
+					if (RunAhead_Frames)
+					{
+						u32 tenths = (RunAhead_Ticks * 10) / 268111;
+						bprintf("Run-ahead: %d frames, %d.%d/16.7 ms\n", RunAhead_Frames, tenths / 10, tenths % 10);
+					}
+					if (Timing_Enabled && Timing_DumpCSV("/blargSnesTiming.csv"))
+						bprintf("Timing saved to /blargSnesTiming.csv\n");
+#ifdef PROFILER
+					if (Prof_Dump("/blargSnesProfile.txt"))
+						bprintf("Profile saved to /blargSnesProfile.txt\n");
+#endif
 					pause = 1;
 					svcSignalEvent(SPCSync);
 				}
@@ -1015,6 +1081,28 @@ int main()
 					{
 						UI_SaveAndSwitch(&UI_Config);
 					}
+					else if (release & (KEY_Y|KEY_B))
+					{
+						u64 t = svcGetSystemTick();
+						bool save = (release & KEY_Y) != 0;
+						bool ok = save ? State_Save(SNES_StatePath) : State_Load(SNES_StatePath);
+						u32 ms = (u32)((svcGetSystemTick() - t) / 268111);
+						
+						if (ok && !save)
+							Rewind_Reset();
+						
+						if (ok)
+							bprintf("State %s %s (%dms)\n", save ? "saved to":"loaded from", SNES_StatePath, ms);
+						else
+							bprintf("Failed to %s state %s\n", save ? "save":"load", SNES_StatePath);
+					}
+					else if ((release & KEY_LEFT) && Rewind_Enabled)
+					{
+						if (Rewind_Step())
+							bprintf("Rewound %d frames\n", Rewind_FramesBack());
+						else
+							bprintf("Can't rewind further\n");
+					}
 					else if (release & KEY_X)
 					{
 						bprintf("PC: CPU %02X:%04X  SPC %04X\n", CPU_Regs.PBR, CPU_Regs.PC, SPC_Regs.PC);
@@ -1094,6 +1182,7 @@ int main()
 			FinishRendering();
 			 
 			aptReturnToMenu();
+			bglInvalidateState();
 			
 			pause = oldpause;
 		}
@@ -1107,6 +1196,7 @@ int main()
 			
 			aptSignalReadyForSleep();
 			aptWaitStatusEvent();
+			bglInvalidateState();
 			
 			pause = oldpause;
 		}
@@ -1133,6 +1223,7 @@ int main()
 	shaderProgramFree(&softRenderShaderP);
 	shaderProgramFree(&hardRenderShaderP);
 	shaderProgramFree(&hard7RenderShaderP);
+	shaderProgramFree(&hard7PlaneShaderP);
 	shaderProgramFree(&plainQuadShaderP);
 	shaderProgramFree(&windowMaskShaderP);
 
@@ -1140,6 +1231,7 @@ int main()
 	DVLB_Free(vsoftRenderShader);	DVLB_Free(gsoftRenderShader);
 	DVLB_Free(vhardRenderShader);	DVLB_Free(ghardRenderShader);
 	DVLB_Free(vhard7RenderShader);	DVLB_Free(ghard7RenderShader);
+	DVLB_Free(ghard7PlaneShader);
 	DVLB_Free(vplainQuadShader);	DVLB_Free(gplainQuadShader);
 	DVLB_Free(vwindowMaskShader);	DVLB_Free(gwindowMaskShader);
 
@@ -19,6 +19,8 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+extern u64 WaitTicks;
+
 void ClearConsole();
 void bprintf(char* fmt, ...);
 void ApplyScaling();
@@ -28,97 +28,78 @@
 .global SNES_IORead16
 .global SNES_IOWrite8
 .global SNES_IOWrite16
+.global IO_GIOWrite8
+.global IO_GIOWrite16
+
+@ the I/O page for the address in r0 is IO_Pages[(r0 >> 8) & 0xFF]
+@ (see IO_Page in snes.h)
+@ page+0 is the extra cycle count, then come the four 256-entry handler tables
+@ r1 (value to write) is left alone
+
+.macro IOPage
+	ldr r12, =IO_Pages
+	and r3, r0, #0xFF00
+	ldr r12, [r12, r3, lsr #6]
+	ldr r3, [r12], #4
+	and r0, r0, #0xFF
+.endm
+
+.macro IOCall table
+	.ifne \table
+		add r12, r12, #\table
+	.endif
+	ldr r3, [r12, r0, lsl #2]
+	blx r3
+.endm
 
 SNES_IORead8:
 	stmdb sp!, {r12, lr}
-	ldr lr, =ior8_ret
-	and r12, r0, #0xFF00
-	and r0, r0, #0xFF
-	
-	cmp r12, #0x2100
-	beq PPU_Read8
-	
-	cmp r12, #0x4200
-	beq SNES_GIORead8
-	
-	cmp r12, #0x4300
-	beq DMA_Read8
-	
-	cmp r12, #0x4000
-	addeq snesCycles, snesCycles, #0x60000
-	beq SNES_JoyRead8
-	
-	ldrb r0, [snesStatus, #LastBusVal]
-ior8_ret:
+	IOPage
+	add snesCycles, snesCycles, r3, lsl #16
+	IOCall 0x000
 	ldmia sp!, {r12, pc}
 	
 	
 SNES_IORead16:
 	stmdb sp!, {r12, lr}
-	ldr lr, =ior16_ret
-	and r12, r0, #0xFF00
-	and r0, r0, #0xFF
-	
-	cmp r12, #0x2100
-	beq PPU_Read16
-	
-	cmp r12, #0x4200
-	beq SNES_GIORead16
-	
-	cmp r12, #0x4300
-	beq DMA_Read16
-	
-	cmp r12, #0x4000
-	addeq snesCycles, snesCycles, #0xC0000
-	beq SNES_JoyRead16
-	
-	ldrb r0, [snesStatus, #LastBusVal]
-	orr r0, r0, r0, lsl #8
-ior16_ret:
+	IOPage
+	add snesCycles, snesCycles, r3, lsl #17
+	IOCall 0x400
 	ldmia sp!, {r12, pc}
 	
 	
 SNES_IOWrite8:
 	stmdb sp!, {r12, lr}
-	ldr lr, =iow8_ret
-	and r12, r0, #0xFF00
-	and r0, r0, #0xFF
-	
-	cmp r12, #0x2100
-	beq PPU_Write8
-	
-	cmp r12, #0x4300
-	beq DMA_Write8
-	
-	cmp r12, #0x4000
-	addeq snesCycles, snesCycles, #0x60000
-	beq SNES_JoyWrite8
-	
-	cmp r12, #0x4200
-	beq SNES_GIOWrite8
-
-iow8_ret:
+	IOPage
+	add snesCycles, snesCycles, r3, lsl #16
+	IOCall 0x800
 	ldmia sp!, {r12, pc}
 
 	
 SNES_IOWrite16:
 	stmdb sp!, {r12, lr}
-	ldr lr, =iow16_ret
-	and r12, r0, #0xFF00
-	and r0, r0, #0xFF
-	
-	cmp r12, #0x2100
-	beq PPU_Write16
-	
-	cmp r12, #0x4300
-	beq DMA_Write16
+	IOPage
+	add snesCycles, snesCycles, r3, lsl #17
+	IOCall 0xC00
+	ldmia sp!, {r12, pc}
 	
-	cmp r12, #0x4000
-	addeq snesCycles, snesCycles, #0xC0000
-	beq SNES_JoyWrite16
 	
-	cmp r12, #0x4200
-	beq SNES_GIOWrite16
+@ $42xx writes may reschedule the IRQ, recompute the CPU's next event after them
 
-iow16_ret:
-	ldmia sp!, {r12, pc}
+IO_GIOWrite8:
+	stmdb sp!, {r3, lr}
+	bl SNES_GIOWrite8
+	b gio_nextevent
+	
+IO_GIOWrite16:
+	stmdb sp!, {r3, lr}
+	bl SNES_GIOWrite16
+	
+gio_nextevent:
+	ldrh r0, [snesStatus, #IRQ_CurHMatch]
+	ldrh r1, [snesStatus, #SliceEnd]
+	cmp r0, r1
+	movgt r0, r1
+	mov snesCycles, snesCycles, lsr #16
+	orr snesCycles, r0, snesCycles, lsl #16
+	ldmia sp!, {r3, pc}
@@ -24,6 +24,8 @@
 #include "ppu.h"
 #include "main.h"
 #include "spc700.h"
+#include "timing.h"
+#include "mem.h"
 
 
 u32 Mem_WRAMAddr = 0;
@@ -108,6 +110,46 @@ const u16 PPU_WindowCombine[] =
 PPUState PPU;
 
 
+// where the sections go once PPU.SectionLog is full (see PPU_SECTIONSPILL_SIZE)
+// outside of PPUState so PPU_Reset() doesn't lose it
+u8* PPU_SectionSpill = NULL;
+u32 PPU_SectionSpillUsed = 0;
+
+void PPU_ClearSectionLog()
+{
+	PPU.SectionLogUsed = 0;
+	PPU_SectionSpillUsed = 0;
+}
+
+// NULL if the log is full and there's no memory for the spill block
+void* PPU_AddSection(u32 size)
+{
+	u32 pos = PPU.SectionLogUsed;
+	
+	size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+	if (pos + size <= sizeof(PPU.SectionLog))
+	{
+		PPU.SectionLogUsed = pos + size;
+		memset(&PPU.SectionLog[pos], 0, size);
+		return &PPU.SectionLog[pos];
+	}
+	
+	if (!PPU_SectionSpill)
+	{
+		PPU_SectionSpill = (u8*)MemAlloc(PPU_SECTIONSPILL_SIZE);
+		if (!PPU_SectionSpill) return NULL;
+	}
+	
+	pos = PPU_SectionSpillUsed;
+	if (pos + size > PPU_SECTIONSPILL_SIZE)
+		return NULL;
+	
+	PPU_SectionSpillUsed = pos + size;
+	memset(&PPU_SectionSpill[pos], 0, size);
+	return &PPU_SectionSpill[pos];
+}
+
+
 void PPU_Init()
 {
 	PPU.MainBuffer = (u16*)linearAlloc(256*512*2);
@@ -117,7 +159,9 @@ void PPU_Init()
 	
 	PPU.SubBackdrop = 0x0001;
 	
-	PPU_ColorEffectSection* c = &PPU.ColorEffectSections[0];
+	PPU_ClearSectionLog();
+	PPU_FIRSTSECTION(PPU.ColorEffectSections, PPU.CurColorEffect);
+	PPU_ColorEffectSection* c = PPU.CurColorEffect;
 	c->EndOffset = 240;
 	c->ColorMath = 0;
 	c->Brightness = 0xFF;
@@ -127,7 +171,10 @@ void PPU_Init()
 	if (PPU.HardwareRenderer)
 		PPU_Init_Hard();
 	else
+	{
 		PPU_Init_Soft();
+		PPU_SetRenderThreads_Soft(Config.RenderThreads, Config.PipelineFrames);
+	}
 }
 
 void PPU_SwitchRenderers()
@@ -135,7 +182,11 @@ void PPU_SwitchRenderers()
 	int i;
 	
 	if (PPU.HardwareRenderer == Config.HardwareRenderer)
+	{
+		if (!PPU.HardwareRenderer)
+			PPU_SetRenderThreads_Soft(Config.RenderThreads, Config.PipelineFrames);
 		return;
+	}
 		
 	if (PPU.HardwareRenderer)
 		PPU_DeInit_Hard();
@@ -158,7 +209,10 @@ void PPU_SwitchRenderers()
 	if (PPU.HardwareRenderer)
 		PPU_Init_Hard();
 	else
+	{
 		PPU_Init_Soft();
+		PPU_SetRenderThreads_Soft(Config.RenderThreads, Config.PipelineFrames);
+	}
 }
 
 void PPU_Reset()
@@ -169,6 +223,9 @@ void PPU_Reset()
 	u16* mbuf = PPU.MainBuffer;
 	u16* sbuf = PPU.SubBuffer;
 	
+	// don't pull the rug from under the render threads
+	PPU_SYNC_SOFT();
+	
 	memset(&PPU, 0, sizeof(PPUState));
 	
 	ApplyScaling();
@@ -193,7 +250,9 @@ void PPU_Reset()
 	s->WindowMask = 0x0F;
 	s->ColorMath = 0x10;
 	
-	PPU_ColorEffectSection* c = &PPU.ColorEffectSections[0];
+	PPU_ClearSectionLog();
+	PPU_FIRSTSECTION(PPU.ColorEffectSections, PPU.CurColorEffect);
+	PPU_ColorEffectSection* c = PPU.CurColorEffect;
 	c->EndOffset = 240;
 	c->ColorMath = 0;
 	c->Brightness = 0xFF;
@@ -204,6 +263,7 @@ void PPU_Reset()
 	PPU.OBJHeight = &PPU_OBJHeights[0];
 	
 	PPU.SubBackdrop = 0x0001;
+	PPU.OBJListDirty = 1;
 	
 	if (PPU.HardwareRenderer)
 	{
@@ -214,16 +274,25 @@ void PPU_Reset()
 			PPU.PaletteEx2[i] = (i >= 128);
 		}
 	}
+	else
+	{
+		// the VRAM counters went back to zero
+		PPU_FlushTileCache_Soft();
+	}
 }
 
 void PPU_DeInit()
 {
-	linearFree(PPU.MainBuffer);
-	
+	// the soft renderer puts PPU.MainBuffer back to this one when it's done
 	if (PPU.HardwareRenderer)
 		PPU_DeInit_Hard();
 	else
 		PPU_DeInit_Soft();
+	
+	linearFree(PPU.MainBuffer);
+	
+	if (PPU_SectionSpill) MemFree(PPU_SectionSpill);
+	PPU_SectionSpill = NULL;
 }
 
 
@@ -329,7 +398,10 @@ inline void PPU_SetColor(u32 num, u16 val)
 		}
 	}
 	else
+	{
 		PPU.Palette[num] = temp;
+		PPU.PaletteDirty = 1;
+	}
 }
 
 u32 PPU_TranslateVRAMAddress(u32 addr)
@@ -380,11 +452,135 @@ void SPC_Compensate()
 	if (torun > 0)
 	{
 		SPC_Run(torun);
-		SNES_Status->SPC_LastCycle = cyclenow;
+		SNES_Status->SPC_LastCycle += torun << 24;
 	}
 }
 
 
+// fast paths for the busiest registers
+// the I/O tables point straight at these, the big switches below call them too
+
+u8 PPU_ReadAPUIO8(u32 addr)
+{
+	return SPC_IOPorts[4 + (addr & 3)];
+}
+
+u16 PPU_ReadAPUIO16(u32 addr)
+{
+	return *(u16*)&SPC_IOPorts[4 + (addr & 2)];
+}
+
+inline void PPU_SetFirstOBJ(u8 first)
+{
+	if (PPU.FirstOBJ == first) return;
+	
+	PPU.FirstOBJ = first;
+	PPU.OBJListDirty = 1;
+}
+
+void PPU_WriteOAM(u32 addr, u8 val)
+{
+	if (PPU.OAMAddr >= 0x200)
+	{
+		if (PPU.OAM[PPU.OAMAddr & 0x21F] != val)
+		{
+			PPU_SYNC_SOFT();
+			PPU.OBJListDirty = 1;
+		}
+		PPU.OAM[PPU.OAMAddr & 0x21F] = val;
+	}
+	else if (PPU.OAMAddr & 0x1)
+	{
+		u16* oam = (u16*)&PPU.OAM[PPU.OAMAddr - 1];
+		u16 newval = PPU.OAMVal | (val << 8);
+		if (*oam != newval)
+		{
+			PPU_SYNC_SOFT();
+			
+			// only Y positions matter to the sprite lists
+			if (!(PPU.OAMAddr & 0x2) && PPU.OAM[PPU.OAMAddr] != val)
+				PPU.OBJListDirty = 1;
+		}
+		*oam = newval;
+	}
+	else
+	{
+		PPU.OAMVal = val;
+	}
+	PPU.OAMAddr++;
+	PPU.OAMAddr &= ~0x400;
+}
+
+void PPU_WriteVRAML(u32 addr, u8 val)
+{
+	addr = PPU_TranslateVRAMAddress(PPU.VRAMAddr);
+	if (PPU.VRAM[addr] != val)
+	{
+		PPU_SYNC_SOFT();
+		PPU.VRAM[addr] = val;
+		PPU.VRAMUpdateCount[addr >> 4]++;
+		PPU.VRAMWrites++;
+	}
+	if (!(PPU.VRAMInc & 0x80))
+		PPU.VRAMAddr += PPU.VRAMStep;
+}
+
+void PPU_WriteVRAMH(u32 addr, u8 val)
+{
+	addr = PPU_TranslateVRAMAddress(PPU.VRAMAddr);
+	if (PPU.VRAM[addr+1] != val)
+	{
+		PPU_SYNC_SOFT();
+		PPU.VRAM[addr+1] = val;
+		PPU.VRAMUpdateCount[addr >> 4]++;
+		PPU.VRAMWrites++;
+		PPU.VRAM7[addr >> 1] = val;
+		PPU.VRAM7UpdateCount[addr >> 7]++;
+	}
+	if (PPU.VRAMInc & 0x80)
+		PPU.VRAMAddr += PPU.VRAMStep;
+}
+
+void PPU_WriteVRAM16(u32 addr, u16 val)
+{
+	addr = PPU_TranslateVRAMAddress(PPU.VRAMAddr);
+
+	if (*(u16*)&PPU.VRAM[addr] != val)
+	{
+		PPU_SYNC_SOFT();
+		*(u16*)&PPU.VRAM[addr] = val;
+		PPU.VRAMUpdateCount[addr >> 4]++;
+		PPU.VRAMWrites++;
+		PPU.VRAM7[addr >> 1] = val >> 8;
+		PPU.VRAM7UpdateCount[addr >> 7]++;
+	}
+	PPU.VRAMAddr += PPU.VRAMStep;
+}
+
+void PPU_WriteCGRAM(u32 addr, u8 val)
+{
+	if (!(PPU.CGRAMAddr & 0x1))
+		PPU.CGRAMVal = val;
+	else
+		PPU_SetColor(PPU.CGRAMAddr >> 1, (val << 8) | PPU.CGRAMVal);
+
+	PPU.CGRAMAddr++;
+	PPU.CGRAMAddr &= ~0x200; // prevent overflow
+}
+
+void PPU_WriteAPUIO8(u32 addr, u8 val)
+{
+	SPC_Compensate();
+	SPC_IOPorts[addr & 3] = val;
+}
+
+void PPU_WriteAPUIO16(u32 addr, u16 val)
+{
+	SPC_Compensate();
+	*(u16*)&SPC_IOPorts[addr & 3] = val;
+}
+
+
 u8 PPU_Read8(u32 addr)
 {
 	u8 ret = 0;
@@ -472,10 +668,10 @@ u8 PPU_Read8(u32 addr)
 			PPU.OPVFlag = 0;
 			break;
 		
-		case 0x40: ret = SPC_IOPorts[4]; break;
-		case 0x41: ret = SPC_IOPorts[5]; break;
-		case 0x42: ret = SPC_IOPorts[6]; break;
-		case 0x43: ret = SPC_IOPorts[7]; break;
+		case 0x40:
+		case 0x41:
+		case 0x42:
+		case 0x43: ret = PPU_ReadAPUIO8(addr); break;
 		
 		case 0x80: ret = SNES_SysRAM[Mem_WRAMAddr++]; Mem_WRAMAddr &= ~0x20000; break;
 
@@ -500,8 +696,8 @@ u16 PPU_Read16(u32 addr)
 		// not in the right place, but well
 		// our I/O functions are mapped to the whole $21xx range
 		
-		case 0x40: ret = *(u16*)&SPC_IOPorts[4]; break;
-		case 0x42: ret = *(u16*)&SPC_IOPorts[6]; break;
+		case 0x40:
+		case 0x42: ret = PPU_ReadAPUIO16(addr); break;
 		
 		default:
 			ret = PPU_Read8(addr);
@@ -540,6 +736,9 @@ void PPU_Write8(u32 addr, u8 val)
 			
 		case 0x01:
 			{
+				if (PPU.OBJHeight != &PPU_OBJHeights[(val & 0xE0) >> 4])
+					PPU.OBJListDirty = 1;
+				
 				PPU.OBJWidth = &PPU_OBJWidths[(val & 0xE0) >> 4];
 				PPU.OBJHeight = &PPU_OBJHeights[(val & 0xE0) >> 4];
 				
@@ -553,31 +752,16 @@ void PPU_Write8(u32 addr, u8 val)
 		case 0x02:
 			PPU.OAMAddr = (PPU.OAMAddr & 0x200) | (val << 1);
 			PPU.OAMReload = PPU.OAMAddr;
-			PPU.FirstOBJ = PPU.OAMPrio ? ((PPU.OAMAddr >> 1) & 0x7F) : 0;
+			PPU_SetFirstOBJ(PPU.OAMPrio ? ((PPU.OAMAddr >> 1) & 0x7F) : 0);
 			break;
 		case 0x03:
 			PPU.OAMAddr = (PPU.OAMAddr & 0x1FE) | ((val & 0x01) << 9);
 			PPU.OAMPrio = val & 0x80;
 			PPU.OAMReload = PPU.OAMAddr;
-			PPU.FirstOBJ = PPU.OAMPrio ? ((PPU.OAMAddr >> 1) & 0x7F) : 0;
+			PPU_SetFirstOBJ(PPU.OAMPrio ? ((PPU.OAMAddr >> 1) & 0x7F) : 0);
 			break;
 			
-		case 0x04:
-			if (PPU.OAMAddr >= 0x200)
-			{
-				PPU.OAM[PPU.OAMAddr & 0x21F] = val;
-			}
-			else if (PPU.OAMAddr & 0x1)
-			{
-				*(u16*)&PPU.OAM[PPU.OAMAddr - 1] = PPU.OAMVal | (val << 8);
-			}
-			else
-			{
-				PPU.OAMVal = val;
-			}
-			PPU.OAMAddr++;
-			PPU.OAMAddr &= ~0x400;
-			break;
+		case 0x04: PPU_WriteOAM(addr, val); break;
 			
 		case 0x05:
 			if(PPU.Mode != val)
@@ -642,32 +826,8 @@ void PPU_Write8(u32 addr, u8 val)
 			PPU.VRAMPref = *(u16*)&PPU.VRAM[addr];
 			break;
 		
-		case 0x18: // VRAM shit
-			{
-				addr = PPU_TranslateVRAMAddress(PPU.VRAMAddr);
-				if (PPU.VRAM[addr] != val)
-				{
-					PPU.VRAM[addr] = val;
-					PPU.VRAMUpdateCount[addr >> 4]++;
-				}
-				if (!(PPU.VRAMInc & 0x80))
-					PPU.VRAMAddr += PPU.VRAMStep;
-			}
-			break;
-		case 0x19:
-			{
-				addr = PPU_TranslateVRAMAddress(PPU.VRAMAddr);
-				if (PPU.VRAM[addr+1] != val)
-				{
-					PPU.VRAM[addr+1] = val;
-					PPU.VRAMUpdateCount[addr >> 4]++;
-					PPU.VRAM7[addr >> 1] = val;
-					PPU.VRAM7UpdateCount[addr >> 7]++;
-				}
-				if (PPU.VRAMInc & 0x80)
-					PPU.VRAMAddr += PPU.VRAMStep;
-			}
-			break;
+		case 0x18: PPU_WriteVRAML(addr, val); break; // VRAM shit
+		case 0x19: PPU_WriteVRAMH(addr, val); break;
 			
 		case 0x1A:
 			if(PPU.M7Sel != val)
@@ -720,15 +880,7 @@ void PPU_Write8(u32 addr, u8 val)
 			PPU.CGRAMAddr = val << 1;
 			break;
 		
-		case 0x22:
-			if (!(PPU.CGRAMAddr & 0x1))
-				PPU.CGRAMVal = val;
-			else
-				PPU_SetColor(PPU.CGRAMAddr >> 1, (val << 8) | PPU.CGRAMVal);
-
-			PPU.CGRAMAddr++;
-			PPU.CGRAMAddr &= ~0x200; // prevent overflow
-			break;
+		case 0x22: PPU_WriteCGRAM(addr, val); break;
 			
 		case 0x23:
 			if (PPU.WinMask[0] != val)
@@ -884,10 +1036,10 @@ void PPU_Write8(u32 addr, u8 val)
 			}
 			break;
 			
-		case 0x40: SPC_Compensate(); SPC_IOPorts[0] = val; break;
-		case 0x41: SPC_Compensate(); SPC_IOPorts[1] = val; break;
-		case 0x42: SPC_Compensate(); SPC_IOPorts[2] = val; break;
-		case 0x43: SPC_Compensate(); SPC_IOPorts[3] = val; break;
+		case 0x40:
+		case 0x41:
+		case 0x42:
+		case 0x43: PPU_WriteAPUIO8(addr, val); break;
 		
 		case 0x80: SNES_SysRAM[Mem_WRAMAddr++] = val; Mem_WRAMAddr &= ~0x20000; break;
 		case 0x81: Mem_WRAMAddr = (Mem_WRAMAddr & 0x0001FF00) | val; break;
@@ -913,22 +1065,11 @@ void PPU_Write16(u32 addr, u16 val)
 			PPU.VRAMPref = *(u16*)&PPU.VRAM[addr];
 			break;
 			
-		case 0x18:
-			addr = PPU_TranslateVRAMAddress(PPU.VRAMAddr);
-
-			if (*(u16*)&PPU.VRAM[addr] != val)
-			{
-				*(u16*)&PPU.VRAM[addr] = val;
-				PPU.VRAMUpdateCount[addr >> 4]++;
-				PPU.VRAM7[addr >> 1] = val >> 8;
-				PPU.VRAM7UpdateCount[addr >> 7]++;
-			}
-			PPU.VRAMAddr += PPU.VRAMStep;
-			break;
+		case 0x18: PPU_WriteVRAM16(addr, val); break;
 			
-		case 0x40: SPC_Compensate(); *(u16*)&SPC_IOPorts[0] = val; break;
-		case 0x41: SPC_Compensate(); *(u16*)&SPC_IOPorts[1] = val; break;
-		case 0x42: SPC_Compensate(); *(u16*)&SPC_IOPorts[2] = val; break;
+		case 0x40:
+		case 0x41:
+		case 0x42: PPU_WriteAPUIO16(addr, val); break;
 		
 		case 0x3F:
 		case 0x43: bprintf("!! write $21%02X %04X\n", addr, val); break;
@@ -1156,33 +1297,43 @@ void PPU_RenderScanline(u32 line)
 	if (!(line & 7))
 		ContinueRendering();
 	
-	if (SkipThisFrame) return;
+	if (SkipThisFrame || HideThisFrame) return;
 	
+	Timing_Begin(TIMING_RENDER);
 	if (PPU.HardwareRenderer)
 		PPU_RenderScanline_Hard(line);
 	else
 		PPU_RenderScanline_Soft(line);
+	Timing_End(TIMING_RENDER);
 }
 
 void PPU_VBlank()
 {
 	/*int i;*/
 	
-	FinishRendering();
+	Timing_Counts[COUNT_SECTIONLOG] = PPU.SectionLogUsed + PPU_SectionSpillUsed;
 	
-	if (!SkipThisFrame)
+	// hidden frames don't wait for the GPU, it can keep going with the last one
+	if (!HideThisFrame)
 	{
-		if (PPU.HardwareRenderer)
+		FinishRendering();
+		
+		if (!SkipThisFrame)
 		{
-			PPU_VBlank_Hard(240);
+			Timing_Begin(TIMING_VBLANK);
+			if (PPU.HardwareRenderer)
+			{
+				PPU_VBlank_Hard(240);
+			}
+			else
+				PPU_VBlank_Soft();
+			
+			RenderTopScreen();
+			Timing_End(TIMING_VBLANK);
 		}
 		else
-			PPU_VBlank_Soft();
-		
-		RenderTopScreen();
+			RenderState = 4;
 	}
-	else
-		RenderState = 4;
 	
 	PPU.OAMAddr = PPU.OAMReload;
 	
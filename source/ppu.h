@@ -26,6 +26,13 @@ typedef struct
 	s32 slope;
 } PPU_Vertex;
 
+// mid-frame changes
+// whenever something the renderers draw with changes, the current section of
+// that kind is closed at that line and a new one with the new values is added
+// to PPU.SectionLog. all kinds share the log, which starts over every frame
+// and only takes as much as the frame's changes need. the sections of each
+// kind are chained through Next, the last one ends at line 240
+
 typedef struct
 {
 	u8 StartOffset;
@@ -75,17 +82,9 @@ typedef struct
 
 	PPU_Vertex vert[8];
 	
-} PPU_Mode7Section;
-
-typedef struct
-{
-	u16* Dest;
-	u16* SrcPixels;
-	u16 Attrib;
-	u8 Alpha;
-	u16 Start, End;
+	void* Next;
 	
-} PPU_DeferredTile;
+} PPU_Mode7Section;
 
 typedef struct
 {
@@ -110,6 +109,8 @@ typedef struct
 		u32 GraphicsParams;
 	};
 	
+	void* Next;
+	
 } PPU_BGSection;
 
 typedef struct
@@ -160,11 +161,8 @@ typedef struct
 	u8 WindowMask;
 	u16 WindowCombine;
 	
-	u32 NumDeferredTiles;
-	PPU_DeferredTile DeferredTiles[40];
-	
 	PPU_BGSection* CurSection;
-	PPU_BGSection Sections[240];
+	PPU_BGSection* Sections;
 
 } PPU_Background;
 
@@ -189,6 +187,7 @@ typedef struct
 {
 	u8 EndOffset;
 	PPU_WindowSegment Window[5];
+	void* Next;
 	
 } PPU_WindowSection;
 
@@ -197,6 +196,7 @@ typedef struct
 	u8 EndOffset;
 	u8 ColorMath;	// 0 = add, !0 = subtract
 	u8 Brightness;	// brightness (0-255)
+	void* Next;
 	
 } PPU_ColorEffectSection;
 
@@ -206,6 +206,7 @@ typedef struct
 	u8 Mode;
 	u16 MainScreen, SubScreen;
 	u8 ColorMath1, ColorMath2;
+	void* Next;
 } PPU_ModeSection;
 
 typedef struct
@@ -213,6 +214,7 @@ typedef struct
 	u8 EndOffset;
 	u16 Color;
 	u8 ColorMath2;
+	void* Next;
 } PPU_MainBackdropSection;
 
 typedef struct
@@ -220,6 +222,7 @@ typedef struct
 	u8 EndOffset;
 	u16 Color;
 	u8 Div2;
+	void* Next;
 } PPU_SubBackdropSection;
 
 typedef struct
@@ -228,8 +231,29 @@ typedef struct
 	const u8 *OBJWidth, *OBJHeight;
 	u16 OBJTilesetAddr;
 	u32 OBJGap;
+	void* Next;
 } PPU_OBJSection;
 
+// every kind changing on every line (one section each per line)
+#define PPU_SECTIONSIZE(type) ((sizeof(type) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+#define PPU_SECTIONLOG_WORST (240 * ( \
+	PPU_SECTIONSIZE(PPU_ModeSection) + \
+	PPU_SECTIONSIZE(PPU_OBJSection) + \
+	4 * PPU_SECTIONSIZE(PPU_BGSection) + \
+	PPU_SECTIONSIZE(PPU_Mode7Section) + \
+	PPU_SECTIONSIZE(PPU_WindowSection) + \
+	PPU_SECTIONSIZE(PPU_ColorEffectSection) + \
+	PPU_SECTIONSIZE(PPU_MainBackdropSection) + \
+	PPU_SECTIONSIZE(PPU_SubBackdropSection)))
+
+// what PPU.SectionLog holds: a mode 7 matrix on every line (HDMA perspective)
+// with room to spare, most frames use a few hundred bytes (COUNT_SECTIONLOG)
+// frames that need more go on in a block that's only allocated the first
+// time that happens, big enough for the rest of the worst case plus what
+// could be left unused at the end of the log
+#define PPU_SECTIONLOG_SIZE 0x8000
+#define PPU_SECTIONSPILL_SIZE (PPU_SECTIONLOG_WORST - PPU_SECTIONLOG_SIZE + PPU_SECTIONSIZE(PPU_Mode7Section))
+
 
 typedef struct
 {
@@ -242,13 +266,6 @@ typedef struct
 	u16* MainBuffer;
 	u16* SubBuffer;
 
-	// OBJ layer
-	// bit0-7: color # (0-127, selecting from upper palette region)
-	// bit8-15: BG-relative priority
-	u16 OBJBuffer[16+256+16];
-
-	u8 SpritesOnLine[4] __attribute__((aligned(4)));
-
 	u16 CGRAMAddr;
 	u8 CGRAMVal;
 	u16 CGRAM[256];		// SNES CGRAM, xBGR1555
@@ -258,6 +275,7 @@ typedef struct
 	u8 PaletteUpdateCount[64];
 	u16 PaletteUpdateCount128;
 	u16 PaletteUpdateCount256;
+	u8 PaletteDirty;	// for the soft renderer's threads
 	
 	// mid-frame palette changes
 	//PPU_PaletteChange PaletteChanges[240][64];
@@ -271,6 +289,7 @@ typedef struct
 	u8 VRAM7[0x8000];
 	u8 VRAMUpdateCount[0x1000];
 	u16 VRAM7UpdateCount[0x800];
+	u32 VRAMWrites;	// goes up along with VRAMUpdateCount
 
 	u16 OAMAddr;
 	u8 OAMVal;
@@ -278,6 +297,7 @@ typedef struct
 	u8 FirstOBJ;
 	u16 OAMReload;
 	u8 OAM[0x220];
+	u8 OBJListDirty;	// soft renderer's per-line sprite lists need rebuilding
 	
 	const u8* OBJWidth;
 	const u8* OBJHeight;
@@ -290,7 +310,7 @@ typedef struct
 	u8 Mode;
 	
 	u8 ModeDirty;
-	PPU_ModeSection ModeSections[240];
+	PPU_ModeSection* ModeSections;
 	PPU_ModeSection* CurModeSection;
 
 	union
@@ -318,14 +338,14 @@ typedef struct
 	u16 SubBackdrop;
 	
 	u8 MainBackdropDirty;
-	PPU_MainBackdropSection MainBackdropSections[240];
+	PPU_MainBackdropSection* MainBackdropSections;
 	PPU_MainBackdropSection* CurMainBackdrop;
 
 	u8 SubBackdropDirty;
-	PPU_SubBackdropSection SubBackdropSections[240];
+	PPU_SubBackdropSection* SubBackdropSections;
 	PPU_SubBackdropSection* CurSubBackdrop;
 
-	PPU_ColorEffectSection ColorEffectSections[240];
+	PPU_ColorEffectSection* ColorEffectSections;
 	PPU_ColorEffectSection* CurColorEffect;
 	u8 ColorEffectDirty;
 
@@ -383,13 +403,13 @@ typedef struct
 	
 	u8 M7ExtBG;
 	
-	PPU_Mode7Section Mode7Sections[240];
+	PPU_Mode7Section* Mode7Sections;
 	PPU_Mode7Section* CurMode7Section;
 	u8 Mode7Dirty;
 
 	PPU_Background BG[4];
 
-	PPU_OBJSection OBJSections[240];
+	PPU_OBJSection* OBJSections;
 	PPU_OBJSection* CurOBJSection;
 	PPU_OBJSection* CurOBJSecSel;
 
@@ -407,7 +427,7 @@ typedef struct
 	
 	PPU_WindowSegment Window[5];
 	
-	PPU_WindowSection WindowSections[240];
+	PPU_WindowSection* WindowSections;
 	PPU_WindowSection* CurWindowSection;
 
 	u8 WindowDirty;
@@ -419,11 +439,16 @@ typedef struct
 
 	u8 OBJOverflow;
 	
+	u32 SectionLogUsed;
+	u8 SectionLog[PPU_SECTIONLOG_SIZE] __attribute__((aligned(8)));
+	
 } PPUState;
 
 extern PPUState PPU;
 
 extern bool SkipThisFrame;
+// emulate the frame without rendering or waiting for anything (run-ahead)
+extern bool HideThisFrame;
 extern u8 RenderState;
 
 
@@ -434,6 +459,29 @@ void PPU_DeInit();
 
 void PPU_SetColor(u32 num, u16 val);
 
+void PPU_ClearSectionLog();
+void* PPU_AddSection(u32 size);
+
+// starts the first section of a kind, on line 0 after the log was cleared
+#define PPU_FIRSTSECTION(first, cur) \
+	{ \
+		(first) = (cur) = PPU_AddSection(sizeof(*(cur))); \
+	}
+
+// closes the current section of a kind at 'line' and moves on to a new one
+// (that only fails if the spill block can't be allocated, then the current
+// one goes on with the new values)
+#define PPU_NEXTSECTION(cur, line) \
+	{ \
+		void* next = PPU_AddSection(sizeof(*(cur))); \
+		if (next) \
+		{ \
+			(cur)->EndOffset = (line); \
+			(cur)->Next = next; \
+			(cur) = next; \
+		} \
+	}
+
 void PPU_LatchHVCounters();
 
 u8 PPU_Read8(u32 addr);
@@ -441,6 +489,17 @@ u16 PPU_Read16(u32 addr);
 void PPU_Write8(u32 addr, u8 val);
 void PPU_Write16(u32 addr, u16 val);
 
+// fast paths for the busiest registers, called straight from the I/O tables
+u8 PPU_ReadAPUIO8(u32 addr);
+u16 PPU_ReadAPUIO16(u32 addr);
+void PPU_WriteOAM(u32 addr, u8 val);
+void PPU_WriteVRAML(u32 addr, u8 val);
+void PPU_WriteVRAMH(u32 addr, u8 val);
+void PPU_WriteVRAM16(u32 addr, u16 val);
+void PPU_WriteCGRAM(u32 addr, u8 val);
+void PPU_WriteAPUIO8(u32 addr, u8 val);
+void PPU_WriteAPUIO16(u32 addr, u16 val);
+
 void PPU_RenderScanline(u32 line);
 void PPU_VBlank();
 
@@ -451,6 +510,24 @@ void PPU_DeInit_Soft();
 void PPU_RenderScanline_Soft(u32 line);
 void PPU_VBlank_Soft();
 
+void PPU_SetRenderThreads_Soft(int num, int pipeline);
+void PPU_FinishLines_Soft();
+void PPU_SyncLines_Soft();
+u16* PPU_LastFrame_Soft();
+
+// the soft renderer's threads read VRAM and OAM while the emulation goes on
+// whatever changes them has to wait for the lines that are still being drawn
+extern u8 PPU_LinesPending;
+#define PPU_SYNC_SOFT() { if (PPU_LinesPending) PPU_SyncLines_Soft(); }
+
+void PPU_FlushTileCache_Soft();
+
+u32 PPU_DecodeRow_2bpp(u32 tilepixels);
+u32 PPU_DecodeRow_4bpp(u32 tilepixels);
+void PPU_RenderRow_16(u16 curtile, u32 pixels, u32* buffer, u16* pal, u32 alpha, int start, int end);
+void PPU_RenderRow_256(u16 curtile, u32* pixels, u32* buffer, u16* pal, u32 alpha, int start, int end);
+void PPU_RenderRow_OBJ(u16 attrib, u32 pixels, u16* buffer, u16 paloffset_prio);
+
 
 void PPU_Init_Hard();
 void PPU_DeInit_Hard();
@@ -458,9 +535,63 @@ void PPU_DeInit_Hard();
 void PPU_RenderScanline_Hard(u32 line);
 void PPU_VBlank_Hard();
 
+#define TILE_2BPP		0
+#define TILE_4BPP		1
+#define TILE_8BPP		2
+#define TILE_Mode7		3
+#define TILE_Mode7_1	4
+#define TILE_Mode7_2	5
+
+typedef struct
+{
+	u16* Pixels;	// 1024x1024 RGBA5551 texture, allocated when first used
+	u32 Style;		// TILE_Mode7*, 0xFF if nothing was drawn yet
+	u32 PalStamp;
+	
+	u16 TileStamps[256];	// VRAM7UpdateCount of each tile
+	u8 MapStamps[2048];		// VRAMUpdateCount of each group of 8 tilemap entries
+	u8 Tiles[128*128];		// what each cell has
+	u16 TilePixels[256*64];	// what each tile looked like when it was last copied
+	u32 Dirty[4];
+} PPU_Mode7Plane;
+
+typedef struct
+{
+	u16* Pixels;	// the low priority plane then the high priority one, allocated when first used
+	u32 Alloc;		// how many pixels each of them has room for
+	
+	// what it was drawn for, Type is 0xFF if nothing
+	u32 GraphicsParams;
+	u8 Size, Type;
+	u8 Width, Height;	// in tiles
+	
+	u32 Frame;			// the last frame it was updated in
+	u32 VRAMWrites;		// PPU.VRAMWrites then
+	u32 PalSeen[8];		// palette stamps at that frame
+	u32 PalStamps[8];	// palette stamps the cells were drawn with
+	u16 PalCells[8];	// how many cells use each palette
+	u8 PalChanging;		// palettes that changed since the frame before
+	
+	u16 Entries[64*64];	// the tilemap entry and tile stamp each cell was drawn with
+	u32 Stamps[64*64];
+	u32 Dirty[4];		// one bit per texture row, both planes
+} PPU_HardBGPlane;
+
+extern u16* PPU_TileCache;
+
+void PPU_InitTileCache();
+void PPU_DeInitTileCache();
+u32 PPU_StoreTileInCache(u32 type, u32 palid, u32 addr);
+u32 PPU_FlushTileCache();
+u16* PPU_UpdateMode7Plane(u32 style);
+PPU_HardBGPlane* PPU_UpdateBGPlane(u32 num, u32 type, PPU_BGSection* s);
+#ifdef TILECACHE_TRACE
+void PPU_TraceFrame();
+#endif
+
 void PPU_ComputeWindows(PPU_WindowSegment* s);
 
-void PPU_BlendScreens(u32 colorformat);
+void PPU_BlendScreens(u32 colorformat, PPU_ColorEffectSection* s);
 u32 PPU_TranslateVRAMAddress(u32 addr);
 
 #endif
@@ -19,12 +19,14 @@
 #include <3ds.h>
 
 #include <limits.h>
+#include <string.h>
 
 #include "blargGL.h"
 #include "mem.h"
 #include "snes.h"
 #include "ppu.h"
 #include "ui.h"
+#include "timing.h"
 
 #include "config.h"
 
@@ -45,6 +47,7 @@ extern void* vertexPtr;
 
 extern shaderProgram_s hardRenderShaderP;
 extern shaderProgram_s hard7RenderShaderP;
+extern shaderProgram_s hard7PlaneShaderP;
 extern shaderProgram_s plainQuadShaderP;
 extern shaderProgram_s windowMaskShaderP;
 
@@ -62,6 +65,8 @@ u32* OBJColorBuffer;
 u32* OBJDepthBuffer;
 
 u16* Mode7ColorBuffer;
+int Mode7DirtyStart, Mode7DirtyEnd;	// lines drawn into it this frame
+u8 Mode7DirtyExt;
 
 u32 YOffset256[256];
 
@@ -74,24 +79,7 @@ u32 tile0idx;
 u32 coord0;
 
 
-// tile cache:
-// 1024x1024 RGBA5551 texture (2 MB)
-// -> can hold 16384 tiles
-// FIFO
-
-// tile is recognized by:
-// * absolute address
-// * type (color depth, normal/hires)
-// * palette #
-
-// maps needed:
-// * tile key (addr/type/pal) -> u/v in tilecache texture
-// * u/v (tilecache index) -> tile key (for removing tiles from the cache)
-// * VRAM address -> dirty flag (for VRAM updates)
-// * palette offset -> dirty flag (for palette updates)
-
-// system for palette updates? (tile doesn't need to be redecoded, only recolored)
-// -> needs storing the tile in indexed format (might slow shit down when palette isn't updated)
+// the tile cache lives in ppu_tilecache.c
 
 
 // SHIT THAT CAN BE CHANGED MIDFRAME
@@ -116,24 +104,6 @@ u32 coord0;
 // + sub backdrop color
 
 
-#define TILE_2BPP		0
-#define TILE_4BPP		1
-#define TILE_8BPP		2
-#define TILE_Mode7		3
-#define TILE_Mode7_1	4
-#define TILE_Mode7_2	5
-
-
-u16* PPU_TileCache;
-u32 PPU_TileCacheIndex;
-
-u16 PPU_TileCacheList[0x20000];
-u32 PPU_TileCacheReverseList[16384];
-
-u32 PPU_TileVRAMUpdate[0x20000];
-u32 PPU_TilePalUpdate[0x20000];
-
-
 void PPU_Init_Hard()
 {
 	int i;
@@ -146,23 +116,12 @@ void PPU_Init_Hard()
 	OBJDepthBuffer = (u32*)VRAM_Alloc(256*256*4);
 	
 	Mode7ColorBuffer = (u16*)linearAlloc(256*512*2);
+	Mode7DirtyStart = 0;
+	Mode7DirtyEnd = 256;
+	Mode7DirtyExt = 1;
 	
-	PPU_TileCache = (u16*)linearAlloc(1024*1024*sizeof(u16));
-	PPU_TileCacheIndex = 0;
-	
-	for (i = 0; i < 0x10000; i++)
-	{
-		PPU_TileCacheList[i] = 0x8000;
-		PPU_TileVRAMUpdate[i] = 0;
-		PPU_TilePalUpdate[i] = 0;
-	}
+	PPU_InitTileCache();
 	
-	for (i = 0; i < 16384; i++)
-		PPU_TileCacheReverseList[i] = 0x80000000;
-		
-	for (i = 0; i < 1024*1024; i++)
-		PPU_TileCache[i] = 0xF800;
-		
 	for (i = 0; i < 256; i++)
 	{
 		u32 y = (i & 0x1) << 1;
@@ -176,7 +135,7 @@ void PPU_Init_Hard()
 
 void PPU_DeInit_Hard()
 {
-	linearFree(PPU_TileCache);
+	PPU_DeInitTileCache();
 	
 	VRAM_Free(MainScreenTex);
 	VRAM_Free(OBJColorBuffer);
@@ -185,451 +144,84 @@ void PPU_DeInit_Hard()
 }
 
 
-// tile decoding
-// note: tiles are directly converted to PICA200 tiles (zcurve)
-
-u32 PPU_DecodeTile_2bpp(u16* vram, u16* pal, u32* dst)
+void PPU_ApplyPaletteChanges(u32 num, PPU_PaletteChange* changes)
 {
-	int i;
-	u8 p1, p2, p3, p4;
-	u32 col1, col2;
-	u32 nonzero = 0;
-	
-	u16 oldcolor0 = pal[0];
-	pal[0] = 0;
-	
-#define DO_MINIBLOCK(l1, l2) \
-	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
-	if (l2 & 0x0080) p1 |= 0x01; \
-	if (l2 & 0x8000) p1 |= 0x02; \
-	if (l2 & 0x0040) p2 |= 0x01; \
-	if (l2 & 0x4000) p2 |= 0x02; \
-	l2 <<= 2; \
-	col1 = pal[p1] | (pal[p2] << 16); \
-	if (l1 & 0x0080) p3 |= 0x01; \
-	if (l1 & 0x8000) p3 |= 0x02; \
-	if (l1 & 0x0040) p4 |= 0x01; \
-	if (l1 & 0x4000) p4 |= 0x02; \
-	l1 <<= 2; \
-	col2 = pal[p3] | (pal[p4] << 16); \
-	*dst++ = col1; \
-	*dst++ = col2; 
-	
-	for (i = 4; i >= 0; i -= 4)
-	{
-		u16 line1 = vram[i+0];
-		u16 line2 = vram[i+1];
-		u16 line3 = vram[i+2];
-		u16 line4 = vram[i+3];
-		
-		nonzero |= line1 | line2 | line3 | line4;
-		
-		DO_MINIBLOCK(line3, line4);
-		DO_MINIBLOCK(line3, line4);
-		DO_MINIBLOCK(line1, line2);
-		DO_MINIBLOCK(line1, line2);
-		DO_MINIBLOCK(line3, line4);
-		DO_MINIBLOCK(line3, line4);
-		DO_MINIBLOCK(line1, line2);
-		DO_MINIBLOCK(line1, line2);
-	}
-	
-	pal[0] = oldcolor0;
+	u32 i;
 	
-#undef DO_MINIBLOCK
-	return nonzero;
-}
-
-u32 PPU_DecodeTile_4bpp(u16* vram, u16* pal, u32* dst)
-{
-	int i;
-	u8 p1, p2, p3, p4;
-	u32 col1, col2;
-	u32 nonzero = 0;
-	
-	u16 oldcolor0 = pal[0];
-	pal[0] = 0;
-	
-#define DO_MINIBLOCK(l1, l2) \
-	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
-	if (l2 & 0x00000080) p1 |= 0x01; \
-	if (l2 & 0x00008000) p1 |= 0x02; \
-	if (l2 & 0x00800000) p1 |= 0x04; \
-	if (l2 & 0x80000000) p1 |= 0x08; \
-	if (l2 & 0x00000040) p2 |= 0x01; \
-	if (l2 & 0x00004000) p2 |= 0x02; \
-	if (l2 & 0x00400000) p2 |= 0x04; \
-	if (l2 & 0x40000000) p2 |= 0x08; \
-	l2 <<= 2; \
-	col1 = pal[p1] | (pal[p2] << 16); \
-	if (l1 & 0x00000080) p3 |= 0x01; \
-	if (l1 & 0x00008000) p3 |= 0x02; \
-	if (l1 & 0x00800000) p3 |= 0x04; \
-	if (l1 & 0x80000000) p3 |= 0x08; \
-	if (l1 & 0x00000040) p4 |= 0x01; \
-	if (l1 & 0x00004000) p4 |= 0x02; \
-	if (l1 & 0x00400000) p4 |= 0x04; \
-	if (l1 & 0x40000000) p4 |= 0x08; \
-	l1 <<= 2; \
-	col2 = pal[p3] | (pal[p4] << 16); \
-	*dst++ = col1; \
-	*dst++ = col2; 
-	
-	for (i = 4; i >= 0; i -= 4)
+	for (i = 0; i < num; i++)
 	{
-		u32 line1 = vram[i+0] | (vram[i+8 ] << 16);
-		u32 line2 = vram[i+1] | (vram[i+9 ] << 16);
-		u32 line3 = vram[i+2] | (vram[i+10] << 16);
-		u32 line4 = vram[i+3] | (vram[i+11] << 16);
-		
-		nonzero |= line1 | line2 | line3 | line4;
-		
-		DO_MINIBLOCK(line3, line4);
-		DO_MINIBLOCK(line3, line4);
-		DO_MINIBLOCK(line1, line2);
-		DO_MINIBLOCK(line1, line2);
-		DO_MINIBLOCK(line3, line4);
-		DO_MINIBLOCK(line3, line4);
-		DO_MINIBLOCK(line1, line2);
-		DO_MINIBLOCK(line1, line2);
+		PPU.Palette[changes[i].Address] = changes[i].Color;
+		if(changes[i].Address < 128)
+		{
+			PPU.PaletteEx1[changes[i].Address] = changes[i].Color;
+			PPU.PaletteEx2[changes[i].Address + 128] = changes[i].Color;
+		}
 	}
-	
-	pal[0] = oldcolor0;
-	
-#undef DO_MINIBLOCK
-	return nonzero;
 }
 
-u32 PPU_DecodeTile_8bpp(u16* vram, u16* pal, u32* dst)
-{
-	int i;
-	u8 p1, p2, p3, p4;
-	u32 col1, col2;
-	u32 nonzero = 0;
-	
-	u16 oldcolor0 = pal[0];
-	pal[0] = 0;
-	
-#define DO_MINIBLOCK(l11, l12, l21, l22) \
-	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
-	if (l21 & 0x00000080) p1 |= 0x01; \
-	if (l21 & 0x00008000) p1 |= 0x02; \
-	if (l21 & 0x00800000) p1 |= 0x04; \
-	if (l21 & 0x80000000) p1 |= 0x08; \
-	if (l22 & 0x00000080) p1 |= 0x10; \
-	if (l22 & 0x00008000) p1 |= 0x20; \
-	if (l22 & 0x00800000) p1 |= 0x40; \
-	if (l22 & 0x80000000) p1 |= 0x80; \
-	if (l21 & 0x00000040) p2 |= 0x01; \
-	if (l21 & 0x00004000) p2 |= 0x02; \
-	if (l21 & 0x00400000) p2 |= 0x04; \
-	if (l21 & 0x40000000) p2 |= 0x08; \
-	if (l22 & 0x00000040) p2 |= 0x10; \
-	if (l22 & 0x00004000) p2 |= 0x20; \
-	if (l22 & 0x00400000) p2 |= 0x40; \
-	if (l22 & 0x40000000) p2 |= 0x80; \
-	l21 <<= 2; l22 <<= 2; \
-	col1 = pal[p1] | (pal[p2] << 16); \
-	if (l11 & 0x00000080) p3 |= 0x01; \
-	if (l11 & 0x00008000) p3 |= 0x02; \
-	if (l11 & 0x00800000) p3 |= 0x04; \
-	if (l11 & 0x80000000) p3 |= 0x08; \
-	if (l12 & 0x00000080) p3 |= 0x10; \
-	if (l12 & 0x00008000) p3 |= 0x20; \
-	if (l12 & 0x00800000) p3 |= 0x40; \
-	if (l12 & 0x80000000) p3 |= 0x80; \
-	if (l11 & 0x00000040) p4 |= 0x01; \
-	if (l11 & 0x00004000) p4 |= 0x02; \
-	if (l11 & 0x00400000) p4 |= 0x04; \
-	if (l11 & 0x40000000) p4 |= 0x08; \
-	if (l12 & 0x00000040) p4 |= 0x10; \
-	if (l12 & 0x00004000) p4 |= 0x20; \
-	if (l12 & 0x00400000) p4 |= 0x40; \
-	if (l12 & 0x40000000) p4 |= 0x80; \
-	l11 <<= 2; l12 <<= 2; \
-	col2 = pal[p3] | (pal[p4] << 16); \
-	*dst++ = col1; \
-	*dst++ = col2; 
-	
-	for (i = 4; i >= 0; i -= 4)
-	{
-		u32 line11 = vram[i+0 ] | (vram[i+8 ] << 16);
-		u32 line12 = vram[i+16] | (vram[i+24] << 16);
-		u32 line21 = vram[i+1 ] | (vram[i+9 ] << 16);
-		u32 line22 = vram[i+17] | (vram[i+25] << 16);
-		u32 line31 = vram[i+2 ] | (vram[i+10] << 16);
-		u32 line32 = vram[i+18] | (vram[i+26] << 16);
-		u32 line41 = vram[i+3 ] | (vram[i+11] << 16);
-		u32 line42 = vram[i+19] | (vram[i+27] << 16);
-		
-		nonzero |= line11 | line21 | line31 | line41;
-		nonzero |= line12 | line22 | line32 | line42;
-		
-		DO_MINIBLOCK(line31, line32, line41, line42);
-		DO_MINIBLOCK(line31, line32, line41, line42);
-		DO_MINIBLOCK(line11, line12, line21, line22);
-		DO_MINIBLOCK(line11, line12, line21, line22);
-		DO_MINIBLOCK(line31, line32, line41, line42);
-		DO_MINIBLOCK(line31, line32, line41, line42);
-		DO_MINIBLOCK(line11, line12, line21, line22);
-		DO_MINIBLOCK(line11, line12, line21, line22);
-	}
-	
-	pal[0] = oldcolor0;
-	
-#undef DO_MINIBLOCK
-	return nonzero;
-}
 
-u32 PPU_DecodeTile_8bpp_m7(u16* vram, u16* pal, u32* dst)
+// fixed state for the tile BG and window mask pipelines, what changes per
+// draw is set after these
+
+static const bglStateBlock PPU_TileBGState = 
 {
-	int i;
-	u8 p1, p2, p3, p4;
-	u32 col1, col2;
-	u32 nonzero = 0;
-	
-	u16 oldcolor0 = pal[0];
-	pal[0] = 0;
-	
-#define DO_MINIBLOCK(block) \
-	p1 = block & 0xFF; p2 = (block >> 8) & 0xFF; \
-	p3 = (block >> 16) & 0xFF; p4 = (block >> 24) & 0xFF; \
-	col1 = pal[p1] | (pal[p2] << 16); \
-	col2 = pal[p3] | (pal[p4] << 16); \
-	*dst++ = col1; \
-	*dst++ = col2; 
-	
-	for (i = 16; i >= 0; i -= 16)
-	{
-		u32 b1 = vram[i+12] | (vram[i+8 ] << 16);
-		u32 b2 = vram[i+13] | (vram[i+9 ] << 16);
-		u32 b3 = vram[i+4 ] | (vram[i+0 ] << 16);
-		u32 b4 = vram[i+5 ] | (vram[i+1 ] << 16);
-		u32 b5 = vram[i+14] | (vram[i+10] << 16);
-		u32 b6 = vram[i+15] | (vram[i+11] << 16);
-		u32 b7 = vram[i+6 ] | (vram[i+2 ] << 16);
-		u32 b8 = vram[i+7 ] | (vram[i+3 ] << 16);
-		
-		nonzero |= b1 | b2 | b3 | b4;
-		nonzero |= b5 | b6 | b7 | b8;
-		
-		DO_MINIBLOCK(b1);
-		DO_MINIBLOCK(b2);
-		DO_MINIBLOCK(b3);
-		DO_MINIBLOCK(b4);
-		DO_MINIBLOCK(b5);
-		DO_MINIBLOCK(b6);
-		DO_MINIBLOCK(b7);
-		DO_MINIBLOCK(b8);
-	}
+	.ScissorMode = GPU_SCISSOR_NORMAL,
 	
-	pal[0] = oldcolor0;
+	.DepthTest = false,
+	.DepthFunc = GPU_GREATER,
+	.ColorDepthMask = GPU_WRITE_COLOR,
 	
-#undef DO_MINIBLOCK
-	return nonzero;
-}
-
-u32 PPU_DecodeTile_8bpp_m7e(u16* vram, u16* pal, u32* dst, u32 prio)
-{
-	int i, j;
-	u8 p1, p2, p3, p4;
-	u32 col1, col2;
-	u32 nonzero = 0;
-	u32 block[8], tmp, tmp1;
-	u16 oldcolor0 = pal[0];
-	pal[0] = 0;
-
-	if(!prio)
-		prio = 0x80808080;
-	else
-		prio = 0x00000000;
+	// enabled along with the stencil func, per BG
+	.StencilTest = false,
+	.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+	.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
 	
-#define DO_MINIBLOCK(block) \
-	p1 = block & 0xFF; p2 = (block >> 8) & 0xFF; \
-	p3 = (block >> 16) & 0xFF; p4 = (block >> 24) & 0xFF; \
-	col1 = pal[p1] | (pal[p2] << 16); \
-	col2 = pal[p3] | (pal[p4] << 16); \
-	*dst++ = col1; \
-	*dst++ = col2; 
+	.AlphaTest = true,
+	.AlphaFunc = GPU_GREATER, .AlphaRef = 0,
 	
-	for (i = 16; i >= 0; i -= 16)
-	{
-		block[0] = vram[i+12] | (vram[i+8 ] << 16);
-		block[1] = vram[i+13] | (vram[i+9 ] << 16);
-		block[2] = vram[i+4 ] | (vram[i+0 ] << 16);
-		block[3] = vram[i+5 ] | (vram[i+1 ] << 16);
-		block[4] = vram[i+14] | (vram[i+10] << 16);
-		block[5] = vram[i+15] | (vram[i+11] << 16);
-		block[6] = vram[i+6 ] | (vram[i+2 ] << 16);
-		block[7] = vram[i+7 ] | (vram[i+3 ] << 16);
-
-		for(j = 0; j < 8; j++)
-		{
-			tmp = 0;
-			tmp1 = block[j] ^ prio;
-			if(tmp1 & 0x80000000)
-				tmp |= 0xFF000000;
-			if(tmp1 & 0x00800000)
-				tmp |= 0x00FF0000;
-			if(tmp1 & 0x00008000)
-				tmp |= 0x0000FF00;
-			if(tmp1 & 0x00000080)
-				tmp |= 0x000000FF;
-			tmp = block[j] & tmp;
-			
-			nonzero |= tmp;
-			DO_MINIBLOCK(tmp);
-		}
-	}
+	.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+	.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
 	
-	pal[0] = oldcolor0;
+	// stage 0 is set per draw, depending on color math
+	.TextureEnable = GPU_TEXUNIT0,
+	.NumTexEnvs = 1,
+	.TexEnv = 
+	{
+		{GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0), GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF},
+	},
 	
-#undef DO_MINIBLOCK
-	return nonzero;
-}
-
+	.NumAttribs = 2,
+	.Attrib = {{GPU_SHORT, 2}, {GPU_UNSIGNED_BYTE, 2}},	// vertex, texcoord
+};
 
-u32 PPU_StoreTileInCache(u32 type, u32 palid, u32 addr)
+static const bglStateBlock PPU_WindowMaskState = 
 {
-	u32 key;
-	u32 paldirty = 0;
-	u32 m7upper = 0;
-	u32 vramdirty = 0;
-	u32 nonzero = 0;
-	u32 isnew = 0;
-	u32 tempbuf[32];
-	
-	switch (type)
-	{
-		case TILE_2BPP: 
-			paldirty = PPU.PaletteUpdateCount[palid];
-			vramdirty = PPU.VRAMUpdateCount[addr >> 4];
-			break;
-			
-		case TILE_4BPP: 
-      paldirty = *(u32*)&PPU.PaletteUpdateCount[palid << 2];
-      vramdirty = *(u16*)&PPU.VRAMUpdateCount[addr >> 4];
-			break;
-			
-		case TILE_8BPP: 
-			paldirty = PPU.PaletteUpdateCount256;
-      vramdirty = *(u32*)&PPU.VRAMUpdateCount[addr >> 4];
-			break;
-
-		case TILE_Mode7:
-			paldirty = PPU.PaletteUpdateCount256;
-			vramdirty = PPU.VRAM7UpdateCount[addr >> 4];
-			break;
-
-		case TILE_Mode7_2:
-			m7upper = 1;
-		case TILE_Mode7_1:
-			paldirty = PPU.PaletteUpdateCount128;
-			vramdirty = PPU.VRAM7UpdateCount[addr >> 4];
-			break;
-
-		default:
-			bprintf("unknown tile type %d\n", type);
-			return 0xFFFF;
-	}
+	.ScissorMode = GPU_SCISSOR_DISABLE,
 	
-	key = (addr >> 4) | (palid << 12) | (m7upper << 16);
+	.DepthTest = false,
+	.DepthFunc = GPU_GREATER,
+	.ColorDepthMask = GPU_WRITE_RED,
 	
-	u16 coord = PPU_TileCacheList[key];
-	u32 tileidx;
+	.StencilTest = false,
+	.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+	.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
 	
-	if (coord != 0x8000) // tile already exists
-	{
-		// if the VRAM hasn't been modified in the meantime, just return the old tile
-		if (vramdirty == PPU_TileVRAMUpdate[key] && paldirty == PPU_TilePalUpdate[key])
-			return coord;
-		
-		if (coord == 0xC000)
-		{
-			tileidx = PPU_TileCacheIndex;
-			coord = (tileidx & 0x7F) | (0x7F00 - ((tileidx & 0x3F80) << 1));
-			isnew = 1;
-		}
-		else
-			tileidx = (coord & 0x7F) | ((0x7F00 - (coord & 0x7F00)) >> 1);
-	}
-	else
-	{
-		tileidx = PPU_TileCacheIndex;
-		
-		coord = (tileidx & 0x7F) | (0x7F00 - ((tileidx & 0x3F80) << 1));
-		isnew = 1;
-	}
+	.AlphaTest = false,
+	.AlphaFunc = GPU_GREATER, .AlphaRef = 0,
 	
-	switch (type)
-	{
-		case TILE_2BPP: nonzero = PPU_DecodeTile_2bpp((u16*)&PPU.VRAM[addr], &TempPalette[palid << 2], tempbuf); break;
-		case TILE_4BPP: nonzero = PPU_DecodeTile_4bpp((u16*)&PPU.VRAM[addr], &TempPalette[palid << 4], tempbuf); break;
-		
-		case TILE_8BPP: 
-			// TODO: direct color!
-			nonzero = PPU_DecodeTile_8bpp((u16*)&PPU.VRAM[addr], &TempPalette[0], tempbuf); 
-			break;
-
-		case TILE_Mode7: nonzero = PPU_DecodeTile_8bpp_m7((u16*)&PPU.VRAM7[addr << 2], &TempPalette[0], tempbuf);	break;
-		case TILE_Mode7_1: nonzero = PPU_DecodeTile_8bpp_m7e((u16*)&PPU.VRAM7[addr << 2], &PPU.PaletteEx1[0], tempbuf, 0); break;
-		case TILE_Mode7_2: nonzero = PPU_DecodeTile_8bpp_m7e((u16*)&PPU.VRAM7[addr << 2], &PPU.PaletteEx2[0], tempbuf, 1); break;
-	}
+	.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+	.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
 	
-	PPU_TileVRAMUpdate[key] = vramdirty;
-	PPU_TilePalUpdate[key] = paldirty;
-	
-	if (!nonzero) // tile is empty - mark it as such
-	{
-		coord = 0xC000;
-		PPU_TileCacheList[key] = coord;
-		
-		if (!isnew)
-		{
-			// free previous tile if need be
-			u32 oldkey = PPU_TileCacheReverseList[tileidx];
-			PPU_TileCacheReverseList[tileidx] = 0x80000000;
-			if (oldkey != 0x80000000)
-				PPU_TileCacheList[oldkey] = 0x8000;
-		}
-	}
-	else
+	.TextureEnable = 0,
+	.NumTexEnvs = 1,
+	.TexEnv = 
 	{
-		if (isnew)
-		{
-			PPU_TileCacheIndex++;
-			PPU_TileCacheIndex &= ~0x3FC000; // prevent overflow
-			
-			PPU_TileCacheList[key] = coord;
-		}
-		
-		memcpy(&PPU_TileCache[tileidx * 64], tempbuf, 64*2);
-		
-		// invalidate previous tile if need be
-		u32 oldkey = PPU_TileCacheReverseList[tileidx];
-		PPU_TileCacheReverseList[tileidx] = key;
-		if (oldkey != key && oldkey != 0x80000000)
-			PPU_TileCacheList[oldkey] = 0x8000;
-	}
+		{GPU_TEVSOURCES(GPU_PRIMARY_COLOR, 0, 0), GPU_TEVSOURCES(GPU_PRIMARY_COLOR, 0, 0), GPU_TEVOPERANDS(0,0,0), GPU_TEVOPERANDS(0,0,0), GPU_REPLACE, GPU_REPLACE, 0xFFFFFFFF},
+	},
 	
-	return coord;
-}
-
-
-void PPU_ApplyPaletteChanges(u32 num, PPU_PaletteChange* changes)
-{
-	u32 i;
-	
-	for (i = 0; i < num; i++)
-	{
-		PPU.Palette[changes[i].Address] = changes[i].Color;
-		if(changes[i].Address < 128)
-		{
-			PPU.PaletteEx1[changes[i].Address] = changes[i].Color;
-			PPU.PaletteEx2[changes[i].Address + 128] = changes[i].Color;
-		}
-	}
-}
+	.NumAttribs = 2,
+	.Attrib = {{GPU_SHORT, 2}, {GPU_UNSIGNED_BYTE, 2}},	// vertex, color
+};
 
 
 void PPU_StartBG(u32 hi)
@@ -637,41 +229,14 @@ void PPU_StartBG(u32 hi)
 	if (doingBG) return;
 	doingBG = 1;
 	
-	//bglEnableStencilTest(true);
-	//bglStencilFunc(GPU_ALWAYS, 0x00, 0xFF, 0x02);
-	bglEnableStencilTest(false);
-	bglStencilOp(GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP);
-	
-	bglEnableDepthTest(false);
-	bglEnableAlphaTest(true);
-	bglAlphaFunc(GPU_GREATER, 0);
-	
-	bglBlendEquation(GPU_BLEND_ADD, GPU_BLEND_ADD);
-	bglBlendFunc(GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO);
-	
-	bglScissorMode(GPU_SCISSOR_NORMAL);
-	
-	bglColorDepthMask(GPU_WRITE_COLOR);
+	bglApplyState(&PPU_TileBGState);
 	
 	SET_UNIFORM(GPU_VERTEX_SHADER, 4, 1.0f/128.0f, 1.0f/128.0f, 1.0f, 1.0f);
 	
-	bglEnableTextures(GPU_TEXUNIT0);
-	
-	bglDummyTexEnv(1);
-	bglDummyTexEnv(2);
-	bglDummyTexEnv(3);
-	bglDummyTexEnv(4);
-	bglDummyTexEnv(5);
-		
 	bglTexImage(GPU_TEXUNIT0, PPU_TileCache,1024,1024,(hi ? 0x6: 0),GPU_RGBA5551);
-	
-	bglNumAttribs(2);
-	bglAttribType(0, GPU_SHORT, 2);	// vertex
-	bglAttribType(1, GPU_UNSIGNED_BYTE, 2);	// texcoord
 }
 
 
-
 void PPU_ClearMainScreen()
 {
 	u8* vptr = (u8*)vertexPtr;
@@ -739,7 +304,7 @@ void PPU_ClearMainScreen()
 		
 		if (s->EndOffset >= 240) break;
 		ystart = s->EndOffset;
-		s++;
+		s = s->Next;
 	}
 	
 	bglDrawArrays(GPU_UNKPRIM, nvtx);
@@ -833,7 +398,7 @@ void PPU_ClearSubScreen()
 		
 		if (s->EndOffset >= 240) break;
 		ystart = s->EndOffset;
-		s++;
+		s = s->Next;
 	}
 	
 	vptr = (u8*)((((u32)vptr) + 0x1F) & ~0x1F);
@@ -868,21 +433,10 @@ void PPU_DrawWindowMask(u32 snum)
 	
 	bglOutputBuffers(OBJDepthBuffer, OBJDepthBuffer);
 	
-	bglEnableStencilTest(false);
-	bglStencilOp(GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP);
-	
-	bglEnableDepthTest(false);
-	bglEnableAlphaTest(false);
-	bglBlendEquation(GPU_BLEND_ADD, GPU_BLEND_ADD);
-	bglBlendFunc(GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO);
-	
-	bglColorDepthMask(GPU_WRITE_RED);
+	bglApplyState(&PPU_WindowMaskState);
 	
 	bglUniformMatrix(GPU_VERTEX_SHADER, 0, snesProjMatrix);
 	
-	bglNumAttribs(2);
-	bglAttribType(0, GPU_SHORT, 2);	// vertex
-	bglAttribType(1, GPU_UNSIGNED_BYTE, 2);	// color
 	bglAttribBuffer(vptr);
 		
 	int nvtx = 0;
@@ -909,7 +463,7 @@ void PPU_DrawWindowMask(u32 snum)
 		
 		if (s->EndOffset >= 240) break;
 		ystart = s->EndOffset;
-		s++;
+		s = s->Next;
 	}
 	
 	vptr = (u8*)((((u32)vptr) + 0x1F) & ~0x1F);
@@ -999,6 +553,162 @@ void PPU_ClearAlpha(u32 snum)
 }
 
 
+// a BG is walked once for both priorities: the high priority tiles found
+// while drawing the low priority ones are kept aside, one run per section,
+// and drawn when the high priority turn comes. a section drawn from the
+// BG's plane keeps a run that draws the high priority plane instead
+typedef struct
+{
+	u16* Vertices;
+	int NumTiles;
+	int YStart, YEnd;
+	
+	PPU_HardBGPlane* Plane;
+	PPU_BGSection* Section;
+	
+} PPU_BGRun;
+
+// when either of these fills up (hires + interlace + offset-per-tile can get
+// close), the walk stops keeping high priority tiles aside from that section
+// on. the runs kept till then are still drawn, the rest of the lines get a
+// second walk of their own, like before. so nothing that went into the vertex
+// buffer is wasted (it can't be taken back anyway, the low priority tiles
+// drawn after a kept run are behind it)
+// host/highruncheck.c builds this with smaller ones, to fill them up
+#ifndef HIGH_MAX_RUNS
+#define HIGH_MAX_RUNS 240
+#define HIGH_MAX_VERTICES (8192 * 2*3)
+#endif
+
+PPU_BGRun PPU_HighRuns[4][HIGH_MAX_RUNS];
+int PPU_NumHighRuns[4];
+int PPU_HighRunsStart[4] = {-1, -1, -1, -1}, PPU_HighRunsEnd[4];	// lines they were walked for
+int PPU_HighRunsUntil[4];	// the line the kept runs stop at, PPU_HighRunsEnd if they're all there
+u16 PPU_HighVertices[HIGH_MAX_VERTICES];	// a section's worth, until they go to the vertex buffer
+
+// past this there may not be room for one more tile (four subtiles)
+#define HIGH_VERTICES_END (&PPU_HighVertices[HIGH_MAX_VERTICES - 4*2*3])
+
+static void PPU_DrawBGTiles(u32 setalpha, u32 num, u32 hi, int systart, int syend, void* vertices, int ntiles)
+{
+	PPU_StartBG(hi);
+	
+	bglScissor(0, systart, 256, syend);
+	
+	bglEnableStencilTest(true);
+	bglStencilFunc(GPU_EQUAL, 0x00, 1<<num, 0xFF);
+	
+	// set alpha to 128 if we need to disable color math in this BG section
+	bglTexEnv(0, 
+		GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), 
+		GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0),
+		GPU_TEVOPERANDS(0,0,0), 
+		GPU_TEVOPERANDS(0,0,0), 
+		GPU_REPLACE, setalpha ? GPU_REPLACE:GPU_MODULATE, 
+		setalpha ? 0xFFFFFFFF:0x80FFFFFF);
+	
+	bglAttribBuffer(vertices);
+	
+	bglDrawArrays(GPU_UNKPRIM, ntiles*2);
+}
+
+// draws a BG section as one quad textured with one of the BG's planes
+// (prio 0: low priority, 1: high priority), with the mode 7 plane shader and
+// the matrix reduced to the scroll
+static void PPU_DrawBGPlane(u32 setalpha, u32 num, PPU_HardBGPlane* plane, u32 prio, PPU_BGSection* s, int systart, int syend)
+{
+	int w = plane->Width << 3, h = plane->Height << 3;
+	int mx = s->XScroll & (w - 1), my = (s->YScroll + systart) & (h - 1);
+	int lines = syend - systart;
+	u16* vptr = (u16*)vertexPtr;
+	
+	doingBG = 0;
+	bglUseShader(&hard7PlaneShaderP);
+	bglFaceCulling(GPU_CULL_NONE);
+	PPU_StartBG(0);
+	
+	bglTexImage(GPU_TEXUNIT0, &plane->Pixels[prio ? (w*h) : 0],w,h,0x2200,GPU_RGBA5551);
+	
+	snesM7Matrix[0] = 1.0f; snesM7Matrix[1] = 0.0f; snesM7Matrix[3] = -mx;
+	snesM7Matrix[4] = 0.0f; snesM7Matrix[5] = 1.0f; snesM7Matrix[7] = systart - my;
+	bglUniformMatrix(GPU_VERTEX_SHADER, 0, snesProjMatrix);
+	bglUniformMatrix(GPU_VERTEX_SHADER, 5, snesM7Matrix);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 14, 256 / 128.0f, 0.0f, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 15, 0.0f, lines / 128.0f, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 10, mx / (float)w, my / (float)h, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 11, (mx + 256) / (float)w, my / (float)h, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 12, mx / (float)w, (my + lines) / (float)h, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 13, (mx + 256) / (float)w, (my + lines) / (float)h, 0.0f, 0.0f);
+	
+	bglScissor(0, systart, 256, syend);
+	
+	bglEnableStencilTest(true);
+	bglStencilFunc(GPU_EQUAL, 0x00, 1<<num, 0xFF);
+	
+	// set alpha to 128 if we need to disable color math in this BG section
+	bglTexEnv(0, 
+		GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), 
+		GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0),
+		GPU_TEVOPERANDS(0,0,0), 
+		GPU_TEVOPERANDS(0,0,0), 
+		GPU_REPLACE, setalpha ? GPU_REPLACE:GPU_MODULATE, 
+		setalpha ? 0xFFFFFFFF:0x80FFFFFF);
+	
+	bglAttribBuffer(vertexPtr);
+	
+	// the texcoords all come from the uniforms
+	*vptr++ = mx;
+	*vptr++ = my;
+	*vptr++ = 0;
+	
+	vptr = (u16*)((((u32)vptr) + 0x1F) & ~0x1F);
+	vertexPtr = vptr;
+	
+	bglDrawArrays(GPU_UNKPRIM, 1);
+	
+	// back to tiles, from the tile cache
+	doingBG = 0;
+	bglUseShader(&hardRenderShaderP);
+	bglFaceCulling(GPU_CULL_BACK_CCW);
+}
+
+static void PPU_KeepHighRun(u32 num, int systart, int syend, u16* end, int ntiles)
+{
+	PPU_BGRun* run = &PPU_HighRuns[num][PPU_NumHighRuns[num]++];
+	u32 size = (u32)end - (u32)PPU_HighVertices;
+	
+	run->Vertices = (u16*)vertexPtr;
+	run->NumTiles = ntiles;
+	run->YStart = systart;
+	run->YEnd = syend;
+	run->Plane = NULL;
+	
+	memcpy(vertexPtr, PPU_HighVertices, size);
+	vertexPtr = (void*)((((u32)vertexPtr) + size + 0x1F) & ~0x1F);
+}
+
+// returns the line the BG has to be walked from for the rest, ystart if
+// there's nothing kept for these lines, yend if it was all kept
+static int PPU_DrawHighRuns(u32 setalpha, u32 num, u32 hi, int ystart, int yend)
+{
+	int i;
+	
+	if (PPU_HighRunsStart[num] != ystart || PPU_HighRunsEnd[num] != yend)
+		return ystart;
+	
+	for (i = 0; i < PPU_NumHighRuns[num]; i++)
+	{
+		PPU_BGRun* run = &PPU_HighRuns[num][i];
+		if (run->Plane)
+			PPU_DrawBGPlane(setalpha, num, run->Plane, 1, run->Section, run->YStart, run->YEnd);
+		else
+			PPU_DrawBGTiles(setalpha, num, hi, run->YStart, run->YEnd, run->Vertices, run->NumTiles);
+	}
+	
+	PPU_HighRunsStart[num] = -1;
+	return PPU_HighRunsUntil[num];
+}
+
 void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart, int yend, u32 opt, u32 hi)
 {
 	PPU_Background* bg = &PPU.BG[num];
@@ -1012,10 +722,13 @@ void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart,
 	int x = 0, y = 0, ox = 0, oy = 0, yf = 0;
 	u32 idx;
 	int systart = 1, syend, syend1, oyend;
-	int ntiles = 0;
-	u16* vptr = (u16*)vertexPtr;
+	int ntiles[2];
+	u16* vptr[2];
+	u32 bin, p;
 	u32 validBit = (num + 1) * 0x2000;
 	int xmax = 256, xsize = 8, yincr = 8, ysize = 8, yshift = 0;
+	PPU_HardBGPlane* plane = NULL;
+	int planedone = (opt || hi || type == TILE_8BPP);	// those always go tile by tile
 
 	if(hi)
 	{
@@ -1030,9 +743,28 @@ void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart,
 	}
 	
 #define ADDVERTEX(x, y, coord) \
-	*vptr++ = x; \
-	*vptr++ = y; \
-	*vptr++ = coord;
+	*vptr[p]++ = x; \
+	*vptr[p]++ = y; \
+	*vptr[p]++ = coord;
+	
+	// the high priority pass draws what the low priority one kept aside, and
+	// walks what it couldn't keep
+	if (prio)
+	{
+		ystart = PPU_DrawHighRuns(setalpha, num, hi, ystart, yend);
+		if (ystart >= yend) return;
+	}
+	
+	bin = !prio;
+	if (bin)
+	{
+		PPU_NumHighRuns[num] = 0;
+		PPU_HighRunsStart[num] = ystart;
+		PPU_HighRunsEnd[num] = yend;
+		PPU_HighRunsUntil[num] = yend;
+	}
+	
+	vptr[0] = (u16*)vertexPtr;
 	
 	PPU_BGSection* s = &bg->Sections[0];
 	PPU_BGSection* o = 0;
@@ -1043,15 +775,54 @@ void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart,
 		if (syend <= ystart)
 		{
 			systart = syend;
-			s++;
+			s = s->Next;
 			continue;
 		}
 
 		if (systart < ystart) systart = ystart;
 		if (syend > yend) syend = yend;
 		
+		if (!planedone)
+		{
+			// brought up to date for the first section, the others use it if
+			// they have the same tilemap, tileset and size
+			plane = PPU_UpdateBGPlane(num, type, s);
+			planedone = 1;
+		}
+		
+		if (plane && s->GraphicsParams == plane->GraphicsParams && s->Size == plane->Size)
+		{
+			PPU_DrawBGPlane(setalpha, num, plane, prio ? 1:0, s, systart, syend);
+			
+			if (bin)
+			{
+				if (PPU_NumHighRuns[num] < HIGH_MAX_RUNS)
+				{
+					PPU_BGRun* run = &PPU_HighRuns[num][PPU_NumHighRuns[num]++];
+					run->Plane = plane;
+					run->Section = s;
+					run->YStart = systart;
+					run->YEnd = syend;
+				}
+				else
+				{
+					bin = 0;
+					PPU_HighRunsUntil[num] = systart;
+				}
+			}
+			
+			vptr[0] = (u16*)vertexPtr;
+			
+			if (syend >= yend) break;
+			systart = syend;
+			s = s->Next;
+			continue;
+		}
+		
 		yoff = (s->YScroll + systart) >> yshift;
-		ntiles = 0;
+		ntiles[0] = 0;
+		ntiles[1] = 0;
+		vptr[1] = PPU_HighVertices;
 
 		if(opt)
 		{
@@ -1059,7 +830,7 @@ void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart,
 			oyend = o->EndOffset;
 			while(systart >= oyend)
 			{
-				o++;
+				o = o->Next;
 				oyend = o->EndOffset;
 			}
 			oxoff = o->XScroll & 0xF8;
@@ -1138,9 +909,22 @@ void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart,
 
 				curtile = tilemap[idx];
 				
-
-				if ((curtile ^ prio) & 0x2000)
+				// when walking for both priorities, the high ones go aside
+				if (bin)
+				{
+					p = (curtile & 0x2000) >> 13;
+					if (p && vptr[1] > HIGH_VERTICES_END)
+					{
+						bin = 0;
+						ntiles[1] = 0;
+						PPU_HighRunsUntil[num] = systart;
+						continue;
+					}
+				}
+				else if ((curtile ^ prio) & 0x2000)
 					continue;
+				else
+					p = 0;
 
 				// render the tile
 				
@@ -1153,7 +937,7 @@ void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart,
 						{ \
 							ADDVERTEX(x+sx,       yf+sy,       coord+t0); \
 							ADDVERTEX(x+sx+xsize, yf+sy+ysize, coord+t3); \
-							ntiles++; \
+							ntiles[p]++; \
 						}				
 				if(hi)
 				{
@@ -1203,35 +987,31 @@ void PPU_HardRenderBG_8x8(u32 setalpha, u32 num, int type, u32 prio, int ystart,
 			}
 		}
 				
-		if (ntiles)
+		if (ntiles[0])
 		{
-			PPU_StartBG(hi);
-			
-			bglScissor(0, systart, 256, syend);
-			
-			bglEnableStencilTest(true);
-			bglStencilFunc(GPU_EQUAL, 0x00, 1<<num, 0xFF);
-			
-			// set alpha to 128 if we need to disable color math in this BG section
-			bglTexEnv(0, 
-				GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), 
-				GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0),
-				GPU_TEVOPERANDS(0,0,0), 
-				GPU_TEVOPERANDS(0,0,0), 
-				GPU_REPLACE, setalpha ? GPU_REPLACE:GPU_MODULATE, 
-				setalpha ? 0xFFFFFFFF:0x80FFFFFF);
-			
-			bglAttribBuffer(vertexPtr);
-			
-			vptr = (u16*)((((u32)vptr) + 0x1F) & ~0x1F);
-			vertexPtr = vptr;
+			PPU_DrawBGTiles(setalpha, num, hi, systart, syend, vertexPtr, ntiles[0]);
 			
-			bglDrawArrays(GPU_UNKPRIM, ntiles*2);
+			vptr[0] = (u16*)((((u32)vptr[0]) + 0x1F) & ~0x1F);
+			vertexPtr = vptr[0];
+		}
+		
+		if (ntiles[1])
+		{
+			if (PPU_NumHighRuns[num] < HIGH_MAX_RUNS)
+			{
+				PPU_KeepHighRun(num, systart, syend, vptr[1], ntiles[1]);
+				vptr[0] = (u16*)vertexPtr;
+			}
+			else
+			{
+				bin = 0;
+				PPU_HighRunsUntil[num] = systart;
+			}
 		}
 		
 		if (syend >= yend) break;
 		systart = syend;
-		s++;
+		s = s->Next;
 	}
 	
 #undef ADDVERTEX
@@ -1247,8 +1027,9 @@ void PPU_HardRenderBG_16x16(u32 setalpha, u32 num, int type, u32 prio, int ystar
 	int x, y;
 	u32 idx;
 	int systart = 1, syend;
-	int ntiles = 0;
-	u16* vptr = (u16*)vertexPtr;
+	int ntiles[2];
+	u16* vptr[2];
+	u32 bin, p;
 	int xincr = 16, xsize = 8, yincr = 16, ysize = 8, yshift = 0;
 
 	if(hi)
@@ -1264,9 +1045,28 @@ void PPU_HardRenderBG_16x16(u32 setalpha, u32 num, int type, u32 prio, int ystar
 	}
 	
 #define ADDVERTEX(x, y, coord) \
-	*vptr++ = x; \
-	*vptr++ = y; \
-	*vptr++ = coord;
+	*vptr[p]++ = x; \
+	*vptr[p]++ = y; \
+	*vptr[p]++ = coord;
+	
+	// the high priority pass draws what the low priority one kept aside, and
+	// walks what it couldn't keep
+	if (prio)
+	{
+		ystart = PPU_DrawHighRuns(setalpha, num, hi, ystart, yend);
+		if (ystart >= yend) return;
+	}
+	
+	bin = !prio;
+	if (bin)
+	{
+		PPU_NumHighRuns[num] = 0;
+		PPU_HighRunsStart[num] = ystart;
+		PPU_HighRunsEnd[num] = yend;
+		PPU_HighRunsUntil[num] = yend;
+	}
+	
+	vptr[0] = (u16*)vertexPtr;
 	
 	PPU_BGSection* s = &bg->Sections[0];
 	for (;;)
@@ -1276,7 +1076,7 @@ void PPU_HardRenderBG_16x16(u32 setalpha, u32 num, int type, u32 prio, int ystar
 		if (syend <= ystart)
 		{
 			systart = syend;
-			s++;
+			s = s->Next;
 			continue;
 		}
 
@@ -1284,7 +1084,9 @@ void PPU_HardRenderBG_16x16(u32 setalpha, u32 num, int type, u32 prio, int ystar
 		if (syend > yend) syend = yend;
 		
 		yoff = (s->YScroll + systart) >> yshift;
-		ntiles = 0;
+		ntiles[0] = 0;
+		ntiles[1] = 0;
+		vptr[1] = PPU_HighVertices;
 		
 		for (y = systart - (yoff&15); y < syend; y += yincr, yoff += 16)
 		{
@@ -1308,8 +1110,23 @@ void PPU_HardRenderBG_16x16(u32 setalpha, u32 num, int type, u32 prio, int ystar
 				}
 
 				curtile = tilemap[idx];
-				if ((curtile ^ prio) & 0x2000)
+				
+				// when walking for both priorities, the high ones go aside
+				if (bin)
+				{
+					p = (curtile & 0x2000) >> 13;
+					if (p && vptr[1] > HIGH_VERTICES_END)
+					{
+						bin = 0;
+						ntiles[1] = 0;
+						PPU_HighRunsUntil[num] = systart;
+						continue;
+					}
+				}
+				else if ((curtile ^ prio) & 0x2000)
 					continue;
+				else
+					p = 0;
 
 				// render the tile
 				
@@ -1326,7 +1143,7 @@ void PPU_HardRenderBG_16x16(u32 setalpha, u32 num, int type, u32 prio, int ystar
 					{ \
 						ADDVERTEX(x+sx,   y+sy,     coord+t0); \
 						ADDVERTEX(x+sx+xsize, y+sy+ysize,   coord+t3); \
-						ntiles++; \
+						ntiles[p]++; \
 					}
 				
 				switch (curtile & 0xC000)
@@ -1388,35 +1205,31 @@ void PPU_HardRenderBG_16x16(u32 setalpha, u32 num, int type, u32 prio, int ystar
 			}
 		}
 		
-		if (ntiles)
+		if (ntiles[0])
 		{
-			PPU_StartBG(hi);
-			
-			bglScissor(0, systart, 256, syend);
+			PPU_DrawBGTiles(setalpha, num, hi, systart, syend, vertexPtr, ntiles[0]);
 			
-			bglEnableStencilTest(true);
-			bglStencilFunc(GPU_EQUAL, 0x00, 1<<num, 0xFF);
-			
-			// set alpha to 128 if we need to disable color math in this BG section
-			bglTexEnv(0, 
-				GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), 
-				GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0),
-				GPU_TEVOPERANDS(0,0,0), 
-				GPU_TEVOPERANDS(0,0,0), 
-				GPU_REPLACE, setalpha ? GPU_REPLACE:GPU_MODULATE, 
-				setalpha ? 0xFFFFFFFF:0x80FFFFFF);
-			
-			bglAttribBuffer(vertexPtr);
-			
-			vptr = (u16*)((((u32)vptr) + 0x1F) & ~0x1F);
-			vertexPtr = vptr;
-			
-			bglDrawArrays(GPU_UNKPRIM, ntiles*2);
+			vptr[0] = (u16*)((((u32)vptr[0]) + 0x1F) & ~0x1F);
+			vertexPtr = vptr[0];
+		}
+		
+		if (ntiles[1])
+		{
+			if (PPU_NumHighRuns[num] < HIGH_MAX_RUNS)
+			{
+				PPU_KeepHighRun(num, systart, syend, vptr[1], ntiles[1]);
+				vptr[0] = (u16*)vertexPtr;
+			}
+			else
+			{
+				bin = 0;
+				PPU_HighRunsUntil[num] = systart;
+			}
 		}
 		
 		if (syend >= yend) break;
 		systart = syend;
-		s++;
+		s = s->Next;
 	}
 	
 #undef ADDVERTEX
@@ -1530,6 +1343,7 @@ void PPU_HardRenderBG_ProcessMode7(int ystart, int yend)
 	TempPalette[0] = 0;
 
 	PPU_Mode7Section* s = &PPU.Mode7Sections[0];
+	PPU_Mode7Section* prev = NULL;
 
 	for (;;)
 	{
@@ -1537,7 +1351,8 @@ void PPU_HardRenderBG_ProcessMode7(int ystart, int yend)
 		if (syend <= ystart)
 		{
 			systart = syend;
-			s++;
+			prev = s;
+			s = s->Next;
 			continue;
 		}
 		if (systart < ystart) systart = ystart;
@@ -1550,7 +1365,7 @@ void PPU_HardRenderBG_ProcessMode7(int ystart, int yend)
 			// Need to set the last software section to be indicated as the end
 			if(wasSW)
 			{
-				(s-1)->endSW = 1;
+				prev->endSW = 1;
 				wasSW = 0;
 			}
 			
@@ -1748,11 +1563,15 @@ void PPU_HardRenderBG_ProcessMode7(int ystart, int yend)
 				ly += D;
 			}
 			
+			if (systart < Mode7DirtyStart) Mode7DirtyStart = systart;
+			if (syend > Mode7DirtyEnd) Mode7DirtyEnd = syend;
+			if (PPU.M7ExtBG) Mode7DirtyExt = 1;
 		}
 
 		if (syend >= yend) break;
 		systart = syend;
-		s++;
+		prev = s;
+		s = s->Next;
 	}
 	s->endSW = 1;
 
@@ -1761,14 +1580,146 @@ void PPU_HardRenderBG_ProcessMode7(int ystart, int yend)
 }
 
 
+// sets up the matrix that takes mode 7 map coords to the screen
+static void PPU_SetMode7Matrix(PPU_Mode7Section* s)
+{
+	// Unlike software rendering of Mode 7, we need to grab the inverse of the 2x2 matrix for proper orientation and positioning
+	float A = (float)s->A / 256.0f;
+	float B = (float)s->B / 256.0f;
+	float C = (float)s->C / 256.0f;
+	float D = (float)s->D / 256.0f;
+	int flipX = s->RefX, flipY = s->RefY;
+	
+	if(s->hflip)
+	{
+		A = -A;
+		C = -C;
+		s->XScroll = -s->XScroll;
+		flipX = 255 - flipX;
+	}
+	if(s->vflip)
+	{
+		B = -B;
+		D = -D;
+		s->YScroll = -s->YScroll;
+		flipY = 255 - flipY;
+	}
+	
+	float det = (A * D) - (B * C);
+	if(det == 0.0f)
+	{
+		// Not correct, as the actual values would be "infinity" when dividing by 0, so max float values?
+		snesM7Matrix[0] = 0.0; snesM7Matrix[1] = 0.0; snesM7Matrix[4] = 0.0; snesM7Matrix[5] = 0.0;
+	}
+	else
+	{
+		det = 1.0f / det;
+		snesM7Matrix[0] = D * det;
+		snesM7Matrix[1] = -B * det;
+		snesM7Matrix[4] = -C * det;
+		snesM7Matrix[5] = A * det;
+	}
+	
+	snesM7Matrix[3] = (snesM7Matrix[0] * -s->RefX) + (snesM7Matrix[1] * -s->RefY) + flipX - s->XScroll;
+	snesM7Matrix[7] = (snesM7Matrix[4] * -s->RefX) + (snesM7Matrix[5] * -s->RefY) + flipY - s->YScroll;
+	
+	bglUniformMatrix(GPU_VERTEX_SHADER, 0, snesProjMatrix);
+	bglUniformMatrix(GPU_VERTEX_SHADER, 5, snesM7Matrix);
+}
+
+// the part of the mode 7 plane a section needs, in map pixels
+// returns 0 if the plane can't be used, then it's drawn tile by tile
+static int PPU_GetMode7PlaneRect(PPU_Mode7Section* s, int* rect)
+{
+	int i;
+	
+	// tile 0 outside of the map isn't in the plane
+	if (s->tileType == 3) return 0;
+	
+	if (s->tileType == 2)
+	{
+		// transparent outside, the plane is all there is
+		rect[0] = 0; rect[1] = 0;
+		rect[2] = 1024; rect[3] = 1024;
+		return 1;
+	}
+	
+	// repeating, only as much of it as the section covers
+	rect[0] = INT_MAX; rect[1] = INT_MAX;
+	rect[2] = INT_MIN; rect[3] = INT_MIN;
+	for (i = 0; i < 8; i++)
+	{
+		int x = s->vert[i].x >> 8, y = s->vert[i].y >> 8;
+		if (x < rect[0]) rect[0] = x;
+		if (y < rect[1]) rect[1] = y;
+		if (x > rect[2]) rect[2] = x;
+		if (y > rect[3]) rect[3] = y;
+	}
+	rect[0] &= ~7; rect[1] &= ~7;
+	rect[2] = (rect[2] + 8) & ~7; rect[3] = (rect[3] + 8) & ~7;
+	
+	// so far out that the texcoords would lose precision
+	for (i = 0; i < 4; i++)
+		if (rect[i] < -8192 || rect[i] > 8192) return 0;
+	
+	return 1;
+}
+
+// draws a mode 7 section as one quad textured with the plane
+static void PPU_HardRenderBG_Mode7Plane(PPU_Mode7Section* s, u16* plane, int* rect, u32 setalpha, int systart, int syend)
+{
+	int minx = rect[0], miny = rect[1], maxx = rect[2], maxy = rect[3];
+	u16* vptr = (u16*)vertexPtr;
+	
+	bglTexImage(GPU_TEXUNIT0, plane,1024,1024,(s->tileType == 2) ? 0 : 0x2200,GPU_RGBA5551);
+	
+	PPU_SetMode7Matrix(s);
+	float w = (maxx - minx) / 128.0f, h = (maxy - miny) / 128.0f;
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 14, snesM7Matrix[0] * w, snesM7Matrix[4] * w, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 15, snesM7Matrix[1] * h, snesM7Matrix[5] * h, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 10, minx / 1024.0f, miny / 1024.0f, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 11, maxx / 1024.0f, miny / 1024.0f, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 12, minx / 1024.0f, maxy / 1024.0f, 0.0f, 0.0f);
+	SET_UNIFORM(GPU_GEOMETRY_SHADER, 13, maxx / 1024.0f, maxy / 1024.0f, 0.0f, 0.0f);
+	
+	bglScissor(0, systart, 256, syend);
+	
+	bglEnableStencilTest(true);
+	bglStencilFunc(GPU_EQUAL, 0x00, 0x01, 0xFF);
+	
+	// set alpha to 128 if we need to disable color math in this BG section
+	bglTexEnv(0, 
+		GPU_TEVSOURCES(GPU_TEXTURE0, 0, 0), 
+		GPU_TEVSOURCES(GPU_TEXTURE0, GPU_CONSTANT, 0),
+		GPU_TEVOPERANDS(0,0,0), 
+		GPU_TEVOPERANDS(0,0,0), 
+		GPU_REPLACE, setalpha ? GPU_REPLACE:GPU_MODULATE, 
+		setalpha ? 0xFFFFFFFF:0x80FFFFFF);
+	
+	bglAttribBuffer(vertexPtr);
+	
+	// the texcoords all come from the uniforms
+	*vptr++ = minx;
+	*vptr++ = miny;
+	*vptr++ = 0;
+	
+	vptr = (u16*)((((u32)vptr) + 0x1F) & ~0x1F);
+	vertexPtr = vptr;
+	
+	bglDrawArrays(GPU_UNKPRIM, 1);
+}
+
 void PPU_HardRenderBG_Mode7(u32 setalpha, int ystart, int yend, u32 prio)
 {
 	int systart = 1, syend;
 	int ntiles = 0, tilecnt = 0;
 	int i, j;
-	int curHW = 0;
+	int curHW = 0;	// 1: drawing tiles, 2: drawing the plane
 	int style;
 	u16* vptr = (u16*)vertexPtr;
+	u16* plane = NULL;
+	int planedone = 0;
+	int rect[4];
 	
 
 	u16 oldcolor0 = TempPalette[0];
@@ -1784,14 +1735,35 @@ void PPU_HardRenderBG_Mode7(u32 setalpha, int ystart, int yend, u32 prio)
 		if (syend <= ystart)
 		{
 			systart = syend;
-			s++;
+			s = s->Next;
 			continue;
 		}
 
 		if (systart < ystart) systart = ystart;
 		if (syend > yend) syend = yend;
 		
-		if(s->doHW)
+		if(s->doHW && s->tileType != 3 && !planedone)
+		{
+			// the plane is brought up to date once, when a section first needs it
+			plane = PPU_UpdateMode7Plane(style);
+			planedone = 1;
+		}
+		
+		if(s->doHW && plane && PPU_GetMode7PlaneRect(s, rect))
+		{
+			if(curHW != 2)
+			{
+				doingBG = 0;
+				bglUseShader(&hard7PlaneShaderP);
+				bglFaceCulling(GPU_CULL_NONE);
+				PPU_StartBG(0);
+				curHW = 2;
+			}
+			
+			PPU_HardRenderBG_Mode7Plane(s, plane, rect, setalpha, systart, syend);
+			vptr = (u16*)vertexPtr;
+		}
+		else if(s->doHW)
 		{
 			PPU_Vertex vert[8];
 			for(i = 0; i < 8; i++)
@@ -1862,7 +1834,7 @@ void PPU_HardRenderBG_Mode7(u32 setalpha, int ystart, int yend, u32 prio)
 			if (ntiles)
 			{
 				// Do we need to set the system to hardware-Mode7-rendering?
-				if(curHW < 1)
+				if(curHW != 1)
 				{
 					doingBG = 0;
 					bglUseShader(&hard7RenderShaderP);
@@ -1872,50 +1844,7 @@ void PPU_HardRenderBG_Mode7(u32 setalpha, int ystart, int yend, u32 prio)
 				}
 								
 
-				// Unlike software rendering of Mode 7, we need to grab the inverse of the 2x2 matrix for proper orientation and positioning
-				float A = (float)s->A / 256.0f;
-				float B = (float)s->B / 256.0f;
-				float C = (float)s->C / 256.0f;
-				float D = (float)s->D / 256.0f;
-				int flipX = s->RefX, flipY = s->RefY;
-
-				if(s->hflip)
-				{
-					A = -A;
-					C = -C;
-					s->XScroll = -s->XScroll;
-					flipX = 255 - flipX;
-				}
-				if(s->vflip)
-				{
-					B = -B;
-					D = -D;
-					s->YScroll = -s->YScroll;
-					flipY = 255 - flipY;
-				}
-
-						
-				float det = (A * D) - (B * C);
-				if(det == 0.0f)
-				{
-					// Not correct, as the actual values would be "infinity" when dividing by 0, so max float values?
-					snesM7Matrix[0] = 0.0; snesM7Matrix[1] = 0.0; snesM7Matrix[4] = 0.0; snesM7Matrix[5] = 0.0;
-				}
-				else
-				{
-					det = 1.0f / det;
-					snesM7Matrix[0] = D * det;
-					snesM7Matrix[1] = -B * det;
-					snesM7Matrix[4] = -C * det;
-					snesM7Matrix[5] = A * det;
-				}
-			
-				snesM7Matrix[3] = (snesM7Matrix[0] * -s->RefX) + (snesM7Matrix[1] * -s->RefY) + flipX - s->XScroll;
-				snesM7Matrix[7] = (snesM7Matrix[4] * -s->RefX) + (snesM7Matrix[5] * -s->RefY) + flipY - s->YScroll;
-			
-
-				bglUniformMatrix(GPU_VERTEX_SHADER, 0, snesProjMatrix);
-				bglUniformMatrix(GPU_VERTEX_SHADER, 5, snesM7Matrix);
+				PPU_SetMode7Matrix(s);
 				SET_UNIFORM(GPU_GEOMETRY_SHADER, 14, snesM7Matrix[0] * 0.0628f, snesM7Matrix[4] * 0.0628f, 0.0f, 0.0f);
 				SET_UNIFORM(GPU_GEOMETRY_SHADER, 15, snesM7Matrix[1] * 0.0628f, snesM7Matrix[5] * 0.0628f, 0.0f, 0.0f);
 				
@@ -1946,7 +1875,7 @@ void PPU_HardRenderBG_Mode7(u32 setalpha, int ystart, int yend, u32 prio)
 			// This grabs the entire continuous software-rendered section, so it prevents needing to assign system settings each time and render scanline-by-scanline.
 			while(!(s->endSW))
 			{
-				s++;
+				s = s->Next;
 				syend = s->EndOffset;
 				if (syend > yend) syend = yend;
 			}
@@ -2020,7 +1949,7 @@ void PPU_HardRenderBG_Mode7(u32 setalpha, int ystart, int yend, u32 prio)
 
 		if (syend >= yend) break;
 		systart = syend;
-		s++;
+		s = s->Next;
 	}
 	
 	TempPalette[0] = oldcolor0;
@@ -2028,6 +1957,8 @@ void PPU_HardRenderBG_Mode7(u32 setalpha, int ystart, int yend, u32 prio)
 	// As a precaution, we'll revert back to normal hardware-rendering should the need be
 	if(curHW)
 	{
+		// the plane is still bound, the next BG needs the tile cache back
+		if(curHW == 2) doingBG = 0;
 		bglUseShader(&hardRenderShaderP);
 		bglFaceCulling(GPU_CULL_BACK_CCW);
 	}
@@ -2177,7 +2108,7 @@ void PPU_HardRenderOBJs()
 
 		PPU.CurOBJSecSel = &PPU.OBJSections[0];
 		while(PPU.CurOBJSecSel->EndOffset < oy && PPU.CurOBJSecSel->EndOffset < 240)
-			PPU.CurOBJSecSel++;
+			PPU.CurOBJSecSel = PPU.CurOBJSecSel->Next;
 		s32 oh = (s32)PPU.CurOBJSecSel->OBJHeight[(oamextra & 0x2) >> 1];
 
 		if ((oy+oh) > ystart && oy < yend)
@@ -2369,74 +2300,131 @@ void PPU_ComputeWindows_Hard(PPU_WindowSegment* s)
 	}
 }
 
+// what goes in a new section of each kind, on line 0 or when it changed
+
+static void PPU_SetModeSection(PPU_ModeSection* s)
+{
+	s->Mode = PPU.Mode;
+	s->MainScreen = PPU.MainScreen;
+	s->SubScreen = PPU.SubScreen;
+	s->ColorMath1 = PPU.ColorMath1;
+	s->ColorMath2 = PPU.ColorMath2;
+}
+
+static void PPU_SetOBJSection(PPU_OBJSection* s)
+{
+	s->OBJWidth = PPU.OBJWidth;
+	s->OBJHeight = PPU.OBJHeight;
+	s->OBJTilesetAddr = PPU.OBJTilesetAddr;
+	s->OBJGap = PPU.OBJGap;
+}
+
+static void PPU_SetBGSection(PPU_Background* bg)
+{
+	bg->CurSection->ScrollParams = bg->ScrollParams;
+	bg->CurSection->GraphicsParams = bg->GraphicsParams;
+	bg->CurSection->Size = bg->Size;
+	
+	bg->LastScrollParams = bg->ScrollParams;
+	bg->LastGraphicsParams = bg->GraphicsParams;
+	bg->LastSize = bg->Size;
+}
+
+static void PPU_SetMode7Section(PPU_Mode7Section* s, u32 line)
+{
+	s->StartOffset = line;
+	s->Sel = PPU.M7Sel;
+	s->AffineParams1 = PPU.M7AffineParams1;
+	s->AffineParams2 = PPU.M7AffineParams2;
+	s->RefParams = PPU.M7RefParams;
+	s->ScrollParams = PPU.M7ScrollParams;
+}
+
+// decides whether a finished mode 7 section can be drawn by the GPU
+static void PPU_EndMode7Section(PPU_Mode7Section* cur)
+{
+	if(Config.HardwareMode7 > 0)
+	{
+		int numLines = cur->EndOffset - cur->StartOffset;
+		int sizeComp = (numLines == 1 ? 0x30000 : (numLines >= 16 ? 0x100000 : 0x80000));
+		coord0 = PPU_StoreTileInCache(TILE_Mode7, 0, ((u32)PPU.VRAM[0]) << 7);
+		if((cur->Sel >> 6) == 2)
+			cur->doHW = 1;
+		else if(((cur->Sel >> 6) == 3) && (coord0 == 0xC000))
+		{
+			cur->Sel &= 0xBF;
+			cur->doHW = 1;
+		}
+		else if(((((int)cur->A * cur->A) + ((int)cur->C * cur->C)) <= sizeComp) && ((((int)cur->B * cur->B) + ((int)cur->D * cur->D)) <= sizeComp))
+			cur->doHW = 1;
+		else
+			cur->doHW = 0;
+	}
+	else
+		cur->doHW = 0;
+}
+
+static void PPU_SetColorEffectSection(PPU_ColorEffectSection* s)
+{
+	s->ColorMath = (PPU.ColorMath2 & 0x80);
+	s->Brightness = PPU.CurBrightness;
+}
+
+static void PPU_SetMainBackdropSection(PPU_MainBackdropSection* s)
+{
+	s->Color = TempPalette[0];
+	s->ColorMath2 = PPU.ColorMath2;
+}
+
+static void PPU_SetSubBackdropSection(PPU_SubBackdropSection* s)
+{
+	s->Color = PPU.SubBackdrop;
+	s->Div2 = (!(PPU.ColorMath1 & 0x02)) && (PPU.ColorMath2 & 0x40);
+}
+
 void PPU_RenderScanline_Hard(u32 line)
 {
 	int i;
 	
 	if (!line)
 	{
-
-		
 		// initialize stuff upon line 0
-
-		//memset(PPU.NumPaletteChanges, 0, 240);
+		// the sections from the last frame are done with
+		PPU_ClearSectionLog();
 		
-		PPU.CurModeSection = &PPU.ModeSections[0];
-		PPU.CurModeSection->Mode = PPU.Mode;
-		PPU.CurModeSection->MainScreen = PPU.MainScreen;
-		PPU.CurModeSection->SubScreen = PPU.SubScreen;
-		PPU.CurModeSection->ColorMath1 = PPU.ColorMath1;
-		PPU.CurModeSection->ColorMath2 = PPU.ColorMath2;
+		PPU_FIRSTSECTION(PPU.ModeSections, PPU.CurModeSection);
+		PPU_SetModeSection(PPU.CurModeSection);
 		PPU.ModeDirty = 0;
 
-		PPU.CurOBJSection = &PPU.OBJSections[0];
-		PPU.CurOBJSection->OBJWidth = PPU.OBJWidth;
-		PPU.CurOBJSection->OBJHeight = PPU.OBJHeight;
-		PPU.CurOBJSection->OBJTilesetAddr = PPU.OBJTilesetAddr;
-		PPU.CurOBJSection->OBJGap = PPU.OBJGap;
-
+		PPU_FIRSTSECTION(PPU.OBJSections, PPU.CurOBJSection);
+		PPU_SetOBJSection(PPU.CurOBJSection);
 		
 		for (i = 0; i < 4; i++)
 		{
 			PPU_Background* bg = &PPU.BG[i];
 			
-			bg->CurSection = &bg->Sections[0];
-			bg->CurSection->ScrollParams = bg->ScrollParams;
-			bg->CurSection->GraphicsParams = bg->GraphicsParams;
-			bg->CurSection->Size = bg->Size;
-			
-			bg->LastScrollParams = bg->ScrollParams;
-			bg->LastGraphicsParams = bg->GraphicsParams;
-			bg->LastSize = bg->Size;
+			PPU_FIRSTSECTION(bg->Sections, bg->CurSection);
+			PPU_SetBGSection(bg);
 		}
 
-		PPU.CurMode7Section = &PPU.Mode7Sections[0];
-		PPU.CurMode7Section->StartOffset = line;
-		PPU.CurMode7Section->Sel = PPU.M7Sel;
-		PPU.CurMode7Section->AffineParams1 = PPU.M7AffineParams1;
-		PPU.CurMode7Section->AffineParams2 = PPU.M7AffineParams2;
-		PPU.CurMode7Section->RefParams = PPU.M7RefParams;
-		PPU.CurMode7Section->ScrollParams = PPU.M7ScrollParams;
+		PPU_FIRSTSECTION(PPU.Mode7Sections, PPU.CurMode7Section);
+		PPU_SetMode7Section(PPU.CurMode7Section, line);
 		PPU.Mode7Dirty = 0;
 		
-		PPU.CurWindowSection = &PPU.WindowSections[0];
+		PPU_FIRSTSECTION(PPU.WindowSections, PPU.CurWindowSection);
 		PPU_ComputeWindows_Hard(&PPU.CurWindowSection->Window[0]);
 		PPU.WindowDirty = 0;
 		
-		PPU.CurColorEffect = &PPU.ColorEffectSections[0];
-		PPU.CurColorEffect->ColorMath = (PPU.ColorMath2 & 0x80);
-		PPU.CurColorEffect->Brightness = PPU.CurBrightness;
+		PPU_FIRSTSECTION(PPU.ColorEffectSections, PPU.CurColorEffect);
+		PPU_SetColorEffectSection(PPU.CurColorEffect);
 		PPU.ColorEffectDirty = 0;
 		
-		PPU.CurMainBackdrop = &PPU.MainBackdropSections[0];
-		PPU.CurMainBackdrop->Color = TempPalette[0];
-		PPU.CurMainBackdrop->ColorMath2 = PPU.ColorMath2;
+		PPU_FIRSTSECTION(PPU.MainBackdropSections, PPU.CurMainBackdrop);
+		PPU_SetMainBackdropSection(PPU.CurMainBackdrop);
 		PPU.MainBackdropDirty = 0;
 		
-
-		PPU.CurSubBackdrop = &PPU.SubBackdropSections[0];
-		PPU.CurSubBackdrop->Color = PPU.SubBackdrop;
-		PPU.CurSubBackdrop->Div2 = (!(PPU.ColorMath1 & 0x02)) && (PPU.ColorMath2 & 0x40);
+		PPU_FIRSTSECTION(PPU.SubBackdropSections, PPU.CurSubBackdrop);
+		PPU_SetSubBackdropSection(PPU.CurSubBackdrop);
 		PPU.SubBackdropDirty = 0;
 	}
 	else
@@ -2449,27 +2437,16 @@ void PPU_RenderScanline_Hard(u32 line)
 			   (PPU.CurModeSection->ColorMath1 != PPU.ColorMath1) ||
 			   (PPU.CurModeSection->ColorMath2 != PPU.ColorMath2))
 			{
-				PPU.CurModeSection->EndOffset = line;
-				PPU.CurModeSection++;
-			
-				PPU.CurModeSection->Mode = PPU.Mode;
-				PPU.CurModeSection->MainScreen = PPU.MainScreen;
-				PPU.CurModeSection->SubScreen = PPU.SubScreen;
-				PPU.CurModeSection->ColorMath1 = PPU.ColorMath1;
-				PPU.CurModeSection->ColorMath2 = PPU.ColorMath2;
+				PPU_NEXTSECTION(PPU.CurModeSection, line);
+				PPU_SetModeSection(PPU.CurModeSection);
 				PPU.MainBackdropDirty = 1;
 			}		
 		}
 
 		if (PPU.OBJDirty)
 		{
-			PPU.CurOBJSection->EndOffset = line;
-			PPU.CurOBJSection++;
-
-			PPU.CurOBJSection->OBJWidth = PPU.OBJWidth;
-			PPU.CurOBJSection->OBJHeight = PPU.OBJHeight;
-			PPU.CurOBJSection->OBJTilesetAddr = PPU.OBJTilesetAddr;
-			PPU.CurOBJSection->OBJGap = PPU.OBJGap;
+			PPU_NEXTSECTION(PPU.CurOBJSection, line);
+			PPU_SetOBJSection(PPU.CurOBJSection);
 			PPU.OBJDirty = 0;
 		}
 		
@@ -2496,16 +2473,8 @@ void PPU_RenderScanline_Hard(u32 line)
 				}
 			}
 	
-			bg->CurSection->EndOffset = line;
-			bg->CurSection++;
-			
-			bg->CurSection->ScrollParams = bg->ScrollParams;
-			bg->CurSection->GraphicsParams = bg->GraphicsParams;
-			bg->CurSection->Size = bg->Size;
-			
-			bg->LastScrollParams = bg->ScrollParams;
-			bg->LastGraphicsParams = bg->GraphicsParams;
-			bg->LastSize = bg->Size;
+			PPU_NEXTSECTION(bg->CurSection, line);
+			PPU_SetBGSection(bg);
 		}
 
 		PPU.ModeDirty = 0;
@@ -2519,78 +2488,41 @@ void PPU_RenderScanline_Hard(u32 line)
 			   (cur->RefParams != PPU.M7RefParams) ||
 			   (cur->ScrollParams != PPU.M7ScrollParams))
 			{
-				cur->EndOffset = line;
-
+				PPU_NEXTSECTION(PPU.CurMode7Section, line);
+				if (PPU.CurMode7Section != cur)
 				{
-					if(Config.HardwareMode7 > 0)
-					{
-						int numLines = cur->EndOffset - cur->StartOffset;
-						int sizeComp = (numLines == 1 ? 0x30000 : (numLines >= 16 ? 0x100000 : 0x80000));
-						coord0 = PPU_StoreTileInCache(TILE_Mode7, 0, ((u32)PPU.VRAM[0]) << 7);
-						if((cur->Sel >> 6) == 2)
-							cur->doHW = 1;
-						else if(((cur->Sel >> 6) == 3) && (coord0 == 0xC000))
-						{
-							cur->Sel &= 0xBF;
-							cur->doHW = 1;
-						}
-						else if(((((int)cur->A * cur->A) + ((int)cur->C * cur->C)) <= sizeComp) && ((((int)cur->B * cur->B) + ((int)cur->D * cur->D)) <= sizeComp))
-							cur->doHW = 1;
-						else
-							cur->doHW = 0;
-					}
-					else
-						cur->doHW = 0;
+					PPU_EndMode7Section(cur);
+					PPU_SetMode7Section(PPU.CurMode7Section, line);
 				}
-
-				cur = ++PPU.CurMode7Section;
-				
-				cur->StartOffset = line;
-				cur->Sel = PPU.M7Sel;
-				cur->AffineParams1 = PPU.M7AffineParams1;
-			    cur->AffineParams2 = PPU.M7AffineParams2;
-			    cur->RefParams = PPU.M7RefParams;
-			    cur->ScrollParams = PPU.M7ScrollParams;
 			}
 			PPU.Mode7Dirty = 0;
 		}
 		
 		if (PPU.WindowDirty)
 		{
-			PPU.CurWindowSection->EndOffset = line;
-			PPU.CurWindowSection++;
-			
+			PPU_NEXTSECTION(PPU.CurWindowSection, line);
 			PPU_ComputeWindows_Hard(&PPU.CurWindowSection->Window[0]);
 			PPU.WindowDirty = 0;
 		}
 		
 		if (PPU.ColorEffectDirty)
 		{
-			PPU.CurColorEffect->EndOffset = line;
-			PPU.CurColorEffect++;
-			
-			PPU.CurColorEffect->ColorMath = (PPU.ColorMath2 & 0x80);
-			PPU.CurColorEffect->Brightness = PPU.CurBrightness;
+			PPU_NEXTSECTION(PPU.CurColorEffect, line);
+			PPU_SetColorEffectSection(PPU.CurColorEffect);
 			PPU.ColorEffectDirty = 0;
 		}
 
 		if(PPU.MainBackdropDirty)
 		{
-			PPU.CurMainBackdrop->EndOffset = line;
-			PPU.CurMainBackdrop++;
-			
-			PPU.CurMainBackdrop->Color = TempPalette[0];
-			PPU.CurMainBackdrop->ColorMath2 = PPU.ColorMath2;
+			PPU_NEXTSECTION(PPU.CurMainBackdrop, line);
+			PPU_SetMainBackdropSection(PPU.CurMainBackdrop);
 			PPU.MainBackdropDirty = 0;
 		}
 		
 		if (PPU.SubBackdropDirty)
 		{
-			PPU.CurSubBackdrop->EndOffset = line;
-			PPU.CurSubBackdrop++;
-			
-			PPU.CurSubBackdrop->Color = PPU.SubBackdrop;
-			PPU.CurSubBackdrop->Div2 = (!(PPU.ColorMath1 & 0x02)) && (PPU.ColorMath2 & 0x40);
+			PPU_NEXTSECTION(PPU.CurSubBackdrop, line);
+			PPU_SetSubBackdropSection(PPU.CurSubBackdrop);
 			PPU.SubBackdropDirty = 0;
 		}
 	}
@@ -2801,7 +2733,7 @@ void PPU_HardRender(u32 snum)
 			{
 				if (s->EndOffset >= 240) break;
 				ystart = s->EndOffset;
-				s++;
+				s = s->Next;
 				continue;
 			}
 			
@@ -2852,7 +2784,7 @@ void PPU_HardRender(u32 snum)
 		
 		if (s->EndOffset >= 240) break;
 		ystart = s->EndOffset;
-		s++;
+		s = s->Next;
 	}
 }
 
@@ -2874,27 +2806,7 @@ void PPU_VBlank_Hard(int endLine)
 	PPU_Mode7Section *cur = PPU.CurMode7Section;
 	cur->EndOffset = endLine;
 	if((PPU.Mode & 0x07) == 7)
-	{
-		if(Config.HardwareMode7 > 0)
-		{
-			int numLines = cur->EndOffset - cur->StartOffset;
-			int sizeComp = (numLines == 1 ? 0x30000 : (numLines >= 16 ? 0x100000 : 0x80000));
-			coord0 = PPU_StoreTileInCache(TILE_Mode7, 0, ((u32)PPU.VRAM[0]) << 7);
-			if((cur->Sel >> 6) == 2)
-				cur->doHW = 1;
-			else if(((cur->Sel >> 6) == 3) && (coord0 == 0xC000))
-			{
-				cur->Sel &= 0xBF;
-				cur->doHW = 1;
-			}
-			else if(((((int)cur->A * cur->A) + ((int)cur->C * cur->C)) <= sizeComp) && ((((int)cur->B * cur->B) + ((int)cur->D * cur->D)) <= sizeComp))
-				cur->doHW = 1;
-			else
-				cur->doHW = 0;
-		}
-		else
-			cur->doHW = 0;
-	}
+		PPU_EndMode7Section(cur);
 	
 	PPU.CurWindowSection->EndOffset = endLine;
 	
@@ -2941,8 +2853,7 @@ void PPU_VBlank_Hard(int endLine)
 	PPU_ClearAlpha(1);
 
 	// reuse the color math system used by the soft renderer
-	bglScissorMode(GPU_SCISSOR_DISABLE);
-	PPU_BlendScreens(GPU_RGBA8);
+	PPU_BlendScreens(GPU_RGBA8, PPU.ColorEffectSections);
 
 	u32 taken = ((u32)vertexPtr - (u32)vertexBuf);
 	GSPGPU_FlushDataCache(NULL, vertexBuf, taken);
@@ -2950,14 +2861,28 @@ void PPU_VBlank_Hard(int endLine)
 		bprintf("OVERFLOW %06X/200000 (%d%%)\n", taken, (taken*100)/0x200000);
 		
 	
-  // OBS! Possibly fix size calculation
-	GSPGPU_FlushDataCache(NULL, (u8*)PPU_TileCache, 1024*1024*sizeof(u16));
+	PPU_FlushTileCache();
 	//GX_SetDisplayTransfer(NULL, (u32*)PPU_TileCacheRAM, 0x04000400, (u32*)PPU_TileCache, 0x04000400, 0x3308);
 	//gspWaitForPPF();
 	//GX_RequestDma(NULL, (u32*)PPU_TileCacheRAM, (u32*)PPU_TileCache, 1024*1024*sizeof(u16));
 	//gspWaitForDMA();
 	
-  // OBS! Possibly fix size calculation
-	GSPGPU_FlushDataCache(NULL, (u8*)Mode7ColorBuffer, 256*512*sizeof(u16));
+	// only the lines the software mode 7 drew, in whole 8-line blocks (see YOffset256)
+	if (Mode7DirtyEnd > Mode7DirtyStart)
+	{
+		u32 start = (Mode7DirtyStart & ~7) << 8;
+		u32 end = ((Mode7DirtyEnd + 7) & ~7) << 8;
+		
+		GSPGPU_FlushDataCache(NULL, (u8*)&Mode7ColorBuffer[start], (end - start) * sizeof(u16));
+		if (Mode7DirtyExt)
+			GSPGPU_FlushDataCache(NULL, (u8*)&Mode7ColorBuffer[65536 + start], (end - start) * sizeof(u16));
+	}
+	Mode7DirtyStart = 256;
+	Mode7DirtyEnd = 0;
+	Mode7DirtyExt = 0;
+	
+#ifdef TILECACHE_TRACE
+	PPU_TraceFrame();
+#endif
 }
 
@@ -16,14 +16,21 @@
     with blargSnes. If not, see http://www.gnu.org/licenses/.
 */
 
+#include <string.h>
 #include <3ds.h>
 
+#ifdef _3DS
 #include "blargGL.h"
+#endif
 #include "snes.h"
 #include "ppu.h"
 #include "mem.h"
+#include "main.h"
 
 
+// the GPU side isn't there on a PC (host/headless.c), the renderer itself is
+#ifdef _3DS
+
 extern void* vertexBuf;
 extern void* vertexPtr;
 
@@ -39,207 +46,478 @@ extern u32* SNESFrame;
 extern u16* MainScreenTex;
 extern u16* SubScreenTex;
 
+#endif
+
+
+// bitplanes -> 8 pixels, one nibble per pixel, leftmost pixel in the low nibble
+// each plane byte goes through the table and gets shifted to its bit of the nibble
+u32 PPU_PlanarTable[256];
+
+void PPU_InitPlanarTable()
+{
+	u32 i, b;
+	
+	for (i = 0; i < 256; i++)
+	{
+		u32 val = 0;
+	
+		for (b = 0; b < 8; b++)
+		{
+			if (i & (0x80 >> b)) val |= 1 << (b << 2);
+		}
+	
+		PPU_PlanarTable[i] = val;
+	}
+}
+
+u32 PPU_DecodeRow_2bpp(u32 tilepixels)
+{
+	return PPU_PlanarTable[tilepixels & 0xFF] | (PPU_PlanarTable[(tilepixels >> 8) & 0xFF] << 1);
+}
+
+u32 PPU_DecodeRow_4bpp(u32 tilepixels)
+{
+	return PPU_PlanarTable[tilepixels & 0xFF]
+		| (PPU_PlanarTable[(tilepixels >> 8) & 0xFF] << 1)
+		| (PPU_PlanarTable[(tilepixels >> 16) & 0xFF] << 2)
+		| (PPU_PlanarTable[tilepixels >> 24] << 3);
+}
+
+// reverses the nibbles, for h-flipped tiles
+static inline u32 PPU_FlipRow(u32 pixels)
+{
+	pixels = __builtin_bswap32(pixels);
+	return ((pixels >> 4) & 0x0F0F0F0F) | ((pixels & 0x0F0F0F0F) << 4);
+}
+
+
+// decoded tile cache
+// every tile in VRAM decoded as above (not flipped), for each color depth
+// there's one entry per tile address so the size is fixed (256K), and it's
+// only allocated when the soft renderer is in use
+// an entry is good as long as the PPU.VRAMUpdateCount bytes for its VRAM didn't change
+
+#define TILES_2BPP 4096
+#define TILES_4BPP 2048
+#define TILES_8BPP 1024
+
+u32* PPU_TileRows_2bpp = NULL;	// 8 rows per tile
+u32* PPU_TileRows_4bpp = NULL;	// 8 rows per tile
+u32* PPU_TileRows_8bpp = NULL;	// 8 rows per tile, low nibbles then high nibbles
+
+u32 PPU_TileStamp_2bpp[TILES_2BPP];
+u32 PPU_TileStamp_4bpp[TILES_4BPP];
+u32 PPU_TileStamp_8bpp[TILES_8BPP];
+
+#define VRAMCOUNT_2BPP(tile) PPU.VRAMUpdateCount[tile]
+#define VRAMCOUNT_4BPP(tile) *(u16*)&PPU.VRAMUpdateCount[(tile) << 1]
+#define VRAMCOUNT_8BPP(tile) *(u32*)&PPU.VRAMUpdateCount[(tile) << 2]
+
+
+// BG planes
+// a BG's whole tilemap drawn out once from the decoded tiles (512x512, or the
+// part of it the BG size uses), so that as long as VRAM doesn't change, a line
+// of the BG is just read from the plane at the scroll position
+// one per BG, only for 8x8 tiles at 2bpp and 4bpp. each pixel is the color #
+// within the BG's palettes (0 = transparent), with the tile priority in bit 7
+// the emulation thread keeps them up to date as it goes, see PPU_GetBGPlane()
+
+typedef struct
+{
+	u8* Pixels;
+	
+	// what it was drawn for, Tilemap is NULL if nothing
+	u16* Tilemap;
+	u16* Tileset;
+	u8 Size;
+	u8 BPP;
+	
+	u32 Frame;	// the last frame that was drawn from it
+	
+	u32 RowCheck[64];	// PPU.VRAMWrites when each row of tiles was last checked
+	u16 Entries[64*64];	// the tilemap entry and tile stamp each tile was drawn with
+	u32 Stamps[64*64];
+	
+} PPU_BGPlane;
+
+PPU_BGPlane PPU_BGPlanes[4];
+
+
+// to be called whenever the VRAM counters are reset (PPU_Reset())
+void PPU_FlushTileCache_Soft()
+{
+	int i;
+	
+	// stamps that can't match the current counts
+	for (i = 0; i < TILES_2BPP; i++) PPU_TileStamp_2bpp[i] = ~VRAMCOUNT_2BPP(i);
+	for (i = 0; i < TILES_4BPP; i++) PPU_TileStamp_4bpp[i] = ~VRAMCOUNT_4BPP(i);
+	for (i = 0; i < TILES_8BPP; i++) PPU_TileStamp_8bpp[i] = ~VRAMCOUNT_8BPP(i);
+	
+	for (i = 0; i < 4; i++) PPU_BGPlanes[i].Tilemap = NULL;
+}
+
+static void PPU_DecodeTile_2bpp(u32 tile)
+{
+	u16* src = (u16*)&PPU.VRAM[tile << 4];
+	u32* dst = &PPU_TileRows_2bpp[tile << 3];
+	int y;
+	
+	for (y = 0; y < 8; y++)
+		dst[y] = PPU_DecodeRow_2bpp(src[y]);
+	
+	// the rows have to be there before another thread sees the stamp
+	__sync_synchronize();
+	PPU_TileStamp_2bpp[tile] = VRAMCOUNT_2BPP(tile);
+}
+
+static void PPU_DecodeTile_4bpp(u32 tile)
+{
+	u16* src = (u16*)&PPU.VRAM[tile << 5];
+	u32* dst = &PPU_TileRows_4bpp[tile << 3];
+	int y;
+	
+	for (y = 0; y < 8; y++)
+		dst[y] = PPU_DecodeRow_4bpp(src[y] | (src[y+8] << 16));
+	
+	__sync_synchronize();
+	PPU_TileStamp_4bpp[tile] = VRAMCOUNT_4BPP(tile);
+}
+
+static void PPU_DecodeTile_8bpp(u32 tile)
+{
+	u16* src = (u16*)&PPU.VRAM[tile << 6];
+	u32* dst = &PPU_TileRows_8bpp[tile << 4];
+	int y;
+	
+	for (y = 0; y < 8; y++)
+	{
+		dst[(y << 1)] = PPU_DecodeRow_4bpp(src[y] | (src[y+8] << 16));
+		dst[(y << 1) + 1] = PPU_DecodeRow_4bpp(src[y+16] | (src[y+24] << 16));
+	}
+	
+	__sync_synchronize();
+	PPU_TileStamp_8bpp[tile] = VRAMCOUNT_8BPP(tile);
+}
+
 
 void PPU_Init_Soft()
 {
+	int i;
+	
+	PPU_InitPlanarTable();
+	
+	PPU_TileRows_2bpp = (u32*)MemAlloc(TILES_2BPP * 8 * 4);
+	PPU_TileRows_4bpp = (u32*)MemAlloc(TILES_4BPP * 8 * 4);
+	PPU_TileRows_8bpp = (u32*)MemAlloc(TILES_8BPP * 8 * 8);
+	PPU_FlushTileCache_Soft();
+	
+	// the planes are allocated when they're first needed
+	for (i = 0; i < 4; i++)
+	{
+		PPU_BGPlanes[i].Pixels = NULL;
+		PPU_BGPlanes[i].Frame = 0xFFFFFFFF;
+	}
+	
+#ifdef _3DS
 	// main/sub screen buffers, RGBA5551
 	MainScreenTex = (u16*)VRAM_Alloc(256*512*2);
 	SubScreenTex = &MainScreenTex[256*256];
+#endif
 }
 
 void PPU_DeInit_Soft()
 {
+	int i;
+	
+	PPU_SetRenderThreads_Soft(0, 0);
+	
+	MemFree(PPU_TileRows_2bpp);
+	MemFree(PPU_TileRows_4bpp);
+	MemFree(PPU_TileRows_8bpp);
+	PPU_TileRows_2bpp = NULL;
+	PPU_TileRows_4bpp = NULL;
+	PPU_TileRows_8bpp = NULL;
+	
+	for (i = 0; i < 4; i++)
+	{
+		if (PPU_BGPlanes[i].Pixels) MemFree(PPU_BGPlanes[i].Pixels);
+		PPU_BGPlanes[i].Pixels = NULL;
+	}
+	
+#ifdef _3DS
 	VRAM_Free(MainScreenTex);
+#endif
 }
 
 
 
-#define COLMATH(n) ((colormath & (1<<n)) ? 1:0)
-#define COLMATH_OBJ ((colormath & 0x80) ? 0xFF:(colormath&0x40))
+// per-line sprite lists, see PPU_BuildOBJList()
+#define OBJLIST_LINES 240
+
+typedef struct
+{
+	u8 Extra;	// the sprite's bits from the OAM high table
+	u8 YMask;	// height-1
 
+} PPU_OBJInfo;
 
-void PPU_RenderTile_2bpp(u16 curtile, u16 tilepixels, u16* buffer, u16* pal, u32 alpha, int start, int end)
+
+// everything a line is drawn from, besides VRAM and OAM
+// PPU_GetLineState() copies it from the PPU when the line is reached, so
+// that the line can be drawn later on another thread (see PPU_RenderThread())
+
+typedef struct
 {
-	u32 idx, colorval;
+	u16* Tileset;
+	u16* Tilemap;
+	u16 XScroll, YScroll;
+	u8 Size;
+	u8 WindowMask;
+	u16 WindowCombine;
 	
-	if (curtile & 0x4000)
+	u8* Plane;	// the BG's plane if it's good for this line, see PPU_GetBGPlane()
+	
+} PPU_LineBG;
+
+typedef struct
+{
+	u32 Line;
+	
+	u8 Mode;
+	u16 MainScreen, SubScreen;
+	u8 ColorMath1, ColorMath2;
+	u16 SubBackdrop;
+	u16* Palette;	// PPU.Palette, or a copy of it when threaded
+	
+	PPU_LineBG BG[4];
+	PPU_WindowSegment Window[5];
+	
+	const u8* OBJWidth;
+	u16* OBJTileset;
+	u8 OBJWindowMask;
+	u16 OBJWindowCombine;
+	
+	u8 M7Sel;
+	s16 M7A, M7B, M7C, M7D;
+	s16 M7RefX, M7RefY;
+	s16 M7XScroll, M7YScroll;
+	
+	u16* MainBuffer;	// the frame it goes to, there's more than one when pipelined
+	u32 Frame;
+	
+	// VRAM, OAM and the sprite lists: the PPU's, or the copy of them the
+	// frame got when it was left to the threads (see PPU_SyncLines_Soft())
+	u8* VRAM;
+	u8* OAM;
+	PPU_OBJInfo* OBJInfos;
+	u16* OBJList;
+	u16* OBJListStart;
+	
+	u32 Row8[2];	// for PPU_GetRow_8bpp()
+	
+} PPU_LineState;
+
+// what a thread draws a line with
+typedef struct
+{
+	// one line, color (bits 0-15) and depth (bits 16-23) for each pixel
+	u32 LineBuffer[256];
+	
+	// OBJ layer
+	// bit0-7: color # (0-127, selecting from upper palette region)
+	// bit8-15: BG-relative priority
+	// 16+256+16: we leave 16 extra pixels on both sides so we don't have to handle tiles that are partially offscreen
+	u16 OBJBuffer[16+256+16];
+	
+	u8 SpritesOnLine[4] __attribute__((aligned(4)));
+	
+	vu32 Drawing;	// the queued line it's on, LINE_NONE if none
+	
+} PPU_LineContext;
+
+#define LINE_NONE 0xFFFFFFFF
+
+PPU_LineContext PPU_MainContext;
+
+
+// these take a pointer to the row's first word in VRAM, like the old tile renderers
+// the tile is figured out from the address, which wraps at 64K like on the
+// SNES (tile numbers past the end of VRAM used to read on into VRAM7)
+// lines that read a copy of VRAM (pipelined frames, see PPU_SyncLines_Soft())
+// decode straight from it, the cache is for what's in PPU.VRAM
+
+static inline u32 PPU_GetRow_2bpp(PPU_LineState* st, u16* src)
+{
+	u32 addr = ((u8*)src - PPU.VRAM) & 0xFFFF;
+	u32 tile = addr >> 4;
+	
+	if (st->VRAM != PPU.VRAM)
+		return PPU_DecodeRow_2bpp(*(u16*)&st->VRAM[addr]);
+	
+	if (PPU_TileStamp_2bpp[tile] != VRAMCOUNT_2BPP(tile))
+		PPU_DecodeTile_2bpp(tile);
+	
+	return PPU_TileRows_2bpp[(tile << 3) | ((addr >> 1) & 0x7)];
+}
+
+static inline u32 PPU_GetRow_4bpp(PPU_LineState* st, u16* src)
+{
+	u32 addr = ((u8*)src - PPU.VRAM) & 0xFFFF;
+	u32 tile = addr >> 5;
+	
+	if (st->VRAM != PPU.VRAM)
 	{
-		tilepixels >>= start;
-		
-		for (idx = 0; idx < end; idx++)
-		{
-			colorval = 0;
-			if (tilepixels & 0x0001) colorval |= 0x01;
-			if (tilepixels & 0x0100) colorval |= 0x02;
-			tilepixels >>= 1;
-			
-			if (colorval)
-				buffer[idx] = pal[colorval] | alpha;
-		}
+		u16* row = (u16*)&st->VRAM[addr];
+		return PPU_DecodeRow_4bpp(row[0] | (row[8] << 16));
 	}
-	else
+	
+	if (PPU_TileStamp_4bpp[tile] != VRAMCOUNT_4BPP(tile))
+		PPU_DecodeTile_4bpp(tile);
+	
+	return PPU_TileRows_4bpp[(tile << 3) | ((addr >> 1) & 0x7)];
+}
+
+static inline u32* PPU_GetRow_8bpp(PPU_LineState* st, u16* src)
+{
+	u32 addr = ((u8*)src - PPU.VRAM) & 0xFFFF;
+	u32 tile = addr >> 6;
+	
+	if (st->VRAM != PPU.VRAM)
 	{
-		tilepixels <<= start;
-		
-		for (idx = 0; idx < end; idx++)
-		{
-			colorval = 0;
-			if (tilepixels & 0x0080) colorval |= 0x01;
-			if (tilepixels & 0x8000) colorval |= 0x02;
-			tilepixels <<= 1;
-			
-			if (colorval)
-				buffer[idx] = pal[colorval] | alpha;
-		}
+		u16* row = (u16*)&st->VRAM[addr];
+		st->Row8[0] = PPU_DecodeRow_4bpp(row[0] | (row[8] << 16));
+		st->Row8[1] = PPU_DecodeRow_4bpp(row[16] | (row[24] << 16));
+		return st->Row8;
 	}
+	
+	if (PPU_TileStamp_8bpp[tile] != VRAMCOUNT_8BPP(tile))
+		PPU_DecodeTile_8bpp(tile);
+	
+	return &PPU_TileRows_8bpp[(tile << 4) | (addr & 0xE)];
 }
 
-void PPU_RenderTile_4bpp(u16 curtile, u32 tilepixels, u16* buffer, u16* pal, u32 alpha, int start, int end)
+
+#define COLMATH(n) ((colormath & (1<<n)) ? 1:0)
+#define COLMATH_OBJ ((colormath & 0x80) ? 0xFF:(colormath&0x40))
+
+
+// these draw decoded rows, 2bpp and 4bpp both go through RenderRow_16
+// start is the first pixel of the row to draw, end the number of pixels
+// alpha has the layer's depth in bits 16-23, see PPU_RenderMode0()
+
+void PPU_RenderRow_16(u16 curtile, u32 pixels, u32* buffer, u16* pal, u32 alpha, int start, int end)
 {
 	u32 idx, colorval;
 	
-	if (curtile & 0x4000)
-	{
-		tilepixels >>= start;
-		
-		for (idx = 0; idx < end; idx++)
-		{
-			colorval = 0;
-			if (tilepixels & 0x00000001) colorval |= 0x01;
-			if (tilepixels & 0x00000100) colorval |= 0x02;
-			if (tilepixels & 0x00010000) colorval |= 0x04;
-			if (tilepixels & 0x01000000) colorval |= 0x08;
-			tilepixels >>= 1;
-			
-			if (colorval)
-				buffer[idx] = pal[colorval] | alpha;
-		}
-	}
-	else
+	if (curtile & 0x4000) pixels = PPU_FlipRow(pixels);
+	pixels >>= (start << 2);
+	
+	for (idx = 0; idx < end; idx++)
 	{
-		tilepixels <<= start;
-		
-		for (idx = 0; idx < end; idx++)
+		colorval = pixels & 0xF;
+		pixels >>= 4;
+	
+		if (colorval)
 		{
-			colorval = 0;
-			if (tilepixels & 0x00000080) colorval |= 0x01;
-			if (tilepixels & 0x00008000) colorval |= 0x02;
-			if (tilepixels & 0x00800000) colorval |= 0x04;
-			if (tilepixels & 0x80000000) colorval |= 0x08;
-			tilepixels <<= 1;
-			
-			if (colorval)
-				buffer[idx] = pal[colorval] | alpha;
+			u32 val = pal[colorval] | alpha;
+			if (val > buffer[idx]) buffer[idx] = val;
 		}
 	}
 }
 
-void PPU_RenderTile_8bpp(u16 curtile, u32 tilepixels1, u32 tilepixels2, u16* buffer, u16* pal, u32 alpha, int start, int end)
+void PPU_RenderRow_256(u16 curtile, u32* pixels, u32* buffer, u16* pal, u32 alpha, int start, int end)
 {
 	u32 idx, colorval;
+	u32 pixlow = pixels[0], pixhigh = pixels[1];
 	
 	if (curtile & 0x4000)
 	{
-		tilepixels1 >>= start;
-		tilepixels2 >>= start;
-		
-		for (idx = 0; idx < end; idx++)
-		{
-			colorval = 0;
-			if (tilepixels1 & 0x00000001) colorval |= 0x01;
-			if (tilepixels1 & 0x00000100) colorval |= 0x02;
-			if (tilepixels1 & 0x00010000) colorval |= 0x04;
-			if (tilepixels1 & 0x01000000) colorval |= 0x08;
-			if (tilepixels2 & 0x00000001) colorval |= 0x10;
-			if (tilepixels2 & 0x00000100) colorval |= 0x20;
-			if (tilepixels2 & 0x00010000) colorval |= 0x40;
-			if (tilepixels2 & 0x01000000) colorval |= 0x80;
-			tilepixels1 >>= 1;
-			tilepixels2 >>= 1;
-			
-			if (colorval)
-				buffer[idx] = pal[colorval] | alpha;
-		}
+		pixlow = PPU_FlipRow(pixlow);
+		pixhigh = PPU_FlipRow(pixhigh);
 	}
-	else
+	pixlow >>= (start << 2);
+	pixhigh >>= (start << 2);
+	
+	for (idx = 0; idx < end; idx++)
 	{
-		tilepixels1 <<= start;
-		tilepixels2 <<= start;
-		
-		for (idx = 0; idx < end; idx++)
+		colorval = (pixlow & 0xF) | ((pixhigh & 0xF) << 4);
+		pixlow >>= 4;
+		pixhigh >>= 4;
+	
+		if (colorval)
 		{
-			colorval = 0;
-			if (tilepixels1 & 0x00000080) colorval |= 0x01;
-			if (tilepixels1 & 0x00008000) colorval |= 0x02;
-			if (tilepixels1 & 0x00800000) colorval |= 0x04;
-			if (tilepixels1 & 0x80000000) colorval |= 0x08;
-			if (tilepixels2 & 0x00000080) colorval |= 0x10;
-			if (tilepixels2 & 0x00008000) colorval |= 0x20;
-			if (tilepixels2 & 0x00800000) colorval |= 0x40;
-			if (tilepixels2 & 0x80000000) colorval |= 0x80;
-			tilepixels1 <<= 1;
-			tilepixels2 <<= 1;
-			
-			if (colorval)
-				buffer[idx] = pal[colorval] | alpha;
+			u32 val = pal[colorval] | alpha;
+			if (val > buffer[idx]) buffer[idx] = val;
 		}
 	}
 }
 
-void PPU_RenderTile_OBJ(u16 attrib, u32 tilepixels, u16* buffer, u16 paloffset_prio)
+void PPU_RenderRow_OBJ(u16 attrib, u32 pixels, u16* buffer, u16 paloffset_prio)
 {
-	if (!tilepixels) return;
+	if (!pixels) return;
 	u32 idx, colorval;
 	
-	if (attrib & 0x4000)
+	if (attrib & 0x4000) pixels = PPU_FlipRow(pixels);
+	
+	for (idx = 0; idx < 8; idx++)
 	{
-		for (idx = 0; idx < 8; idx++)
-		{
-			colorval = 0;
-			if (tilepixels & 0x00000001) colorval |= 0x01;
-			if (tilepixels & 0x00000100) colorval |= 0x02;
-			if (tilepixels & 0x00010000) colorval |= 0x04;
-			if (tilepixels & 0x01000000) colorval |= 0x08;
-			tilepixels >>= 1;
-			
-			if (colorval)
-				buffer[idx] = colorval | paloffset_prio;
-		}
+		colorval = pixels & 0xF;
+		pixels >>= 4;
+	
+		if (colorval)
+			buffer[idx] = colorval | paloffset_prio;
 	}
-	else
+}
+
+// BG line out of its plane, pixel by pixel because of the depth test
+void PPU_RenderBG_Plane(PPU_LineState* st, PPU_LineBG* bg, u32* buffer, u16* pal, u32 alpha, u32 window, u32 depthlo, u32 depthhi)
+{
+	u32 line = (st->Line + bg->YScroll) & ((bg->Size & 0x2) ? 0x1FF : 0xFF);
+	u32 xmask = (bg->Size & 0x1) ? 0x1FF : 0xFF;
+	u8* src = &bg->Plane[line << 9];
+	u32 xoff;
+	s32 i;
+	
+	xoff = bg->XScroll;
+	i = 0;
+	
+	PPU_WindowSegment* s = &st->Window[0];
+	for (;;)
 	{
-		for (idx = 0; idx < 8; idx++)
+		int end = s->EndOffset;
+		u16 hidden = window ? (bg->WindowCombine & (1 << (s->WindowMask ^ bg->WindowMask))) : 0;
+		
+		if (hidden)
+		{
+			xoff += end - i;
+			i = end;
+		}
+		else
 		{
-			colorval = 0;
-			if (tilepixels & 0x00000080) colorval |= 0x01;
-			if (tilepixels & 0x00008000) colorval |= 0x02;
-			if (tilepixels & 0x00800000) colorval |= 0x04;
-			if (tilepixels & 0x80000000) colorval |= 0x08;
-			tilepixels <<= 1;
+			u32 finalalpha = (st->ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 alphalo = finalalpha | depthlo;
+			u32 alphahi = finalalpha | depthhi;
 			
-			if (colorval)
-				buffer[idx] = colorval | paloffset_prio;
+			for (; i < end; i++, xoff++)
+			{
+				u32 colorval = src[xoff & xmask];
+				if (!colorval) continue;
+				
+				u32 val = pal[colorval & 0x7F] | ((colorval & 0x80) ? alphahi : alphalo);
+				if (val > buffer[i]) buffer[i] = val;
+			}
 		}
+		
+		if (end >= 256) return;
+		s++;
 	}
 }
 
-inline void PPU_DeferTile(PPU_Background* bg, u16* buffer, u16 attrib, u16* pixels, u32 alpha, int start, int end)
-{
-	PPU_DeferredTile* deftile = &(bg->DeferredTiles[bg->NumDeferredTiles]);
-	deftile->Dest = buffer;
-	deftile->SrcPixels = pixels;
-	deftile->Attrib = attrib;
-	deftile->Alpha = (u8)alpha;
-	deftile->Start = (u16)start;
-	deftile->End = (u16)end;
-	bg->NumDeferredTiles++;
-}
-
-
-void PPU_RenderBG_2bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
+void PPU_RenderBG_2bpp_8x8(PPU_LineState* st, PPU_LineBG* bg, u32* buffer, u16* pal, u32 alpha, u32 window, u32 depthlo, u32 depthhi)
 {
 	u16* tileset = bg->Tileset;
 	u16* tilemap = bg->Tilemap;
+	u32 line;
 	u32 xoff;
 	u32 tiley;
 	u16 curtile;
@@ -247,7 +525,13 @@ void PPU_RenderBG_2bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 	s32 i;
 	u32 idx;
 	
-	line += bg->YScroll;
+	if (bg->Plane)
+	{
+		PPU_RenderBG_Plane(st, bg, buffer, pal, alpha, window, depthlo, depthhi);
+		return;
+	}
+	
+	line = st->Line + bg->YScroll;
 	tiley = (line & 0x07);
 	tilemap += (line & 0xF8) << 2;
 	if (line & 0x100)
@@ -259,7 +543,7 @@ void PPU_RenderBG_2bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 	xoff = bg->XScroll;
 	i = 0;
 	
-	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* s = &st->Window[0];
 	for (;;)
 	{
 		int remaining = s->EndOffset - i;
@@ -272,7 +556,9 @@ void PPU_RenderBG_2bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 		}
 		else
 		{
-			u32 finalalpha = (PPU.ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 finalalpha = (st->ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 alphalo = finalalpha | depthlo;
+			u32 alphahi = finalalpha | depthhi;
 			
 			while (remaining > 0)
 			{
@@ -294,16 +580,11 @@ void PPU_RenderBG_2bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 				if (curtile & 0x8000) 	idx += (7 - tiley);
 				else					idx += tiley;
 				
-				if (curtile & 0x2000) // high prio
-				{
-					PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end);
-				}
-				else
-				{
-					tilepixels = tileset[idx];
-					if (tilepixels)
-						PPU_RenderTile_2bpp(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 8], finalalpha, start, end);
-				}
+				u32 tilealpha = (curtile & 0x2000) ? alphahi : alphalo;
+				
+				tilepixels = PPU_GetRow_2bpp(st, &tileset[idx]);
+				if (tilepixels)
+					PPU_RenderRow_16(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 8], tilealpha, start, end);
 				
 				i += end;
 			}
@@ -314,10 +595,11 @@ void PPU_RenderBG_2bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 	}
 }
 
-void PPU_RenderBG_2bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
+void PPU_RenderBG_2bpp_16x16(PPU_LineState* st, PPU_LineBG* bg, u32* buffer, u16* pal, u32 alpha, u32 window, u32 depthlo, u32 depthhi)
 {
 	u16* tileset = bg->Tileset;
 	u16* tilemap = bg->Tilemap;
+	u32 line;
 	u32 xoff;
 	u32 tiley;
 	u16 curtile;
@@ -325,7 +607,7 @@ void PPU_RenderBG_2bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 	s32 i;
 	u32 idx;
 	
-	line += bg->YScroll;
+	line = st->Line + bg->YScroll;
 	tiley = (line & 0x07);
 	tilemap += (line & 0x1F0) << 1;
 	if (line & 0x200)
@@ -337,7 +619,7 @@ void PPU_RenderBG_2bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 	xoff = bg->XScroll;
 	i = 0;
 	
-	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* s = &st->Window[0];
 	for (;;)
 	{
 		int remaining = s->EndOffset - i;
@@ -350,7 +632,9 @@ void PPU_RenderBG_2bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 		}
 		else
 		{
-			u32 finalalpha = (PPU.ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 finalalpha = (st->ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 alphalo = finalalpha | depthlo;
+			u32 alphahi = finalalpha | depthhi;
 			
 			while (remaining > 0)
 			{
@@ -382,59 +666,34 @@ void PPU_RenderBG_2bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 				
 				if (curtile & 0x4000) idx += 8;
 				
-				if (curtile & 0x2000) // high prio
+				u32 tilealpha = (curtile & 0x2000) ? alphahi : alphalo;
+				
+				if (start < 8)
 				{
-					if (start < 8)
-					{
-						int end1 = 8-start;
-						if (end1 > end) end1 = end;
-						PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end1);
-						
-						start = 0;
-						end -= end1;
-						i += end1;
-					}
-					else
-						start -= 8;
+					int end1 = 8-start;
+					if (end1 > end) end1 = end;
 					
-					if (end > 0)
-					{
-						if (curtile & 0x4000) idx -= 8;
-						else                  idx += 8;
-						
-						PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end);
-						i += end;
-					}
+					tilepixels = PPU_GetRow_2bpp(st, &tileset[idx]);
+					if (tilepixels)
+						PPU_RenderRow_16(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 8], tilealpha, start, end1);
+					
+					start = 0;
+					end -= end1;
+					i += end1;
 				}
 				else
+					start -= 8;
+				
+				if (end > 0)
 				{
-					if (start < 8)
-					{
-						int end1 = 8-start;
-						if (end1 > end) end1 = end;
-						
-						tilepixels = tileset[idx];
-						if (tilepixels)
-							PPU_RenderTile_2bpp(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 8], finalalpha, start, end1);
-						
-						start = 0;
-						end -= end1;
-						i += end1;
-					}
-					else
-						start -= 8;
+					if (curtile & 0x4000) idx -= 8;
+					else                  idx += 8;
 					
-					if (end > 0)
-					{
-						if (curtile & 0x4000) idx -= 8;
-						else                  idx += 8;
+					tilepixels = PPU_GetRow_2bpp(st, &tileset[idx]);
+					if (tilepixels)
+						PPU_RenderRow_16(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 8], tilealpha, start, end);
 						
-						tilepixels = tileset[idx];
-						if (tilepixels)
-							PPU_RenderTile_2bpp(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 8], finalalpha, start, end);
-							
-						i += end;
-					}
+					i += end;
 				}
 			}
 		}
@@ -444,10 +703,11 @@ void PPU_RenderBG_2bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 	}
 }
 
-void PPU_RenderBG_4bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
+void PPU_RenderBG_4bpp_8x8(PPU_LineState* st, PPU_LineBG* bg, u32* buffer, u16* pal, u32 alpha, u32 window, u32 depthlo, u32 depthhi)
 {
 	u16* tileset = bg->Tileset;
 	u16* tilemap = bg->Tilemap;
+	u32 line;
 	u32 xoff;
 	u32 tiley;
 	u16 curtile;
@@ -455,7 +715,13 @@ void PPU_RenderBG_4bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 	s32 i;
 	u32 idx;
 	
-	line += bg->YScroll;
+	if (bg->Plane)
+	{
+		PPU_RenderBG_Plane(st, bg, buffer, pal, alpha, window, depthlo, depthhi);
+		return;
+	}
+	
+	line = st->Line + bg->YScroll;
 	tiley = (line & 0x07);
 	tilemap += (line & 0xF8) << 2;
 	if (line & 0x100)
@@ -467,7 +733,7 @@ void PPU_RenderBG_4bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 	xoff = bg->XScroll;
 	i = 0;
 	
-	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* s = &st->Window[0];
 	for (;;)
 	{
 		int remaining = s->EndOffset - i;
@@ -480,7 +746,9 @@ void PPU_RenderBG_4bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 		}
 		else
 		{
-			u32 finalalpha = (PPU.ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 finalalpha = (st->ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 alphalo = finalalpha | depthlo;
+			u32 alphahi = finalalpha | depthhi;
 			
 			while (remaining > 0)
 			{
@@ -502,16 +770,11 @@ void PPU_RenderBG_4bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 				if (curtile & 0x8000) 	idx += (7 - tiley);
 				else					idx += tiley;
 				
-				if (curtile & 0x2000) // high prio
-				{
-					PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end);
-				}
-				else
-				{
-					tilepixels = tileset[idx] | (tileset[idx+8] << 16);
-					if (tilepixels)
-						PPU_RenderTile_4bpp(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 6], finalalpha, start, end);
-				}
+				u32 tilealpha = (curtile & 0x2000) ? alphahi : alphalo;
+				
+				tilepixels = PPU_GetRow_4bpp(st, &tileset[idx]);
+				if (tilepixels)
+					PPU_RenderRow_16(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 6], tilealpha, start, end);
 				
 				i += end;
 			}
@@ -522,10 +785,11 @@ void PPU_RenderBG_4bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 	}
 }
 
-void PPU_RenderBG_4bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
+void PPU_RenderBG_4bpp_16x16(PPU_LineState* st, PPU_LineBG* bg, u32* buffer, u16* pal, u32 alpha, u32 window, u32 depthlo, u32 depthhi)
 {
 	u16* tileset = bg->Tileset;
 	u16* tilemap = bg->Tilemap;
+	u32 line;
 	u32 xoff;
 	u32 tiley;
 	u16 curtile;
@@ -533,7 +797,7 @@ void PPU_RenderBG_4bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 	s32 i;
 	u32 idx;
 	
-	line += bg->YScroll;
+	line = st->Line + bg->YScroll;
 	tiley = (line & 0x07);
 	tilemap += (line & 0x1F0) << 1;
 	if (line & 0x200)
@@ -545,7 +809,7 @@ void PPU_RenderBG_4bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 	xoff = bg->XScroll;
 	i = 0;
 	
-	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* s = &st->Window[0];
 	for (;;)
 	{
 		int remaining = s->EndOffset - i;
@@ -558,7 +822,9 @@ void PPU_RenderBG_4bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 		}
 		else
 		{
-			u32 finalalpha = (PPU.ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 finalalpha = (st->ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 alphalo = finalalpha | depthlo;
+			u32 alphahi = finalalpha | depthhi;
 			
 			while (remaining > 0)
 			{
@@ -590,59 +856,34 @@ void PPU_RenderBG_4bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 				
 				if (curtile & 0x4000) idx += 16;
 				
-				if (curtile & 0x2000) // high prio
+				u32 tilealpha = (curtile & 0x2000) ? alphahi : alphalo;
+				
+				if (start < 8)
 				{
-					if (start < 8)
-					{
-						int end1 = 8-start;
-						if (end1 > end) end1 = end;
-						PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end1);
-						
-						start = 0;
-						end -= end1;
-						i += end1;
-					}
-					else
-						start -= 8;
+					int end1 = 8-start;
+					if (end1 > end) end1 = end;
 					
-					if (end > 0)
-					{
-						if (curtile & 0x4000) idx -= 16;
-						else                  idx += 16;
-						
-						PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end);
-						i += end;
-					}
+					tilepixels = PPU_GetRow_4bpp(st, &tileset[idx]);
+					if (tilepixels)
+						PPU_RenderRow_16(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 6], tilealpha, start, end1);
+					
+					start = 0;
+					end -= end1;
+					i += end1;
 				}
 				else
+					start -= 8;
+				
+				if (end > 0)
 				{
-					if (start < 8)
-					{
-						int end1 = 8-start;
-						if (end1 > end) end1 = end;
-						
-						tilepixels = tileset[idx] | (tileset[idx+8] << 16);
-						if (tilepixels)
-							PPU_RenderTile_4bpp(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 6], finalalpha, start, end1);
-						
-						start = 0;
-						end -= end1;
-						i += end1;
-					}
-					else
-						start -= 8;
+					if (curtile & 0x4000) idx -= 16;
+					else                  idx += 16;
 					
-					if (end > 0)
-					{
-						if (curtile & 0x4000) idx -= 16;
-						else                  idx += 16;
+					tilepixels = PPU_GetRow_4bpp(st, &tileset[idx]);
+					if (tilepixels)
+						PPU_RenderRow_16(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 6], tilealpha, start, end);
 						
-						tilepixels = tileset[idx] | (tileset[idx+8] << 16);
-						if (tilepixels)
-							PPU_RenderTile_4bpp(curtile, tilepixels, &buffer[i], &pal[(curtile & 0x1C00) >> 6], finalalpha, start, end);
-							
-						i += end;
-					}
+					i += end;
 				}
 			}
 		}
@@ -652,18 +893,19 @@ void PPU_RenderBG_4bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 	}
 }
 
-void PPU_RenderBG_8bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
+void PPU_RenderBG_8bpp_8x8(PPU_LineState* st, PPU_LineBG* bg, u32* buffer, u16* pal, u32 alpha, u32 window, u32 depthlo, u32 depthhi)
 {
 	u16* tileset = bg->Tileset;
 	u16* tilemap = bg->Tilemap;
+	u32 line;
 	u32 xoff;
 	u32 tiley;
 	u16 curtile;
-	u32 tilepixels1, tilepixels2;
+	u32* tilepixels;
 	s32 i;
 	u32 idx;
 	
-	line += bg->YScroll;
+	line = st->Line + bg->YScroll;
 	tiley = (line & 0x07);
 	tilemap += (line & 0xF8) << 2;
 	if (line & 0x100)
@@ -675,7 +917,7 @@ void PPU_RenderBG_8bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 	xoff = bg->XScroll;
 	i = 0;
 	
-	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* s = &st->Window[0];
 	for (;;)
 	{
 		int remaining = s->EndOffset - i;
@@ -688,7 +930,9 @@ void PPU_RenderBG_8bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 		}
 		else
 		{
-			u32 finalalpha = (PPU.ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 finalalpha = (st->ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 alphalo = finalalpha | depthlo;
+			u32 alphahi = finalalpha | depthhi;
 			
 			while (remaining > 0)
 			{
@@ -710,20 +954,14 @@ void PPU_RenderBG_8bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 				if (curtile & 0x8000) 	idx += (7 - tiley);
 				else					idx += tiley;
 				
-				if (curtile & 0x2000) // high prio
-				{
-					PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end);
-				}
-				else
-				{
-					// TODO: palette offset for direct color
-					
-					tilepixels1 = tileset[idx] | (tileset[idx+8] << 16);
-					tilepixels2 = tileset[idx+16] | (tileset[idx+24] << 16);
-					
-					if (tilepixels1|tilepixels2)
-						PPU_RenderTile_8bpp(curtile, tilepixels1, tilepixels2, &buffer[i], pal, finalalpha, start, end);
-				}
+				u32 tilealpha = (curtile & 0x2000) ? alphahi : alphalo;
+				
+				// TODO: palette offset for direct color
+				
+				tilepixels = PPU_GetRow_8bpp(st, &tileset[idx]);
+				
+				if (tilepixels[0]|tilepixels[1])
+					PPU_RenderRow_256(curtile, tilepixels, &buffer[i], pal, tilealpha, start, end);
 				
 				i += end;
 			}
@@ -734,18 +972,19 @@ void PPU_RenderBG_8bpp_8x8(PPU_Background* bg, u16* buffer, u32 line, u16* pal,
 	}
 }
 
-void PPU_RenderBG_8bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
+void PPU_RenderBG_8bpp_16x16(PPU_LineState* st, PPU_LineBG* bg, u32* buffer, u16* pal, u32 alpha, u32 window, u32 depthlo, u32 depthhi)
 {
 	u16* tileset = bg->Tileset;
 	u16* tilemap = bg->Tilemap;
+	u32 line;
 	u32 xoff;
 	u32 tiley;
 	u16 curtile;
-	u32 tilepixels1, tilepixels2;
+	u32* tilepixels;
 	s32 i;
 	u32 idx;
 	
-	line += bg->YScroll;
+	line = st->Line + bg->YScroll;
 	tiley = (line & 0x07);
 	tilemap += (line & 0x1F0) << 1;
 	if (line & 0x200)
@@ -757,7 +996,7 @@ void PPU_RenderBG_8bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 	xoff = bg->XScroll;
 	i = 0;
 	
-	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* s = &st->Window[0];
 	for (;;)
 	{
 		int remaining = s->EndOffset - i;
@@ -770,7 +1009,9 @@ void PPU_RenderBG_8bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 		}
 		else
 		{
-			u32 finalalpha = (PPU.ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 finalalpha = (st->ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 alphalo = finalalpha | depthlo;
+			u32 alphahi = finalalpha | depthhi;
 			
 			while (remaining > 0)
 			{
@@ -802,65 +1043,38 @@ void PPU_RenderBG_8bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 				
 				if (curtile & 0x4000) idx += 32;
 				
-				if (curtile & 0x2000) // high prio
+				u32 tilealpha = (curtile & 0x2000) ? alphahi : alphalo;
+				
+				// TODO: palette offset for direct color
+				
+				if (start < 8)
 				{
-					if (start < 8)
-					{
-						int end1 = 8-start;
-						if (end1 > end) end1 = end;
-						PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end1);
-						
-						start = 0;
-						end -= end1;
-						i += end1;
-					}
-					else
-						start -= 8;
+					int end1 = 8-start;
+					if (end1 > end) end1 = end;
 					
-					if (end > 0)
-					{
-						if (curtile & 0x4000) idx -= 32;
-						else                  idx += 32;
-						
-						PPU_DeferTile(bg, &buffer[i], curtile, &tileset[idx], finalalpha, start, end);
-						i += end;
-					}
+					tilepixels = PPU_GetRow_8bpp(st, &tileset[idx]);
+					
+					if (tilepixels[0]|tilepixels[1])
+						PPU_RenderRow_256(curtile, tilepixels, &buffer[i], pal, tilealpha, start, end1);
+					
+					start = 0;
+					end -= end1;
+					i += end1;
 				}
 				else
+					start -= 8;
+				
+				if (end > 0)
 				{
-					// TODO: palette offset for direct color
+					if (curtile & 0x4000) idx -= 32;
+					else                  idx += 32;
 					
-					if (start < 8)
-					{
-						int end1 = 8-start;
-						if (end1 > end) end1 = end;
-						
-						tilepixels1 = tileset[idx] | (tileset[idx+8] << 16);
-						tilepixels2 = tileset[idx+16] | (tileset[idx+24] << 16);
-						
-						if (tilepixels1|tilepixels2)
-							PPU_RenderTile_8bpp(curtile, tilepixels1, tilepixels2, &buffer[i], pal, finalalpha, start, end1);
-						
-						start = 0;
-						end -= end1;
-						i += end1;
-					}
-					else
-						start -= 8;
+					tilepixels = PPU_GetRow_8bpp(st, &tileset[idx]);
 					
-					if (end > 0)
-					{
-						if (curtile & 0x4000) idx -= 32;
-						else                  idx += 32;
-						
-						tilepixels1 = tileset[idx] | (tileset[idx+8] << 16);
-						tilepixels2 = tileset[idx+16] | (tileset[idx+24] << 16);
+					if (tilepixels[0]|tilepixels[1])
+						PPU_RenderRow_256(curtile, tilepixels, &buffer[i], pal, tilealpha, start, end);
 						
-						if (tilepixels1|tilepixels2)
-							PPU_RenderTile_8bpp(curtile, tilepixels1, tilepixels2, &buffer[i], pal, finalalpha, start, end);
-							
-						i += end;
-					}
+					i += end;
 				}
 			}
 		}
@@ -871,29 +1085,30 @@ void PPU_RenderBG_8bpp_16x16(PPU_Background* bg, u16* buffer, u32 line, u16* pal
 }
 
 
-void PPU_RenderBG_Mode7(u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
+void PPU_RenderBG_Mode7(PPU_LineState* st, u32* buffer, u16* pal, u32 alpha, u32 window, u32 depth)
 {
-	s32 x = (PPU.M7A * (PPU.M7XScroll-PPU.M7RefX)) + (PPU.M7B * (line+PPU.M7YScroll-PPU.M7RefY)) + (PPU.M7RefX << 8);
-	s32 y = (PPU.M7C * (PPU.M7XScroll-PPU.M7RefX)) + (PPU.M7D * (line+PPU.M7YScroll-PPU.M7RefY)) + (PPU.M7RefY << 8);
+	s32 x = (st->M7A * (st->M7XScroll-st->M7RefX)) + (st->M7B * (st->Line+st->M7YScroll-st->M7RefY)) + (st->M7RefX << 8);
+	s32 y = (st->M7C * (st->M7XScroll-st->M7RefX)) + (st->M7D * (st->Line+st->M7YScroll-st->M7RefY)) + (st->M7RefY << 8);
 	int i = 0;
 	u32 tileidx;
 	u8 colorval;
+	u8* vram = st->VRAM;
 	
-	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* s = &st->Window[0];
 	for (;;)
 	{
-		u16 hidden = window ? (PPU.BG[0].WindowCombine & (1 << (s->WindowMask ^ PPU.BG[0].WindowMask))) : 0;
+		u16 hidden = window ? (st->BG[0].WindowCombine & (1 << (s->WindowMask ^ st->BG[0].WindowMask))) : 0;
 		
 		if (hidden)
 		{
 			int remaining = s->EndOffset - i;
 			i += remaining;
-			x += remaining*PPU.M7A;
-			y += remaining*PPU.M7C;
+			x += remaining*st->M7A;
+			y += remaining*st->M7C;
 		}
 		else
 		{
-			u32 finalalpha = (PPU.ColorMath1 & s->ColorMath) ? 0:alpha;
+			u32 finalalpha = ((st->ColorMath1 & s->ColorMath) ? 0:alpha) | depth;
 			int end = s->EndOffset;
 			
 			while (i < end)
@@ -903,15 +1118,15 @@ void PPU_RenderBG_Mode7(u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
 				if ((x|y) & 0xFFFC0000)
 				{
 					// wraparound
-					if ((PPU.M7Sel & 0xC0) == 0x80)
+					if ((st->M7Sel & 0xC0) == 0x80)
 					{
 						// skip pixel (transparent)
 						i++;
-						x += PPU.M7A;
-						y += PPU.M7C;
+						x += st->M7A;
+						y += st->M7C;
 						continue;
 					}
-					else if ((PPU.M7Sel & 0xC0) == 0xC0)
+					else if ((st->M7Sel & 0xC0) == 0xC0)
 					{
 						// use tile 0
 						tileidx = 0;
@@ -920,24 +1135,27 @@ void PPU_RenderBG_Mode7(u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
 					{
 						// ignore wraparound
 						tileidx = ((x & 0x3F800) >> 10) + ((y & 0x3F800) >> 3);
-						tileidx = PPU.VRAM[tileidx] << 7;
+						tileidx = vram[tileidx] << 7;
 					}
 				}
 				else
 				{
 					tileidx = ((x & 0x3F800) >> 10) + ((y & 0x3F800) >> 3);
-					tileidx = PPU.VRAM[tileidx] << 7;
+					tileidx = vram[tileidx] << 7;
 				}
 				
 				tileidx += ((x & 0x700) >> 7) + ((y & 0x700) >> 4) + 1;
-				colorval = PPU.VRAM[tileidx];
+				colorval = vram[tileidx];
 				
 				if (colorval)
-					buffer[i] = pal[colorval] | finalalpha;
+				{
+					u32 val = pal[colorval] | finalalpha;
+					if (val > buffer[i]) buffer[i] = val;
+				}
 				
 				i++;
-				x += PPU.M7A;
-				y += PPU.M7C;
+				x += st->M7A;
+				y += st->M7C;
 			}
 		}
 		
@@ -947,70 +1165,15 @@ void PPU_RenderBG_Mode7(u16* buffer, u32 line, u16* pal, u32 alpha, u32 window)
 }
 
 
-void PPU_RenderDeferredTiles_2bpp(PPU_Background* bg, u16* pal)
-{
-	PPU_DeferredTile* deftile = &(bg->DeferredTiles[0]);
-	PPU_DeferredTile* end = &(bg->DeferredTiles[bg->NumDeferredTiles]);
-	
-	for (; deftile < end; deftile++)
-	{
-		u16 tilepixels = deftile->SrcPixels[0];
-		if (!tilepixels) continue;
-		
-		u16 attrib = deftile->Attrib;
-		PPU_RenderTile_2bpp(attrib, tilepixels, deftile->Dest, &pal[(attrib & 0x1C00) >> 8], deftile->Alpha, deftile->Start, deftile->End);
-	}
-	
-	bg->NumDeferredTiles = 0;
-}
-
-void PPU_RenderDeferredTiles_4bpp(PPU_Background* bg, u16* pal)
+int PPU_RenderOBJ(PPU_LineState* st, PPU_LineContext* ctx, u8* oam, u32 oamextra, u32 ymask, u16* buffer, u32 line)
 {
-	PPU_DeferredTile* deftile = &(bg->DeferredTiles[0]);
-	PPU_DeferredTile* end = &(bg->DeferredTiles[bg->NumDeferredTiles]);
-	
-	for (; deftile < end; deftile++)
-	{
-		u32 tilepixels = deftile->SrcPixels[0] | (deftile->SrcPixels[8] << 16);
-		if (!tilepixels) continue;
-		
-		u16 attrib = deftile->Attrib;
-		PPU_RenderTile_4bpp(attrib, tilepixels, deftile->Dest, &pal[(attrib & 0x1C00) >> 6], deftile->Alpha, deftile->Start, deftile->End);
-	}
-	
-	bg->NumDeferredTiles = 0;
-}
-
-void PPU_RenderDeferredTiles_8bpp(PPU_Background* bg, u16* pal)
-{
-	PPU_DeferredTile* deftile = &(bg->DeferredTiles[0]);
-	PPU_DeferredTile* end = &(bg->DeferredTiles[bg->NumDeferredTiles]);
-	
-	for (; deftile < end; deftile++)
-	{
-		u32 tilepixels1 = deftile->SrcPixels[0] | (deftile->SrcPixels[8] << 16);
-		u32 tilepixels2 = deftile->SrcPixels[16] | (deftile->SrcPixels[24] << 16);
-		if (!(tilepixels1|tilepixels2)) continue;
-		
-		// TODO: pal for direct color
-		
-		u16 attrib = deftile->Attrib;
-		PPU_RenderTile_8bpp(attrib, tilepixels1, tilepixels2, deftile->Dest, pal, deftile->Alpha, deftile->Start, deftile->End);
-	}
-	
-	bg->NumDeferredTiles = 0;
-}
-
-
-int PPU_RenderOBJ(u8* oam, u32 oamextra, u32 ymask, u16* buffer, u32 line)
-{
-	u16* tileset = PPU.OBJTileset;
+	u16* tileset = st->OBJTileset;
 	s32 xoff;
 	u16 attrib;
 	u32 tilepixels;
 	u32 idx;
 	s32 i;
-	s32 width = (s32)PPU.OBJWidth[(oamextra & 0x2) >> 1];
+	s32 width = (s32)st->OBJWidth[(oamextra & 0x2) >> 1];
 	u32 paloffset, prio;
 	
 	xoff = oam[0];
@@ -1022,7 +1185,7 @@ int PPU_RenderOBJ(u8* oam, u32 oamextra, u32 ymask, u16* buffer, u32 line)
 	}
 	else
 		i = xoff;
-		
+	
 	attrib = *(u16*)&oam[2];
 	
 	idx = (attrib & 0x01FF) << 4;
@@ -1032,14 +1195,14 @@ int PPU_RenderOBJ(u8* oam, u32 oamextra, u32 ymask, u16* buffer, u32 line)
 	
 	if (attrib & 0x4000)
 		idx += ((width-1) & 0x38) << 1;
-		
+	
 	width += i;
 	if (width > 256) width = 256;
 	
 	paloffset = ((oam[3] & 0x0E) << 3);
 	
 	prio = oam[3] & 0x30;
-	PPU.SpritesOnLine[prio >> 4] = 1;
+	ctx->SpritesOnLine[prio >> 4] = 1;
 	
 	for (; i < width;)
 	{
@@ -1050,9 +1213,9 @@ int PPU_RenderOBJ(u8* oam, u32 oamextra, u32 ymask, u16* buffer, u32 line)
 			idx += (attrib & 0x4000) ? -16:16;
 			continue;
 		}
-		
-		tilepixels = tileset[idx] | (tileset[idx+8] << 16);
-		PPU_RenderTile_OBJ(attrib, tilepixels, &buffer[i], paloffset | (prio << 8));
+	
+		tilepixels = PPU_GetRow_4bpp(st, &tileset[idx]);
+		PPU_RenderRow_OBJ(attrib, tilepixels, &buffer[i], paloffset | (prio << 8));
 		i += 8;
 		idx += (attrib & 0x4000) ? -16:16;
 	}
@@ -1060,201 +1223,880 @@ int PPU_RenderOBJ(u8* oam, u32 oamextra, u32 ymask, u16* buffer, u32 line)
 	return 1;
 }
 
-void PPU_PrerenderOBJs(u16* buf, s32 line)
+// sprites on each line, in the order they're drawn (lowest priority first)
+// each entry is the OAM index | the sprite's row on that line << 8
+// rebuilt when something that changes them does (PPU.OBJListDirty): sprite Y
+// positions and sizes in OAM, the OBJ size ($2101) and the priority rotation
+
+PPU_OBJInfo PPU_OBJInfos[128];
+u16 PPU_OBJList[128*64];
+u16 PPU_OBJListStart[OBJLIST_LINES+1];
+
+static void PPU_AddOBJLines(u16* pos, int fill, u32 num, s32 oy, s32 start, s32 end)
 {
-	int i = PPU.FirstOBJ;
-	i--;
-	if (i < 0) i = 127;
-	int last = i;
-	int nrendered = 0;
+	s32 line;
+	
+	if (start < 0) start = 0;
+	if (end > OBJLIST_LINES) end = OBJLIST_LINES;
+	
+	for (line = start; line < end; line++)
+	{
+		if (fill) PPU_OBJList[PPU_OBJListStart[line] + pos[line]] = num | ((line - oy) << 8);
+		pos[line]++;
+	}
+}
 
-	do
+void PPU_BuildOBJList()
+{
+	u16 pos[OBJLIST_LINES];
+	int fill, i, n, line;
+	
+	for (i = 0; i < 128; i++)
 	{
-		u8* oam = &PPU.OAM[i << 2];
 		u8 oamextra = PPU.OAM[0x200 + (i >> 2)] >> ((i & 0x03) << 1);
-		s32 oy = (s32)oam[1] + 1;
-		s32 oh = (s32)PPU.OBJHeight[(oamextra & 0x2) >> 1];
-		
-		if (line >= oy && line < (oy+oh))
+		PPU_OBJInfos[i].Extra = oamextra;
+		PPU_OBJInfos[i].YMask = PPU.OBJHeight[(oamextra & 0x2) >> 1] - 1;
+	}
+	
+	// first pass counts the sprites on each line, second pass fills the lists
+	memset(pos, 0, sizeof(pos));
+	for (fill = 0; fill < 2; fill++)
+	{
+		i = PPU.FirstOBJ;
+		for (n = 0; n < 128; n++)
 		{
-			if (nrendered >= 32)
+			i = (i - 1) & 0x7F;
+			
+			s32 oy = (s32)PPU.OAM[(i << 2) + 1] + 1;
+			s32 oh = (s32)PPU_OBJInfos[i].YMask + 1;
+			
+			PPU_AddOBJLines(pos, fill, i, oy, oy, oy+oh);
+			
+			// sprites near the bottom wrap to the top of the screen
+			if (oy >= 192)
 			{
-				PPU.OBJOverflow |= 0x40;
-				return;
+				oy -= 0x100;
+				if ((oy+oh) > 1)
+					PPU_AddOBJLines(pos, fill, i, oy, 0, oy+oh);
 			}
-			nrendered += PPU_RenderOBJ(oam, oamextra, oh-1, buf, line-oy);
 		}
-		else if (oy >= 192)
+		
+		if (!fill)
 		{
-			oy -= 0x100;
-			if ((oy+oh) > 1 && line < (oy+oh))
+			PPU_OBJListStart[0] = 0;
+			for (line = 0; line < OBJLIST_LINES; line++)
 			{
-				if (nrendered >= 32)
-				{
-					PPU.OBJOverflow |= 0x40;
-					return;
-				}
-				nrendered += PPU_RenderOBJ(oam, oamextra, oh-1, buf, line-oy);
+				PPU_OBJListStart[line+1] = PPU_OBJListStart[line] + pos[line];
+				pos[line] = 0;
 			}
 		}
+	}
+	
+	PPU.OBJListDirty = 0;
+}
+
+// a sprite counts towards the 32 per line unless it's entirely past the left edge
+static inline int PPU_OBJOnScreen(u32 i)
+{
+	if (!(PPU_OBJInfos[i].Extra & 0x1)) return 1;
+	return (0x100 - PPU.OAM[i << 2]) < PPU.OBJWidth[(PPU_OBJInfos[i].Extra & 0x2) >> 1];
+}
 
-		i--;
-		if (i < 0) i = 127;
+// range over, done on the emulation thread so $213E sees it when it should
+void PPU_CheckOBJOverflow(s32 line)
+{
+	u16* entry = &PPU_OBJList[PPU_OBJListStart[line]];
+	u16* end = &PPU_OBJList[PPU_OBJListStart[line+1]];
+	int nrendered = 0;
+	
+	if ((end - entry) <= 32) return;
+	
+	for (; entry < end; entry++)
+	{
+		if (nrendered >= 32)
+		{
+			PPU.OBJOverflow |= 0x40;
+			return;
+		}
+	
+		nrendered += PPU_OBJOnScreen(*entry & 0x7F);
 	}
-	while (i != last);
 }
 
-void PPU_RenderOBJs(u16* buf, u32 line, u32 prio, u32 colmathmask, u32 window)
+void PPU_PrerenderOBJs(PPU_LineState* st, PPU_LineContext* ctx)
+{
+	u16* buf = &ctx->OBJBuffer[16];
+	u16* entry = &st->OBJList[st->OBJListStart[st->Line]];
+	u16* end = &st->OBJList[st->OBJListStart[st->Line+1]];
+	int nrendered = 0;
+	
+	for (; entry < end; entry++)
+	{
+		if (nrendered >= 32) return;
+	
+		u32 i = *entry & 0x7F;
+		nrendered += PPU_RenderOBJ(st, ctx, &st->OAM[i << 2], st->OBJInfos[i].Extra, st->OBJInfos[i].YMask, buf, *entry >> 8);
+	}
+}
+
+// all the OBJ priorities in one go, depths has the depth of each of them
+void PPU_RenderOBJs(PPU_LineState* st, PPU_LineContext* ctx, const u32* depths, u32 colmathmask, u32 window)
 {
 	int i = 0;
 	
-	if (!PPU.SpritesOnLine[prio >> 12]) return;
+	if (!*(u32*)&ctx->SpritesOnLine[0]) return;
 	
-	u16* srcbuf = &PPU.OBJBuffer[16];
-	u16* pal = &PPU.Palette[128];
+	u32* buf = ctx->LineBuffer;
+	u16* srcbuf = &ctx->OBJBuffer[16];
+	u16* pal = &st->Palette[128];
 	
-	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* s = &st->Window[0];
 	for (;;)
 	{
-		u16 hidden = window ? (PPU.OBJWindowCombine & (1 << (s->WindowMask ^ PPU.OBJWindowMask))) : 0;
-		
+		u16 hidden = window ? (st->OBJWindowCombine & (1 << (s->WindowMask ^ st->OBJWindowMask))) : 0;
+	
 		if (hidden)
 		{
 			i = s->EndOffset;
 		}
 		else
 		{
-			u32 finalalpha = (PPU.ColorMath1 & s->ColorMath) ? 0:1;
-			
+			u32 finalalpha = (st->ColorMath1 & s->ColorMath) ? 0:1;
+	
 			while (i < s->EndOffset)
 			{
 				u16 val = srcbuf[i];
-				if ((val & 0xFF00) == prio)
-					buf[i] = pal[val & 0xFF] | ((val & colmathmask) ? finalalpha:0);
+				if (val != 0xFFFF)
+				{
+					u32 col = pal[val & 0xFF] | ((val & colmathmask) ? finalalpha:0) | depths[val >> 12];
+					if (col > buf[i]) buf[i] = col;
+				}
 				i++;
 			}
 		}
-		
+	
 		if (s->EndOffset >= 256) return;
 		s++;
 	}
 }
 
 
+// the layers are composited with a depth per pixel, instead of being drawn
+// back to front one priority at a time
+// every layer is drawn once, each pixel goes in with the layer's depth in
+// bits 16-23 and only replaces what's there if it's in front of it
+// (backdrop is 0). the depths below follow the priority order of each mode,
+// lowest first
+
+#define DEPTH(n) ((n) << 16)
+
 // TODO maybe optimize? precompute that whenever the PPU mode is changed?
-#define PPU_RENDERBG(depth, num, pal) \
+#define PPU_RENDERBG(depth, num, pal, lo, hi) \
 	{ \
-		if (PPU.Mode & (0x10<<num)) \
-			PPU_RenderBG_##depth##_16x16(&PPU.BG[num], buf, line, &PPU.Palette[pal], COLMATH(num), screen&(0x100<<num)); \
+		if (st->Mode & (0x10<<num)) \
+			PPU_RenderBG_##depth##_16x16(st, &st->BG[num], ctx->LineBuffer, &st->Palette[pal], COLMATH(num), screen&(0x100<<num), DEPTH(lo), DEPTH(hi)); \
 		else \
-			PPU_RenderBG_##depth##_8x8(&PPU.BG[num], buf, line, &PPU.Palette[pal], COLMATH(num), screen&(0x100<<num)); \
+			PPU_RenderBG_##depth##_8x8(st, &st->BG[num], ctx->LineBuffer, &st->Palette[pal], COLMATH(num), screen&(0x100<<num), DEPTH(lo), DEPTH(hi)); \
 	}
 
-void PPU_RenderMode0(u16* buf, u32 line, u16 screen, u8 colormath)
+const u32 PPU_OBJDepths_Mode0[4] = {DEPTH(3), DEPTH(6), DEPTH(9), DEPTH(12)};
+const u32 PPU_OBJDepths_Mode1[4] = {DEPTH(2), DEPTH(4), DEPTH(7), DEPTH(10)};
+const u32 PPU_OBJDepths_Mode2[4] = {DEPTH(2), DEPTH(4), DEPTH(6), DEPTH(8)};
+const u32 PPU_OBJDepths_Mode7[4] = {DEPTH(1), DEPTH(3), DEPTH(4), DEPTH(5)};
+
+void PPU_RenderMode0(PPU_LineState* st, PPU_LineContext* ctx, u16 screen, u8 colormath)
+{
+	// BG4 lo, BG3 lo, OBJ0, BG4 hi, BG3 hi, OBJ1, BG2 lo, BG1 lo, OBJ2, BG2 hi, BG1 hi, OBJ3
+	if (screen & 0x08) PPU_RENDERBG(2bpp, 3, 96, 1, 4);
+	if (screen & 0x04) PPU_RENDERBG(2bpp, 2, 64, 2, 5);
+	if (screen & 0x02) PPU_RENDERBG(2bpp, 1, 32, 7, 10);
+	if (screen & 0x01) PPU_RENDERBG(2bpp, 0, 0, 8, 11);
+	if (screen & 0x10) PPU_RenderOBJs(st, ctx, PPU_OBJDepths_Mode0, COLMATH_OBJ, (screen&0x1000));
+}
+
+void PPU_RenderMode1(PPU_LineState* st, PPU_LineContext* ctx, u16 screen, u8 colormath)
+{
+	// BG3 lo, OBJ0, BG3 hi, OBJ1, BG2 lo, BG1 lo, OBJ2, BG2 hi, BG1 hi, OBJ3
+	// BG3 hi goes on top of everything when BG3 priority is set
+	if (screen & 0x04) PPU_RENDERBG(2bpp, 2, 0, 1, (st->Mode & 0x08) ? 11:3);
+	if (screen & 0x02) PPU_RENDERBG(4bpp, 1, 0, 5, 8);
+	if (screen & 0x01) PPU_RENDERBG(4bpp, 0, 0, 6, 9);
+	if (screen & 0x10) PPU_RenderOBJs(st, ctx, PPU_OBJDepths_Mode1, COLMATH_OBJ, (screen&0x1000));
+}
+
+// modes 2-4: BG2 lo, OBJ0, BG1 lo, OBJ1, BG2 hi, OBJ2, BG1 hi, OBJ3
+
+// TODO: offset per tile, someday
+void PPU_RenderMode2(PPU_LineState* st, PPU_LineContext* ctx, u16 screen, u8 colormath)
+{
+	if (screen & 0x02) PPU_RENDERBG(4bpp, 1, 0, 1, 5);
+	if (screen & 0x01) PPU_RENDERBG(4bpp, 0, 0, 3, 7);
+	if (screen & 0x10) PPU_RenderOBJs(st, ctx, PPU_OBJDepths_Mode2, COLMATH_OBJ, (screen&0x1000));
+}
+
+void PPU_RenderMode3(PPU_LineState* st, PPU_LineContext* ctx, u16 screen, u8 colormath)
+{
+	if (screen & 0x02) PPU_RENDERBG(4bpp, 1, 0, 1, 5);
+	if (screen & 0x01) PPU_RENDERBG(8bpp, 0, 0, 3, 7);
+	if (screen & 0x10) PPU_RenderOBJs(st, ctx, PPU_OBJDepths_Mode2, COLMATH_OBJ, (screen&0x1000));
+}
+
+// TODO: offset per tile, someday
+void PPU_RenderMode4(PPU_LineState* st, PPU_LineContext* ctx, u16 screen, u8 colormath)
 {
-	if (screen & 0x08) PPU_RENDERBG(2bpp, 3, 96);
-	if (screen & 0x04) PPU_RENDERBG(2bpp, 2, 64);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x0000, COLMATH_OBJ, (screen&0x1000));
+	if (screen & 0x02) PPU_RENDERBG(2bpp, 1, 0, 1, 5);
+	if (screen & 0x01) PPU_RENDERBG(8bpp, 0, 0, 3, 7);
+	if (screen & 0x10) PPU_RenderOBJs(st, ctx, PPU_OBJDepths_Mode2, COLMATH_OBJ, (screen&0x1000));
+}
+
+void PPU_RenderMode7(PPU_LineState* st, PPU_LineContext* ctx, u16 screen, u8 colormath)
+{
+	// OBJ0, BG1, OBJ1, OBJ2, OBJ3
+	if (screen & 0x01) PPU_RenderBG_Mode7(st, ctx->LineBuffer, &st->Palette[0], COLMATH(0), (screen&0x100), DEPTH(2));
+	if (screen & 0x10) PPU_RenderOBJs(st, ctx, PPU_OBJDepths_Mode7, COLMATH_OBJ, (screen&0x1000));
+}
+
+void PPU_RenderLayers(PPU_LineState* st, PPU_LineContext* ctx, u16 screen, u8 colormath)
+{
+	switch (st->Mode & 0x07)
+	{
+		case 0: PPU_RenderMode0(st, ctx, screen, colormath); break;
+		case 1: PPU_RenderMode1(st, ctx, screen, colormath); break;
+		case 2: PPU_RenderMode2(st, ctx, screen, colormath); break;
+		case 3: PPU_RenderMode3(st, ctx, screen, colormath); break;
+		case 4: PPU_RenderMode4(st, ctx, screen, colormath); break;
 	
-	if (screen & 0x08) PPU_RenderDeferredTiles_2bpp(&PPU.BG[3], &PPU.Palette[96]);
-	if (screen & 0x04) PPU_RenderDeferredTiles_2bpp(&PPU.BG[2], &PPU.Palette[64]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x1000, COLMATH_OBJ, (screen&0x1000));
+		// TODO: mode 5/6 (hires)
 	
-	if (screen & 0x02) PPU_RENDERBG(2bpp, 1, 32);
-	if (screen & 0x01) PPU_RENDERBG(2bpp, 0, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x2000, COLMATH_OBJ, (screen&0x1000));
+		case 7: PPU_RenderMode7(st, ctx, screen, colormath); break;
+	}
+}
+
+// the depth bits go away here
+void PPU_ResolveLine(u16* dst, u32* src)
+{
+	int i;
 	
-	if (screen & 0x02) PPU_RenderDeferredTiles_2bpp(&PPU.BG[1], &PPU.Palette[32]);
-	if (screen & 0x01) PPU_RenderDeferredTiles_2bpp(&PPU.BG[0], &PPU.Palette[0]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x3000, COLMATH_OBJ, (screen&0x1000));
+	for (i = 0; i < 256; i++)
+		dst[i] = (u16)src[i];
 }
 
-void PPU_RenderMode1(u16* buf, u32 line, u16 screen, u8 colormath)
+
+void PPU_RenderLine(PPU_LineState* st, PPU_LineContext* ctx)
 {
-	if (screen & 0x04) PPU_RENDERBG(2bpp, 2, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x0000, COLMATH_OBJ, (screen&0x1000));
+	int i;
+	u16* mbuf = &st->MainBuffer[(255-st->Line) << 8];
+	u16* sbuf = &st->MainBuffer[(256+255-st->Line) << 8];
+	u32* linebuf = ctx->LineBuffer;
+	
+	memset(&ctx->OBJBuffer[16], 0xFF, 256*2);
+	
+	*(u32*)&ctx->SpritesOnLine[0] = 0;
+	
 	
-	if (screen & 0x04) 
+	if ((st->MainScreen|st->SubScreen) & 0x10)
+		PPU_PrerenderOBJs(st, ctx);
+	
+	u8 colormathmain, colormathsub, rendersub;
+	if ((st->ColorMath1 & 0x30) == 0x30) // color math completely disabled
+	{
+		colormathmain = 0;
+		rendersub = 0;
+	}
+	else
 	{
-		if (!(PPU.Mode & 0x08))
-			PPU_RenderDeferredTiles_2bpp(&PPU.BG[2], &PPU.Palette[0]);
+		colormathmain = st->ColorMath2 & 0x0F;
+		if (st->ColorMath2 & 0x10) colormathmain |= 0x40;
+		colormathsub = (st->ColorMath2 & 0x40) ? 0:0xFF;
+		rendersub = (st->ColorMath1 & 0x02);
 	}
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x1000, COLMATH_OBJ, (screen&0x1000));
 	
-	if (screen & 0x02) PPU_RENDERBG(4bpp, 1, 0);
-	if (screen & 0x01) PPU_RENDERBG(4bpp, 0, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x2000, COLMATH_OBJ, (screen&0x1000));
+	// sub screen
+	u32 backdrop = st->SubBackdrop;
+	if (rendersub)
+	{
+		for (i = 0; i < 256; i++)
+			linebuf[i] = backdrop;
 	
-	if (screen & 0x02) PPU_RenderDeferredTiles_4bpp(&PPU.BG[1], &PPU.Palette[0]);
-	if (screen & 0x01) PPU_RenderDeferredTiles_4bpp(&PPU.BG[0], &PPU.Palette[0]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x3000, COLMATH_OBJ, (screen&0x1000));
+		PPU_RenderLayers(st, ctx, st->SubScreen, colormathsub);
+		PPU_ResolveLine(sbuf, linebuf);
+	}
+	else
+	{
+		backdrop |= (backdrop << 16);
+		for (i = 0; i < 256; i += 2)
+			*(u32*)&sbuf[i] = backdrop;
+	}
+	
+	// main screen
+	backdrop = st->Palette[0];
+	if (st->ColorMath2 & 0x20)
+	{
+		PPU_WindowSegment* s = &st->Window[0];
+		i = 0;
+		for (;;)
+		{
+			u32 alpha = (st->ColorMath1 & s->ColorMath) ? 0:1;
+			while (i < s->EndOffset)
+				linebuf[i++] = backdrop|alpha;
 	
-	if (screen & 0x04)
+			if (s->EndOffset >= 256) break;
+			s++;
+		}
+	}
+	else
 	{
-		if (PPU.Mode & 0x08)
-			PPU_RenderDeferredTiles_2bpp(&PPU.BG[2], &PPU.Palette[0]);
+		for (i = 0; i < 256; i++)
+			linebuf[i] = backdrop;
 	}
+	
+	PPU_RenderLayers(st, ctx, st->MainScreen, colormathmain);
+	PPU_ResolveLine(mbuf, linebuf);
+	
+	// that's all folks.
+	// color math and master brightness will be done in hardware from now on
 }
 
-// TODO: offset per tile, someday
-void PPU_RenderMode2(u16* buf, u32 line, u16 screen, u8 colormath)
+
+// render threads
+// with them on, PPU_RenderScanline_Soft() only takes a snapshot of the line
+// and queues it, and the threads draw the lines while the emulation goes on.
+// PPU_VBlank_Soft() waits for them before the frame goes to the GPU
+//
+// the snapshot doesn't cover VRAM, OAM and the sprite lists, so whatever
+// changes those mid-frame has to wait for the queued lines first (PPU_SYNC_SOFT())
+//
+// the queue is a ring of the lines in the order they come, the emulation
+// thread is the only one adding to it and the threads take lines with a
+// compare-and-swap. the counters only ever go up
+//
+// pipelined, PPU_VBlank_Soft() doesn't wait: the frame that just ended is
+// left to the threads while the next one is emulated, and goes to the GPU at
+// the next VBlank (one frame of lag). the next frame goes to another buffer,
+// and when it first changes VRAM or OAM the old frame gets a copy of them
+// instead of holding it up (PPU_SyncLines_Soft()). so there are at most two
+// frames in the queue: the one being emulated and the one before it
+
+#define RENDER_THREADS_MAX 3
+#define LINEQUEUE_SIZE 512
+
+int PPU_NumThreads = 0;
+Handle PPU_Threads[RENDER_THREADS_MAX];
+u8 PPU_ThreadStacks[RENDER_THREADS_MAX][0x4000] __attribute__((aligned(8)));
+PPU_LineContext PPU_ThreadContexts[RENDER_THREADS_MAX];
+volatile int PPU_ExitThreads = 0;
+
+Handle PPU_LinesReady;	// lines were queued
+Handle PPU_LinesDone;	// the last queued line of a frame was drawn, and the emulation thread is waiting for it
+
+PPU_LineState PPU_LineQueue[LINEQUEUE_SIZE];
+vu32 PPU_LinesQueued = 0;
+vu32 PPU_LinesTaken = 0;
+vu32 PPU_FrameLines[2] = {0, 0};	// lines left to draw, per frame (odd/even)
+vu32 PPU_WaitingForLines = 0;
+u8 PPU_LinesPending = 0;
+
+u32 PPU_FrameNum = 0;	// the frame being emulated
+u32 PPU_FrameStart = 0;	// where its lines start in the queue
+
+// the palette can change on every line (HDMA gradients), each change gets
+// its own copy for the lines that use it. one set per frame in the queue
+u16* PPU_PalettePool = NULL;
+u32 PPU_NumPalettes = 0;
+u16* PPU_CurPalette = NULL;
+
+// pipelining
+typedef struct
 {
-	if (screen & 0x02) PPU_RENDERBG(4bpp, 1, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x0000, COLMATH_OBJ, (screen&0x1000));
+	u8 VRAM[0x10000 + 0x2000];	// tilemaps can go a bit past the end
+	u8 OAM[0x220];
+	PPU_OBJInfo OBJInfos[128];
+	u16 OBJListStart[OBJLIST_LINES+1];
+	u16 OBJList[128*64];
 	
-	if (screen & 0x01) PPU_RENDERBG(4bpp, 0, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x1000, COLMATH_OBJ, (screen&0x1000));
+} PPU_FrameCopy;
+
+int PPU_Pipelined = 0;
+u16* PPU_FrameBuffers[3];	// [0] is the one PPU_Init() made
+int PPU_CurBuffer = 0;
+
+int PPU_Detached = 0;	// the last frame is still being drawn, or wasn't shown yet
+u32 PPU_DetachedNum;
+u16* PPU_DetachedBuffer;
+PPU_ColorEffectSection PPU_DetachedColorEffects[240];
+
+PPU_FrameCopy* PPU_Copy = NULL;
+vu32 PPU_CopyFrame = 0xFFFFFFFF;	// the frame whose remaining lines read PPU_Copy
+
+
+// the color depth of each BG in each mode, for the ones that can have a plane
+const u8 PPU_PlaneBPP[8][4] =
+{
+	{2, 2, 2, 2},
+	{4, 4, 2, 0},
+	{4, 4, 0, 0},
+	{0, 4, 0, 0},
+	{0, 2, 0, 0},
+	{0, 0, 0, 0},
+	{0, 0, 0, 0},
+	{0, 0, 0, 0}
+};
+
+static void PPU_DrawPlaneTile(PPU_BGPlane* p, u32 tx, u32 ty, u16 curtile, u32* rows)
+{
+	u8* dst = &p->Pixels[(ty << 12) | (tx << 3)];
+	u32 paloffset = (curtile & 0x1C00) >> ((p->BPP == 2) ? 8 : 6);
+	u32 y, x;
 	
-	if (screen & 0x02) PPU_RenderDeferredTiles_4bpp(&PPU.BG[1], &PPU.Palette[0]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x2000, COLMATH_OBJ, (screen&0x1000));
+	paloffset |= (curtile & 0x2000) >> 6;
 	
-	if (screen & 0x01) PPU_RenderDeferredTiles_4bpp(&PPU.BG[0], &PPU.Palette[0]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x3000, COLMATH_OBJ, (screen&0x1000));
+	for (y = 0; y < 8; y++)
+	{
+		u32 pixels = rows[(curtile & 0x8000) ? (7 - y) : y];
+		if (curtile & 0x4000) pixels = PPU_FlipRow(pixels);
+		
+		for (x = 0; x < 8; x++)
+		{
+			u32 colorval = pixels & 0xF;
+			pixels >>= 4;
+			
+			dst[x] = colorval ? (paloffset | colorval) : 0;
+		}
+		
+		dst += 512;
+	}
 }
 
-void PPU_RenderMode3(u16* buf, u32 line, u16 screen, u8 colormath)
+// redraws the tiles of a row whose tilemap entry or VRAM changed
+static void PPU_UpdatePlaneRow(PPU_BGPlane* p, u32 ty)
 {
-	if (screen & 0x02) PPU_RENDERBG(4bpp, 1, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x0000, COLMATH_OBJ, (screen&0x1000));
+	u16* tilemap = p->Tilemap + ((ty & 0x1F) << 5);
+	u16* entries = &p->Entries[ty << 6];
+	u32* stamps = &p->Stamps[ty << 6];
+	u32 width = (p->Size & 0x1) ? 64 : 32;
+	u32 tx;
 	
-	if (screen & 0x01) PPU_RENDERBG(8bpp, 0, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x1000, COLMATH_OBJ, (screen&0x1000));
+	if (ty & 0x20)
+		tilemap += (p->Size & 0x1) ? 2048 : 1024;
 	
-	if (screen & 0x02) PPU_RenderDeferredTiles_4bpp(&PPU.BG[1], &PPU.Palette[0]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x2000, COLMATH_OBJ, (screen&0x1000));
+	for (tx = 0; tx < width; tx++)
+	{
+		u16 curtile = tilemap[(tx & 0x1F) + ((tx & 0x20) ? 1024 : 0)];
+		u32 addr, tile, stamp;
+		
+		if (p->BPP == 2)
+		{
+			addr = ((u8*)&p->Tileset[(curtile & 0x3FF) << 3] - PPU.VRAM) & 0xFFFF;
+			tile = addr >> 4;
+			stamp = VRAMCOUNT_2BPP(tile);
+			if (curtile == entries[tx] && stamp == stamps[tx]) continue;
+			
+			if (PPU_TileStamp_2bpp[tile] != stamp)
+				PPU_DecodeTile_2bpp(tile);
+			PPU_DrawPlaneTile(p, tx, ty, curtile, &PPU_TileRows_2bpp[tile << 3]);
+		}
+		else
+		{
+			addr = ((u8*)&p->Tileset[(curtile & 0x3FF) << 4] - PPU.VRAM) & 0xFFFF;
+			tile = addr >> 5;
+			stamp = VRAMCOUNT_4BPP(tile);
+			if (curtile == entries[tx] && stamp == stamps[tx]) continue;
+			
+			if (PPU_TileStamp_4bpp[tile] != stamp)
+				PPU_DecodeTile_4bpp(tile);
+			PPU_DrawPlaneTile(p, tx, ty, curtile, &PPU_TileRows_4bpp[tile << 3]);
+		}
+		
+		entries[tx] = curtile;
+		stamps[tx] = stamp;
+	}
 	
-	if (screen & 0x01) PPU_RenderDeferredTiles_8bpp(&PPU.BG[0], &PPU.Palette[0]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x3000, COLMATH_OBJ, (screen&0x1000));
+	p->RowCheck[ty] = PPU.VRAMWrites;
 }
 
-// TODO: offset per tile, someday
-void PPU_RenderMode4(u16* buf, u32 line, u16 screen, u8 colormath)
+// the plane a BG's line can be drawn from, or NULL if it has to be drawn tile by tile
+// called on the emulation thread before the line is queued. a row of the plane
+// is only redrawn after VRAM changed, and PPU_SYNC_SOFT() made sure that no
+// queued line is reading it by then
+static u8* PPU_GetBGPlane(u32 num, u32 line)
 {
-	if (screen & 0x02) PPU_RENDERBG(2bpp, 1, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x0000, COLMATH_OBJ, (screen&0x1000));
+	PPU_Background* bg = &PPU.BG[num];
+	PPU_BGPlane* p = &PPU_BGPlanes[num];
+	u32 bpp = PPU_PlaneBPP[PPU.Mode & 0x07][num];
+	u32 ty, i;
 	
-	if (screen & 0x01) PPU_RENDERBG(8bpp, 0, 0);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x1000, COLMATH_OBJ, (screen&0x1000));
+	if (!bpp || (PPU.Mode & (0x10 << num))) return NULL;
+	if (!((PPU.MainScreen | PPU.SubScreen) & (1 << num))) return NULL;
 	
-	if (screen & 0x02) PPU_RenderDeferredTiles_2bpp(&PPU.BG[1], &PPU.Palette[0]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x2000, COLMATH_OBJ, (screen&0x1000));
+	if (p->Tilemap != bg->Tilemap || p->Tileset != bg->Tileset || p->Size != bg->Size || p->BPP != bpp)
+	{
+		// lines from before might still be drawn from it, so it only goes to
+		// new settings once a frame, after the lines that used it are done.
+		// a BG that changes mid-frame is drawn tile by tile after the change
+		if (p->Frame == PPU_FrameNum) return NULL;
+		if (PPU_FrameLines[p->Frame & 1] && p->Frame != PPU_CopyFrame) return NULL;
+		
+		if (!p->Pixels)
+		{
+			p->Pixels = (u8*)MemAlloc(512*512);
+			if (!p->Pixels) return NULL;
+		}
+		
+		p->Tilemap = bg->Tilemap;
+		p->Tileset = bg->Tileset;
+		p->Size = bg->Size;
+		p->BPP = bpp;
+		
+		// everything gets redrawn
+		memset(p->Stamps, 0xFF, sizeof(p->Stamps));
+		for (i = 0; i < 64; i++)
+			p->RowCheck[i] = PPU.VRAMWrites - 1;
+	}
+	
+	ty = ((line + bg->YScroll) & ((bg->Size & 0x2) ? 0x1FF : 0xFF)) >> 3;
+	if (p->RowCheck[ty] != PPU.VRAMWrites)
+		PPU_UpdatePlaneRow(p, ty);
 	
-	if (screen & 0x01) PPU_RenderDeferredTiles_8bpp(&PPU.BG[0], &PPU.Palette[0]);
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x3000, COLMATH_OBJ, (screen&0x1000));
+	p->Frame = PPU_FrameNum;
+	return p->Pixels;
 }
 
-void PPU_RenderMode7(u16* buf, u32 line, u16 screen, u8 colormath)
+static void PPU_GetLineState(PPU_LineState* st, u32 line)
 {
-	if (screen & 0x10) PPU_RenderOBJs(buf, line, 0x0000, COLMATH_OBJ, (screen&0x1000));
+	int i;
+	
+	st->Line = line;
+	
+	st->Mode = PPU.Mode;
+	st->MainScreen = PPU.MainScreen;
+	st->SubScreen = PPU.SubScreen;
+	st->ColorMath1 = PPU.ColorMath1;
+	st->ColorMath2 = PPU.ColorMath2;
+	st->SubBackdrop = PPU.SubBackdrop;
+	
+	if (PPU_NumThreads)
+	{
+		if (PPU.PaletteDirty || !PPU_CurPalette)
+		{
+			PPU_CurPalette = &PPU_PalettePool[(((PPU_FrameNum & 1) * 240) + PPU_NumPalettes) << 8];
+			PPU_NumPalettes++;
+			memcpy(PPU_CurPalette, PPU.Palette, 256*2);
+			PPU.PaletteDirty = 0;
+		}
+		st->Palette = PPU_CurPalette;
+	}
+	else
+		st->Palette = PPU.Palette;
+	
+	for (i = 0; i < 4; i++)
+	{
+		PPU_Background* bg = &PPU.BG[i];
+		PPU_LineBG* lbg = &st->BG[i];
+	
+		lbg->Tileset = bg->Tileset;
+		lbg->Tilemap = bg->Tilemap;
+		lbg->XScroll = bg->XScroll;
+		lbg->YScroll = bg->YScroll;
+		lbg->Size = bg->Size;
+		lbg->WindowMask = bg->WindowMask;
+		lbg->WindowCombine = bg->WindowCombine;
+		lbg->Plane = PPU_GetBGPlane(i, line);
+	}
+	
+	PPU_WindowSegment* s = &PPU.Window[0];
+	PPU_WindowSegment* d = &st->Window[0];
+	for (;;)
+	{
+		*d = *s;
+		if (s->EndOffset >= 256) break;
+		s++; d++;
+	}
 	
-	if (screen & 0x01) PPU_RenderBG_Mode7(buf, line, &PPU.Palette[0], COLMATH(0), (screen&0x100));
+	st->OBJWidth = PPU.OBJWidth;
+	st->OBJTileset = PPU.OBJTileset;
+	st->OBJWindowMask = PPU.OBJWindowMask;
+	st->OBJWindowCombine = PPU.OBJWindowCombine;
 	
-	if (screen & 0x10)
+	if ((PPU.Mode & 0x07) == 7)
 	{
-		PPU_RenderOBJs(buf, line, 0x1000, COLMATH_OBJ, (screen&0x1000));
-		PPU_RenderOBJs(buf, line, 0x2000, COLMATH_OBJ, (screen&0x1000));
-		PPU_RenderOBJs(buf, line, 0x3000, COLMATH_OBJ, (screen&0x1000));
+		st->M7Sel = PPU.M7Sel;
+		st->M7A = PPU.M7A;
+		st->M7B = PPU.M7B;
+		st->M7C = PPU.M7C;
+		st->M7D = PPU.M7D;
+		st->M7RefX = PPU.M7RefX;
+		st->M7RefY = PPU.M7RefY;
+		st->M7XScroll = PPU.M7XScroll;
+		st->M7YScroll = PPU.M7YScroll;
 	}
+	
+	st->MainBuffer = PPU.MainBuffer;
+	st->Frame = PPU_FrameNum;
+	
+	st->VRAM = PPU.VRAM;
+	st->OAM = PPU.OAM;
+	st->OBJInfos = PPU_OBJInfos;
+	st->OBJList = PPU_OBJList;
+	st->OBJListStart = PPU_OBJListStart;
+}
+
+// points a line at the frame's copy of VRAM and OAM
+static void PPU_UseFrameCopy(PPU_LineState* st, PPU_FrameCopy* c)
+{
+	int i;
+	
+	// the planes are for what's in PPU.VRAM
+	for (i = 0; i < 4; i++)
+	{
+		st->BG[i].Tilemap = (u16*)&c->VRAM[(u8*)st->BG[i].Tilemap - PPU.VRAM];
+		st->BG[i].Plane = NULL;
+	}
+	
+	st->VRAM = c->VRAM;
+	st->OAM = c->OAM;
+	st->OBJInfos = c->OBJInfos;
+	st->OBJList = c->OBJList;
+	st->OBJListStart = c->OBJListStart;
+}
+
+// takes the next queued line before 'end' and draws it
+// returns 0 if there was nothing left
+static int PPU_RenderQueuedLine(PPU_LineContext* ctx, u32 end)
+{
+	u32 n = PPU_LinesTaken;
+	if ((s32)(end - n) <= 0) return 0;
+	
+	// has to be visible before the line is taken, see PPU_CopyForFrame()
+	ctx->Drawing = n;
+	__sync_synchronize();
+	
+	// another thread got it first
+	if (!__sync_bool_compare_and_swap(&PPU_LinesTaken, n, n+1))
+	{
+		ctx->Drawing = LINE_NONE;
+		return 1;
+	}
+	
+	PPU_LineState* st = &PPU_LineQueue[n & (LINEQUEUE_SIZE-1)];
+	u32 frame = st->Frame;
+	
+	if (frame == PPU_CopyFrame)
+		PPU_UseFrameCopy(st, PPU_Copy);
+	
+	PPU_RenderLine(st, ctx);
+	ctx->Drawing = LINE_NONE;
+	
+	if (!__sync_sub_and_fetch(&PPU_FrameLines[frame & 1], 1) && PPU_WaitingForLines)
+		svcSignalEvent(PPU_LinesDone);
+	
+	return 1;
+}
+
+void PPU_RenderThread(u32 num)
+{
+	PPU_LineContext* ctx = &PPU_ThreadContexts[num];
+	
+	for (;;)
+	{
+		if (PPU_RenderQueuedLine(ctx, PPU_LinesQueued)) continue;
+	
+		// clear first so a line queued right after the check still wakes us up
+		svcClearEvent(PPU_LinesReady);
+		if (PPU_RenderQueuedLine(ctx, PPU_LinesQueued)) continue;
+		if (PPU_ExitThreads) break;
+	
+		svcWaitSynchronization(PPU_LinesReady, U64_MAX);
+	}
+	
+	svcExitThread();
+}
+
+static inline int PPU_LinesLeft(u32 frames)
+{
+	return ((frames & 1) && PPU_FrameLines[0]) || ((frames & 2) && PPU_FrameLines[1]);
+}
+
+// waits till the lines of the given frames (bit0: even, bit1: odd) are drawn,
+// and helps with the ones queued before 'end' meanwhile
+static void PPU_WaitForLines(u32 end, u32 frames)
+{
+	if (PPU_NumThreads) svcSignalEvent(PPU_LinesReady);
+	
+	while (PPU_RenderQueuedLine(&PPU_MainContext, end));
+	
+	PPU_WaitingForLines = 1;
+	while (PPU_LinesLeft(frames))
+	{
+		svcClearEvent(PPU_LinesDone);
+		__sync_synchronize();
+		if (!PPU_LinesLeft(frames)) break;
+	
+		svcWaitSynchronization(PPU_LinesDone, U64_MAX);
+	}
+	PPU_WaitingForLines = 0;
+}
+
+// waits till every queued line is drawn
+void PPU_FinishLines_Soft()
+{
+	PPU_WaitForLines(PPU_LinesQueued, 3);
+	PPU_LinesPending = 0;
+	
+	// nothing in flight, the palettes can start over
+	PPU_NumPalettes = 0;
+	PPU_CurPalette = NULL;
+}
+
+// gives the frame that's left to the threads its own copy of VRAM, OAM and
+// the sprite lists, so they can change
+static void PPU_CopyForFrame()
+{
+	PPU_FrameCopy* c = PPU_Copy;
+	int i;
+	
+	memcpy(c->VRAM, PPU.VRAM, sizeof(c->VRAM));
+	memcpy(c->OAM, PPU.OAM, sizeof(c->OAM));
+	memcpy(c->OBJInfos, PPU_OBJInfos, sizeof(c->OBJInfos));
+	memcpy(c->OBJListStart, PPU_OBJListStart, sizeof(c->OBJListStart));
+	memcpy(c->OBJList, PPU_OBJList, PPU_OBJListStart[OBJLIST_LINES] * 2);
+	
+	__sync_synchronize();
+	PPU_CopyFrame = PPU_DetachedNum;
+	__sync_synchronize();
+	
+	// the lines that were taken before that still read the real ones
+	for (i = 0; i < PPU_NumThreads; i++)
+	{
+		u32 line = PPU_ThreadContexts[i].Drawing;
+		if (line == LINE_NONE) continue;
+	
+		while (PPU_ThreadContexts[i].Drawing == line);
+	}
+}
+
+// PPU_SYNC_SOFT(): VRAM or OAM are about to change
+void PPU_SyncLines_Soft()
+{
+	// lines from this frame: they have to be drawn first
+	if (!PPU_Detached || PPU_LinesQueued != PPU_FrameStart)
+	{
+		PPU_FinishLines_Soft();
+		return;
+	}
+	
+	// only the last frame's, which gets its copy unless it's done already
+	if (PPU_FrameLines[PPU_DetachedNum & 1])
+		PPU_CopyForFrame();
+	
+	PPU_LinesPending = 0;
+}
+
+static void PPU_StopPipeline()
+{
+	if (!PPU_Pipelined) return;
+	
+	// the frame that was left over is dropped
+	PPU_Detached = 0;
+	PPU_CopyFrame = 0xFFFFFFFF;
+	
+	PPU.MainBuffer = PPU_FrameBuffers[0];
+	PPU.SubBuffer = &PPU.MainBuffer[256*256];
+	linearFree(PPU_FrameBuffers[1]);
+	linearFree(PPU_FrameBuffers[2]);
+	MemFree(PPU_Copy);
+	PPU_Copy = NULL;
+	
+	PPU_Pipelined = 0;
+}
+
+static void PPU_StartPipeline()
+{
+	PPU_FrameBuffers[0] = PPU.MainBuffer;
+	PPU_FrameBuffers[1] = (u16*)linearAlloc(256*512*2);
+	PPU_FrameBuffers[2] = (u16*)linearAlloc(256*512*2);
+	PPU_Copy = (PPU_FrameCopy*)MemAlloc(sizeof(PPU_FrameCopy));
+	
+	if (!PPU_FrameBuffers[1] || !PPU_FrameBuffers[2] || !PPU_Copy)
+	{
+		bprintf("Not enough memory for frame pipelining\n");
+		if (PPU_FrameBuffers[1]) linearFree(PPU_FrameBuffers[1]);
+		if (PPU_FrameBuffers[2]) linearFree(PPU_FrameBuffers[2]);
+		if (PPU_Copy) MemFree(PPU_Copy);
+		PPU_Copy = NULL;
+		return;
+	}
+	
+	PPU_CurBuffer = 0;
+	PPU_Pipelined = 1;
+}
+
+// the cores the threads go to: the New 3DS's extra core, then the syscore
+// (shared with the SPC700 thread)
+const s32 PPU_ThreadCores[RENDER_THREADS_MAX] = {2, 1, 3};
+
+// pipelining needs the threads, it's ignored without them
+void PPU_SetRenderThreads_Soft(int num, int pipeline)
+{
+	int i;
+	Result res;
+	
+	if (num < 0) num = 0;
+	if (num > RENDER_THREADS_MAX) num = RENDER_THREADS_MAX;
+	if (!num) pipeline = 0;
+	if (num == PPU_NumThreads && (pipeline != 0) == PPU_Pipelined) return;
+	
+	if (PPU_NumThreads)
+	{
+		PPU_FinishLines_Soft();
+		PPU_StopPipeline();
+	
+		PPU_ExitThreads = 1;
+		svcSignalEvent(PPU_LinesReady);
+		for (i = 0; i < PPU_NumThreads; i++)
+		{
+			svcWaitSynchronization(PPU_Threads[i], U64_MAX);
+			svcCloseHandle(PPU_Threads[i]);
+		}
+		PPU_ExitThreads = 0;
+	
+		svcCloseHandle(PPU_LinesReady);
+		svcCloseHandle(PPU_LinesDone);
+		MemFree(PPU_PalettePool);
+		PPU_PalettePool = NULL;
+		PPU_NumThreads = 0;
+	}
+	
+	if (!num) return;
+	
+	PPU_PalettePool = (u16*)MemAlloc(2*240*256*2);
+	if (!PPU_PalettePool) return;
+	
+	svcCreateEvent(&PPU_LinesReady, 1);
+	svcCreateEvent(&PPU_LinesDone, 1);
+	
+	for (i = 0; i < num; i++)
+	{
+		PPU_ThreadContexts[i].Drawing = LINE_NONE;
+	
+		res = svcCreateThread(&PPU_Threads[i], PPU_RenderThread, i, (u32*)(PPU_ThreadStacks[i]+0x4000), 0x18, PPU_ThreadCores[i]);
+		if (res)
+		{
+			bprintf("Failed to create render thread %d:\n -> %08X\n", i, res);
+			break;
+		}
+	}
+	
+	PPU_NumThreads = i;
+	if (!PPU_NumThreads)
+	{
+		svcCloseHandle(PPU_LinesReady);
+		svcCloseHandle(PPU_LinesDone);
+		MemFree(PPU_PalettePool);
+		PPU_PalettePool = NULL;
+		return;
+	}
+	
+	if (pipeline) PPU_StartPipeline();
 }
 
 
@@ -1262,22 +2104,17 @@ void PPU_RenderScanline_Soft(u32 line)
 {
 	if ((!line) || PPU.ColorEffectDirty)
 	{
-		PPU_ColorEffectSection* s;
 		if (!line)
 		{
-			PPU.CurColorEffect = &PPU.ColorEffectSections[0];
-			s = PPU.CurColorEffect;
+			PPU_ClearSectionLog();
+			PPU_FIRSTSECTION(PPU.ColorEffectSections, PPU.CurColorEffect);
 		}
 		else
-		{
-			s = PPU.CurColorEffect;
-			s->EndOffset = line;
-			s++;
-		}
-		
+			PPU_NEXTSECTION(PPU.CurColorEffect, line);
+	
+		PPU_ColorEffectSection* s = PPU.CurColorEffect;
 		s->ColorMath = (PPU.ColorMath2 & 0x80);
 		s->Brightness = PPU.CurBrightness;
-		PPU.CurColorEffect = s;
 		PPU.ColorEffectDirty = 0;
 	}
 	
@@ -1290,109 +2127,69 @@ void PPU_RenderScanline_Soft(u32 line)
 		PPU.WindowDirty = 0;
 	}
 	
-	int i;
-	u16* mbuf = &PPU.MainBuffer[(255-line) << 8];
-	u16* sbuf = &PPU.SubBuffer[(255-line) << 8];
-	
-	// main backdrop
-	u32 backdrop = PPU.Palette[0];
-	if (PPU.ColorMath2 & 0x20)
+	// the sprite lists and the sprite limit stay on this thread
+	if ((PPU.MainScreen|PPU.SubScreen) & 0x10)
 	{
-		PPU_WindowSegment* s = &PPU.Window[0];
-		i = 0;
-		for (;;)
+		if (PPU.OBJListDirty)
 		{
-			u32 alpha = (PPU.ColorMath1 & s->ColorMath) ? 0:1;
-			while (i < s->EndOffset)
-				mbuf[i++] = backdrop|alpha;
-			
-			if (s->EndOffset >= 256) break;
-			s++;
+			PPU_SYNC_SOFT();
+			PPU_BuildOBJList();
 		}
-	}
-	else
-	{
-		backdrop |= (backdrop << 16);
-		for (i = 0; i < 256; i += 2)
-			*(u32*)&mbuf[i] = backdrop;
-	}
 	
-	// sub backdrop
-	backdrop = PPU.SubBackdrop;
-	backdrop |= (backdrop << 16);
-	for (i = 0; i < 256; i += 2)
-		*(u32*)&sbuf[i] = backdrop;
+		PPU_CheckOBJOverflow(line);
+	}
 	
-	for (i = 16; i < 272; i += 2)
-		*(u32*)&PPU.OBJBuffer[i] = 0xFFFFFFFF;
-		
-	*(u32*)&PPU.SpritesOnLine[0] = 0;
+	if (PPU_NumThreads)
+	{
+		PPU_GetLineState(&PPU_LineQueue[PPU_LinesQueued & (LINEQUEUE_SIZE-1)], line);
+		__sync_add_and_fetch(&PPU_FrameLines[PPU_FrameNum & 1], 1);
+		PPU_LinesPending = 1;
 	
+		__sync_synchronize();
+		PPU_LinesQueued++;
 	
-	if ((PPU.MainScreen|PPU.SubScreen) & 0x10)
-		PPU_PrerenderOBJs(&PPU.OBJBuffer[16], line);
-		
-	u8 colormathmain, colormathsub, rendersub;
-	if ((PPU.ColorMath1 & 0x30) == 0x30) // color math completely disabled
-	{
-		colormathmain = 0;
-		rendersub = 0;
+		// wake the threads up every 8 lines, they keep going on their own meanwhile
+		if (!(PPU_LinesQueued & 7))
+			svcSignalEvent(PPU_LinesReady);
 	}
 	else
 	{
-		colormathmain = PPU.ColorMath2 & 0x0F;
-		if (PPU.ColorMath2 & 0x10) colormathmain |= 0x40;
-		colormathsub = (PPU.ColorMath2 & 0x40) ? 0:0xFF;
-		rendersub = (PPU.ColorMath1 & 0x02);
-	}
-	
-	switch (PPU.Mode & 0x07)
-	{
-		case 0:
-			if (rendersub)
-				PPU_RenderMode0(sbuf, line, PPU.SubScreen, colormathsub);
-			PPU_RenderMode0(mbuf, line, PPU.MainScreen, colormathmain);
-			break;
-			
-		case 1:
-			if (rendersub)
-				PPU_RenderMode1(sbuf, line, PPU.SubScreen, colormathsub);
-			PPU_RenderMode1(mbuf, line, PPU.MainScreen, colormathmain);
-			break;
-		
-		case 2:
-			if (rendersub)
-				PPU_RenderMode2(sbuf, line, PPU.SubScreen, colormathsub);
-			PPU_RenderMode2(mbuf, line, PPU.MainScreen, colormathmain);
-			break;
-			
-		case 3:
-			if (rendersub)
-				PPU_RenderMode3(sbuf, line, PPU.SubScreen, colormathsub);
-			PPU_RenderMode3(mbuf, line, PPU.MainScreen, colormathmain);
-			break;
-			
-		case 4:
-			if (rendersub)
-				PPU_RenderMode4(sbuf, line, PPU.SubScreen, colormathsub);
-			PPU_RenderMode4(mbuf, line, PPU.MainScreen, colormathmain);
-			break;
-			
-		// TODO: mode 5/6 (hires)
-		
-		case 7:
-			if (rendersub)
-				PPU_RenderMode7(sbuf, line, PPU.SubScreen, colormathsub);
-			PPU_RenderMode7(mbuf, line, PPU.MainScreen, colormathmain);
-			break;
+		PPU_LineState st;
+		PPU_GetLineState(&st, line);
+		PPU_RenderLine(&st, &PPU_MainContext);
 	}
-	
-	// that's all folks.
-	// color math and master brightness will be done in hardware from now on
 }
 
 
-void PPU_BlendScreens(u32 colorformat)
+#ifdef _3DS
+
+// the texture env stages are set per section, for the color math
+static const bglStateBlock PPU_BlendState = 
+{
+	.ScissorMode = GPU_SCISSOR_DISABLE,
+	
+	.DepthTest = false,
+	.DepthFunc = GPU_GREATER,
+	.ColorDepthMask = GPU_WRITE_COLOR,
+	
+	.StencilTest = false,
+	.StencilFunc = GPU_EQUAL, .StencilRef = 0x00, .StencilMask = 0xFF, .StencilReplace = 0xFF,
+	.StencilOp = {GPU_STENCIL_KEEP, GPU_STENCIL_KEEP, GPU_STENCIL_KEEP},
+	
+	.AlphaTest = false,
+	.AlphaFunc = GPU_GREATER, .AlphaRef = 0,
+	
+	.BlendEquation = {GPU_BLEND_ADD, GPU_BLEND_ADD},
+	.BlendFunc = {GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO},
+	
+	.TextureEnable = GPU_TEXUNIT0|GPU_TEXUNIT1,
+	.NumTexEnvs = 0,
+	
+	.NumAttribs = 2,
+	.Attrib = {{GPU_SHORT, 2}, {GPU_SHORT, 2}},	// vertex, texcoord
+};
+
+void PPU_BlendScreens(u32 colorformat, PPU_ColorEffectSection* s)
 {
 	int startoffset = 1;
 	
@@ -1404,27 +2201,19 @@ void PPU_BlendScreens(u32 colorformat)
 	bglOutputBuffers(SNESFrame, gpuDOut); // depth buffer doesn't matter
 	bglViewport(0, 0, 256, 256);
 	
-	bglEnableDepthTest(false);
-	bglColorDepthMask(GPU_WRITE_COLOR);
-	bglEnableAlphaTest(false);
+	bglApplyState(&PPU_BlendState);
 
 	bglUniformMatrix(GPU_VERTEX_SHADER, 0, snesProjMatrix);
 	
-	bglEnableTextures(GPU_TEXUNIT0|GPU_TEXUNIT1);
 	bglTexImage(GPU_TEXUNIT0, MainScreenTex,256,256,0,colorformat);
 	bglTexImage(GPU_TEXUNIT1, SubScreenTex,256,256,0,colorformat);
 	
-	bglNumAttribs(2);
-	bglAttribType(0, GPU_SHORT, 2);	// vertex
-	bglAttribType(1, GPU_SHORT, 2);	// texcoord
-	
 #define ADDVERTEX(x, y, s, t) \
 	*vptr++ = x; \
 	*vptr++ = y; \
 	*vptr++ = s; \
 	*vptr++ = t;
 	
-	PPU_ColorEffectSection* s = &PPU.ColorEffectSections[0];
 	for (;;)
 	{
 		// TEXTURE ENV STAGES
@@ -1526,27 +2315,88 @@ void PPU_BlendScreens(u32 colorformat)
 		if (s->EndOffset == 240) break;
 		
 		startoffset = s->EndOffset;
-		s++;
+		s = s->Next;
 	}
 	
 #undef ADDVERTEX
 }
 
+#endif
+
 	
 
-void PPU_VBlank_Soft()
+// the frame's color effect sections, out of the section log that the next
+// frame is going to reuse
+static void PPU_CopyColorEffects(PPU_ColorEffectSection* dst, PPU_ColorEffectSection* src)
+{
+	for (;;)
+	{
+		*dst = *src;
+		if (src->EndOffset >= 240) break;
+	
+		dst->Next = dst + 1;
+		dst++;
+		src = src->Next;
+	}
+}
+
+// sends a frame to the GPU, which does the color math and brightness
+static void PPU_ShowFrame(u16* buffer, PPU_ColorEffectSection* coloreffects)
 {
+#ifdef _3DS
 	// copy new screen textures
 	// SetDisplayTransfer with flags=2 converts linear graphics to the tiled format used for textures
 	// since the two sets of buffers are contiguous, we can transfer them as one 256x512 texture
-	GSPGPU_FlushDataCache(NULL, (u8*)PPU.MainBuffer, 256*512*2);
-	GX_SetDisplayTransfer(NULL, (u32*)PPU.MainBuffer, 0x02000100, (u32*)MainScreenTex, 0x02000100, 0x3302);
-	
-	PPU.CurColorEffect->EndOffset = 240;
+	GSPGPU_FlushDataCache(NULL, (u8*)buffer, 256*512*2);
+	GX_SetDisplayTransfer(NULL, (u32*)buffer, 0x02000100, (u32*)MainScreenTex, 0x02000100, 0x3302);
 	
 	vertexPtr = vertexBuf;
 	
-	PPU_BlendScreens(GPU_RGBA5551);
+	PPU_BlendScreens(GPU_RGBA5551, coloreffects);
 	
 	RenderState = 3;
+#endif
+}
+
+void PPU_VBlank_Soft()
+{
+	PPU.CurColorEffect->EndOffset = 240;
+	
+	if (!PPU_Pipelined)
+	{
+		if (PPU_LinesPending) PPU_FinishLines_Soft();
+		PPU_ShowFrame(PPU.MainBuffer, PPU.ColorEffectSections);
+	}
+	else
+	{
+		// the last frame goes to the GPU, and this one is left to the threads
+		if (PPU_Detached)
+		{
+			PPU_WaitForLines(PPU_FrameStart, 1 << (PPU_DetachedNum & 1));
+			PPU_ShowFrame(PPU_DetachedBuffer, PPU_DetachedColorEffects);
+		}
+	
+		PPU_CopyColorEffects(PPU_DetachedColorEffects, PPU.ColorEffectSections);
+		PPU_DetachedBuffer = PPU.MainBuffer;
+		PPU_DetachedNum = PPU_FrameNum;
+		PPU_Detached = 1;
+		if (!PPU_FrameLines[PPU_FrameNum & 1]) PPU_LinesPending = 0;
+		svcSignalEvent(PPU_LinesReady);
+	
+		PPU_CurBuffer = (PPU_CurBuffer + 1) % 3;
+		PPU.MainBuffer = PPU_FrameBuffers[PPU_CurBuffer];
+		PPU.SubBuffer = &PPU.MainBuffer[256*256];
+	}
+	
+	PPU_FrameNum++;
+	PPU_FrameStart = PPU_LinesQueued;
+	PPU_NumPalettes = 0;
+	PPU_CurPalette = NULL;
+}
+
+// the last complete frame (pipelined, PPU.MainBuffer is the one in progress)
+u16* PPU_LastFrame_Soft()
+{
+	PPU_FinishLines_Soft();
+	return PPU_Detached ? PPU_DetachedBuffer : PPU.MainBuffer;
 }
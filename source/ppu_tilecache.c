@@ -0,0 +1,1011 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY 
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along 
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include <3ds.h>
+
+#include "mem.h"
+#include "snes.h"
+#include "ppu.h"
+#include "main.h"
+#include "timing.h"
+
+
+// the hard renderer's tile cache:
+// 1024x1024 RGBA5551 texture (2 MB)
+// -> can hold 16384 tiles
+// CLOCK replacement: each slot has a reference bit that's set when the tile
+// is used, and the hand goes around skipping (and clearing) the slots that
+// have it set. so tiles that are used all the time (status bar, font) stay
+// while the hand goes past them
+
+// tile is recognized by:
+// * absolute address
+// * type (color depth, normal/hires)
+// * palette #
+
+// maps needed:
+// * tile key (addr/type/pal) -> u/v in tilecache texture
+// * u/v (tilecache index) -> tile key (for removing tiles from the cache)
+// * VRAM address -> dirty flag (for VRAM updates)
+// * palette offset -> dirty flag (for palette updates)
+
+// each tile is also kept as color #s (in the same order as in the texture),
+// so that when only its palette changed it's just recolored from those
+// instead of being decoded again. the GPU can't do the palette lookup itself
+// (no dependent texture reads), so the texture stays RGBA5551
+//
+// the rows of the texture (128 tiles, 16K each) that were written to are
+// marked dirty, and only those are flushed from the data cache at the end
+// of the frame
+//
+// none of this talks to the GPU, so it can be built on the host (host/tilecachebench.c)
+
+
+u16* PPU_TileCache;
+u32 PPU_TileCacheIndex;	// the clock hand
+
+u16 PPU_TileCacheList[0x20000];
+u32 PPU_TileCacheReverseList[16384];
+u8 PPU_TileCacheRef[16384];
+u8 PPU_TileColors[16384 * 64];
+u32 PPU_TileCacheDirty[4];	// one bit per texture row
+
+PPU_Mode7Plane PPU_Mode7Planes[2];	// BG1 (or the only one), BG2 with EXTBG
+PPU_HardBGPlane PPU_BGPlanes_Hard[4];
+u32 PPU_BGPlaneFrame = 0;	// goes up with every PPU_FlushTileCache()
+
+u32 PPU_TileVRAMUpdate[0x20000];
+u32 PPU_TilePalUpdate[0x20000];
+
+
+void PPU_InitTileCache()
+{
+	int i;
+	
+	PPU_TileCache = (u16*)linearAlloc(1024*1024*sizeof(u16));
+	PPU_TileCacheIndex = 0;
+	
+	for (i = 0; i < 0x20000; i++)
+	{
+		PPU_TileCacheList[i] = 0x8000;
+		PPU_TileVRAMUpdate[i] = 0;
+		PPU_TilePalUpdate[i] = 0;
+	}
+	
+	for (i = 0; i < 16384; i++)
+	{
+		PPU_TileCacheReverseList[i] = 0x80000000;
+		PPU_TileCacheRef[i] = 0;
+	}
+		
+	for (i = 0; i < 1024*1024; i++)
+		PPU_TileCache[i] = 0xF800;
+	
+	// the whole thing goes out the first time
+	for (i = 0; i < 4; i++)
+		PPU_TileCacheDirty[i] = 0xFFFFFFFF;
+	
+	for (i = 0; i < 4; i++)
+	{
+		PPU_BGPlanes_Hard[i].Type = 0xFF;
+		PPU_BGPlanes_Hard[i].Frame = 0xFFFFFFFF;
+	}
+}
+
+void PPU_DeInitTileCache()
+{
+	int i;
+	
+	linearFree(PPU_TileCache);
+	
+	for (i = 0; i < 2; i++)
+	{
+		if (PPU_Mode7Planes[i].Pixels) linearFree(PPU_Mode7Planes[i].Pixels);
+		PPU_Mode7Planes[i].Pixels = NULL;
+	}
+	
+	for (i = 0; i < 4; i++)
+	{
+		if (PPU_BGPlanes_Hard[i].Pixels) linearFree(PPU_BGPlanes_Hard[i].Pixels);
+		PPU_BGPlanes_Hard[i].Pixels = NULL;
+		PPU_BGPlanes_Hard[i].Alloc = 0;
+	}
+}
+
+
+// tile decoding, to color #s
+// note: tiles are directly converted to PICA200 tiles (zcurve)
+
+static u32 PPU_DecodeTile_2bpp(u16* vram, u32* dst)
+{
+	int i;
+	u8 p1, p2, p3, p4;
+	u32 nonzero = 0;
+	
+#define DO_MINIBLOCK(l1, l2) \
+	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
+	if (l2 & 0x0080) p1 |= 0x01; \
+	if (l2 & 0x8000) p1 |= 0x02; \
+	if (l2 & 0x0040) p2 |= 0x01; \
+	if (l2 & 0x4000) p2 |= 0x02; \
+	l2 <<= 2; \
+	if (l1 & 0x0080) p3 |= 0x01; \
+	if (l1 & 0x8000) p3 |= 0x02; \
+	if (l1 & 0x0040) p4 |= 0x01; \
+	if (l1 & 0x4000) p4 |= 0x02; \
+	l1 <<= 2; \
+	*dst++ = p1 | (p2 << 8) | (p3 << 16) | (p4 << 24);
+	
+	for (i = 4; i >= 0; i -= 4)
+	{
+		u16 line1 = vram[i+0];
+		u16 line2 = vram[i+1];
+		u16 line3 = vram[i+2];
+		u16 line4 = vram[i+3];
+		
+		nonzero |= line1 | line2 | line3 | line4;
+		
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line1, line2);
+	}
+	
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+static u32 PPU_DecodeTile_4bpp(u16* vram, u32* dst)
+{
+	int i;
+	u8 p1, p2, p3, p4;
+	u32 nonzero = 0;
+	
+#define DO_MINIBLOCK(l1, l2) \
+	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
+	if (l2 & 0x00000080) p1 |= 0x01; \
+	if (l2 & 0x00008000) p1 |= 0x02; \
+	if (l2 & 0x00800000) p1 |= 0x04; \
+	if (l2 & 0x80000000) p1 |= 0x08; \
+	if (l2 & 0x00000040) p2 |= 0x01; \
+	if (l2 & 0x00004000) p2 |= 0x02; \
+	if (l2 & 0x00400000) p2 |= 0x04; \
+	if (l2 & 0x40000000) p2 |= 0x08; \
+	l2 <<= 2; \
+	if (l1 & 0x00000080) p3 |= 0x01; \
+	if (l1 & 0x00008000) p3 |= 0x02; \
+	if (l1 & 0x00800000) p3 |= 0x04; \
+	if (l1 & 0x80000000) p3 |= 0x08; \
+	if (l1 & 0x00000040) p4 |= 0x01; \
+	if (l1 & 0x00004000) p4 |= 0x02; \
+	if (l1 & 0x00400000) p4 |= 0x04; \
+	if (l1 & 0x40000000) p4 |= 0x08; \
+	l1 <<= 2; \
+	*dst++ = p1 | (p2 << 8) | (p3 << 16) | (p4 << 24);
+	
+	for (i = 4; i >= 0; i -= 4)
+	{
+		u32 line1 = vram[i+0] | (vram[i+8 ] << 16);
+		u32 line2 = vram[i+1] | (vram[i+9 ] << 16);
+		u32 line3 = vram[i+2] | (vram[i+10] << 16);
+		u32 line4 = vram[i+3] | (vram[i+11] << 16);
+		
+		nonzero |= line1 | line2 | line3 | line4;
+		
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line3, line4);
+		DO_MINIBLOCK(line1, line2);
+		DO_MINIBLOCK(line1, line2);
+	}
+	
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+static u32 PPU_DecodeTile_8bpp(u16* vram, u32* dst)
+{
+	int i;
+	u8 p1, p2, p3, p4;
+	u32 nonzero = 0;
+	
+#define DO_MINIBLOCK(l11, l12, l21, l22) \
+	p1 = 0; p2 = 0; p3 = 0; p4 = 0; \
+	if (l21 & 0x00000080) p1 |= 0x01; \
+	if (l21 & 0x00008000) p1 |= 0x02; \
+	if (l21 & 0x00800000) p1 |= 0x04; \
+	if (l21 & 0x80000000) p1 |= 0x08; \
+	if (l22 & 0x00000080) p1 |= 0x10; \
+	if (l22 & 0x00008000) p1 |= 0x20; \
+	if (l22 & 0x00800000) p1 |= 0x40; \
+	if (l22 & 0x80000000) p1 |= 0x80; \
+	if (l21 & 0x00000040) p2 |= 0x01; \
+	if (l21 & 0x00004000) p2 |= 0x02; \
+	if (l21 & 0x00400000) p2 |= 0x04; \
+	if (l21 & 0x40000000) p2 |= 0x08; \
+	if (l22 & 0x00000040) p2 |= 0x10; \
+	if (l22 & 0x00004000) p2 |= 0x20; \
+	if (l22 & 0x00400000) p2 |= 0x40; \
+	if (l22 & 0x40000000) p2 |= 0x80; \
+	l21 <<= 2; l22 <<= 2; \
+	if (l11 & 0x00000080) p3 |= 0x01; \
+	if (l11 & 0x00008000) p3 |= 0x02; \
+	if (l11 & 0x00800000) p3 |= 0x04; \
+	if (l11 & 0x80000000) p3 |= 0x08; \
+	if (l12 & 0x00000080) p3 |= 0x10; \
+	if (l12 & 0x00008000) p3 |= 0x20; \
+	if (l12 & 0x00800000) p3 |= 0x40; \
+	if (l12 & 0x80000000) p3 |= 0x80; \
+	if (l11 & 0x00000040) p4 |= 0x01; \
+	if (l11 & 0x00004000) p4 |= 0x02; \
+	if (l11 & 0x00400000) p4 |= 0x04; \
+	if (l11 & 0x40000000) p4 |= 0x08; \
+	if (l12 & 0x00000040) p4 |= 0x10; \
+	if (l12 & 0x00004000) p4 |= 0x20; \
+	if (l12 & 0x00400000) p4 |= 0x40; \
+	if (l12 & 0x40000000) p4 |= 0x80; \
+	l11 <<= 2; l12 <<= 2; \
+	*dst++ = p1 | (p2 << 8) | (p3 << 16) | (p4 << 24);
+	
+	for (i = 4; i >= 0; i -= 4)
+	{
+		u32 line11 = vram[i+0 ] | (vram[i+8 ] << 16);
+		u32 line12 = vram[i+16] | (vram[i+24] << 16);
+		u32 line21 = vram[i+1 ] | (vram[i+9 ] << 16);
+		u32 line22 = vram[i+17] | (vram[i+25] << 16);
+		u32 line31 = vram[i+2 ] | (vram[i+10] << 16);
+		u32 line32 = vram[i+18] | (vram[i+26] << 16);
+		u32 line41 = vram[i+3 ] | (vram[i+11] << 16);
+		u32 line42 = vram[i+19] | (vram[i+27] << 16);
+		
+		nonzero |= line11 | line21 | line31 | line41;
+		nonzero |= line12 | line22 | line32 | line42;
+		
+		DO_MINIBLOCK(line31, line32, line41, line42);
+		DO_MINIBLOCK(line31, line32, line41, line42);
+		DO_MINIBLOCK(line11, line12, line21, line22);
+		DO_MINIBLOCK(line11, line12, line21, line22);
+		DO_MINIBLOCK(line31, line32, line41, line42);
+		DO_MINIBLOCK(line31, line32, line41, line42);
+		DO_MINIBLOCK(line11, line12, line21, line22);
+		DO_MINIBLOCK(line11, line12, line21, line22);
+	}
+	
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+static u32 PPU_DecodeTile_8bpp_m7(u16* vram, u32* dst)
+{
+	int i;
+	u32 nonzero = 0;
+	
+// the pixels are bytes already
+#define DO_MINIBLOCK(block) \
+	*dst++ = block;
+	
+	for (i = 16; i >= 0; i -= 16)
+	{
+		u32 b1 = vram[i+12] | (vram[i+8 ] << 16);
+		u32 b2 = vram[i+13] | (vram[i+9 ] << 16);
+		u32 b3 = vram[i+4 ] | (vram[i+0 ] << 16);
+		u32 b4 = vram[i+5 ] | (vram[i+1 ] << 16);
+		u32 b5 = vram[i+14] | (vram[i+10] << 16);
+		u32 b6 = vram[i+15] | (vram[i+11] << 16);
+		u32 b7 = vram[i+6 ] | (vram[i+2 ] << 16);
+		u32 b8 = vram[i+7 ] | (vram[i+3 ] << 16);
+		
+		nonzero |= b1 | b2 | b3 | b4;
+		nonzero |= b5 | b6 | b7 | b8;
+		
+		DO_MINIBLOCK(b1);
+		DO_MINIBLOCK(b2);
+		DO_MINIBLOCK(b3);
+		DO_MINIBLOCK(b4);
+		DO_MINIBLOCK(b5);
+		DO_MINIBLOCK(b6);
+		DO_MINIBLOCK(b7);
+		DO_MINIBLOCK(b8);
+	}
+	
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+static u32 PPU_DecodeTile_8bpp_m7e(u16* vram, u32* dst, u32 prio)
+{
+	int i, j;
+	u32 nonzero = 0;
+	u32 block[8], tmp, tmp1;
+
+	if(!prio)
+		prio = 0x80808080;
+	else
+		prio = 0x00000000;
+	
+// the pixels are bytes already
+#define DO_MINIBLOCK(block) \
+	*dst++ = block;
+	
+	for (i = 16; i >= 0; i -= 16)
+	{
+		block[0] = vram[i+12] | (vram[i+8 ] << 16);
+		block[1] = vram[i+13] | (vram[i+9 ] << 16);
+		block[2] = vram[i+4 ] | (vram[i+0 ] << 16);
+		block[3] = vram[i+5 ] | (vram[i+1 ] << 16);
+		block[4] = vram[i+14] | (vram[i+10] << 16);
+		block[5] = vram[i+15] | (vram[i+11] << 16);
+		block[6] = vram[i+6 ] | (vram[i+2 ] << 16);
+		block[7] = vram[i+7 ] | (vram[i+3 ] << 16);
+
+		for(j = 0; j < 8; j++)
+		{
+			tmp = 0;
+			tmp1 = block[j] ^ prio;
+			if(tmp1 & 0x80000000)
+				tmp |= 0xFF000000;
+			if(tmp1 & 0x00800000)
+				tmp |= 0x00FF0000;
+			if(tmp1 & 0x00008000)
+				tmp |= 0x0000FF00;
+			if(tmp1 & 0x00000080)
+				tmp |= 0x000000FF;
+			tmp = block[j] & tmp;
+			
+			nonzero |= tmp;
+			DO_MINIBLOCK(tmp);
+		}
+	}
+	
+#undef DO_MINIBLOCK
+	return nonzero;
+}
+
+
+static u16* PPU_TilePalette(u32 type, u32 palid)
+{
+	switch (type)
+	{
+		case TILE_2BPP: return &PPU.Palette[palid << 2];
+		case TILE_4BPP: return &PPU.Palette[palid << 4];
+		case TILE_Mode7_1: return &PPU.PaletteEx1[0];
+		case TILE_Mode7_2: return &PPU.PaletteEx2[0];
+		default: return &PPU.Palette[0];
+	}
+}
+
+// color #s -> texture, color 0 is transparent
+static void PPU_ColorTile(u8* src, u16* pal, u16* dst)
+{
+	int i;
+	
+	for (i = 0; i < 64; i++)
+	{
+		u32 colorval = src[i];
+		dst[i] = colorval ? pal[colorval] : 0;
+	}
+}
+
+// slot # <-> coordinates in the cache texture (as given to the vertices)
+#define PPU_IDX2COORD(idx) (((idx) & 0x7F) | (0x7F00 - (((idx) & 0x3F80) << 1)))
+#define PPU_COORD2IDX(coord) (((coord) & 0x7F) | ((0x7F00 - ((coord) & 0x7F00)) >> 1))
+
+#define PPU_TILEDIRTY(idx) PPU_TileCacheDirty[(idx) >> 12] |= (1 << (((idx) >> 7) & 0x1F))
+
+// finds a slot for a new tile
+static u32 PPU_AllocTileSlot()
+{
+	for (;;)
+	{
+		u32 idx = PPU_TileCacheIndex;
+		PPU_TileCacheIndex = (idx + 1) & 0x3FFF;
+		
+		if (!PPU_TileCacheRef[idx]) return idx;
+		PPU_TileCacheRef[idx] = 0;
+	}
+}
+
+
+#ifdef TILECACHE_TRACE
+
+// records the tile lookups of the first frames to the SD, for host/tilecachebench.c
+// three words per lookup: key (bit31: the tile was decoded and was empty),
+// VRAM and palette stamps. a frame ends with FFFFFFFF,0,0
+
+#define TILETRACE_WORDS (3*0x80000)
+
+extern FS_archive sdmcArchive;
+
+u32* PPU_TileTrace = NULL;
+u32 PPU_TileTraceLen = 0;
+
+static u32* PPU_TraceTile(u32 key, u32 vramdirty, u32 paldirty)
+{
+	if (!PPU_TileTrace)
+	{
+		if (PPU_TileTraceLen) return NULL;
+		
+		PPU_TileTrace = (u32*)MemAlloc(TILETRACE_WORDS * 4);
+		if (!PPU_TileTrace)
+		{
+			PPU_TileTraceLen = 1;
+			return NULL;
+		}
+	}
+	
+	// room for a frame marker is always kept
+	if (PPU_TileTraceLen + 6 > TILETRACE_WORDS) return NULL;
+	
+	u32* ret = &PPU_TileTrace[PPU_TileTraceLen];
+	ret[0] = key;
+	ret[1] = vramdirty;
+	ret[2] = paldirty;
+	PPU_TileTraceLen += 3;
+	return ret;
+}
+
+void PPU_TraceFrame()
+{
+	if (!PPU_TileTrace) return;
+	
+	PPU_TileTrace[PPU_TileTraceLen++] = 0xFFFFFFFF;
+	PPU_TileTrace[PPU_TileTraceLen++] = 0;
+	PPU_TileTrace[PPU_TileTraceLen++] = 0;
+	
+	// once it's full it's saved, and that's it
+	if (PPU_TileTraceLen + 6 <= TILETRACE_WORDS) return;
+	
+	char* path = "/blargSnesTiles.bin";
+	Handle file;
+	FS_path filePath;
+	filePath.type = PATH_CHAR;
+	filePath.size = strlen(path) + 1;
+	filePath.data = (u8*)path;
+	
+	Result res = FSUSER_OpenFile(NULL, &file, sdmcArchive, filePath, FS_OPEN_CREATE|FS_OPEN_WRITE, FS_ATTRIBUTE_NONE);
+	if (!res)
+	{
+		u32 byteswritten = 0;
+		FSFILE_SetSize(file, (u64)(PPU_TileTraceLen * 4));
+		FSFILE_Write(file, &byteswritten, 0, PPU_TileTrace, PPU_TileTraceLen * 4, FS_WRITE_FLUSH);
+		FSFILE_Close(file);
+		bprintf("Tile trace saved to %s\n", path);
+	}
+	else
+		bprintf("Failed to save the tile trace:\n -> %08X\n", res);
+	
+	MemFree(PPU_TileTrace);
+	PPU_TileTrace = NULL;
+}
+
+#endif
+
+
+u32 PPU_StoreTileInCache(u32 type, u32 palid, u32 addr)
+{
+	u32 key;
+	u32 paldirty = 0;
+	u32 m7upper = 0;
+	u32 vramdirty = 0;
+	u32 nonzero = 0;
+	u32 isnew = 0;
+	u32 tempbuf[16];
+	
+	switch (type)
+	{
+		case TILE_2BPP: 
+			paldirty = PPU.PaletteUpdateCount[palid];
+			vramdirty = PPU.VRAMUpdateCount[addr >> 4];
+			break;
+			
+		case TILE_4BPP: 
+      paldirty = *(u32*)&PPU.PaletteUpdateCount[palid << 2];
+      vramdirty = *(u16*)&PPU.VRAMUpdateCount[addr >> 4];
+			break;
+			
+		case TILE_8BPP: 
+			paldirty = PPU.PaletteUpdateCount256;
+      vramdirty = *(u32*)&PPU.VRAMUpdateCount[addr >> 4];
+			break;
+
+		case TILE_Mode7:
+			paldirty = PPU.PaletteUpdateCount256;
+			vramdirty = PPU.VRAM7UpdateCount[addr >> 4];
+			break;
+
+		case TILE_Mode7_2:
+			m7upper = 1;
+		case TILE_Mode7_1:
+			paldirty = PPU.PaletteUpdateCount128;
+			vramdirty = PPU.VRAM7UpdateCount[addr >> 4];
+			break;
+
+		default:
+			bprintf("unknown tile type %d\n", type);
+			return 0xFFFF;
+	}
+	
+	key = (addr >> 4) | (palid << 12) | (m7upper << 16);
+	
+#ifdef TILECACHE_TRACE
+	u32* trace = PPU_TraceTile(key, vramdirty, paldirty);
+#endif
+	
+	u16 coord = PPU_TileCacheList[key];
+	u32 tileidx = 0;
+	
+	if (coord != 0x8000) // tile already exists
+	{
+		if (vramdirty == PPU_TileVRAMUpdate[key])
+		{
+			// if the VRAM hasn't been modified in the meantime, just return the old tile
+			// recolored if its palette changed. an empty tile stays empty
+			if (coord == 0xC000)
+			{
+				PPU_TilePalUpdate[key] = paldirty;
+				Timing_Counts[COUNT_TILEEMPTY]++;
+				return coord;
+			}
+			
+			tileidx = PPU_COORD2IDX(coord);
+			PPU_TileCacheRef[tileidx] = 1;
+			
+			if (paldirty == PPU_TilePalUpdate[key])
+			{
+				Timing_Counts[COUNT_TILEHIT]++;
+				return coord;
+			}
+			
+			PPU_ColorTile(&PPU_TileColors[tileidx * 64], PPU_TilePalette(type, palid), &PPU_TileCache[tileidx * 64]);
+			PPU_TILEDIRTY(tileidx);
+			PPU_TilePalUpdate[key] = paldirty;
+			Timing_Counts[COUNT_TILERECOLOR]++;
+			return coord;
+		}
+		
+		// an empty tile doesn't have a slot yet
+		if (coord == 0xC000)
+			isnew = 1;
+		else
+			tileidx = PPU_COORD2IDX(coord);
+	}
+	else
+		isnew = 1;
+	
+	Timing_Counts[COUNT_TILEMISS]++;
+	
+	switch (type)
+	{
+		case TILE_2BPP: nonzero = PPU_DecodeTile_2bpp((u16*)&PPU.VRAM[addr], tempbuf); break;
+		case TILE_4BPP: nonzero = PPU_DecodeTile_4bpp((u16*)&PPU.VRAM[addr], tempbuf); break;
+		
+		case TILE_8BPP: 
+			// TODO: direct color!
+			nonzero = PPU_DecodeTile_8bpp((u16*)&PPU.VRAM[addr], tempbuf); 
+			break;
+
+		case TILE_Mode7: nonzero = PPU_DecodeTile_8bpp_m7((u16*)&PPU.VRAM7[addr << 2], tempbuf);	break;
+		case TILE_Mode7_1: nonzero = PPU_DecodeTile_8bpp_m7e((u16*)&PPU.VRAM7[addr << 2], tempbuf, 0); break;
+		case TILE_Mode7_2: nonzero = PPU_DecodeTile_8bpp_m7e((u16*)&PPU.VRAM7[addr << 2], tempbuf, 1); break;
+	}
+	
+	PPU_TileVRAMUpdate[key] = vramdirty;
+	PPU_TilePalUpdate[key] = paldirty;
+	
+	if (!nonzero) // tile is empty - mark it as such
+	{
+#ifdef TILECACHE_TRACE
+		if (trace) *trace |= 0x80000000;
+#endif
+		coord = 0xC000;
+		PPU_TileCacheList[key] = coord;
+		
+		if (!isnew)
+		{
+			// its slot is free now
+			PPU_TileCacheReverseList[tileidx] = 0x80000000;
+			PPU_TileCacheRef[tileidx] = 0;
+		}
+	}
+	else
+	{
+		if (isnew)
+		{
+			tileidx = PPU_AllocTileSlot();
+			coord = PPU_IDX2COORD(tileidx);
+			PPU_TileCacheList[key] = coord;
+		}
+		
+		Timing_Counts[COUNT_TILEDECODE]++;
+		memcpy(&PPU_TileColors[tileidx * 64], tempbuf, 64);
+		PPU_ColorTile(&PPU_TileColors[tileidx * 64], PPU_TilePalette(type, palid), &PPU_TileCache[tileidx * 64]);
+		PPU_TILEDIRTY(tileidx);
+		
+		// invalidate previous tile if need be
+		u32 oldkey = PPU_TileCacheReverseList[tileidx];
+		PPU_TileCacheReverseList[tileidx] = key;
+		if (oldkey != key && oldkey != 0x80000000)
+		{
+			PPU_TileCacheList[oldkey] = 0x8000;
+			Timing_Counts[COUNT_TILEEVICT]++;
+		}
+		
+		PPU_TileCacheRef[tileidx] = 1;
+	}
+	
+	return coord;
+}
+
+
+// mode 7 planes: the whole 128x128 tile map as one 1024x1024 texture, so
+// that a mode 7 section is one quad. the map is laid out like the cache
+// (map tile x,y is where the cache's coord x,y would be), so the texcoords
+// are just the map coords / 1024
+// cells are only redrawn when their tilemap entry or their tile changed.
+// tiles go through the cache and are copied from there
+// a palette change doesn't redraw the plane: the tiles the map uses (256 at
+// most) are recolored through the cache and compared with what was copied
+// last time, only the cells of those that came out different are redrawn.
+// so sprite palettes changing, which bumps PaletteUpdateCount256 too, costs
+// a recolor and a compare per tile, not a redraw
+//
+// memory: 2 MB of linear memory per plane, on top of the 2 MB of the cache,
+// so up to 2x2 MB with EXTBG. and 32K of tile copies per plane
+
+// brings one tile of the plane up to date
+// returns 1 if it looks different from the last time
+static u32 PPU_FetchMode7PlaneTile(PPU_Mode7Plane* plane, u32 style, u32 tile)
+{
+	u16* dst = &plane->TilePixels[tile * 64];
+	u32 coord = PPU_StoreTileInCache(style, 0, tile << 4);
+	
+	if (coord == 0xC000)
+	{
+		u32 i;
+		for (i = 0; i < 64; i++)
+			if (dst[i]) break;
+		if (i == 64) return 0;
+		
+		memset(dst, 0, 64*sizeof(u16));
+		return 1;
+	}
+	
+	u16* src = &PPU_TileCache[PPU_COORD2IDX(coord) * 64];
+	if (!memcmp(dst, src, 64*sizeof(u16))) return 0;
+	
+	memcpy(dst, src, 64*sizeof(u16));
+	return 1;
+}
+
+u16* PPU_UpdateMode7Plane(u32 style)
+{
+	PPU_Mode7Plane* plane = &PPU_Mode7Planes[(style == TILE_Mode7_2) ? 1:0];
+	u32 paldirty = (style == TILE_Mode7) ? PPU.PaletteUpdateCount256 : PPU.PaletteUpdateCount128;
+	u8 fetched[256];
+	u8 stale[256];
+	u32 full, any, i, j;
+	
+	if (!plane->Pixels)
+	{
+		plane->Pixels = (u16*)linearAlloc(1024*1024*sizeof(u16));
+		if (!plane->Pixels) return NULL;
+		plane->Style = 0xFF;
+	}
+	
+	full = (style != plane->Style);
+	plane->Style = style;
+	
+	// which tiles changed
+	any = full;
+	for (i = 0; i < 256; i++)
+	{
+		fetched[i] = 0;
+		stale[i] = full;
+		
+		if (PPU.VRAM7UpdateCount[i] != plane->TileStamps[i])
+		{
+			plane->TileStamps[i] = PPU.VRAM7UpdateCount[i];
+			stale[i] = 1;
+			any = 1;
+		}
+	}
+	
+	// the palette changed: recolor the tiles the map uses, see which ones it
+	// actually changed
+	if (paldirty != plane->PalStamp)
+	{
+		plane->PalStamp = paldirty;
+		
+		if (!full)
+		{
+			u8 used[256];
+			memset(used, 0, sizeof(used));
+			for (j = 0; j < 128*128; j++)
+				used[plane->Tiles[j]] = 1;
+			
+			for (i = 0; i < 256; i++)
+			{
+				if (!used[i] || stale[i]) continue;
+				
+				fetched[i] = 1;
+				if (PPU_FetchMode7PlaneTile(plane, style, i))
+				{
+					stale[i] = 1;
+					any = 1;
+				}
+			}
+		}
+	}
+	
+	// tilemap entries go 8 to a VRAMUpdateCount
+	for (i = 0; i < 2048; i++)
+	{
+		u32 mapchanged = (PPU.VRAMUpdateCount[i] != plane->MapStamps[i]);
+		if (!mapchanged && !any) continue;
+		plane->MapStamps[i] = PPU.VRAMUpdateCount[i];
+		
+		for (j = i << 3; j < (i << 3) + 8; j++)
+		{
+			u32 tile = PPU.VRAM[j << 1];
+			if (!full && tile == plane->Tiles[j] && !stale[tile]) continue;
+			plane->Tiles[j] = tile;
+			
+			if (!fetched[tile])
+			{
+				PPU_FetchMode7PlaneTile(plane, style, tile);
+				fetched[tile] = 1;
+			}
+			
+			u32 row = 127 - (j >> 7);
+			memcpy(&plane->Pixels[((j & 0x7F) | (row << 7)) * 64], &plane->TilePixels[tile * 64], 64*sizeof(u16));
+			
+			plane->Dirty[row >> 5] |= (1 << (row & 0x1F));
+		}
+	}
+	
+	return plane->Pixels;
+}
+
+
+// BG planes: the same thing for 8x8 2bpp/4bpp BGs. the whole tilemap (32 or
+// 64 tiles each way) is drawn out twice, once per priority, and a BG section
+// is one quad per priority textured with the plane at the scroll position
+// laid out like the mode 7 planes: map tile x,y is cell x,(height-1-y), so
+// the texcoords are the map coords / the plane size. flips are done when a
+// cell is copied in, by flipping the coordinate bits of the zcurve
+// a cell is redrawn when its tilemap entry, its tile or its palette changed.
+// nothing is looked at while PPU.VRAMWrites and the palettes stay the same
+// palettes changing every frame (fades) would mean redrawing the cells that
+// use them every frame, so the BG is drawn tile by tile while that goes on
+// and the plane catches up once they settle
+//
+// memory: 256K of linear memory per BG for a 32x32 map, up to 1 MB for 64x64
+// (4 MB in mode 0), allocated when a BG first uses it
+
+static void PPU_DrawBGPlaneCell(PPU_HardBGPlane* plane, u32 tx, u32 ty, u16 curtile, u32 addr)
+{
+	u32 size = plane->Width * plane->Height;
+	u32 row = plane->Height - 1 - ty;
+	u32 cell = (tx | (row * plane->Width)) * 64;
+	u16* dst = &plane->Pixels[cell];
+	u16* other = &plane->Pixels[cell + size*64];
+	u32 coord = PPU_StoreTileInCache(plane->Type, (curtile & 0x1C00) >> 10, addr);
+	u32 flip = 0, i;
+	
+	if (curtile & 0x2000)
+	{
+		u16* tmp = dst;
+		dst = other;
+		other = tmp;
+	}
+	
+	// hflip flips the X bits of the zcurve, vflip the Y bits
+	if (curtile & 0x4000) flip |= 0x15;
+	if (curtile & 0x8000) flip |= 0x2A;
+	
+	memset(other, 0, 64*sizeof(u16));
+	if (coord == 0xC000)
+		memset(dst, 0, 64*sizeof(u16));
+	else
+	{
+		u16* src = &PPU_TileCache[PPU_COORD2IDX(coord) * 64];
+		if (!flip)
+			memcpy(dst, src, 64*sizeof(u16));
+		else
+		{
+			for (i = 0; i < 64; i++)
+				dst[i ^ flip] = src[i];
+		}
+	}
+	
+	plane->Dirty[row >> 5] |= (1 << (row & 0x1F));
+	row += plane->Height;
+	plane->Dirty[row >> 5] |= (1 << (row & 0x1F));
+}
+
+// returns the BG's plane, up to date for the section, or NULL if the BG has to
+// be drawn tile by tile this frame
+// the GPU only draws once the frame is done, so the plane can't change for
+// another section during a frame. it's returned as it was brought up to date
+// for the first one then, the sections that don't match it are drawn tile by
+// tile
+PPU_HardBGPlane* PPU_UpdateBGPlane(u32 num, u32 type, PPU_BGSection* s)
+{
+	PPU_HardBGPlane* plane = &PPU_BGPlanes_Hard[num];
+	u32 w = (s->Size & 0x1) ? 64 : 32, h = (s->Size & 0x2) ? 64 : 32;
+	u32 shift = (type == TILE_4BPP) ? 5 : 4;
+	u32 newframe = (plane->Frame != PPU_BGPlaneFrame);
+	u32 stalepal = 0;
+	u32 i, j;
+	
+	if (s->GraphicsParams != plane->GraphicsParams || s->Size != plane->Size || type != plane->Type)
+	{
+		if (!newframe) return (type == plane->Type) ? plane : NULL;
+		
+		if (plane->Alloc < w*h*64)
+		{
+			if (plane->Pixels) linearFree(plane->Pixels);
+			plane->Pixels = (u16*)linearAlloc(2 * w*h*64 * sizeof(u16));
+			plane->Alloc = plane->Pixels ? w*h*64 : 0;
+			if (!plane->Pixels)
+			{
+				plane->Type = 0xFF;
+				return NULL;
+			}
+		}
+		
+		plane->GraphicsParams = s->GraphicsParams;
+		plane->Size = s->Size;
+		plane->Type = type;
+		plane->Width = w;
+		plane->Height = h;
+		
+		// everything gets redrawn
+		memset(plane->Stamps, 0xFF, sizeof(plane->Stamps));
+		memset(plane->PalCells, 0, sizeof(plane->PalCells));
+		plane->VRAMWrites = PPU.VRAMWrites - 1;
+	}
+	
+	if (newframe)
+	{
+		plane->Frame = PPU_BGPlaneFrame;
+		plane->PalChanging = 0;
+		
+		for (i = 0; i < 8; i++)
+		{
+			u32 stamp = (type == TILE_4BPP) ? *(u32*)&PPU.PaletteUpdateCount[i << 2] : PPU.PaletteUpdateCount[i];
+			if (stamp != plane->PalSeen[i]) plane->PalChanging |= (1 << i);
+			plane->PalSeen[i] = stamp;
+		}
+	}
+	
+	for (i = 0; i < 8; i++)
+	{
+		if (plane->PalSeen[i] == plane->PalStamps[i]) continue;
+		
+		// no cell to redraw, the ones that start using it get the new colors
+		if (!plane->PalCells[i])
+		{
+			plane->PalStamps[i] = plane->PalSeen[i];
+			continue;
+		}
+		
+		if (plane->PalChanging & (1 << i)) return NULL;
+		stalepal |= (1 << i);
+	}
+	
+	if (!stalepal && plane->VRAMWrites == PPU.VRAMWrites) return plane;
+	plane->VRAMWrites = PPU.VRAMWrites;
+	
+	// in tilemap order: 32x32 blocks, the one to the right then the ones below
+	for (j = 0; j < w*h; j++)
+	{
+		u16 curtile = *(u16*)&PPU.VRAM[(s->TilemapOffset + (j << 1)) & 0xFFFF];
+		u32 addr = (s->TilesetOffset + ((curtile & 0x3FF) << shift)) & 0xFFFF;
+		u32 stamp = (type == TILE_4BPP) ? *(u16*)&PPU.VRAMUpdateCount[addr >> 4] : PPU.VRAMUpdateCount[addr >> 4];
+		u32 pal = (curtile & 0x1C00) >> 10;
+		
+		if (curtile == plane->Entries[j] && stamp == plane->Stamps[j] && !(stalepal & (1 << pal)))
+			continue;
+		
+		if (plane->Stamps[j] != 0xFFFFFFFF)
+			plane->PalCells[(plane->Entries[j] & 0x1C00) >> 10]--;
+		plane->PalCells[pal]++;
+		plane->Entries[j] = curtile;
+		plane->Stamps[j] = stamp;
+		
+		u32 block = (s->Size & 0x1) ? (j >> 10) : ((j >> 10) << 1);
+		u32 tx = (j & 0x1F) | ((block & 0x1) << 5);
+		u32 ty = ((j >> 5) & 0x1F) | ((block & 0x2) << 4);
+		PPU_DrawBGPlaneCell(plane, tx, ty, curtile, addr);
+	}
+	
+	for (i = 0; i < 8; i++)
+	{
+		if (stalepal & (1 << i))
+			plane->PalStamps[i] = plane->PalSeen[i];
+	}
+	
+	return plane;
+}
+
+
+// rows of 'rowsize' pixels
+static u32 PPU_FlushRows(u16* tex, u32* dirty, u32 rows, u32 rowsize)
+{
+	u32 row = 0, total = 0;
+	
+	while (row < rows)
+	{
+		if (!(dirty[row >> 5] & (1 << (row & 0x1F))))
+		{
+			// skip clean words whole
+			if (!(row & 0x1F) && !dirty[row >> 5]) row += 32;
+			else row++;
+			continue;
+		}
+		
+		u32 start = row;
+		while (row < rows && (dirty[row >> 5] & (1 << (row & 0x1F))))
+			row++;
+		
+		u32 size = (row - start) * rowsize*sizeof(u16);
+#ifdef _3DS
+		GSPGPU_FlushDataCache(NULL, (u8*)&tex[start * rowsize], size);
+#endif
+		total += size;
+	}
+	
+	dirty[0] = 0;
+	dirty[1] = 0;
+	dirty[2] = 0;
+	dirty[3] = 0;
+	return total;
+}
+
+// flushes the dirty rows of the cache texture and the planes, runs of them
+// in one go. to be called once a frame, after it's drawn
+// returns how many bytes were flushed
+u32 PPU_FlushTileCache()
+{
+	u32 i, total;
+	
+	total = PPU_FlushRows(PPU_TileCache, PPU_TileCacheDirty, 128, 128*64);
+	for (i = 0; i < 2; i++)
+	{
+		if (PPU_Mode7Planes[i].Pixels)
+			total += PPU_FlushRows(PPU_Mode7Planes[i].Pixels, PPU_Mode7Planes[i].Dirty, 128, 128*64);
+	}
+	for (i = 0; i < 4; i++)
+	{
+		PPU_HardBGPlane* plane = &PPU_BGPlanes_Hard[i];
+		if (plane->Pixels)
+			total += PPU_FlushRows(plane->Pixels, plane->Dirty, plane->Height * 2, plane->Width * 64);
+	}
+	
+	PPU_BGPlaneFrame++;
+	return total;
+}
@@ -0,0 +1,391 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifdef PROFILER
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#ifdef _3DS
+#include <3ds.h>
+extern FS_archive sdmcArchive;
+#else
+#include <3ds/types.h>
+#endif
+
+#include "profile.h"
+
+
+// how often PBR:PC is sampled, in master cycles
+u32 Prof_Interval = 256;
+
+u32 Prof_SPCCurOp = 0;
+u8 Prof_CPUIntPending = 0;
+
+u32 Prof_Frames;
+u32 Prof_Samples;
+
+u32 Prof_CPUOpCount[256];
+u64 Prof_CPUOpCycles[256];
+u32 Prof_SPCOpCount[256];
+u64 Prof_SPCOpCycles[256];
+
+u32 Prof_CPULastOp;
+u32 Prof_CPULastPC;
+s32 Prof_CPULastCycle;
+u32 Prof_SampleCycles;
+
+u32 Prof_BankSamples[256];
+
+// PCs and functions are kept in small open-addressed hash tables
+// when one fills up, new addresses are just dropped (and counted)
+
+#define PROF_HASH_SIZE 4096
+#define PROF_EMPTY 0xFFFFFFFF
+
+typedef struct
+{
+	u32 Addr;
+	u32 Samples;
+	u32 Calls;
+
+} Prof_Entry;
+
+Prof_Entry Prof_PCs[PROF_HASH_SIZE];
+Prof_Entry Prof_Funcs[PROF_HASH_SIZE];
+u32 Prof_Dropped;
+
+// shadow call stack, to know which function we're in
+// games that mess with the stack will confuse it, it resyncs on its own at the top level
+// 0x01000000 = top level (reset/main loop)
+
+#define PROF_STACK_SIZE 64
+#define PROF_TOPLEVEL 0x01000000
+
+u32 Prof_Stack[PROF_STACK_SIZE];
+u32 Prof_StackLevel;
+
+
+void Prof_Reset()
+{
+	Prof_Frames = 0;
+	Prof_Samples = 0;
+
+	memset(Prof_CPUOpCount, 0, sizeof(Prof_CPUOpCount));
+	memset(Prof_CPUOpCycles, 0, sizeof(Prof_CPUOpCycles));
+	memset(Prof_SPCOpCount, 0, sizeof(Prof_SPCOpCount));
+	memset(Prof_SPCOpCycles, 0, sizeof(Prof_SPCOpCycles));
+
+	Prof_CPULastOp = 0xEA;
+	Prof_CPULastPC = 0;
+	Prof_CPULastCycle = 0;
+	Prof_SampleCycles = 0;
+	Prof_CPUIntPending = 0;
+
+	memset(Prof_BankSamples, 0, sizeof(Prof_BankSamples));
+	memset(Prof_PCs, 0xFF, sizeof(Prof_PCs));
+	memset(Prof_Funcs, 0xFF, sizeof(Prof_Funcs));
+	Prof_Dropped = 0;
+
+	Prof_StackLevel = 0;
+}
+
+void Prof_EndFrame()
+{
+	Prof_Frames++;
+}
+
+
+Prof_Entry* Prof_Lookup(Prof_Entry* table, u32 addr)
+{
+	u32 hash = (addr * 0x9E3779B1) >> 20;
+	u32 i;
+
+	for (i = 0; i < 16; i++)
+	{
+		Prof_Entry* entry = &table[(hash + i) & (PROF_HASH_SIZE - 1)];
+
+		if (entry->Addr == addr)
+			return entry;
+
+		if (entry->Addr == PROF_EMPTY)
+		{
+			entry->Addr = addr;
+			entry->Samples = 0;
+			entry->Calls = 0;
+			return entry;
+		}
+	}
+
+	Prof_Dropped++;
+	return NULL;
+}
+
+u32 Prof_CurFunc()
+{
+	if (Prof_StackLevel == 0) return PROF_TOPLEVEL;
+	if (Prof_StackLevel > PROF_STACK_SIZE) return Prof_Stack[PROF_STACK_SIZE - 1];
+	return Prof_Stack[Prof_StackLevel - 1];
+}
+
+void Prof_EnterFunc(u32 pc)
+{
+	if (Prof_StackLevel < PROF_STACK_SIZE)
+		Prof_Stack[Prof_StackLevel] = pc;
+	Prof_StackLevel++;
+
+	Prof_Entry* func = Prof_Lookup(Prof_Funcs, pc);
+	if (func) func->Calls++;
+}
+
+
+void Prof_CPUOp(u32 op, u32 pc, s32 cycle)
+{
+	// whatever happened since the last opcode (including WAI and idle loop skips)
+	// is charged to it. going backwards means we went to the next scanline.
+	s32 delta = cycle - Prof_CPULastCycle;
+	if (delta < 0) delta += 1364;
+
+	Prof_CPUOpCycles[Prof_CPULastOp] += delta;
+	Prof_CPUOpCount[op]++;
+
+	// samples also go to the last opcode, and the function it was in
+	Prof_SampleCycles += delta;
+	while (Prof_SampleCycles >= Prof_Interval)
+	{
+		Prof_SampleCycles -= Prof_Interval;
+		Prof_Samples++;
+
+		Prof_BankSamples[Prof_CPULastPC >> 16]++;
+
+		Prof_Entry* entry = Prof_Lookup(Prof_PCs, Prof_CPULastPC);
+		if (entry) entry->Samples++;
+
+		entry = Prof_Lookup(Prof_Funcs, Prof_CurFunc());
+		if (entry) entry->Samples++;
+	}
+
+	if (Prof_CPUIntPending)
+	{
+		Prof_CPUIntPending = 0;
+		Prof_EnterFunc(pc);
+	}
+	else switch (Prof_CPULastOp)
+	{
+		case 0x20: // JSR
+		case 0x22: // JSL
+		case 0xFC: // JSR (a,X)
+			Prof_EnterFunc(pc);
+			break;
+
+		case 0x40: // RTI
+		case 0x60: // RTS
+		case 0x6B: // RTL
+			if (Prof_StackLevel > 0) Prof_StackLevel--;
+			break;
+	}
+
+	Prof_CPULastOp = op;
+	Prof_CPULastPC = pc;
+	Prof_CPULastCycle = cycle;
+}
+
+void Prof_SPCOp(u32 cycles)
+{
+	Prof_SPCOpCount[Prof_SPCCurOp]++;
+	Prof_SPCOpCycles[Prof_SPCCurOp] += cycles;
+}
+
+
+// --- Dumping -----------------------------------------------------------------
+
+char* Prof_Text;
+u32 Prof_TextLen;
+
+#define PROF_TEXT_SIZE 0x20000
+
+void Prof_Print(const char* fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (Prof_TextLen >= PROF_TEXT_SIZE) return;
+
+	va_start(args, fmt);
+	len = vsnprintf(&Prof_Text[Prof_TextLen], PROF_TEXT_SIZE - Prof_TextLen, fmt, args);
+	va_end(args);
+
+	if (len > 0) Prof_TextLen += len;
+	if (Prof_TextLen > PROF_TEXT_SIZE) Prof_TextLen = PROF_TEXT_SIZE;
+}
+
+u64* Prof_SortKey;
+
+int Prof_CompareKey(const void* a, const void* b)
+{
+	u64 ka = Prof_SortKey[*(u32*)a];
+	u64 kb = Prof_SortKey[*(u32*)b];
+
+	if (ka > kb) return -1;
+	if (ka < kb) return 1;
+	return 0;
+}
+
+int Prof_CompareSamples(const void* a, const void* b)
+{
+	const Prof_Entry* ea = (const Prof_Entry*)a;
+	const Prof_Entry* eb = (const Prof_Entry*)b;
+
+	if (ea->Samples > eb->Samples) return -1;
+	if (ea->Samples < eb->Samples) return 1;
+	if (ea->Calls > eb->Calls) return -1;
+	if (ea->Calls < eb->Calls) return 1;
+	return 0;
+}
+
+void Prof_DumpOps(const char* name, u32* count, u64* cycles)
+{
+	u32 order[256];
+	u64 total = 0;
+	u32 i;
+
+	for (i = 0; i < 256; i++)
+	{
+		order[i] = i;
+		total += cycles[i];
+	}
+
+	Prof_SortKey = cycles;
+	qsort(order, 256, sizeof(u32), Prof_CompareKey);
+
+	Prof_Print("\n-- %s opcodes, by cycles --\n", name);
+	Prof_Print("op        count          cycles  cyc/op      %%\n");
+	for (i = 0; i < 256; i++)
+	{
+		u32 op = order[i];
+		if (!count[op] && !cycles[op]) continue;
+
+		Prof_Print("%02X %12u %15llu %7.2f %6.2f\n", op, count[op], (unsigned long long)cycles[op],
+			count[op] ? (double)cycles[op] / count[op] : 0.0,
+			total ? (cycles[op] * 100.0) / total : 0.0);
+	}
+}
+
+u32 Prof_DumpEntries(Prof_Entry* table, u32 max, bool calls)
+{
+	Prof_Entry* sorted = (Prof_Entry*)malloc(sizeof(Prof_Entry) * PROF_HASH_SIZE);
+	u32 n = 0, i;
+
+	if (!sorted) return 0;
+
+	for (i = 0; i < PROF_HASH_SIZE; i++)
+	{
+		if (table[i].Addr != PROF_EMPTY)
+			sorted[n++] = table[i];
+	}
+	qsort(sorted, n, sizeof(Prof_Entry), Prof_CompareSamples);
+
+	if (n > max) n = max;
+	for (i = 0; i < n; i++)
+	{
+		Prof_Entry* entry = &sorted[i];
+
+		if (entry->Addr == PROF_TOPLEVEL)
+			Prof_Print("(top)  ");
+		else
+			Prof_Print("%02X:%04X", entry->Addr >> 16, entry->Addr & 0xFFFF);
+
+		Prof_Print(" %10u %6.2f", entry->Samples, Prof_Samples ? (entry->Samples * 100.0) / Prof_Samples : 0.0);
+		if (calls)
+			Prof_Print(" %10u", entry->Calls);
+		Prof_Print("\n");
+	}
+
+	free(sorted);
+	return n;
+}
+
+bool Prof_Dump(char* path)
+{
+	u32 i;
+
+	Prof_Text = (char*)malloc(PROF_TEXT_SIZE);
+	if (!Prof_Text) return false;
+	Prof_TextLen = 0;
+
+	Prof_Print("blargSnes profile\n");
+	Prof_Print("%u frames, %u samples (one every %u master cycles)", Prof_Frames, Prof_Samples, Prof_Interval);
+	if (Prof_Dropped)
+		Prof_Print(", %u samples dropped (hash tables full)", Prof_Dropped);
+	Prof_Print("\n");
+
+	Prof_DumpOps("CPU", Prof_CPUOpCount, Prof_CPUOpCycles);
+	Prof_DumpOps("SPC", Prof_SPCOpCount, Prof_SPCOpCycles);
+
+	Prof_Print("\n-- CPU banks --\n");
+	Prof_Print("bank   samples      %%\n");
+	for (i = 0; i < 256; i++)
+	{
+		if (!Prof_BankSamples[i]) continue;
+		Prof_Print("%02X  %10u %6.2f\n", i, Prof_BankSamples[i], (Prof_BankSamples[i] * 100.0) / Prof_Samples);
+	}
+
+	Prof_Print("\n-- CPU functions (JSR/JSL targets and interrupt handlers) --\n");
+	Prof_Print("addr       samples      %%      calls\n");
+	Prof_DumpEntries(Prof_Funcs, 256, true);
+
+	Prof_Print("\n-- CPU hot spots --\n");
+	Prof_Print("addr       samples      %%\n");
+	Prof_DumpEntries(Prof_PCs, 128, false);
+
+	bool ret = false;
+
+#ifdef _3DS
+	Handle file;
+	FS_path filePath;
+	filePath.type = PATH_CHAR;
+	filePath.size = strlen(path) + 1;
+	filePath.data = (u8*)path;
+
+	Result res = FSUSER_OpenFile(NULL, &file, sdmcArchive, filePath, FS_OPEN_CREATE|FS_OPEN_WRITE, FS_ATTRIBUTE_NONE);
+	if (!res)
+	{
+		u32 byteswritten = 0;
+		FSFILE_SetSize(file, Prof_TextLen);
+		FSFILE_Write(file, &byteswritten, 0, (u32*)Prof_Text, Prof_TextLen, FS_WRITE_FLUSH);
+		FSFILE_Close(file);
+		ret = true;
+	}
+#else
+	FILE* file = fopen(path, "w");
+	if (file)
+	{
+		fwrite(Prof_Text, 1, Prof_TextLen, file);
+		fclose(file);
+		ret = true;
+	}
+#endif
+
+	free(Prof_Text);
+	Prof_Text = NULL;
+	return ret;
+}
+
+#endif
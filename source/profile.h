@@ -0,0 +1,50 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef _PROFILE_H_
+#define _PROFILE_H_
+
+// guest profiler
+// counts executed opcodes and their cycles for the CPU and SPC, and samples
+// PBR:PC every Prof_Interval master cycles, per bank and per function
+// (function = last JSR/JSL target or interrupt vector)
+//
+// only there when built with PROFILER defined, in both CFLAGS and ASFLAGS
+// (see the Makefile). it slows the emulator down a lot.
+
+#ifdef PROFILER
+
+extern u32 Prof_Interval;
+extern u32 Prof_SPCCurOp;
+extern u8 Prof_CPUIntPending;	// set by the CPU cores when they take an interrupt
+
+void Prof_Reset();
+void Prof_EndFrame();
+
+// called by the CPU cores before every opcode
+// pc is PBR:PC of the opcode, cycle is the current master cycle in the scanline
+void Prof_CPUOp(u32 op, u32 pc, s32 cycle);
+
+// called by the SPC core after every opcode (the opcode is in Prof_SPCCurOp)
+void Prof_SPCOp(u32 cycles);
+
+bool Prof_Dump(char* path);
+
+#endif
+
+#endif
@@ -0,0 +1,279 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include <3ds/types.h>
+
+#include "mem.h"
+#include "savestate.h"
+#include "rewind.h"
+
+
+bool Rewind_Enabled = false;
+u32 Rewind_Interval = 4;
+
+u32 Rewind_LastSize = 0;
+u32 Rewind_NumSnapshots = 0;
+
+// the newest snapshot, and the one being taken
+u32* Rewind_Last = NULL;
+u32* Rewind_Cur = NULL;
+u32 Rewind_StateSize = 0;	// in words
+u32 Rewind_LastLen = 0;		// in bytes, as returned by State_SaveMem()
+bool Rewind_HaveLast = false;
+
+// scratch space for one delta
+u32* Rewind_Delta = NULL;
+
+// the ring. each entry is: length in words, the delta, length in words again
+u32* Rewind_Ring = NULL;
+u32 Rewind_Head = 0, Rewind_Tail = 0, Rewind_Used = 0;
+
+#define RING_WORDS (REWIND_BUFFER_SIZE >> 2)
+
+u32 Rewind_FrameCount = 0;
+u32 Rewind_Back = 0;
+bool Rewind_AtLast = false;
+
+
+// the state size depends on the ROM (SRAM), so call this again for every ROM
+bool Rewind_Init()
+{
+	Rewind_DeInit();
+
+	Rewind_StateSize = (State_MaxSize() + 3) >> 2;
+
+	Rewind_Ring = (u32*)MemAlloc(REWIND_BUFFER_SIZE);
+	Rewind_Last = (u32*)MemAlloc(Rewind_StateSize << 2);
+	Rewind_Cur = (u32*)MemAlloc(Rewind_StateSize << 2);
+	// worst case for a delta is a bit over one word per word
+	Rewind_Delta = (u32*)MemAlloc((Rewind_StateSize + 16) << 3);
+
+	if (!Rewind_Ring || !Rewind_Last || !Rewind_Cur || !Rewind_Delta)
+	{
+		Rewind_DeInit();
+		return false;
+	}
+
+	// the padding at the end of the snapshots has to stay the same
+	memset(Rewind_Last, 0, Rewind_StateSize << 2);
+	memset(Rewind_Cur, 0, Rewind_StateSize << 2);
+
+	Rewind_Reset();
+	return true;
+}
+
+void Rewind_DeInit()
+{
+	if (Rewind_Ring) MemFree(Rewind_Ring);
+	if (Rewind_Last) MemFree(Rewind_Last);
+	if (Rewind_Cur) MemFree(Rewind_Cur);
+	if (Rewind_Delta) MemFree(Rewind_Delta);
+
+	Rewind_Ring = NULL;
+	Rewind_Last = NULL;
+	Rewind_Cur = NULL;
+	Rewind_Delta = NULL;
+}
+
+void Rewind_Reset()
+{
+	Rewind_Head = 0;
+	Rewind_Tail = 0;
+	Rewind_Used = 0;
+	Rewind_NumSnapshots = 0;
+	Rewind_LastSize = 0;
+
+	Rewind_HaveLast = false;
+	Rewind_AtLast = false;
+	Rewind_FrameCount = 0;
+	Rewind_Back = 0;
+}
+
+
+// XORs cur into last, leaving cur in last
+// output: a header word (unchanged words to skip << 16 | number of XOR words)
+// followed by the XOR words, repeat
+u32 Rewind_Encode(u32* dst, u32* last, u32* cur, u32 len)
+{
+	u32 i = 0, o = 0;
+
+	while (i < len)
+	{
+		u32 skip = 0, count = 0;
+		u32 hdr = o++;
+
+		while (i < len && last[i] == cur[i] && skip < 0xFFFF)
+		{
+			i++;
+			skip++;
+		}
+
+		while (i < len && count < 0xFFFF)
+		{
+			u32 x = last[i] ^ cur[i];
+			if (!x) break;
+
+			dst[o++] = x;
+			last[i] = cur[i];
+			i++;
+			count++;
+		}
+
+		dst[hdr] = (skip << 16) | count;
+	}
+
+	return o;
+}
+
+void Rewind_Decode(u32* dst, u32* src, u32 len)
+{
+	u32 i = 0;
+
+	while (i < len)
+	{
+		u32 hdr = src[i++];
+		u32 count = hdr & 0xFFFF;
+
+		dst += hdr >> 16;
+		while (count--)
+			*dst++ ^= src[i++];
+	}
+}
+
+
+void Rewind_RingWrite(u32 pos, u32* src, u32 len)
+{
+	u32 first = RING_WORDS - pos;
+	if (first > len) first = len;
+
+	memcpy(&Rewind_Ring[pos], src, first << 2);
+	if (len > first)
+		memcpy(&Rewind_Ring[0], &src[first], (len - first) << 2);
+}
+
+void Rewind_RingRead(u32 pos, u32* dst, u32 len)
+{
+	u32 first = RING_WORDS - pos;
+	if (first > len) first = len;
+
+	memcpy(dst, &Rewind_Ring[pos], first << 2);
+	if (len > first)
+		memcpy(&dst[first], &Rewind_Ring[0], (len - first) << 2);
+}
+
+bool Rewind_Push(u32* src, u32 len)
+{
+	u32 need = len + 2;
+	if (need > RING_WORDS) return false;
+
+	// make room by dropping the oldest deltas
+	while (Rewind_Used + need > RING_WORDS)
+	{
+		u32 oldlen = Rewind_Ring[Rewind_Tail] + 2;
+		Rewind_Tail = (Rewind_Tail + oldlen) % RING_WORDS;
+		Rewind_Used -= oldlen;
+		Rewind_NumSnapshots--;
+	}
+
+	Rewind_Ring[Rewind_Head] = len;
+	Rewind_RingWrite((Rewind_Head + 1) % RING_WORDS, src, len);
+	Rewind_Ring[(Rewind_Head + 1 + len) % RING_WORDS] = len;
+
+	Rewind_Head = (Rewind_Head + need) % RING_WORDS;
+	Rewind_Used += need;
+	Rewind_NumSnapshots++;
+	return true;
+}
+
+u32 Rewind_Pop(u32* dst)
+{
+	if (!Rewind_NumSnapshots) return 0;
+
+	u32 len = Rewind_Ring[(Rewind_Head + RING_WORDS - 1) % RING_WORDS];
+	u32 start = (Rewind_Head + RING_WORDS - 1 - len) % RING_WORDS;
+
+	Rewind_RingRead(start, dst, len);
+
+	Rewind_Head = (start + RING_WORDS - 1) % RING_WORDS;
+	Rewind_Used -= len + 2;
+	Rewind_NumSnapshots--;
+	return len;
+}
+
+
+void Rewind_Frame()
+{
+	if (!Rewind_Enabled || !Rewind_Ring) return;
+
+	if (++Rewind_FrameCount < Rewind_Interval) return;
+	Rewind_FrameCount = 0;
+	Rewind_AtLast = false;
+	Rewind_Back = 0;
+
+	// the mixer thread is still going, so the DSP is left out (it just keeps
+	// playing from where it is after rewinding)
+	u32 len = State_SaveMem((u8*)Rewind_Cur, Rewind_StateSize << 2, STATE_NODSP);
+	if (!len) return;
+
+	if (!Rewind_HaveLast || len != Rewind_LastLen)
+	{
+		// nothing to diff against, start over
+		Rewind_Reset();
+		memcpy(Rewind_Last, Rewind_Cur, len);
+		Rewind_LastLen = len;
+		Rewind_HaveLast = true;
+		return;
+	}
+
+	u32 dlen = Rewind_Encode(Rewind_Delta, Rewind_Last, Rewind_Cur, (len + 3) >> 2);
+	if (!Rewind_Push(Rewind_Delta, dlen))
+	{
+		// can't keep this one, so the older ones are useless too
+		Rewind_Head = Rewind_Tail = Rewind_Used = 0;
+		Rewind_NumSnapshots = 0;
+	}
+
+	Rewind_LastSize = (dlen + 2) << 2;
+}
+
+bool Rewind_Step()
+{
+	if (!Rewind_Ring || !Rewind_HaveLast) return false;
+
+	if (Rewind_AtLast)
+	{
+		u32 dlen = Rewind_Pop(Rewind_Delta);
+		if (!dlen) return false;
+
+		Rewind_Decode(Rewind_Last, Rewind_Delta, dlen);
+		Rewind_Back += Rewind_Interval;
+	}
+	else
+		Rewind_Back += Rewind_FrameCount;
+
+	Rewind_AtLast = true;
+	Rewind_FrameCount = 0;
+
+	return State_LoadMem((u8*)Rewind_Last, Rewind_LastLen);
+}
+
+u32 Rewind_FramesBack()
+{
+	return Rewind_Back;
+}
@@ -0,0 +1,57 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef _REWIND_H_
+#define _REWIND_H_
+
+// rewind
+// every Rewind_Interval frames, a snapshot of the whole machine is taken
+// (an uncompressed savestate, see savestate.c), minus the DSP, which belongs
+// to the mixer thread
+//
+// only the newest snapshot is kept as is. every older one is kept as the XOR
+// of itself and the snapshot that came after it, with the runs of zero words
+// skipped, in a ring buffer. when the ring is full the oldest ones go.
+// going back one step is XORing the newest delta into the newest snapshot.
+
+#define REWIND_BUFFER_SIZE (4 * 1024 * 1024)
+
+extern bool Rewind_Enabled;
+extern u32 Rewind_Interval;
+
+// stats for the last snapshot
+extern u32 Rewind_LastSize;		// bytes the delta took in the ring
+extern u32 Rewind_NumSnapshots;
+
+bool Rewind_Init();
+void Rewind_DeInit();
+
+// forget the history (new ROM, savestate loaded, ...)
+void Rewind_Reset();
+
+// call after every emulated frame
+void Rewind_Frame();
+
+// goes back one snapshot, returns false if there's nothing left
+// the first call goes back to the newest snapshot
+bool Rewind_Step();
+
+// how many frames back the last Rewind_Step() went, in total
+u32 Rewind_FramesBack();
+
+#endif
@@ -39,8 +39,8 @@ u32 ROM_NumBanks;
 extern FS_archive sdmcArchive;
 
 
-// TODO find a better way to do speedhacks
-// (like, detecting branches with offset -4 or -5 at runtime)
+// old ROM patching speedhacks, disabled
+// idle loops are now detected at runtime (see branch_idlecheck in cpu.s)
 void ROM_ApplySpeedHacks(int banknum, u8* bank)
 {
 	return;
@@ -0,0 +1,101 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include <3ds.h>
+
+#include "main.h"
+#include "mem.h"
+#include "cpu.h"
+#include "dsp.h"
+#include "ppu.h"
+#include "savestate.h"
+#include "runahead.h"
+
+
+u32 RunAhead_Frames = 0;
+u32 RunAhead_Ticks = 0;
+
+u8* RunAhead_State = NULL;
+u32 RunAhead_StateSize = 0;
+
+// DSP writes the real frame left for the mixer
+u16 RunAhead_DSPWrites[32*128];
+
+
+bool RunAhead_Init()
+{
+	RunAhead_DeInit();
+
+	RunAhead_StateSize = State_MaxSize();
+	RunAhead_State = (u8*)MemAlloc(RunAhead_StateSize);
+	if (!RunAhead_State)
+		return false;
+
+	RunAhead_Ticks = 0;
+	return true;
+}
+
+void RunAhead_DeInit()
+{
+	if (RunAhead_State) MemFree(RunAhead_State);
+	RunAhead_State = NULL;
+}
+
+
+void RunAhead_Frame()
+{
+	u64 start = svcGetSystemTick();
+	u64 waitstart = WaitTicks;
+	u32 i;
+
+	if (!RunAhead_Frames || !RunAhead_State)
+	{
+		CPU_MainLoop();
+		return;
+	}
+
+	// the real frame, heard but not seen
+	HideThisFrame = true;
+	CPU_MainLoop();
+
+	u32 len = State_SaveMem(RunAhead_State, RunAhead_StateSize, STATE_NODSP);
+	if (!len)
+	{
+		HideThisFrame = false;
+		return;
+	}
+	memcpy(RunAhead_DSPWrites, DSP_WritingWriteBuffer, sizeof(RunAhead_DSPWrites));
+
+	// the frames ahead, neither seen nor heard except for the last one
+	DSP_Muted = true;
+	for (i = 1; i < RunAhead_Frames; i++)
+		CPU_MainLoop();
+
+	HideThisFrame = false;
+	CPU_MainLoop();
+
+	State_LoadMem(RunAhead_State, len);
+	memcpy(DSP_WritingWriteBuffer, RunAhead_DSPWrites, sizeof(RunAhead_DSPWrites));
+	DSP_Muted = false;
+
+	// only count the time we actually spent working
+	u32 ticks = (u32)(svcGetSystemTick() - start - (WaitTicks - waitstart));
+	if (!RunAhead_Ticks) RunAhead_Ticks = ticks;
+	else RunAhead_Ticks = (RunAhead_Ticks * 15 + ticks) >> 4;
+}
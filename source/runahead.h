@@ -0,0 +1,44 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef _RUNAHEAD_H_
+#define _RUNAHEAD_H_
+
+// run-ahead
+// every frame, the real frame is emulated and a snapshot is taken, then
+// RunAhead_Frames more frames are emulated with the same input and the last
+// one is displayed. then the snapshot is loaded back. this hides the game's
+// own input lag, as long as the extra frames fit in the frame budget.
+//
+// only the real frame is heard, the DSP is left out of the snapshot
+
+#define RUNAHEAD_MAX 3
+
+extern u32 RunAhead_Frames;	// 0 = off
+
+// average time a frame took, not counting the vsync/GPU waits
+extern u32 RunAhead_Ticks;
+
+// the state size depends on the ROM, so call this again for every ROM
+bool RunAhead_Init();
+void RunAhead_DeInit();
+
+// emulates one frame, replaces CPU_MainLoop()
+void RunAhead_Frame();
+
+#endif
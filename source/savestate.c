@@ -0,0 +1,792 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "main.h"
+#include "snes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "spc700.h"
+#include "dsp.h"
+#include "ui.h"
+#include "savestate.h"
+
+
+#ifdef _3DS
+extern FS_archive sdmcArchive;
+#endif
+
+extern u8* SNES_SRAM;
+extern u32 SNES_SRAMMask;
+extern u8 SNES_HVBJOY;
+extern u8 SNES_MulA;
+extern u16 SNES_MulRes;
+extern u16 SNES_DivA;
+extern u16 SNES_DivRes;
+
+extern u32 Mem_WRAMAddr;
+extern const u8 PPU_OBJWidths[16];
+extern const u8 PPU_OBJHeights[16];
+
+extern u8 DMA_Chans[8*16];
+extern u8 DMA_HDMAFlag;
+extern u8 DMA_HDMACurFlag;
+extern u8 DMA_HDMAEnded;
+extern u8 HDMA_Pause[8];
+
+extern u8 SPC_ROMAccess;
+extern u8 SPC_DSPAddr;
+
+extern u16 DSP_WriteBuffer[2][32*128];
+extern u32 echoDelay;
+extern u16 firOffset;
+extern s16 DSP_NoiseSample;
+extern u16 DSP_NoiseStep;
+
+
+#define STATE_VERSION 1
+
+#define CHUNK_PACKED (1 << 0)
+
+// chunks are only packed if they're at least this big
+#define STATE_PACK_MIN 1024
+
+
+u8* State_Buf;
+u32 State_Len;
+u32 State_Pos;
+bool State_Saving;
+bool State_Overflow;
+
+u8* State_Chunk;
+u32 State_ChunkLen;
+u32 State_ChunkPos;
+
+
+// copies one field in or out, depending on what we're doing
+// when loading, fields past the end of the chunk are left alone
+bool State_Sync(void* ptr, u32 len)
+{
+	if (State_Saving)
+	{
+		if (State_Pos + len > State_Len)
+		{
+			State_Overflow = true;
+			return false;
+		}
+		memcpy(&State_Buf[State_Pos], ptr, len);
+		State_Pos += len;
+	}
+	else
+	{
+		if (State_ChunkPos + len > State_ChunkLen)
+		{
+			State_ChunkPos = State_ChunkLen;
+			return false;
+		}
+		memcpy(ptr, &State_Chunk[State_ChunkPos], len);
+		State_ChunkPos += len;
+	}
+
+	return true;
+}
+
+#define SYNC(v) State_Sync(&(v), sizeof(v))
+
+
+// RLE
+// control byte 00-7F: 1-128 literal bytes follow
+// control byte 80-FF: the next byte is repeated 3-130 times
+// returns 0 if the packed data doesn't fit in maxlen
+
+u32 State_Pack(u8* dst, u32 maxlen, u8* src, u32 len)
+{
+	u32 i = 0, o = 0, lit = 0;
+
+	while (i < len)
+	{
+		u8 b = src[i];
+		u32 run = 1;
+		while (i+run < len && run < 130 && src[i+run] == b) run++;
+
+		if (run < 3)
+		{
+			i += run;
+			if (i - lit < 128) continue;
+			run = 0;
+		}
+
+		// flush the literals before this run (or a full block of them)
+		u32 end = run ? i : lit + 128;
+		while (lit < end)
+		{
+			u32 n = end - lit;
+			if (n > 128) n = 128;
+			if (o + 1 + n > maxlen) return 0;
+			dst[o++] = n - 1;
+			memcpy(&dst[o], &src[lit], n);
+			o += n;
+			lit += n;
+		}
+
+		if (run)
+		{
+			if (o + 2 > maxlen) return 0;
+			dst[o++] = 0x80 + (run - 3);
+			dst[o++] = b;
+			i += run;
+			lit = i;
+		}
+	}
+
+	while (lit < len)
+	{
+		u32 n = len - lit;
+		if (n > 128) n = 128;
+		if (o + 1 + n > maxlen) return 0;
+		dst[o++] = n - 1;
+		memcpy(&dst[o], &src[lit], n);
+		o += n;
+		lit += n;
+	}
+
+	return o;
+}
+
+u32 State_Unpack(u8* dst, u32 maxlen, u8* src, u32 len)
+{
+	u32 i = 0, o = 0;
+
+	while (i < len)
+	{
+		u8 c = src[i++];
+		if (c < 0x80)
+		{
+			u32 n = c + 1;
+			if (i + n > len || o + n > maxlen) return 0;
+			memcpy(&dst[o], &src[i], n);
+			i += n;
+			o += n;
+		}
+		else
+		{
+			u32 n = c - 0x80 + 3;
+			if (i >= len || o + n > maxlen) return 0;
+			memset(&dst[o], src[i++], n);
+			o += n;
+		}
+	}
+
+	return o;
+}
+
+
+void State_SyncCPU(u32 version)
+{
+	SYNC(CPU_Regs.A);
+	SYNC(CPU_Regs.X);
+	SYNC(CPU_Regs.Y);
+	SYNC(CPU_Regs.P.val);
+	SYNC(CPU_Regs.PC);
+	SYNC(CPU_Regs.DBR);
+	SYNC(CPU_Regs.D);
+	SYNC(CPU_Regs.PBR);
+	SYNC(CPU_Regs.S);
+	SYNC(CPU_Regs.nCycles);
+	SYNC(CPU_Regs.nLines);
+
+	if (!State_Saving)
+		CPU_FixupRegs();
+}
+
+void State_SyncSNES(u32 version)
+{
+	u8 height = SNES_Status->ScreenHeight;
+	bool fastrom = SNES_FastROM;
+
+	SYNC(SNES_Status->SliceEnd);
+	SYNC(SNES_Status->LastBusVal);
+	SYNC(SNES_Status->SPC_LastCycle);
+	SYNC(SNES_Status->IRQ_VMatch);
+	SYNC(SNES_Status->IRQ_HMatch);
+	SYNC(SNES_Status->IRQ_CurHMatch);
+	SYNC(SNES_Status->VCount);
+	SYNC(SNES_Status->HCount);
+	SYNC(SNES_Status->ScreenHeight);
+	SYNC(SNES_Status->IRQCond);
+	SYNC(SNES_Status->HVBFlags);
+
+	SYNC(SNES_FastROM);
+	SYNC(SNES_HVBJOY);
+	SYNC(SNES_WRIO);
+	SYNC(SNES_AutoJoypad);
+	SYNC(SNES_JoyBit);
+	SYNC(SNES_JoyBuffer);
+	SYNC(SNES_Joy16);
+	SYNC(SNES_MulA);
+	SYNC(SNES_MulRes);
+	SYNC(SNES_DivA);
+	SYNC(SNES_DivRes);
+
+	SYNC(Mem_WRAMAddr);
+	SYNC(SPC_IOPorts);
+
+	if (!State_Saving)
+	{
+		if (SNES_Status->ScreenHeight != height)
+			ApplyScaling();
+		if (SNES_FastROM != fastrom)
+			ROM_SpeedChanged();
+	}
+}
+
+void State_SyncWRAM(u32 version)
+{
+	State_Sync(SNES_SysRAM, 0x20000);
+}
+
+void State_SyncSRAM(u32 version)
+{
+	if (!SNES_SRAM) return;
+
+	if (State_Saving)
+		State_Sync(SNES_SRAM, SNES_SRAMMask + 1);
+	else
+	{
+		// take what's there, the SRAM size is the ROM's business
+		u32 len = State_ChunkLen;
+		if (len > SNES_SRAMMask + 1) len = SNES_SRAMMask + 1;
+
+		// run-ahead and rewind load states all the time, only flag SRAM
+		// for writing back to the SD card when the load changed it
+		if (memcmp(SNES_SRAM, &State_Chunk[State_ChunkPos], len))
+			SNES_Status->SRAMDirty = 1;
+		State_Sync(SNES_SRAM, len);
+	}
+}
+
+void State_SyncDMA(u32 version)
+{
+	SYNC(DMA_Chans);
+	SYNC(DMA_HDMAFlag);
+	SYNC(DMA_HDMACurFlag);
+	SYNC(DMA_HDMAEnded);
+	SYNC(HDMA_Pause);
+}
+
+void State_SyncSPC(u32 version)
+{
+	SYNC(SPC_Regs.nCycles);
+	SYNC(SPC_Regs.PSW);
+	SYNC(SPC_Regs.PC);
+	SYNC(SPC_Regs.SP);
+	SYNC(SPC_Regs.Y);
+	SYNC(SPC_Regs.X);
+	SYNC(SPC_Regs.A);
+
+	SYNC(SPC_TimerReload);
+	SYNC(SPC_TimerVal);
+	SYNC(SPC_TimerEnable);
+	SYNC(SPC_ElapsedCycles);
+
+	SYNC(SPC_ROMAccess);
+	SYNC(SPC_DSPAddr);
+
+	if (!State_Saving)
+		SPC_Regs._memoryMap = (u32)(uintptr_t)&SPC_RAM[0];
+}
+
+void State_SyncARAM(u32 version)
+{
+	// includes the IPL ROM/RAM swap area at the end
+	State_Sync(SPC_RAM, 0x10040);
+}
+
+void State_SyncDSP(u32 version)
+{
+	SYNC(DSP_MEM);
+	SYNC(channels);
+
+	SYNC(echoBase);
+	SYNC(echoDelay);
+	SYNC(echoRemain);
+	SYNC(firFilter);
+	SYNC(firOffset);
+	SYNC(dspPreamp);
+
+	SYNC(DSP_NoiseSample);
+	SYNC(DSP_NoiseStep);
+	SYNC(DSP_NoiseSamples);
+
+	// writes that were queued before the state was loaded don't belong to it
+	if (!State_Saving)
+		memset(DSP_WriteBuffer, 0, sizeof(DSP_WriteBuffer));
+}
+
+// when loading, only the tiles that changed are copied and flagged as updated
+// so the renderers keep what they cached for the rest (matters for run-ahead)
+void State_SyncVRAM()
+{
+	int i, j;
+
+	if (State_Saving || State_ChunkPos + 0x10000 > State_ChunkLen)
+	{
+		SYNC(PPU.VRAM);
+		return;
+	}
+
+	u8* src = &State_Chunk[State_ChunkPos];
+	State_ChunkPos += 0x10000;
+
+	for (i = 0; i < 0x10000; i += 16)
+	{
+		if (!memcmp(&PPU.VRAM[i], &src[i], 16)) continue;
+
+		memcpy(&PPU.VRAM[i], &src[i], 16);
+		for (j = 1; j < 16; j += 2)
+			PPU.VRAM7[(i + j) >> 1] = src[i + j];
+
+		PPU.VRAMUpdateCount[i >> 4]++;
+		PPU.VRAMWrites++;
+		PPU.VRAM7UpdateCount[i >> 7]++;
+	}
+}
+
+void State_SyncPPU(u32 version)
+{
+	static u16 cgram[256];
+	int i;
+
+	u8 objsize = PPU.OBJWidth - &PPU_OBJWidths[0];
+	memcpy(cgram, PPU.CGRAM, sizeof(cgram));
+
+	// the soft renderer's threads may still be drawing from VRAM and OAM
+	if (!State_Saving)
+		PPU_SYNC_SOFT();
+
+	SYNC(PPU.CGRAMAddr);
+	SYNC(PPU.CGRAMVal);
+	SYNC(cgram);
+
+	SYNC(PPU.VRAMAddr);
+	SYNC(PPU.VRAMPref);
+	SYNC(PPU.VRAMInc);
+	SYNC(PPU.VRAMStep);
+	State_SyncVRAM();
+
+	SYNC(PPU.OAMAddr);
+	SYNC(PPU.OAMVal);
+	SYNC(PPU.OAMPrio);
+	SYNC(PPU.FirstOBJ);
+	SYNC(PPU.OAMReload);
+	SYNC(PPU.OAM);
+
+	SYNC(objsize);
+	SYNC(PPU.CurBrightness);
+	SYNC(PPU.ForcedBlank);
+	SYNC(PPU.Interlace);
+	SYNC(PPU.Mode);
+	SYNC(PPU.MainScreen);
+	SYNC(PPU.SubScreen);
+	SYNC(PPU.ColorMath1);
+	SYNC(PPU.ColorMath2);
+	SYNC(PPU.SubBackdrop);
+
+	SYNC(PPU.WinX);
+	SYNC(PPU.WinSel);
+	SYNC(PPU.WinLogic);
+	SYNC(PPU.WinMask);
+	SYNC(PPU.WinCombine);
+	SYNC(PPU.BGOld);
+	SYNC(PPU.M7Old);
+
+	SYNC(PPU.MulA);
+	SYNC(PPU.MulB);
+	SYNC(PPU.MulResult);
+
+	SYNC(PPU.M7Sel);
+	SYNC(PPU.M7AffineParams1);
+	SYNC(PPU.M7AffineParams2);
+	SYNC(PPU.M7RefParams);
+	SYNC(PPU.M7ScrollParams);
+	SYNC(PPU.M7ExtBG);
+
+	for (i = 0; i < 4; i++)
+	{
+		PPU_Background* bg = &PPU.BG[i];
+
+		SYNC(bg->GraphicsParams);
+		SYNC(bg->Size);
+		SYNC(bg->ScrollParams);
+		SYNC(bg->WindowMask);
+		SYNC(bg->WindowCombine);
+	}
+
+	SYNC(PPU.OBJTilesetAddr);
+	SYNC(PPU.OBJGap);
+	SYNC(PPU.OBJVDir);
+	SYNC(PPU.OBJWindowMask);
+	SYNC(PPU.OBJWindowCombine);
+	SYNC(PPU.ColorMathWindowMask);
+	SYNC(PPU.ColorMathWindowCombine);
+
+	SYNC(PPU.OPHCT);
+	SYNC(PPU.OPVCT);
+	SYNC(PPU.OPHFlag);
+	SYNC(PPU.OPVFlag);
+	SYNC(PPU.OPLatch);
+	SYNC(PPU.OBJOverflow);
+
+	if (State_Saving) return;
+
+	// rebuild everything that is derived from the registers
+
+	for (i = 0; i < 4; i++)
+	{
+		PPU_Background* bg = &PPU.BG[i];
+
+		bg->Tileset = (u16*)&PPU.VRAM[bg->TilesetOffset];
+		bg->Tilemap = (u16*)&PPU.VRAM[bg->TilemapOffset];
+	}
+
+	objsize &= 0x0E;
+	PPU.OBJWidth = &PPU_OBJWidths[objsize];
+	PPU.OBJHeight = &PPU_OBJHeights[objsize];
+	PPU.OBJTileset = (u16*)&PPU.VRAM[PPU.OBJTilesetAddr];
+
+	// only the colors that changed get converted
+	for (i = 0; i < 256; i++)
+		PPU_SetColor(i, cgram[i]);
+
+	PPU.ModeDirty = 1;
+	PPU.MainBackdropDirty = 1;
+	PPU.SubBackdropDirty = 1;
+	PPU.ColorEffectDirty = 1;
+	PPU.Mode7Dirty = 1;
+	PPU.OBJDirty = 1;
+	PPU.OBJListDirty = 1;
+	PPU.WindowDirty = 2;
+}
+
+
+typedef struct
+{
+	char Tag[4];
+	u16 Version;
+	bool Pack;		// worth packing
+	u32 Omit;		// left out when saving with any of these flags
+	void (*Sync)(u32 version);
+
+} State_ChunkType;
+
+State_ChunkType State_Chunks[] =
+{
+	{{'C','P','U',' '}, 1, false, 0, State_SyncCPU},
+	{{'S','N','E','S'}, 1, false, 0, State_SyncSNES},
+	{{'W','R','A','M'}, 1, true,  0, State_SyncWRAM},
+	{{'S','R','A','M'}, 1, true,  0, State_SyncSRAM},
+	{{'D','M','A',' '}, 1, false, 0, State_SyncDMA},
+	{{'S','P','C',' '}, 1, false, 0, State_SyncSPC},
+	{{'A','R','A','M'}, 1, true,  0, State_SyncARAM},
+	{{'D','S','P',' '}, 1, false, STATE_NODSP, State_SyncDSP},
+	{{'P','P','U',' '}, 1, true,  0, State_SyncPPU},
+};
+
+#define NUM_CHUNKS (sizeof(State_Chunks) / sizeof(State_ChunkType))
+
+
+void State_PutHeader(u8* ptr, const char* tag, u16 version, u16 flags, u32 size, u32 rawsize)
+{
+	memcpy(&ptr[0], tag, 4);
+	memcpy(&ptr[4], &version, 2);
+	memcpy(&ptr[6], &flags, 2);
+	memcpy(&ptr[8], &size, 4);
+	memcpy(&ptr[12], &rawsize, 4);
+}
+
+u32 State_MaxSize()
+{
+	u32 ret = 8 + ((NUM_CHUNKS + 1) * 16);
+
+	ret += 0x20000;						// WRAM
+	if (SNES_SRAM) ret += SNES_SRAMMask + 1;
+	ret += 0x10040;						// ARAM
+	ret += sizeof(channels) + 0x100;	// DSP
+	ret += 0x10000 + 0x200 + 0x220;		// PPU
+	ret += 0x1000;						// all the little things
+
+	return ret;
+}
+
+u32 State_SaveMem(u8* buf, u32 maxlen, u32 flags)
+{
+	u32 i;
+	u32 version = STATE_VERSION;
+
+	if (maxlen < 8 + 16) return 0;
+
+	State_Buf = buf;
+	State_Len = maxlen;
+	State_Saving = true;
+	State_Overflow = false;
+
+	memcpy(&buf[0], "BSST", 4);
+	memcpy(&buf[4], &version, 4);
+	State_Pos = 8;
+
+	for (i = 0; i < NUM_CHUNKS; i++)
+	{
+		State_ChunkType* c = &State_Chunks[i];
+		u32 hdr = State_Pos;
+		u16 cflags = 0;
+
+		if (flags & c->Omit) continue;
+		if (State_Pos + 16 > State_Len) return 0;
+		State_Pos += 16;
+
+		c->Sync(c->Version);
+		if (State_Overflow) return 0;
+
+		u32 rawsize = State_Pos - (hdr + 16);
+		u32 size = rawsize;
+
+		if ((flags & STATE_COMPRESS) && c->Pack && rawsize >= STATE_PACK_MIN)
+		{
+			u8* tmp = (u8*)malloc(rawsize);
+			if (tmp)
+			{
+				u32 packed = State_Pack(tmp, rawsize - 1, &buf[hdr + 16], rawsize);
+				if (packed)
+				{
+					memcpy(&buf[hdr + 16], tmp, packed);
+					size = packed;
+					cflags |= CHUNK_PACKED;
+				}
+				free(tmp);
+			}
+		}
+
+		State_PutHeader(&buf[hdr], c->Tag, c->Version, cflags, size, rawsize);
+		State_Pos = hdr + 16 + size;
+	}
+
+	if (State_Pos + 16 > State_Len) return 0;
+	State_PutHeader(&buf[State_Pos], "END ", 1, 0, 0, 0);
+	State_Pos += 16;
+
+	return State_Pos;
+}
+
+bool State_LoadMem(u8* buf, u32 len)
+{
+	u32 i, pos;
+	u32 version;
+	bool ret = false;
+
+	// what goes into each chunk, unpacked, found before anything is applied
+	// so that a broken file doesn't leave us half loaded
+	struct
+	{
+		u8* Data;
+		u32 Len;
+		u16 Version;
+		bool Unpacked;
+
+	} chunks[NUM_CHUNKS];
+
+	if (len < 8 + 16) return false;
+	if (memcmp(&buf[0], "BSST", 4)) return false;
+
+	memcpy(&version, &buf[4], 4);
+	if (version > STATE_VERSION)
+	{
+		bprintf("Savestate is from a newer version\n");
+		return false;
+	}
+
+	memset(chunks, 0, sizeof(chunks));
+
+	pos = 8;
+	for (;;)
+	{
+		u16 cversion, cflags;
+		u32 size, rawsize;
+
+		if (pos + 16 > len) goto done;
+		if (!memcmp(&buf[pos], "END ", 4)) break;
+
+		memcpy(&cversion, &buf[pos + 4], 2);
+		memcpy(&cflags, &buf[pos + 6], 2);
+		memcpy(&size, &buf[pos + 8], 4);
+		memcpy(&rawsize, &buf[pos + 12], 4);
+		if (size > len - (pos + 16)) goto done;
+
+		for (i = 0; i < NUM_CHUNKS; i++)
+		{
+			if (memcmp(&buf[pos], State_Chunks[i].Tag, 4)) continue;
+			if (chunks[i].Data) goto done;
+
+			chunks[i].Data = &buf[pos + 16];
+			chunks[i].Len = size;
+			chunks[i].Version = cversion;
+
+			if (cflags & CHUNK_PACKED)
+			{
+				u8* unpacked = (u8*)malloc(rawsize ? rawsize : 1);
+				if (!unpacked) goto done;
+
+				chunks[i].Data = unpacked;
+				chunks[i].Len = rawsize;
+				chunks[i].Unpacked = true;
+
+				if (State_Unpack(unpacked, rawsize, &buf[pos + 16], size) != rawsize)
+					goto done;
+			}
+			break;
+		}
+
+		pos += 16 + size;
+	}
+
+	// all good, now nothing can fail
+	State_Saving = false;
+
+	for (i = 0; i < NUM_CHUNKS; i++)
+	{
+		if (!chunks[i].Data) continue;
+
+		State_Chunk = chunks[i].Data;
+		State_ChunkLen = chunks[i].Len;
+		State_ChunkPos = 0;
+
+		State_Chunks[i].Sync(chunks[i].Version);
+	}
+
+	ret = true;
+
+done:
+	for (i = 0; i < NUM_CHUNKS; i++)
+	{
+		if (chunks[i].Unpacked)
+			free(chunks[i].Data);
+	}
+
+	return ret;
+}
+
+
+bool State_Save(char* path)
+{
+	bool ret = false;
+
+	u32 maxlen = State_MaxSize();
+	u8* buf = (u8*)malloc(maxlen);
+	if (!buf) return false;
+
+	u32 len = State_SaveMem(buf, maxlen, STATE_COMPRESS);
+	if (!len)
+	{
+		free(buf);
+		return false;
+	}
+
+#ifdef _3DS
+	Handle file;
+	FS_path filePath;
+	filePath.type = PATH_CHAR;
+	filePath.size = strlen(path) + 1;
+	filePath.data = (u8*)path;
+
+	Result res = FSUSER_OpenFile(NULL, &file, sdmcArchive, filePath, FS_OPEN_CREATE|FS_OPEN_WRITE, FS_ATTRIBUTE_NONE);
+	if (!res)
+	{
+		u32 byteswritten = 0;
+		FSFILE_SetSize(file, (u64)len);
+		FSFILE_Write(file, &byteswritten, 0, (u32*)buf, len, FS_WRITE_FLUSH);
+		FSFILE_Close(file);
+		ret = (byteswritten == len);
+	}
+#else
+	FILE* file = fopen(path, "wb");
+	if (file)
+	{
+		ret = (fwrite(buf, 1, len, file) == len);
+		fclose(file);
+	}
+#endif
+
+	free(buf);
+	return ret;
+}
+
+bool State_Load(char* path)
+{
+	bool ret = false;
+	u8* buf = NULL;
+	u32 len = 0;
+
+#ifdef _3DS
+	Handle file;
+	FS_path filePath;
+	filePath.type = PATH_CHAR;
+	filePath.size = strlen(path) + 1;
+	filePath.data = (u8*)path;
+
+	Result res = FSUSER_OpenFile(NULL, &file, sdmcArchive, filePath, FS_OPEN_READ, FS_ATTRIBUTE_NONE);
+	if (res) return false;
+
+	u64 size64 = 0;
+	FSFILE_GetSize(file, &size64);
+	len = (u32)size64;
+
+	buf = (u8*)malloc(len);
+	if (buf)
+	{
+		u32 bytesread = 0;
+		FSFILE_Read(file, &bytesread, 0, (u32*)buf, len);
+		if (bytesread != len) len = 0;
+	}
+	FSFILE_Close(file);
+#else
+	FILE* file = fopen(path, "rb");
+	if (!file) return false;
+
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	buf = (u8*)malloc(len);
+	if (buf)
+	{
+		if (fread(buf, 1, len, file) != len) len = 0;
+	}
+	fclose(file);
+#endif
+
+	if (buf)
+	{
+		ret = State_LoadMem(buf, len);
+		free(buf);
+	}
+
+	return ret;
+}
@@ -0,0 +1,49 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef _SAVESTATE_H_
+#define _SAVESTATE_H_
+
+// savestates
+//
+// file format:
+//   "BSST", u32 format version
+//   then chunks: char tag[4], u16 version, u16 flags, u32 size, u32 rawsize, data
+//   ends with an "END " chunk
+//
+// chunks we don't know about are skipped. fields are only ever added at the
+// end of a chunk (bump its version), and loading a shorter chunk leaves the
+// missing fields alone. flag bit0 = the data is RLE packed.
+//
+// only call these while the emulation is paused (the SPC thread must be idle),
+// or between frames with STATE_NODSP
+
+#define STATE_COMPRESS	(1 << 0)
+#define STATE_NODSP		(1 << 1)	// leave the DSP out (the mixer thread owns it while running)
+
+// upper bound for the size of a state, for allocating buffers
+u32 State_MaxSize();
+
+// serialize into buf, returns the size (0 if it didn't fit)
+u32 State_SaveMem(u8* buf, u32 maxlen, u32 flags);
+bool State_LoadMem(u8* buf, u32 len);
+
+bool State_Save(char* path);
+bool State_Load(char* path);
+
+#endif
@@ -24,6 +24,7 @@
 #include "snes.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "profile.h"
 
 
 u8* ROM_Bank0;
@@ -37,6 +38,7 @@ u32 SNES_SRAMMask;
 u8* SNES_SRAM = NULL;
 
 char SNES_SRAMPath[300];
+char SNES_StatePath[300];
 extern FS_archive sdmcArchive;
 
 // addressing: BBBBBBBB:AAAaaaaa:aaaaaaaa
@@ -94,6 +96,107 @@ void SNES_Init()
 	// TODO get rid of this junk!
 	SNES_Status = (SNES_StatusData*)&_Mem_PtrTable[0];
 	Mem_PtrTable = &_Mem_PtrTable[SNESSTATUS_SIZE >> 2];
+	
+	SNES_InitIO();
+}
+
+
+// I/O dispatch tables
+// mem_io.s indexes IO_Pages with address bits 8-15 and calls the handler
+// for the low byte directly, no compare chains
+
+IO_Page* IO_Pages[0x100];
+
+IO_Page IO_PPUPage;
+IO_Page IO_JoyPage;
+IO_Page IO_GIOPage;
+IO_Page IO_DMAPage;
+IO_Page IO_OpenBusPage;
+
+u8 IO_OpenBusRead8(u32 addr)
+{
+	return SNES_Status->LastBusVal;
+}
+
+u16 IO_OpenBusRead16(u32 addr)
+{
+	u8 val = SNES_Status->LastBusVal;
+	return val | (val << 8);
+}
+
+void IO_OpenBusWrite8(u32 addr, u8 val)
+{
+}
+
+void IO_OpenBusWrite16(u32 addr, u16 val)
+{
+}
+
+void SNES_InitIO()
+{
+	int i;
+	
+	for (i = 0; i < 256; i++)
+	{
+		IO_PPUPage.Read8[i] = PPU_Read8;
+		IO_PPUPage.Read16[i] = PPU_Read16;
+		IO_PPUPage.Write8[i] = PPU_Write8;
+		IO_PPUPage.Write16[i] = PPU_Write16;
+		
+		IO_JoyPage.Read8[i] = SNES_JoyRead8;
+		IO_JoyPage.Read16[i] = SNES_JoyRead16;
+		IO_JoyPage.Write8[i] = SNES_JoyWrite8;
+		IO_JoyPage.Write16[i] = SNES_JoyWrite16;
+		
+		// these writes may reschedule the IRQ, the wrappers take care of it
+		IO_GIOPage.Read8[i] = SNES_GIORead8;
+		IO_GIOPage.Read16[i] = SNES_GIORead16;
+		IO_GIOPage.Write8[i] = IO_GIOWrite8;
+		IO_GIOPage.Write16[i] = IO_GIOWrite16;
+		
+		IO_DMAPage.Read8[i] = DMA_Read8;
+		IO_DMAPage.Read16[i] = DMA_Read16;
+		IO_DMAPage.Write8[i] = DMA_Write8;
+		IO_DMAPage.Write16[i] = DMA_Write16;
+		
+		IO_OpenBusPage.Read8[i] = IO_OpenBusRead8;
+		IO_OpenBusPage.Read16[i] = IO_OpenBusRead16;
+		IO_OpenBusPage.Write8[i] = IO_OpenBusWrite8;
+		IO_OpenBusPage.Write16[i] = IO_OpenBusWrite16;
+	}
+	
+	IO_PPUPage.Cycles = 0;
+	IO_JoyPage.Cycles = 6;
+	IO_GIOPage.Cycles = 0;
+	IO_DMAPage.Cycles = 0;
+	IO_OpenBusPage.Cycles = 0;
+	
+	IO_PPUPage.Write8[0x04] = PPU_WriteOAM;
+	IO_PPUPage.Write8[0x18] = PPU_WriteVRAML;
+	IO_PPUPage.Write8[0x19] = PPU_WriteVRAMH;
+	IO_PPUPage.Write16[0x18] = PPU_WriteVRAM16;
+	IO_PPUPage.Write8[0x22] = PPU_WriteCGRAM;
+	for (i = 0x40; i < 0x44; i++)
+	{
+		IO_PPUPage.Read8[i] = PPU_ReadAPUIO8;
+		IO_PPUPage.Write8[i] = PPU_WriteAPUIO8;
+	}
+	IO_PPUPage.Read16[0x40] = PPU_ReadAPUIO16;
+	IO_PPUPage.Read16[0x42] = PPU_ReadAPUIO16;
+	IO_PPUPage.Write16[0x40] = PPU_WriteAPUIO16;
+	IO_PPUPage.Write16[0x41] = PPU_WriteAPUIO16;
+	IO_PPUPage.Write16[0x42] = PPU_WriteAPUIO16;
+	
+	IO_JoyPage.Read8[0x16] = SNES_ReadJOYA;
+	IO_JoyPage.Write8[0x16] = SNES_WriteJOYWR;
+	
+	for (i = 0; i < 0x100; i++)
+		IO_Pages[i] = &IO_OpenBusPage;
+	
+	IO_Pages[0x21] = &IO_PPUPage;
+	IO_Pages[0x40] = &IO_JoyPage;
+	IO_Pages[0x42] = &IO_GIOPage;
+	IO_Pages[0x43] = &IO_DMAPage;
 }
 
 
@@ -117,7 +220,6 @@ bool SNES_LoadROM(char* path)
 	SNES_Status->ScreenHeight = 224;
 	
 	SNES_Status->SPC_CycleRatio = ROM_Region ? 0x000C51D9 : 0x000C39C6;
-	SNES_Status->SPC_CycleRatio += 0x1000; // hax -- TODO investigate why we need this to run at a somewhat proper rate
 	SNES_Status->SPC_CyclesPerLine = SNES_Status->SPC_CycleRatio * 1364;
 	//SNES_Status->SPC_CyclesPerLine = ROM_Region ? 0x41A41A42 : 0x4123D3B5;
 	
@@ -125,6 +227,10 @@ bool SNES_LoadROM(char* path)
 	SNES_SRAMMask &= 0x000FFFFF;
 	bprintf("SRAM size: %dKB\n", (SNES_SRAMMask+1) >> 10);
 	
+	strncpy(SNES_StatePath, path, strlen(path)-3);
+	strncpy(SNES_StatePath + strlen(path)-3, "sst", 3);
+	SNES_StatePath[strlen(path)] = '\0';
+	
 	if (SNES_SRAMMask)
 	{
 		strncpy(SNES_SRAMPath, path, strlen(path)-3);
@@ -157,6 +263,10 @@ void SNES_Reset()
 {
 	u32 i, a, b;
 	
+#ifdef PROFILER
+	Prof_Reset();
+#endif
+	
 	// generate random garbage to fill the RAM with
 	u64 t = osGetTime();
 	u32 randblarg = (u32)(t ^ (t >> 32ULL) ^ (t >> 19ULL) ^ (t << 7ULL) ^ (t >> 53ULL));
@@ -587,27 +697,39 @@ void SNES_GIOWrite16(u32 addr, u16 val)
 }
 
 
+u8 SNES_ReadJOYA(u32 addr)
+{
+	// TODO: investigate later
+	// this shit breaks SMAS SMB1 (pressing Start returns to menu)
+	/*if (SNES_Joy16 & 0x01)
+	{
+		return 0;
+	}
+	else
+	{
+		if (SNES_JoyBit == 0) IO_ManualReadKeys();
+		
+		u8 ret = (SNES_JoyBuffer >> (SNES_JoyBit ^ 15)) & 1;
+		SNES_JoyBit++;
+		return ret;
+	}*/
+	return 0x01;
+}
+
+void SNES_WriteJOYWR(u32 addr, u8 val)
+{
+	if (!(SNES_Joy16 & 0x01) && (val & 0x01))
+		SNES_JoyBit = 0;
+	
+	SNES_Joy16 = val;
+}
+
 u8 SNES_JoyRead8(u32 addr)
 {
 	u8 ret = 0;
 
 	if (addr == 0x16)
-	{
-		// TODO: investigate later
-		// this shit breaks SMAS SMB1 (pressing Start returns to menu)
-		/*if (SNES_Joy16 & 0x01)
-		{
-			ret = 0;
-		}
-		else
-		{
-			if (SNES_JoyBit == 0) IO_ManualReadKeys();
-			
-			ret = (SNES_JoyBuffer >> (SNES_JoyBit ^ 15)) & 1;
-			SNES_JoyBit++;
-		}*/
-		ret = 0x01;
-	}
+		ret = SNES_ReadJOYA(addr);
 	else if (addr != 0x17) 
 		ret = SNES_Status->LastBusVal;
 
@@ -622,12 +744,7 @@ u16 SNES_JoyRead16(u32 addr)
 void SNES_JoyWrite8(u32 addr, u8 val)
 {
 	if (addr == 0x16)
-	{
-		if (!(SNES_Joy16 & 0x01) && (val & 0x01))
-			SNES_JoyBit = 0;
-		
-		SNES_Joy16 = val;
-	}
+		SNES_WriteJOYWR(addr, val);
 }
 
 void SNES_JoyWrite16(u32 addr, u16 val)
@@ -639,6 +756,8 @@ void SNES_JoyWrite16(u32 addr, u16 val)
 
 // this used for DMA
 // I/O only available for 4210-421F, they say
+// these go through the I/O tables directly, SNES_IORead8 & co are for the CPU
+// (they add the page cycles, and the $42xx write wrappers touch CPU registers)
 
 u8 SNES_Read8(u32 addr)
 {
@@ -648,7 +767,7 @@ u8 SNES_Read8(u32 addr)
 		if ((addr & 0xFFF0) != 0x4210)
 			return 0xFF;
 		
-		return SNES_IORead8(addr);
+		return IO_Pages[(addr >> 8) & 0xFF]->Read8[addr & 0xFF](addr & 0xFF);
 	}
 	else
 	{
@@ -665,7 +784,7 @@ u16 SNES_Read16(u32 addr)
 		if ((addr & 0xFFF0) != 0x4210)
 			return 0xFFFF;
 		
-		return SNES_IORead16(addr);
+		return IO_Pages[(addr >> 8) & 0xFF]->Read16[addr & 0xFF](addr & 0xFF);
 	}
 	else
 	{
@@ -682,8 +801,10 @@ void SNES_Write8(u32 addr, u8 val)
 	if (ptr & MPTR_SPECIAL)
 	{
 		// CHECKME: what are the writable ranges with DMA?
-		if ((addr & 0xFFF0) != 0x4000)
-			SNES_IOWrite8(addr, val);
+		if ((addr & 0xFF00) == 0x4200)
+			SNES_GIOWrite8(addr & 0xFF, val);
+		else if ((addr & 0xFFF0) != 0x4000)
+			IO_Pages[(addr >> 8) & 0xFF]->Write8[addr & 0xFF](addr & 0xFF, val);
 	}
 	else
 	{
@@ -699,8 +820,10 @@ void SNES_Write16(u32 addr, u8 val)
 	if (ptr & MPTR_SPECIAL)
 	{
 		// CHECKME: what are the writable ranges with DMA?
-		if ((addr & 0xFFF0) != 0x4000)
-			SNES_IOWrite16(addr, val);
+		if ((addr & 0xFF00) == 0x4200)
+			SNES_GIOWrite16(addr & 0xFF, val);
+		else if ((addr & 0xFFF0) != 0x4000)
+			IO_Pages[(addr >> 8) & 0xFF]->Write16[addr & 0xFF](addr & 0xFF, val);
 	}
 	else
 	{
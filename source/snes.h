@@ -24,13 +24,16 @@
 
 typedef struct
 {
+	u16 SliceEnd;		// -44 | end of the current CPU_Run() slice
+	u8 __pad4[2];		// -42
+	
 	u8 __pad3[2];		// -40 
 	u8 LastBusVal;		// -38
 	u8 __pad2;			// -37
 	
 	s32 SPC_CyclesPerLine;	// -36 | cycleratio * 1364
-	s32 SPC_CycleRatio;		// -32
-	s32 SPC_LastCycle;		// -28 | SPC cycle count (<<24) at last SPC run
+	s32 SPC_CycleRatio;		// -32 | SPC cycles per master cycle (<<24)
+	s32 SPC_LastCycle;		// -28 | how far into the line the SPC has run (<<24)
 	
 	u16 IRQ_VMatch;		// -24
 	u16 IRQ_HMatch;		// -22
@@ -72,6 +75,21 @@ extern u8 SNES_Joy16;
 #define MPTR_READONLY	(1 << 2)
 #define MPTR_SRAM		(1 << 3)
 
+// I/O dispatch
+// one page per 256 bytes of I/O space, indexed by address bits 8-15
+// the layout is known by mem_io.s, don't change it
+typedef struct
+{
+	u32 Cycles;		// extra cycles per byte accessed
+	u8 (*Read8[256])(u32 addr);
+	u16 (*Read16[256])(u32 addr);
+	void (*Write8[256])(u32 addr, u8 val);
+	void (*Write16[256])(u32 addr, u16 val);
+	
+} IO_Page;
+
+extern IO_Page* IO_Pages[0x100];
+
 extern u32 ROM_BaseOffset;
 extern u8* ROM_Buffer;
 extern u32 ROM_HeaderOffset;
@@ -90,6 +108,8 @@ extern u8 SNES_SysRAM[0x20000];
 
 extern u8 SNES_WRIO;
 
+extern char SNES_StatePath[300];
+
 extern u8 SPC_IOPorts[8];
 
 
@@ -109,6 +129,10 @@ u16 SNES_IORead16(u32 addr);
 void SNES_IOWrite8(u32 addr, u32 val);
 void SNES_IOWrite16(u32 addr, u32 val);
 
+void SNES_InitIO();
+void IO_GIOWrite8(u32 addr, u8 val);
+void IO_GIOWrite16(u32 addr, u16 val);
+
 void report_unk_lol(u32 op, u32 pc);
 void reportBRK(u32 pc);
 
@@ -121,6 +145,8 @@ u8 SNES_JoyRead8(u32 addr);
 u16 SNES_JoyRead16(u32 addr);
 void SNES_JoyWrite8(u32 addr, u8 val);
 void SNES_JoyWrite16(u32 addr, u16 val);
+u8 SNES_ReadJOYA(u32 addr);
+void SNES_WriteJOYWR(u32 addr, u8 val);
 
 u8 DMA_Read8(u32 addr);
 u16 DMA_Read16(u32 addr);
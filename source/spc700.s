@@ -26,6 +26,7 @@
 @ -----------------------------------------------------------------------------
 
 #include "spc700.inc"
+#include "timing.h"
 
 .data
 
@@ -345,6 +346,12 @@ SPC_Reset:
 @ r0 = number of cycles to run
 SPC_Run:
 	stmdb sp!, {r3-r12, lr}
+	
+	stmdb sp!, {r0}
+	mov r0, #TIMING_SPC
+	bl Timing_Begin
+	ldmia sp!, {r0}
+	
 	LoadRegs
 	
 	add spcCycles, r0
@@ -354,6 +361,10 @@ SPC_Run:
 spcloop:
 		
 		Prefetch8
+#ifdef PROFILER
+		ldr r1, =Prof_SPCCurOp
+		str r0, [r1]
+#endif
 		ldr pc, [pc, r0, lsl #0x2]
 		nop
 	.long OP_NOP, OP_TCALL_0, OP_SET0, OP_BBS_0, OP_OR_A_DP, OP_OR_A_lm, OP_OR_A_mX, OP_OR_A_m_Y	@0
@@ -392,6 +403,13 @@ spcloop:
 op_return:
 		@ r3 = cycles taken by the instruction
 
+#ifdef PROFILER
+		stmdb sp!, {r3, r12}
+		mov r0, r3
+		bl Prof_SPCOp
+		ldmia sp!, {r3, r12}
+#endif
+
 		ldrb r0, [memory, #-8] @ timer enable
 		
 		tst r0, #0x01
@@ -442,6 +460,8 @@ noTimer2:
 		
 spcpause:
 	StoreRegs
+	mov r0, #TIMING_SPC
+	bl Timing_End
 	ldmia sp!, {r3-r12, pc}
 		
 .ltorg
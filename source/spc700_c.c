@@ -0,0 +1,849 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+// portable C version of the SPC700 core (spc700.s), same deal as cpu_c.c
+// it behaves like the asm core, quirks included (H is set along with V, etc),
+// so fix things in both places
+//
+// the only differences are where spc700.s would go outside of SPC_RAM or
+// leave junk in the upper bits of a register: here addresses wrap at 64K
+// and the registers stay 8-bit
+//
+// the 3DS build still uses spc700.s
+
+#ifndef ARM11
+
+#include <stdint.h>
+
+#include "snes.h"
+#include "spc700.h"
+#include "dsp.h"
+#include "timing.h"
+#include "profile.h"
+
+
+#define flagC	0x01
+#define flagZ	0x02
+#define flagI	0x04	// interrupt enable (unused)
+#define flagH	0x08	// half carry
+#define flagB	0x10	// break (unused)
+#define flagP	0x20	// direct page
+#define flagV	0x40
+#define flagN	0x80
+#define flagR	0x100	// ROM access flag (0 = RAM, 1 = ROM)
+
+#define vec_Reset 0xFFC0
+
+
+SPC_Regs_t SPC_Regs;
+
+u32 dbgcycles = 0;
+u32 nruns = 0;
+
+u32 SPC_TimerReload[3];
+SPC_Timer SPC_TimerVal[3];
+u8 SPC_TimerEnable;
+u32 SPC_ElapsedCycles;
+
+u8 SPC_RAM[0x10040];
+u8 SPC_ROM[0x40] =
+{
+	0xCD,0xEF,0xBD,0xE8,0x00,0xC6,0x1D,0xD0,
+	0xFC,0x8F,0xAA,0xF4,0x8F,0xBB,0xF5,0x78,
+	0xCC,0xF4,0xD0,0xFB,0x2F,0x19,0xEB,0xF4,
+	0xD0,0xFC,0x7E,0xF4,0xD0,0x0B,0xE4,0xF5,
+	0xCB,0xF4,0xD7,0x00,0xFC,0xD0,0xF3,0xAB,
+	0x01,0x10,0xEF,0x7E,0xF4,0x10,0xEB,0xBA,
+	0xF6,0xDA,0x00,0xBA,0xF4,0xC4,0xF4,0xDD,
+	0x5D,0xD0,0xDB,0x1F,0x00,0x00,0xC0,0xFF
+};
+
+void SPC_ReportUnk(u8 op, u32 pc);
+
+// live registers, same as r6-r11 in spc700.s
+static u32 spcA, spcX, spcY;
+static u32 spcSP;		// with bit 8 set
+static u32 spcPC;
+static u32 spcPSW;
+static s32 spcCycles;
+
+
+static void LoadRegs()
+{
+	spcA = SPC_Regs.A;
+	spcX = SPC_Regs.X;
+	spcY = SPC_Regs.Y;
+	spcSP = SPC_Regs.SP;
+	spcPC = SPC_Regs.PC;
+	spcPSW = SPC_Regs.PSW;
+	spcCycles = SPC_Regs.nCycles;
+}
+
+static void StoreRegs()
+{
+	SPC_Regs._memoryMap = (u32)(uintptr_t)&SPC_RAM[0];
+	SPC_Regs.A = spcA;
+	SPC_Regs.X = spcX;
+	SPC_Regs.Y = spcY;
+	SPC_Regs.SP = spcSP;
+	SPC_Regs.PC = spcPC;
+	SPC_Regs.PSW = spcPSW;
+	SPC_Regs.nCycles = spcCycles;
+}
+
+
+// --- Memory access -----------------------------------------------------------
+
+// the IPL ROM and the RAM under it trade places at $FFC0/$10000
+static void UpdateMemMap(u32 val)
+{
+	int i;
+
+	if (!((val ^ (spcPSW >> 1)) & 0x80))
+		return;
+
+	spcPSW ^= flagR;
+	for (i = 0; i < 0x40; i++)
+	{
+		u8 tmp = SPC_RAM[0xFFC0 + i];
+		SPC_RAM[0xFFC0 + i] = SPC_RAM[0x10000 + i];
+		SPC_RAM[0x10000 + i] = tmp;
+	}
+}
+
+static u32 MemRead8(u32 addr)
+{
+	addr &= 0xFFFF;
+	if ((addr & ~0xF) == 0xF0)
+		return SPC_IORead8(addr);
+
+	return SPC_RAM[addr];
+}
+
+static u32 MemRead16(u32 addr)
+{
+	addr &= 0xFFFF;
+	if ((addr & ~0xF) == 0xF0)
+		return SPC_IORead16(addr);
+
+	return SPC_RAM[addr] | (SPC_RAM[(addr + 1) & 0xFFFF] << 8);
+}
+
+// writes to $FFC0-$FFFF go to the RAM even when the ROM is mapped there
+static void MemWrite8(u32 addr, u32 val)
+{
+	addr &= 0xFFFF;
+	if ((addr & ~0xF) == 0xF0)
+	{
+		if (addr == 0xF1) UpdateMemMap(val);
+		SPC_IOWrite8(addr, val & 0xFF);
+		return;
+	}
+
+	if (addr >= 0xFFC0) addr += (spcPSW & flagR) >> 2;
+	SPC_RAM[addr] = val;
+}
+
+static void MemWrite16(u32 addr, u32 val)
+{
+	addr &= 0xFFFF;
+	if ((addr & ~0xF) == 0xF0)
+	{
+		if (addr == 0xF0) UpdateMemMap(val >> 8);
+		else if (addr == 0xF1) UpdateMemMap(val);
+		SPC_IOWrite16(addr, val & 0xFFFF);
+		return;
+	}
+
+	if (addr >= 0xFFC0) addr += (spcPSW & flagR) >> 2;
+	SPC_RAM[addr] = val;
+	SPC_RAM[addr + 1] = val >> 8;
+}
+
+
+// the stack is always in page 1
+
+static u32 StackRead8()
+{
+	spcSP = ((spcSP + 1) & 0xFF) | 0x100;
+	return SPC_RAM[spcSP];
+}
+
+static u32 StackRead16()
+{
+	spcSP = ((spcSP + 2) & 0xFF) | 0x100;
+	return SPC_RAM[spcSP - 1] | (SPC_RAM[spcSP] << 8);
+}
+
+static void StackWrite8(u32 val)
+{
+	SPC_RAM[spcSP] = val;
+	spcSP = ((spcSP - 1) & 0xFF) | 0x100;
+}
+
+static void StackWrite16(u32 val)
+{
+	SPC_RAM[spcSP - 1] = val;
+	SPC_RAM[spcSP] = val >> 8;
+	spcSP = ((spcSP - 2) & 0xFF) | 0x100;
+}
+
+
+// opcode and operand fetches read the memory directly, no I/O
+
+static u32 Prefetch8()
+{
+	u32 val = SPC_RAM[spcPC];
+	spcPC = (spcPC + 1) & 0xFFFF;
+	return val;
+}
+
+static u32 Prefetch16()
+{
+	u32 val = Prefetch8();
+	return val | (Prefetch8() << 8);
+}
+
+
+// --- Addressing modes --------------------------------------------------------
+
+static u32 Addr_DP()
+{
+	u32 addr = Prefetch8();
+	if (spcPSW & flagP) addr |= 0x100;
+	return addr;
+}
+
+static u32 Addr_DPX()
+{
+	u32 addr = Prefetch8() + spcX;
+	if (spcPSW & flagP) addr |= 0x100;
+	else addr &= 0xFF;
+	return addr;
+}
+
+static u32 Addr_DPY()
+{
+	u32 addr = Prefetch8() + spcY;
+	if (spcPSW & flagP) addr |= 0x100;
+	else addr &= 0xFF;
+	return addr;
+}
+
+static u32 Addr_mX() { return (spcPSW & flagP) ? (spcX | 0x100) : spcX; }
+static u32 Addr_mY() { return (spcPSW & flagP) ? (spcY | 0x100) : spcY; }
+
+// like in spc700.s, these two ignore the P flag
+static u32 Addr_IndX() { return MemRead16(Prefetch8() + spcX); }
+static u32 Addr_IndY() { return MemRead16(Prefetch8()) + spcY; }
+
+static u32 Addr_Abs() { return Prefetch16(); }
+static u32 Addr_AbsX() { return Prefetch16() + spcX; }
+static u32 Addr_AbsY() { return Prefetch16() + spcY; }
+
+
+// --- Operations --------------------------------------------------------------
+
+#define SetNZ(v) \
+	spcPSW &= ~(flagN|flagZ); \
+	if ((v) & 0x80) spcPSW |= flagN; \
+	if (!((v) & 0xFF)) spcPSW |= flagZ;
+
+static u32 Op_OR(u32 a, u32 b) { a |= b; SetNZ(a); return a; }
+static u32 Op_AND(u32 a, u32 b) { a &= b; SetNZ(a); return a; }
+static u32 Op_EOR(u32 a, u32 b) { a ^= b; SetNZ(a); return a; }
+
+static u32 Op_ADC(u32 a, u32 b)
+{
+	u32 res = a + b + (spcPSW & flagC);
+
+	spcPSW &= ~(flagN|flagV|flagH|flagZ|flagC);
+	if (res & 0x80) spcPSW |= flagN;
+	if (res & 0x100) spcPSW |= flagC;
+	if (!((a ^ b) & 0x80) && ((b ^ res) & 0x80)) spcPSW |= (flagV|flagH);
+
+	res &= 0xFF;
+	if (!res) spcPSW |= flagZ;
+	return res;
+}
+
+static u32 Op_SBC(u32 a, u32 b)
+{
+	u32 res = a - b - (~spcPSW & flagC);
+
+	spcPSW &= ~(flagN|flagV|flagH|flagZ|flagC);
+	if (res & 0x80) spcPSW |= flagN;
+	if (!(res & 0x100)) spcPSW |= flagC;
+	if (((a ^ b) & 0x80) && ((a ^ res) & 0x80)) spcPSW |= (flagV|flagH);
+
+	res &= 0xFF;
+	if (!res) spcPSW |= flagZ;
+	return res;
+}
+
+// doesn't write anything back, returns the first operand so it fits in with the rest
+static u32 Op_CMP(u32 a, u32 b)
+{
+	s32 res = (s32)a - (s32)b;
+
+	spcPSW &= ~(flagN|flagZ|flagC);
+	if (res >= 0) spcPSW |= flagC;
+	if (!(res & 0xFF)) spcPSW |= flagZ;
+	if (res & 0x80) spcPSW |= flagN;
+	return a;
+}
+
+static u32 Op_ASL(u32 val)
+{
+	val <<= 1;
+	spcPSW &= ~flagC;
+	if (val & 0x100) spcPSW |= flagC;
+	val &= 0xFF;
+	SetNZ(val);
+	return val;
+}
+
+static u32 Op_LSR(u32 val)
+{
+	spcPSW &= ~flagC;
+	if (val & 0x1) spcPSW |= flagC;
+	val >>= 1;
+	SetNZ(val);
+	return val;
+}
+
+static u32 Op_ROL(u32 val)
+{
+	val = (val << 1) | (spcPSW & flagC);
+	spcPSW &= ~flagC;
+	if (val & 0x100) spcPSW |= flagC;
+	val &= 0xFF;
+	SetNZ(val);
+	return val;
+}
+
+static u32 Op_ROR(u32 val)
+{
+	val |= (spcPSW & flagC) << 8;
+	spcPSW &= ~flagC;
+	if (val & 0x1) spcPSW |= flagC;
+	val >>= 1;
+	SetNZ(val);
+	return val;
+}
+
+static u32 Op_INC(u32 val) { val = (val + 1) & 0xFF; SetNZ(val); return val; }
+static u32 Op_DEC(u32 val) { val = (val - 1) & 0xFF; SetNZ(val); return val; }
+
+static u32 Op_MOV(u32 val) { SetNZ(val); return val; }
+
+
+static void Branch(bool cond, u32* cycles, u32 taken, u32 nottaken)
+{
+	if (cond)
+	{
+		s8 offset = (s8)Prefetch8();
+		spcPC = (spcPC + offset) & 0xFFFF;
+		*cycles = taken;
+	}
+	else
+	{
+		spcPC = (spcPC + 1) & 0xFFFF;
+		*cycles = nottaken;
+	}
+}
+
+static void Call(u32 addr)
+{
+	StackWrite16(spcPC);
+	spcPC = addr;
+}
+
+// mem.bit operand: the bit number is in the top 3 bits
+static u32 BitOperand(u32* bit)
+{
+	u32 addr = Prefetch16();
+	*bit = 1 << (addr >> 13);
+	return addr & 0x1FFF;
+}
+
+static void Op_DIV()
+{
+	u32 ya, x;
+	int i;
+
+	if (!spcX)
+	{
+		spcA = 0xFF;
+		spcY = 0xFF;
+		spcPSW |= (flagN|flagV|flagH);
+		spcPSW &= ~flagZ;
+		return;
+	}
+
+	// this one is straight from spc700.s
+	ya = spcA | (spcY << 8);
+	x = spcX << 9;
+	for (i = 0; i < 9; i++)
+	{
+		ya <<= 1;
+		if (ya & 0x20000) ya ^= 0x20001;
+		if (ya >= x) ya ^= 1;
+		if (ya & 1) ya = (ya - x) & 0x1FFFF;
+	}
+
+	spcY = (ya >> 9) & 0xFF;
+	spcA = ya & 0xFF;
+	spcPSW &= ~(flagN|flagV|flagH|flagZ);
+	if (!spcA) spcPSW |= flagZ;
+	if (spcA & 0x80) spcPSW |= flagN;
+	if (ya & 0x100) spcPSW |= flagV;
+}
+
+
+// ALU ops with all their addressing modes
+// (OR 00, AND 20, EOR 40, CMP 60, ADC 80, SBC A0)
+// the ones that write to memory don't for CMP
+// spc700.s has OR's [dp+X] and [dp]+Y the wrong way around (07/17), keep that
+#define ALU_OPS(base, func, write) \
+	case base+0x04: spcA = func(spcA, MemRead8(Addr_DP())); cyc = 3; break; \
+	case base+0x05: spcA = func(spcA, MemRead8(Addr_Abs())); cyc = 4; break; \
+	case base+0x06: spcA = func(spcA, MemRead8(Addr_mX())); cyc = 3; break; \
+	case base+0x07: spcA = func(spcA, MemRead8(base ? Addr_IndX() : Addr_IndY())); cyc = 6; break; \
+	case base+0x08: spcA = func(spcA, Prefetch8()); cyc = 2; break; \
+	case base+0x09: \
+		val = MemRead8(Addr_DP()); \
+		addr = Addr_DP(); \
+		val = func(MemRead8(addr), val); \
+		if (write) MemWrite8(addr, val); \
+		cyc = 6; break; \
+	case base+0x14: spcA = func(spcA, MemRead8(Addr_DPX())); cyc = 4; break; \
+	case base+0x15: spcA = func(spcA, MemRead8(Addr_AbsX())); cyc = 5; break; \
+	case base+0x16: spcA = func(spcA, MemRead8(Addr_AbsY())); cyc = 5; break; \
+	case base+0x17: spcA = func(spcA, MemRead8(base ? Addr_IndY() : Addr_IndX())); cyc = 6; break; \
+	case base+0x18: \
+		val = Prefetch8(); \
+		addr = Addr_DP(); \
+		val = func(MemRead8(addr), val); \
+		if (write) MemWrite8(addr, val); \
+		cyc = 5; break; \
+	case base+0x19: \
+		val = MemRead8(Addr_mY()); \
+		addr = Addr_mX(); \
+		val = func(MemRead8(addr), val); \
+		if (write) MemWrite8(addr, val); \
+		cyc = 5; break;
+
+// shifts and INC/DEC
+#define RMW_OPS(op_dp, op_abs, op_dpx, op_a, func) \
+	case op_dp: addr = Addr_DP(); MemWrite8(addr, func(MemRead8(addr))); cyc = 4; break; \
+	case op_abs: addr = Addr_Abs(); MemWrite8(addr, func(MemRead8(addr))); cyc = 5; break; \
+	case op_dpx: addr = Addr_DPX(); MemWrite8(addr, func(MemRead8(addr))); cyc = 5; break; \
+	case op_a: spcA = func(spcA); cyc = 2; break;
+
+// SET1/CLR1, BBS/BBC and TCALL, one for each bit
+#define BIT_OPS(n) \
+	case (n<<5)|0x02: addr = Addr_DP(); MemWrite8(addr, MemRead8(addr) | (1<<n)); cyc = 4; break; \
+	case (n<<5)|0x12: addr = Addr_DP(); MemWrite8(addr, MemRead8(addr) & ~(1<<n)); cyc = 4; break; \
+	case (n<<5)|0x03: val = MemRead8(Addr_DP()); Branch(val & (1<<n), &cyc, 7, 5); break; \
+	case (n<<5)|0x13: val = MemRead8(Addr_DP()); Branch(!(val & (1<<n)), &cyc, 7, 5); break; \
+	case (n<<5)|0x01: Call(MemRead16(0xFFDE - (n*4))); cyc = 8; break; \
+	case (n<<5)|0x11: Call(MemRead16(0xFFDE - (n*4) - 2)); cyc = 8; break;
+
+
+static u32 SPC_Execute(u32 op)
+{
+	u32 cyc = 2;
+	u32 addr, val, bit;
+
+	switch (op)
+	{
+		ALU_OPS(0x00, Op_OR, true)
+		ALU_OPS(0x20, Op_AND, true)
+		ALU_OPS(0x40, Op_EOR, true)
+		ALU_OPS(0x60, Op_CMP, false)
+		ALU_OPS(0x80, Op_ADC, true)
+		ALU_OPS(0xA0, Op_SBC, true)
+
+		RMW_OPS(0x0B, 0x0C, 0x1B, 0x1C, Op_ASL)
+		RMW_OPS(0x2B, 0x2C, 0x3B, 0x3C, Op_ROL)
+		RMW_OPS(0x4B, 0x4C, 0x5B, 0x5C, Op_LSR)
+		RMW_OPS(0x6B, 0x6C, 0x7B, 0x7C, Op_ROR)
+		RMW_OPS(0x8B, 0x8C, 0x9B, 0x9C, Op_DEC)
+		RMW_OPS(0xAB, 0xAC, 0xBB, 0xBC, Op_INC)
+
+		BIT_OPS(0) BIT_OPS(1) BIT_OPS(2) BIT_OPS(3)
+		BIT_OPS(4) BIT_OPS(5) BIT_OPS(6) BIT_OPS(7)
+
+		case 0x00: break;
+
+		// INC/DEC X/Y
+		case 0x1D: spcX = Op_DEC(spcX); break;
+		case 0x3D: spcX = Op_INC(spcX); break;
+		case 0xDC: spcY = Op_DEC(spcY); break;
+		case 0xFC: spcY = Op_INC(spcY); break;
+
+		// CMP X/Y
+		case 0xC8: Op_CMP(spcX, Prefetch8()); break;
+		case 0x3E: Op_CMP(spcX, MemRead8(Addr_DP())); cyc = 3; break;
+		case 0x1E: Op_CMP(spcX, MemRead8(Addr_Abs())); cyc = 4; break;
+		case 0xAD: Op_CMP(spcY, Prefetch8()); break;
+		case 0x7E: Op_CMP(spcY, MemRead8(Addr_DP())); cyc = 3; break;
+		case 0x5E: Op_CMP(spcY, MemRead8(Addr_Abs())); cyc = 4; break;
+
+		// MOV to A/X/Y
+		case 0xE4: spcA = Op_MOV(MemRead8(Addr_DP())); cyc = 3; break;
+		case 0xE5: spcA = Op_MOV(MemRead8(Addr_Abs())); cyc = 4; break;
+		case 0xE6: spcA = Op_MOV(MemRead8(Addr_mX())); cyc = 3; break;
+		case 0xE7: spcA = Op_MOV(MemRead8(Addr_IndX())); cyc = 6; break;
+		case 0xE8: spcA = Op_MOV(Prefetch8()); break;
+		case 0xF4: spcA = Op_MOV(MemRead8(Addr_DPX())); cyc = 4; break;
+		case 0xF5: spcA = Op_MOV(MemRead8(Addr_AbsX())); cyc = 5; break;
+		case 0xF6: spcA = Op_MOV(MemRead8(Addr_AbsY())); cyc = 5; break;
+		case 0xF7: spcA = Op_MOV(MemRead8(Addr_IndY())); cyc = 6; break;
+		case 0xBF:
+			spcA = Op_MOV(MemRead8(Addr_mX()));
+			spcX = (spcX + 1) & 0xFF;
+			cyc = 4;
+			break;
+		case 0xCD: spcX = Op_MOV(Prefetch8()); break;
+		case 0xF8: spcX = Op_MOV(MemRead8(Addr_DP())); cyc = 3; break;
+		case 0xF9: spcX = Op_MOV(MemRead8(Addr_DPY())); cyc = 4; break;
+		case 0xE9: spcX = Op_MOV(MemRead8(Addr_Abs())); cyc = 4; break;
+		case 0x8D: spcY = Op_MOV(Prefetch8()); break;
+		case 0xEB: spcY = Op_MOV(MemRead8(Addr_DP())); cyc = 3; break;
+		case 0xFB: spcY = Op_MOV(MemRead8(Addr_DPX())); cyc = 4; break;
+		case 0xEC: spcY = Op_MOV(MemRead8(Addr_Abs())); cyc = 4; break;
+
+		// MOV between registers
+		case 0x7D: spcA = Op_MOV(spcX); break;
+		case 0xDD: spcA = Op_MOV(spcY); break;
+		case 0x5D: spcX = Op_MOV(spcA); break;
+		case 0xFD: spcY = Op_MOV(spcA); break;
+		case 0x9D: spcX = Op_MOV(spcSP & 0xFF); break;
+		case 0xBD: spcSP = spcX | 0x100; break;
+
+		// MOV to memory, no flags
+		case 0xC4: MemWrite8(Addr_DP(), spcA); cyc = 4; break;
+		case 0xC5: MemWrite8(Addr_Abs(), spcA); cyc = 5; break;
+		case 0xC6: MemWrite8(Addr_mX(), spcA); cyc = 4; break;
+		case 0xC7: MemWrite8(Addr_IndX(), spcA); cyc = 7; break;
+		case 0xD4: MemWrite8(Addr_DPX(), spcA); cyc = 5; break;
+		case 0xD5: MemWrite8(Addr_AbsX(), spcA); cyc = 6; break;
+		case 0xD6: MemWrite8(Addr_AbsY(), spcA); cyc = 6; break;
+		case 0xD7: MemWrite8(Addr_IndY(), spcA); cyc = 7; break;
+		case 0xAF:
+			MemWrite8(Addr_mX(), spcA);
+			spcX = (spcX + 1) & 0xFF;
+			cyc = 4;
+			break;
+		case 0xD8: MemWrite8(Addr_DP(), spcX); cyc = 4; break;
+		case 0xD9: MemWrite8(Addr_DPY(), spcX); cyc = 5; break;
+		case 0xC9: MemWrite8(Addr_Abs(), spcX); cyc = 5; break;
+		case 0xCB: MemWrite8(Addr_DP(), spcY); cyc = 4; break;
+		case 0xDB: MemWrite8(Addr_DPX(), spcY); cyc = 5; break;
+		case 0xCC: MemWrite8(Addr_Abs(), spcY); cyc = 5; break;
+		case 0x8F:
+			val = Prefetch8();
+			MemWrite8(Addr_DP(), val);
+			cyc = 5;
+			break;
+		case 0xFA:
+			val = MemRead8(Addr_DP());
+			MemWrite8(Addr_DP(), val);
+			cyc = 5;
+			break;
+
+		// 16-bit ops
+		case 0xBA:
+			val = MemRead16(Addr_DP());
+			spcPSW &= ~(flagN|flagZ);
+			if (!val) spcPSW |= flagZ;
+			if (val & 0x8000) spcPSW |= flagN;
+			spcA = val & 0xFF;
+			spcY = val >> 8;
+			cyc = 5;
+			break;
+		case 0xDA:
+			MemWrite16(Addr_DP(), spcA | (spcY << 8));
+			cyc = 5;
+			break;
+		case 0x3A:
+		case 0x1A:
+			addr = Addr_DP();
+			val = (MemRead16(addr) + ((op == 0x3A) ? 1 : -1)) & 0xFFFF;
+			spcPSW &= ~(flagN|flagZ);
+			if (!val) spcPSW |= flagZ;
+			if (val & 0x8000) spcPSW |= flagN;
+			MemWrite16(addr, val);
+			cyc = 6;
+			break;
+		case 0x7A:
+			{
+				u32 ya = spcA | (spcY << 8);
+				val = MemRead16(Addr_DP());
+				addr = ya + val;
+				spcPSW &= ~(flagN|flagV|flagH|flagZ|flagC);
+				if (addr & 0x8000) spcPSW |= flagN;
+				if (addr & 0x10000) spcPSW |= flagC;
+				addr &= 0xFFFF;
+				if (!((ya ^ val) & 0x8000) && ((val ^ addr) & 0x8000)) spcPSW |= (flagV|flagH);
+				if (!addr) spcPSW |= flagZ;
+				spcA = addr & 0xFF;
+				spcY = addr >> 8;
+				cyc = 5;
+			}
+			break;
+		case 0x9A:
+			{
+				u32 ya = spcA | (spcY << 8);
+				val = MemRead16(Addr_DP());
+				addr = ya - val;
+				spcPSW &= ~(flagN|flagV|flagH|flagZ|flagC);
+				if (addr & 0x8000) spcPSW |= flagN;
+				if (!(addr & 0x10000)) spcPSW |= flagC;
+				if (((ya ^ val) & 0x8000) && ((ya ^ addr) & 0x8000)) spcPSW |= (flagV|flagH);
+				addr &= 0xFFFF;
+				if (!addr) spcPSW |= flagZ;
+				spcA = addr & 0xFF;
+				spcY = addr >> 8;
+				cyc = 5;
+			}
+			break;
+		case 0x5A:
+			{
+				s32 res = (s32)(spcA | (spcY << 8)) - (s32)MemRead16(Addr_DP());
+				spcPSW &= ~(flagN|flagZ|flagC);
+				if (!res) spcPSW |= flagZ;
+				if (res & 0x8000) spcPSW |= flagN;
+				if (!(res & 0x10000)) spcPSW |= flagC;
+				cyc = 5;
+			}
+			break;
+
+		// mem.bit ops
+		case 0x0A:
+			addr = BitOperand(&bit);
+			if (MemRead8(addr) & bit) spcPSW |= flagC;
+			cyc = 5;
+			break;
+		case 0x2A:
+			addr = BitOperand(&bit);
+			if (!(MemRead8(addr) & bit)) spcPSW |= flagC;
+			cyc = 5;
+			break;
+		case 0x4A:
+			addr = BitOperand(&bit);
+			if (!(MemRead8(addr) & bit)) spcPSW &= ~flagC;
+			cyc = 4;
+			break;
+		case 0x6A:
+			addr = BitOperand(&bit);
+			if (MemRead8(addr) & bit) spcPSW &= ~flagC;
+			cyc = 4;
+			break;
+		case 0x8A:
+			addr = BitOperand(&bit);
+			if (MemRead8(addr) & bit) spcPSW ^= flagC;
+			cyc = 5;
+			break;
+		case 0xAA:
+			addr = BitOperand(&bit);
+			spcPSW &= ~flagC;
+			if (MemRead8(addr) & bit) spcPSW |= flagC;
+			cyc = 4;
+			break;
+		case 0xCA:
+			addr = BitOperand(&bit);
+			val = MemRead8(addr);
+			if (spcPSW & flagC) val |= bit;
+			else val &= ~bit;
+			MemWrite8(addr, val);
+			cyc = 6;
+			break;
+		case 0xEA:
+			addr = BitOperand(&bit);
+			MemWrite8(addr, MemRead8(addr) ^ bit);
+			cyc = 5;
+			break;
+
+		// TSET1/TCLR1
+		case 0x0E:
+		case 0x4E:
+			addr = Addr_Abs();
+			val = MemRead8(addr);
+			spcPSW &= ~(flagN|flagZ);
+			if (spcA == val) spcPSW |= flagZ;
+			if (spcA < val) spcPSW |= flagN;
+			MemWrite8(addr, (op == 0x0E) ? (val | spcA) : (val & ~spcA));
+			cyc = 6;
+			break;
+
+		// branches
+		case 0x2F: Branch(true, &cyc, 4, 4); break;
+		case 0x10: Branch(!(spcPSW & flagN), &cyc, 4, 2); break;
+		case 0x30: Branch(spcPSW & flagN, &cyc, 4, 2); break;
+		case 0x50: Branch(!(spcPSW & flagV), &cyc, 4, 2); break;
+		case 0x70: Branch(spcPSW & flagV, &cyc, 4, 2); break;
+		case 0x90: Branch(!(spcPSW & flagC), &cyc, 4, 2); break;
+		case 0xB0: Branch(spcPSW & flagC, &cyc, 4, 2); break;
+		case 0xD0: Branch(!(spcPSW & flagZ), &cyc, 4, 2); break;
+		case 0xF0: Branch(spcPSW & flagZ, &cyc, 4, 2); break;
+		case 0x2E:
+			val = MemRead8(Addr_DP());
+			Branch(spcA != val, &cyc, 7, 5);
+			break;
+		case 0xDE:
+			val = MemRead8(Addr_DPX());
+			Branch(spcA != val, &cyc, 8, 6);
+			break;
+		case 0x6E:
+			addr = Addr_DP();
+			val = MemRead8(addr) - 1;
+			MemWrite8(addr, val);
+			Branch(val != 0, &cyc, 7, 5);
+			break;
+		case 0xFE:
+			spcY = (spcY - 1) & 0xFF;
+			Branch(spcY != 0, &cyc, 6, 4);
+			break;
+
+		// jumps and calls
+		case 0x5F: spcPC = Prefetch16(); cyc = 3; break;
+		case 0x1F: spcPC = MemRead16(Addr_AbsX()); cyc = 6; break;
+		case 0x3F: Call(Prefetch16()); cyc = 8; break;
+		case 0x4F: Call(0xFF00 | Prefetch8()); cyc = 6; break;
+		case 0x6F: spcPC = StackRead16(); cyc = 5; break;
+		case 0x7F:
+			spcPSW = (spcPSW & ~0xFF) | StackRead8();
+			spcPC = StackRead16();
+			cyc = 6;
+			break;
+
+		// stack
+		case 0x2D: StackWrite8(spcA); cyc = 4; break;
+		case 0x4D: StackWrite8(spcX); cyc = 4; break;
+		case 0x6D: StackWrite8(spcY); cyc = 4; break;
+		case 0x0D: StackWrite8(spcPSW & 0xFF); cyc = 4; break;
+		case 0xAE: spcA = StackRead8(); cyc = 4; break;
+		case 0xCE: spcX = StackRead8(); cyc = 4; break;
+		case 0xEE: spcY = StackRead8(); cyc = 4; break;
+		case 0x8E: spcPSW = (spcPSW & ~0xFF) | StackRead8(); cyc = 4; break;
+
+		// flags
+		case 0x60: spcPSW &= ~flagC; break;
+		case 0x80: spcPSW |= flagC; break;
+		case 0xED: spcPSW ^= flagC; cyc = 3; break;
+		case 0xE0: spcPSW &= ~(flagV|flagH); break;
+		case 0x20: spcPSW &= ~flagP; break;
+		case 0x40: spcPSW |= flagP; break;
+		case 0xA0: spcPSW |= flagI; cyc = 3; break;
+		case 0xC0: spcPSW &= ~flagI; cyc = 3; break;
+
+		// misc
+		case 0xCF:
+			val = spcY * spcA;
+			spcA = val & 0xFF;
+			spcY = val >> 8;
+			spcPSW &= ~(flagN|flagZ);
+			if (!spcY) spcPSW |= flagZ;
+			if (spcY & 0x80) spcPSW |= flagN;
+			cyc = 9;
+			break;
+		case 0x9E: Op_DIV(); cyc = 12; break;
+		case 0x9F:
+			spcA = ((spcA >> 4) | (spcA << 4)) & 0xFF;
+			SetNZ(spcA);
+			cyc = 5;
+			break;
+
+		// BRK, DAA, DAS, SLEEP, STOP
+		// spc700.s reports these and sits there forever
+		default:
+			spcPC = (spcPC - 1) & 0xFFFF;
+			SPC_ReportUnk(MemRead8(spcPC), spcPC);
+			break;
+	}
+
+	return cyc;
+}
+
+
+// --- Main loop ---------------------------------------------------------------
+
+void SPC_Reset()
+{
+	SPC_InitMisc();
+
+	spcA = 0;
+	spcX = 0;
+	spcY = 0;
+	spcSP = 0x100;
+	spcPSW = flagR;
+	spcPC = vec_Reset;
+	spcCycles = 0;
+
+	StoreRegs();
+}
+
+void SPC_Run(int cycles)
+{
+	int i;
+
+	Timing_Begin(TIMING_SPC);
+	LoadRegs();
+
+	spcCycles += cycles;
+
+	do
+	{
+		u32 op = Prefetch8();
+#ifdef PROFILER
+		Prof_SPCCurOp = op;
+#endif
+		u32 cyc = SPC_Execute(op);
+#ifdef PROFILER
+		Prof_SPCOp(cyc);
+#endif
+
+		for (i = 0; i < 3; i++)
+		{
+			if (!(SPC_TimerEnable & (1 << i))) continue;
+
+			SPC_TimerVal[i].Val += cyc;
+			if (!(SPC_TimerVal[i].Val & 0x8000))
+				SPC_TimerVal[i].Val += SPC_TimerReload[i];
+		}
+
+		SPC_ElapsedCycles += cyc;
+		if (SPC_ElapsedCycles >= 0x4000)
+		{
+			SPC_ElapsedCycles -= 0x4000;
+			DSP_BufferSwap();
+		}
+
+		spcCycles -= cyc;
+	}
+	while (spcCycles >= 0);
+
+	StoreRegs();
+	Timing_End(TIMING_SPC);
+}
+
+
+#endif
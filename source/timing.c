@@ -0,0 +1,290 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY 
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along 
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <3ds.h>
+
+#include "ui.h"
+#include "timing.h"
+
+
+extern FS_archive sdmcArchive;
+
+
+// ARM11 system ticks per millisecond
+#define TICKS_PER_MS 268111.856
+
+bool Timing_Enabled = false;
+
+u32 Timing_Acc[TIMING_NUM];
+u32 Timing_Counts[COUNT_NUM];
+u32 Timing_LastFrame = 0;
+
+u32 Timing_Stack[16];
+u32 Timing_Level = 0;
+u32 Timing_Last = 0;
+u32 Timing_DSPStart = 0;
+
+Timing_Frame Timing_Frames[TIMING_FRAMES];
+u32 Timing_FrameIdx = 0;
+u32 Timing_NumFrames = 0;
+
+
+void Timing_Begin(u32 id)
+{
+	if (!Timing_Enabled) return;
+	
+	u32 now = (u32)svcGetSystemTick();
+	if (id == TIMING_DSP)
+	{
+		Timing_DSPStart = now;
+		return;
+	}
+	
+	// charge the time so far to whoever was running
+	if (Timing_Level > 0)
+		Timing_Acc[Timing_Stack[Timing_Level-1]] += now - Timing_Last;
+	
+	Timing_Stack[Timing_Level++] = id;
+	Timing_Last = now;
+}
+
+void Timing_End(u32 id)
+{
+	if (!Timing_Enabled) return;
+	
+	u32 now = (u32)svcGetSystemTick();
+	if (id == TIMING_DSP)
+	{
+		Timing_Acc[TIMING_DSP] += now - Timing_DSPStart;
+		return;
+	}
+	
+	if (Timing_Level == 0) return;
+	
+	Timing_Acc[Timing_Stack[--Timing_Level]] += now - Timing_Last;
+	Timing_Last = now;
+}
+
+
+void Timing_Reset()
+{
+	memset(Timing_Acc, 0, sizeof(Timing_Acc));
+	memset(Timing_Counts, 0, sizeof(Timing_Counts));
+	memset(Timing_Frames, 0, sizeof(Timing_Frames));
+	Timing_FrameIdx = 0;
+	Timing_NumFrames = 0;
+	Timing_Level = 0;
+	Timing_LastFrame = (u32)svcGetSystemTick();
+}
+
+void Timing_EndFrame(bool skipped)
+{
+	int i;
+	
+	if (!Timing_Enabled)
+	{
+		memset(Timing_Counts, 0, sizeof(Timing_Counts));
+		return;
+	}
+	
+	u32 now = (u32)svcGetSystemTick();
+	Timing_Frame* frame = &Timing_Frames[Timing_FrameIdx];
+	
+	for (i = 0; i < TIMING_NUM; i++)
+	{
+		// the DSP counter is updated by the SPC thread, don't just zero it
+		u32 ticks = Timing_Acc[i];
+		Timing_Acc[i] -= ticks;
+		frame->Ticks[i] = ticks;
+	}
+	
+	memcpy(frame->Counts, Timing_Counts, sizeof(Timing_Counts));
+	memset(Timing_Counts, 0, sizeof(Timing_Counts));
+	
+	frame->FrameTicks = now - Timing_LastFrame;
+	frame->Skipped = skipped ? 1:0;
+	Timing_LastFrame = now;
+	
+	Timing_FrameIdx = (Timing_FrameIdx + 1) & (TIMING_FRAMES - 1);
+	if (Timing_NumFrames < TIMING_FRAMES) Timing_NumFrames++;
+}
+
+
+static Timing_Frame* Timing_GetFrame(u32 age)
+{
+	return &Timing_Frames[(Timing_FrameIdx - 1 - age) & (TIMING_FRAMES - 1)];
+}
+
+
+#define HUD_Y 148
+#define HUD_AVG 60
+#define HUD_BARS 160
+#define HUD_BARHEIGHT 40
+#define HUD_BARSCALE (TICKS_PER_MS * 33.4 / HUD_BARHEIGHT) // two frames fill it
+
+void Timing_DrawHUD()
+{
+	char buf[64];
+	u32 sum[TIMING_NUM];
+	u32 counts[COUNT_NUM];
+	u32 total = 0, skipped = 0;
+	u32 n, i, j;
+	
+	FillRect(0, 319, HUD_Y, 239, RGB(0,0,32));
+	DrawRect(0, 319, HUD_Y, 239, RGB(64,64,128));
+	
+	n = (Timing_NumFrames < HUD_AVG) ? Timing_NumFrames : HUD_AVG;
+	if (!n)
+	{
+		DrawText(4, HUD_Y+3, RGB(255,255,255), "no timing data yet");
+		return;
+	}
+	
+	memset(sum, 0, sizeof(sum));
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < n; i++)
+	{
+		Timing_Frame* frame = Timing_GetFrame(i);
+		for (j = 0; j < TIMING_NUM; j++)
+			sum[j] += frame->Ticks[j];
+		for (j = 0; j < COUNT_NUM; j++)
+			counts[j] += frame->Counts[j];
+		total += frame->FrameTicks;
+		skipped += frame->Skipped;
+	}
+	
+	#define AVG_MS(t) ((t) / (TICKS_PER_MS * n))
+	
+	snprintf(buf, 64, "frame %.2fms  %.1ffps  skip %u/%u  cmd %u", AVG_MS(total), total ? (n * TICKS_PER_MS * 1000.0) / total : 0.0, skipped, n,
+		(unsigned int)(counts[COUNT_GPUCMD] / n));
+	DrawText(4, HUD_Y+3, RGB(255,255,255), buf);
+	snprintf(buf, 64, "CPU %.2f  SPC %.2f  PPU %.2f  VBL %.2f  idle %uk", AVG_MS(sum[TIMING_CPU]), AVG_MS(sum[TIMING_SPC]), AVG_MS(sum[TIMING_RENDER]), AVG_MS(sum[TIMING_VBLANK]),
+		(unsigned int)(counts[COUNT_IDLECYCLES] / (n * 1000)));
+	DrawText(4, HUD_Y+15, RGB(255,255,255), buf);
+	snprintf(buf, 64, "HDMA %.2f  GPU %.2f  VSync %.2f  DSP %.2f", AVG_MS(sum[TIMING_HDMA]), AVG_MS(sum[TIMING_GPUWAIT]), AVG_MS(sum[TIMING_VSYNC]), AVG_MS(sum[TIMING_DSP]));
+	DrawText(4, HUD_Y+27, RGB(255,255,255), buf);
+	
+	// tile cache, only the hard renderer has one
+	u32 lookups = counts[COUNT_TILEHIT] + counts[COUNT_TILEEMPTY] + counts[COUNT_TILERECOLOR] + counts[COUNT_TILEMISS];
+	if (lookups)
+	{
+		snprintf(buf, 64, "tiles hit %.1f%%  miss %u  recol %u  evict %u",
+			((lookups - counts[COUNT_TILEMISS]) * 100.0) / lookups,
+			(unsigned int)(counts[COUNT_TILEMISS] / n), (unsigned int)(counts[COUNT_TILERECOLOR] / n),
+			(unsigned int)(counts[COUNT_TILEEVICT] / n));
+		DrawText(4, HUD_Y+39, RGB(255,255,255), buf);
+	}
+	
+	#undef AVG_MS
+	
+	// frame time graph, newest on the right
+	// CPU in red, SPC in green, PPU in blue, everything else in grey
+	int bottom = 238;
+	int top = bottom - HUD_BARHEIGHT;
+	int x = 2 + (HUD_BARS - 1) * 2;
+	
+	n = (Timing_NumFrames < HUD_BARS) ? Timing_NumFrames : HUD_BARS;
+	for (i = 0; i < n; i++, x -= 2)
+	{
+		Timing_Frame* frame = Timing_GetFrame(i);
+		u32 parts[4];
+		u32 colors[4] = {RGB(255,64,64), RGB(64,255,64), RGB(64,128,255), RGB(128,128,128)};
+		int y = bottom;
+		
+		parts[0] = frame->Ticks[TIMING_CPU];
+		parts[1] = frame->Ticks[TIMING_SPC];
+		parts[2] = frame->Ticks[TIMING_RENDER] + frame->Ticks[TIMING_VBLANK];
+		parts[3] = frame->FrameTicks - parts[0] - parts[1] - parts[2];
+		if ((s32)parts[3] < 0) parts[3] = 0;
+		
+		for (j = 0; j < 4 && y > top; j++)
+		{
+			int h = (int)(parts[j] / HUD_BARSCALE);
+			if (h <= 0) continue;
+			if (y - h < top) h = y - top;
+			
+			FillRect(x, x+1, y-h+1, y, colors[j]);
+			y -= h;
+		}
+	}
+	
+	// 60fps line
+	FillRect(2, 317, bottom - (HUD_BARHEIGHT/2), bottom - (HUD_BARHEIGHT/2), RGB(255,255,0));
+}
+
+
+bool Timing_DumpCSV(char* path)
+{
+	u32 i;
+	
+	Handle file;
+	FS_path filePath;
+	filePath.type = PATH_CHAR;
+	filePath.size = strlen(path) + 1;
+	filePath.data = (u8*)path;
+	
+	Result res = FSUSER_OpenFile(NULL, &file, sdmcArchive, filePath, FS_OPEN_CREATE|FS_OPEN_WRITE, FS_ATTRIBUTE_NONE);
+	if (res) 
+		return false;
+	
+	// one line per frame, ~200 chars at most
+	u32 bufsize = 224 * (TIMING_FRAMES + 1);
+	char* buf = (char*)malloc(bufsize);
+	u32 len = 0;
+	
+	len += snprintf(&buf[len], bufsize-len, "frame,total_ms,cpu_ms,spc_ms,render_ms,vblank_ms,hdma_ms,gpuwait_ms,vsync_ms,dsp_ms,skipped,tile_hits,tile_empty,tile_recolors,tile_misses,tile_decodes,tile_evictions,gpu_cmd_words,idle_cycles,section_log_bytes\n");
+	
+	for (i = 0; i < Timing_NumFrames; i++)
+	{
+		Timing_Frame* frame = Timing_GetFrame(Timing_NumFrames - 1 - i);
+		
+		len += snprintf(&buf[len], bufsize-len, "%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\n",
+			(unsigned int)i,
+			frame->FrameTicks / TICKS_PER_MS,
+			frame->Ticks[TIMING_CPU] / TICKS_PER_MS,
+			frame->Ticks[TIMING_SPC] / TICKS_PER_MS,
+			frame->Ticks[TIMING_RENDER] / TICKS_PER_MS,
+			frame->Ticks[TIMING_VBLANK] / TICKS_PER_MS,
+			frame->Ticks[TIMING_HDMA] / TICKS_PER_MS,
+			frame->Ticks[TIMING_GPUWAIT] / TICKS_PER_MS,
+			frame->Ticks[TIMING_VSYNC] / TICKS_PER_MS,
+			frame->Ticks[TIMING_DSP] / TICKS_PER_MS,
+			frame->Skipped,
+			(unsigned int)frame->Counts[COUNT_TILEHIT],
+			(unsigned int)frame->Counts[COUNT_TILEEMPTY],
+			(unsigned int)frame->Counts[COUNT_TILERECOLOR],
+			(unsigned int)frame->Counts[COUNT_TILEMISS],
+			(unsigned int)frame->Counts[COUNT_TILEDECODE],
+			(unsigned int)frame->Counts[COUNT_TILEEVICT],
+			(unsigned int)frame->Counts[COUNT_GPUCMD],
+			(unsigned int)frame->Counts[COUNT_IDLECYCLES],
+			(unsigned int)frame->Counts[COUNT_SECTIONLOG]);
+		if (len >= bufsize) { len = bufsize; break; }
+	}
+	
+	u32 byteswritten = 0;
+	FSFILE_SetSize(file, (u64)len);
+	FSFILE_Write(file, &byteswritten, 0, (u32*)buf, len, FS_WRITE_FLUSH);
+	FSFILE_Close(file);
+	
+	free(buf);
+	return true;
+}
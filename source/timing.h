@@ -0,0 +1,89 @@
+/*
+    Copyright 2014 StapleButter
+
+    This file is part of blargSnes.
+
+    blargSnes is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    blargSnes is distributed in the hope that it will be useful, but WITHOUT ANY 
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS 
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along 
+    with blargSnes. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef _TIMING_H_
+#define _TIMING_H_
+
+// per-frame timing of the emulator's parts, in system ticks
+// results go to a ring buffer, shown on the bottom screen (Config.TimingHUD)
+// and dumped as CSV when pausing
+// the hooks return right away when timing is off
+//
+// the counters nest: time spent in a child is not counted in the parent
+// so TIMING_CPU ends up being the CPU core itself
+//
+// the ids are defines so spc700.s can include this too, the rest of the
+// file is hidden from the assembler
+
+#define TIMING_CPU		0	// CPU_MainLoop(), minus the rest
+#define TIMING_SPC		1	// SPC_Run()
+#define TIMING_RENDER	2	// PPU_RenderScanline_Soft/Hard()
+#define TIMING_VBLANK	3	// PPU_VBlank_Soft/Hard() and RenderTopScreen()
+#define TIMING_HDMA		4	// DMA_DoHDMA()
+#define TIMING_GPUWAIT	5	// SafeWait()
+#define TIMING_VSYNC	6	// waiting for the VBlank
+#define TIMING_DSP		7	// DSP replay and audio mixing (SPC thread, doesn't nest)
+
+#define TIMING_NUM		8
+
+#ifndef __ASSEMBLER__
+
+// things counted per frame, by whoever does them (Timing_Counts[x]++)
+// they're kept along with the times. unlike those, they're counted even
+// with timing off, it's just an increment
+enum
+{
+	COUNT_TILEHIT = 0,	// hard renderer tile cache: the tile was there already
+	COUNT_TILEEMPTY,	// the tile was known to be empty, nothing to draw
+	COUNT_TILERECOLOR,	// only the palette changed, recolored from the color #s
+	COUNT_TILEMISS,		// the tile had to be decoded (new, or its VRAM changed)
+	COUNT_TILEDECODE,	// misses that went into the cache (the others were empty)
+	COUNT_TILEEVICT,	// tiles thrown out of the cache to make room
+	COUNT_GPUCMD,		// words in the GPU command lists (counted by bglFlush())
+	COUNT_IDLECYCLES,	// master cycles skipped by the idle loop detection (CPU_IdleCycles)
+	COUNT_SECTIONLOG,	// bytes of mid-frame sections the frame used (PPU_AddSection())
+	
+	COUNT_NUM
+};
+
+#define TIMING_FRAMES 256
+
+typedef struct
+{
+	u32 Ticks[TIMING_NUM];
+	u32 Counts[COUNT_NUM];
+	u32 FrameTicks;		// between the end of the previous frame and this one
+	u8 Skipped;
+	
+} Timing_Frame;
+
+extern bool Timing_Enabled;
+extern u32 Timing_Counts[COUNT_NUM];
+
+void Timing_Begin(u32 id);
+void Timing_End(u32 id);
+
+void Timing_EndFrame(bool skipped);
+void Timing_Reset();
+
+void Timing_DrawHUD();
+bool Timing_DumpCSV(char* path);
+
+#endif
+
+#endif
@@ -21,6 +21,9 @@
 #include "config.h"
 #include "ppu.h"
 #include "main.h"
+#include "timing.h"
+#include "rewind.h"
+#include "runahead.h"
 
 //extern badShader;
 
@@ -66,6 +69,35 @@ void Config_Render(bool force)
 	if (themode < 0 || themode > 4) themode = 0;
 	DrawButton(x, y-3, 140, RGB(255,255,255), scalemodes[themode]);
 	
+	y += 26;
+	
+	DrawCheckBox(10, y, RGB(255,255,255), "Timing HUD", Config.TimingHUD);
+	
+	y += 26;
+	
+	DrawCheckBox(10, y, RGB(255,255,255), "Rewind (Left when paused)", Config.Rewind);
+	
+	y += 26;
+	
+	DrawText(10, y+1, RGB(255,255,255), "Run-ahead:");
+	x = 10 + MeasureText("Run-ahead:") + 6;
+	
+	char* runaheadmodes[] = {"Off", "1 frame", "2 frames", "3 frames"};
+	int runahead = Config.RunAhead;
+	if (runahead < 0 || runahead > RUNAHEAD_MAX) runahead = 0;
+	DrawButton(x, y-3, 140, RGB(255,255,255), runaheadmodes[runahead]);
+	
+	y += 26;
+	
+	DrawText(10, y+1, RGB(255,255,255), "Render threads:");
+	x = 10 + MeasureText("Render threads:") + 6;
+	
+	char* threadmodes[] = {"Off", "1", "2", "3", "Off", "1, pipelined", "2, pipelined", "3, pipelined"};
+	int threads = Config.RenderThreads;
+	if (threads < 0 || threads > 3) threads = 0;
+	if (Config.PipelineFrames) threads += 4;
+	DrawButton(x, y-3, 140, RGB(255,255,255), threadmodes[threads]);
+	
 	DrawButton(10, 212, 0, RGB(255,128,128), "Cancel");
 	DrawButton(-10, 212, 0, RGB(128,255,128), "Save changes");
 }
@@ -97,6 +129,58 @@ void Config_Touch(int touch, u32 x, u32 y)
 		if (Config.ScaleMode > 4) Config.ScaleMode = 0;
 		configdirty = 2;
 	}
+	else if (y >= 102 && y < 122)
+	{
+		Config.TimingHUD = !Config.TimingHUD;
+		Timing_Enabled = Config.TimingHUD;
+		Timing_Reset();
+		configdirty = 2;
+	}
+	else if (y >= 128 && y < 148)
+	{
+		Config.Rewind = !Config.Rewind;
+		Rewind_Enabled = Config.Rewind;
+		if (Rewind_Enabled)
+		{
+			if (!Rewind_Init())
+			{
+				Rewind_Enabled = false;
+				Config.Rewind = 0;
+			}
+		}
+		else
+			Rewind_DeInit();
+		configdirty = 2;
+	}
+	else if (y >= 154 && y < 174)
+	{
+		Config.RunAhead++;
+		if (Config.RunAhead > RUNAHEAD_MAX) Config.RunAhead = 0;
+		RunAhead_Frames = Config.RunAhead;
+		if (RunAhead_Frames)
+		{
+			if (!RunAhead_Init())
+			{
+				RunAhead_Frames = 0;
+				Config.RunAhead = 0;
+			}
+		}
+		else
+			RunAhead_DeInit();
+		configdirty = 2;
+	}
+	else if (y >= 180 && y < 200)
+	{
+		// soft renderer only, PPU_SwitchRenderers() below starts/stops them
+		// Off, 1-3, then 1-3 pipelined (one frame of lag)
+		Config.RenderThreads++;
+		if (Config.RenderThreads > 3)
+		{
+			Config.PipelineFrames = !Config.PipelineFrames;
+			Config.RenderThreads = Config.PipelineFrames ? 1 : 0;
+		}
+		configdirty = 2;
+	}
 	else if (x < 106 && y >= 200)
 	{
 		LoadConfig(0);